@@ -34,6 +34,7 @@
 #include "contactlistener.h"
 #include "eventsquery.h"
 #include "queryrunner.h"
+#include "querytemplates.h"
 #include "updatequery.h"
 #include "committingtransaction.h"
 
@@ -77,6 +78,14 @@ CallModelPrivate::CallModelPrivate( EventModel *model )
     propertyMask -= unusedProperties;
 }
 
+void CallModelPrivate::supersedeQueries()
+{
+    // partQueryRunner carries call group deletions, those must not be
+    // cancelled by a refetch
+    firstValidQuery = queryRunner->cancelQueries();
+    threadCanFetchMore = false;
+}
+
 void CallModelPrivate::executeGroupedQuery(const QString &query)
 {
     qDebug() << __PRETTY_FUNCTION__;
@@ -84,11 +93,8 @@ void CallModelPrivate::executeGroupedQuery(const QString &query)
     startContactListening();
 
     isReady = false;
-    if (queryMode == EventModel::StreamedAsyncQuery) {
-        queryRunner->setStreamedMode(true);
-        queryRunner->setChunkSize(chunkSize);
-        queryRunner->setFirstChunkSize(firstChunkSize);
-    }
+    if (isStreamed())
+        setupStreaming();
     queryRunner->runGroupedCallQuery(query);
     if (queryMode == EventModel::SyncQuery) {
         QEventLoop loop;
@@ -147,11 +153,17 @@ void CallModelPrivate::eventsReceivedSlot(int start, int end, QList<CommHistory:
 
     qDebug() << Q_FUNC_INFO << start << end << events.count();
 
+    if (isStaleDelivery())
+        return;
+
     if (sortBy != CallModel::SortByContact || updatedGroups.isEmpty())
         return EventModelPrivate::eventsReceivedSlot(start, end, events);
 
     // reimp from EventModelPrivate, for video calls
 
+    if (!queryContacts)
+        resolveContacts(events);
+
     // Here we should usually get one or two result rows, one for the
     // video call group and one for the corresponding audio call group.
     QMutableListIterator<Event> i(events);
@@ -231,6 +243,9 @@ void CallModelPrivate::eventsReceivedSlot(int start, int end, QList<CommHistory:
 
 void CallModelPrivate::modelUpdatedSlot( bool successful )
 {
+    if (isStaleDelivery())
+        return;
+
     EventModelPrivate::modelUpdatedSlot(successful);
     countedUids.clear();
     updatedGroups.clear();
@@ -680,8 +695,9 @@ void CallModelPrivate::eventsUpdatedSlot( const QList<Event> &events )
             }
         }
 
-        QString query = TrackerIOPrivate::prepareGroupedCallQuery(updatedGroups.toList());
-        executeGroupedQuery(query);
+        QSparqlQuery query = TrackerIOPrivate::prepareGroupedCallQuery(updatedGroups.toList(),
+                                                                            queryContacts);
+        executeGroupedQuery(QueryTemplates::queryText(query));
     }
 }
 
@@ -933,12 +949,14 @@ bool CallModel::getEvents()
     d->updatedGroups.clear();
 
     if (d->sortBy == SortByContact) {
-        QString query = TrackerIOPrivate::prepareGroupedCallQuery();
-        d->executeGroupedQuery(query);
+        QSparqlQuery query = TrackerIOPrivate::prepareGroupedCallQuery(QStringList(),
+                                                                       d->queryContacts);
+        d->supersedeQueries();
+        d->executeGroupedQuery(QueryTemplates::queryText(query));
         return true;
     }
 
-    EventsQuery query(d->propertyMask);
+    EventsQuery query(d->queryProperties());
     query.addPattern(QLatin1String("%1 a nmo:Call .")).variable(Event::Id);
 
     if (d->eventType != CallEvent::UnknownCallType) {
@@ -964,9 +982,7 @@ bool CallModel::getEvents()
         }
     }
 
-    query.addModifier("ORDER BY DESC(%1) DESC(tracker:id(%2))")
-                     .variable(Event::StartTime)
-                     .variable(Event::Id);
+    d->addSeekOrder(query, Event::StartTime);
 
     return d->executeQuery(query);
 }
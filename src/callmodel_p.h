@@ -46,6 +46,8 @@ public:
 
     void executeGroupedQuery(const QString &query);
 
+    void supersedeQueries();
+
     void eventsReceivedSlot(int start, int end, QList<CommHistory::Event> events);
 
     void modelUpdatedSlot(bool successful);
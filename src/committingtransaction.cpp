@@ -21,10 +21,10 @@
 ******************************************************************************/
 
 #include <QDebug>
+#include <QStringList>
 
 #include <QSparqlResult>
 #include <QSparqlError>
-#include <QTimer>
 
 #include "committingtransaction.h"
 #include "committingtransaction_p.h"
@@ -60,8 +60,8 @@ CommittingTransactionPrivate::~CommittingTransactionPrivate()
         }
     }
 
-    if (!pendingQueries.isEmpty()) {
-        QPointer<QSparqlResult> result = pendingQueries.first()->result;
+    for (int i = 0; i < runningQueries; i++) {
+        QPointer<QSparqlResult> result = pendingQueries.at(i)->result;
         if (result)
             result->deleteLater();
     }
@@ -70,21 +70,42 @@ CommittingTransactionPrivate::~CommittingTransactionPrivate()
     pendingQueries.clear();
 }
 
+bool CommittingTransactionPrivate::isReadOnly(const PendingQuery *query)
+{
+    return query->query.type() == QSparqlQuery::SelectStatement;
+}
+
 bool CommittingTransactionPrivate::runNextQuery()
 {
     qDebug() << Q_FUNC_INFO;
 
-    PendingQuery *query = pendingQueries.first();
-    query->result = connection->exec(query->query);
-    if (query->result->hasError()) {
-        qWarning() << query->result->lastError().message();
-        return false;
-    }
+    // Running queries are always a prefix of pendingQueries. Updates run
+    // one at a time in order, consecutive selects are started together
+    // since they cannot depend on each other.
+    while (runningQueries < pendingQueries.size()) {
+        PendingQuery *query = pendingQueries.at(runningQueries);
+        if (runningQueries > 0
+            && (!isReadOnly(query)
+                || !isReadOnly(pendingQueries.at(runningQueries - 1))))
+            break;
+
+        query->result = connection->exec(query->query);
+        if (query->result->hasError()) {
+            qWarning() << query->result->lastError().message();
+            delete query->result;
+            if (runningQueries == 0)
+                return false;
+
+            // let the running ones finish the transaction
+            error = true;
+            aborted = true;
+            return true;
+        }
 
-    connect(query->result, SIGNAL(finished()), SLOT(finished()));
-    // delete result out of the slot, workaround qsparl bugs for insert queries
-    connect(query->result, SIGNAL(finished()), query->result, SLOT(deleteLater()), Qt::QueuedConnection);
-    started = true;
+        connect(query->result, SIGNAL(finished()), SLOT(finished()));
+        runningQueries++;
+        started = true;
+    }
 
     return true;
 }
@@ -110,6 +131,10 @@ void CommittingTransactionPrivate::sendSignals()
 {
     qDebug() << Q_FUNC_INFO;
 
+    if (signalsSent)
+        return;
+    signalsSent = true;
+
     foreach (DelayedSignal s, modelSignals) {
         if (error == s.onError
             && s.sender) {
@@ -132,31 +157,119 @@ void CommittingTransactionPrivate::sendSignals()
     }
 }
 
+bool CommittingTransactionPrivate::canCoalesce() const
+{
+    if (started || pendingQueries.isEmpty())
+        return false;
+
+    foreach (PendingQuery *query, pendingQueries) {
+        if (query->callback
+            || query->query.type() == QSparqlQuery::SelectStatement)
+            return false;
+    }
+
+    return true;
+}
+
+void CommittingTransactionPrivate::coalesce(CommittingTransaction *other)
+{
+    pendingQueries.append(other->d->pendingQueries);
+    other->d->pendingQueries.clear();
+    other->d->started = true;
+    coalesced.append(other);
+}
+
+void CommittingTransactionPrivate::joinQueries()
+{
+    if (pendingQueries.size() < 2)
+        return;
+
+    QString updates = queryText();
+
+    PendingQuery *joined = pendingQueries.takeFirst();
+    joined->query = QSparqlQuery(updates, joined->query.type());
+
+    qDeleteAll(pendingQueries);
+    pendingQueries.clear();
+    pendingQueries.append(joined);
+}
+
+QString CommittingTransactionPrivate::queryText() const
+{
+    QStringList updates;
+    foreach (PendingQuery *query, pendingQueries)
+        updates << query->query.preparedQueryText();
+
+    return updates.join(QLatin1String(" "));
+}
+
+bool CommittingTransactionPrivate::hasError() const
+{
+    return error;
+}
+
+void CommittingTransactionPrivate::finishCoalesced()
+{
+    foreach (QPointer<CommittingTransaction> t, coalesced) {
+        if (t) {
+            t->d->error = error;
+            t->d->sendSignals();
+            emit t->finished();
+        }
+    }
+    coalesced.clear();
+}
+
 void CommittingTransactionPrivate::finished()
 {
     qDebug() << Q_FUNC_INFO;
 
     QSparqlResult *currentResult = qobject_cast<QSparqlResult*>(sender());
-    if (currentResult) {
-        bool isError = currentResult->hasError();
-        if (isError) {
-            error = isError;
-            qWarning() << Q_FUNC_INFO << currentResult->lastError().message();
+    if (!currentResult)
+        return;
+
+    int index = -1;
+    for (int i = 0; i < runningQueries; i++) {
+        if (pendingQueries.at(i)->result == currentResult) {
+            index = i;
+            break;
         }
     }
+    if (index == -1)
+        return;
+
+    if (currentResult->hasError()) {
+        error = true;
+        qWarning() << Q_FUNC_INFO << currentResult->lastError().message();
+    }
 
-    PendingQuery *query = pendingQueries.takeFirst();
+    PendingQuery *query = pendingQueries.takeAt(index);
+    runningQueries--;
     handleCallbacks(query);
     delete query;
+    // delete result out of the slot, workaround qsparql bugs for insert queries
+    currentResult->deleteLater();
+
+    // submit the next query right away instead of waiting for
+    // another event loop iteration
+    if (!aborted && !pendingQueries.isEmpty() && !runNextQuery()) {
+        error = true;
+        aborted = true;
+    }
 
-    if (!aborted && !pendingQueries.isEmpty()) {
-        QTimer::singleShot(0, this, SLOT(runNextQuery()));
+    if (runningQueries > 0)
+        return;
+
+    if (!aborted && !pendingQueries.isEmpty())
         return;
-    }
 
-    // all done
+    // all done, drop what was left after an abort
+    qDeleteAll(pendingQueries);
+    pendingQueries.clear();
+
     sendSignals();
     emit q->finished();
+    finishCoalesced();
 }
 
 CommittingTransaction::CommittingTransaction(QObject *parent) : QObject(parent),
@@ -197,17 +310,26 @@ bool CommittingTransaction::run(QSparqlConnection &connection, bool isBlocking)
     if (isRunning()) return true;
 
     d->connection = &connection;
+    d->runTime.start();
+    // transactions merged into this one run and finish with it
+    foreach (QPointer<CommittingTransaction> t, d->coalesced) {
+        if (t)
+            t->d->runTime = d->runTime;
+    }
 
     if (!isBlocking)
         return d->runNextQuery();
 
     d->started = true;
     d->aborted = false;
-    while (d->pendingQueries.isEmpty() && !d->aborted) {
+    while (!d->pendingQueries.isEmpty() && !d->aborted) {
         CommittingTransactionPrivate::PendingQuery *query = d->pendingQueries.first();
         query->result = connection.exec(query->query);
         if (query->result->hasError()) {
             qWarning() << query->result->lastError().message();
+            delete query->result;
+            query->result = 0;
+            d->error = true;
             return false;
         }
 
@@ -215,11 +337,13 @@ bool CommittingTransaction::run(QSparqlConnection &connection, bool isBlocking)
 
         if (query->result->hasError()) {
             qWarning() << query->result->lastError().message();
+            d->error = true;
         } else {
             d->handleCallbacks(query);
         }
 
         d->pendingQueries.removeFirst();
+        delete query->result;
         delete query;
     }
 
@@ -244,6 +368,14 @@ bool CommittingTransaction::isFinished() const
     return d->started && d->pendingQueries.isEmpty();
 }
 
+int CommittingTransaction::elapsed() const
+{
+    if (!d->runTime.isValid())
+        return -1;
+
+    return d->runTime.elapsed();
+}
+
 void CommittingTransaction::addQuery(const QSparqlQuery &query,
                                      QObject *caller,
                                      const char *callback,
@@ -64,6 +64,12 @@ public:
     bool isRunning() const;
     bool isFinished() const;
 
+    /*!
+     * \return Milliseconds since the transaction started running, -1 if
+     * it has not been started.
+     */
+    int elapsed() const;
+
     void abort(bool isError = true);
 
     /*!
@@ -28,6 +28,7 @@
 #include <QPointer>
 #include <QWeakPointer>
 #include <QMetaType>
+#include <QTime>
 
 #include <QSparqlConnection>
 #include <QSparqlQuery>
@@ -53,9 +54,11 @@ public:
 
     CommittingTransactionPrivate(CommittingTransaction *parent) :
         q(parent),
+        runningQueries(0),
         error(false),
         started(false),
-        aborted(false)
+        aborted(false),
+        signalsSent(false)
     {
     }
 
@@ -66,8 +69,44 @@ public:
     bool isEmpty() const;
 
     void handleCallbacks(PendingQuery *query);
+    /*!
+     * Send the delayed signals for the current error state, only the
+     * first call has an effect.
+     */
     void sendSignals();
 
+    /*!
+     * A transaction can be coalesced with others when it has not been
+     * started, contains only updates and has no query callbacks.
+     */
+    bool canCoalesce() const;
+
+    /*!
+     * Take over the queries of other, which then finishes together with
+     * this transaction, sharing its result. Call joinQueries() when done.
+     */
+    void coalesce(CommittingTransaction *other);
+
+    /*!
+     * Merge the pending queries into one update request.
+     */
+    void joinQueries();
+
+    /*!
+     * Send the signals of the coalesced transactions, with the error
+     * state of this one.
+     */
+    void finishCoalesced();
+
+    /*!
+     * \return Text of the pending queries, joined as one update request.
+     */
+    QString queryText() const;
+
+    bool hasError() const;
+
+    static bool isReadOnly(const PendingQuery *query);
+
 private Q_SLOTS:
     bool runNextQuery();
     void finished();
@@ -92,9 +131,14 @@ private:
 
     QSparqlConnection *connection;
     QList<PendingQuery *> pendingQueries;
+    // number of queries at the head of pendingQueries already running
+    int runningQueries;
+    QTime runTime;
+    QList<QPointer<CommittingTransaction> > coalesced;
     bool error;
     bool started;
     bool aborted;
+    bool signalsSent;
 
     friend class CommittingTransaction;
 };
@@ -0,0 +1,193 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** Contact: Reto Zingg <reto.zingg@nokia.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+#include <QDebug>
+
+#include "contactcache.h"
+#include "contactlistener.h"
+
+using namespace CommHistory;
+
+QWeakPointer<ContactCache> ContactCache::m_Instance;
+
+ContactCache::ContactCache()
+{
+    m_listener = ContactListener::instance();
+    connect(m_listener.data(),
+            SIGNAL(contactUpdated(quint32, const QString&, const QList<QPair<QString,QString> >&)),
+            this,
+            SLOT(slotContactUpdated(quint32, const QString&, const QList<QPair<QString,QString> >&)));
+    connect(m_listener.data(),
+            SIGNAL(contactFound(quint32, const QString&, const QList<QPair<QString,QString> >&)),
+            this,
+            SLOT(slotContactUpdated(quint32, const QString&, const QList<QPair<QString,QString> >&)));
+    connect(m_listener.data(), SIGNAL(contactRemoved(quint32)),
+            this, SLOT(slotContactRemoved(quint32)));
+    connect(m_listener.data(),
+            SIGNAL(contactsResolved(const QList<QPair<QString,QString> >&)),
+            this, SLOT(slotContactsResolved(const QList<QPair<QString,QString> >&)));
+    connect(m_listener.data(), SIGNAL(contactSettingsChanged(const QHash<QString, QVariant> &)),
+            this, SLOT(slotSettingsChanged()));
+}
+
+ContactCache::~ContactCache()
+{
+}
+
+QSharedPointer<ContactCache> ContactCache::instance()
+{
+    QSharedPointer<ContactCache> result;
+    if (!m_Instance) {
+        result = QSharedPointer<ContactCache>(new ContactCache());
+        m_Instance = result.toWeakRef();
+    } else {
+        result = m_Instance.toStrongRef();
+    }
+
+    return result;
+}
+
+bool ContactCache::lookup(const QString &localUid, const QString &remoteUid,
+                          QList<Event::Contact> &contacts) const
+{
+    QHash<Address, QList<Event::Contact> >::const_iterator i =
+        m_contacts.constFind(qMakePair(localUid, remoteUid));
+    if (i == m_contacts.constEnd())
+        return false;
+
+    contacts = i.value();
+    return true;
+}
+
+void ContactCache::resolve(const QList<Address> &addresses)
+{
+    QList<Address> unknown;
+    foreach (const Address &address, addresses) {
+        if (!m_contacts.contains(address) && !m_pending.contains(address)) {
+            m_pending.insert(address, QList<Event::Contact>());
+            unknown.append(address);
+        }
+    }
+
+    if (unknown.isEmpty())
+        return;
+
+    qDebug() << Q_FUNC_INFO << unknown.size() << "of" << addresses.size();
+    m_listener->resolveContacts(unknown);
+}
+
+void ContactCache::clear()
+{
+    m_contacts.clear();
+}
+
+void ContactCache::slotContactUpdated(quint32 localId,
+                                      const QString &contactName,
+                                      const QList< QPair<QString,QString> > &contactAddresses)
+{
+    Event::Contact contact(localId, contactName);
+    QList<Address> changed;
+
+    QMutableHashIterator<Address, QList<Event::Contact> > i(m_contacts);
+    while (i.hasNext()) {
+        i.next();
+        QList<Event::Contact> &contacts = i.value();
+
+        int index = -1;
+        for (int c = 0; c < contacts.size(); c++) {
+            if ((quint32)contacts.at(c).first == localId) {
+                index = c;
+                break;
+            }
+        }
+
+        if (ContactListener::addressMatchesList(i.key().first, i.key().second,
+                                                contactAddresses)) {
+            if (index == -1)
+                contacts.append(contact);
+            else if (contacts.at(index).second != contactName)
+                contacts[index].second = contactName;
+            else
+                continue;
+        } else if (index != -1) {
+            // address removed from the contact
+            contacts.removeAt(index);
+        } else {
+            continue;
+        }
+
+        changed.append(i.key());
+    }
+
+    QMutableHashIterator<Address, QList<Event::Contact> > p(m_pending);
+    while (p.hasNext()) {
+        p.next();
+        if (ContactListener::addressMatchesList(p.key().first, p.key().second,
+                                                contactAddresses)
+            && !p.value().contains(contact))
+            p.value().append(contact);
+    }
+
+    if (!changed.isEmpty())
+        emit contactsResolved(changed);
+}
+
+void ContactCache::slotContactRemoved(quint32 localId)
+{
+    QList<Address> changed;
+
+    QMutableHashIterator<Address, QList<Event::Contact> > i(m_contacts);
+    while (i.hasNext()) {
+        i.next();
+        QMutableListIterator<Event::Contact> contact(i.value());
+        while (contact.hasNext()) {
+            if ((quint32)contact.next().first == localId) {
+                contact.remove();
+                changed.append(i.key());
+            }
+        }
+    }
+
+    if (!changed.isEmpty())
+        emit contactsResolved(changed);
+}
+
+void ContactCache::slotContactsResolved(const QList< QPair<QString,QString> > &addresses)
+{
+    QList<Address> resolved;
+    foreach (const Address &address, addresses) {
+        // batches of other ContactListener users
+        if (!m_pending.contains(address))
+            continue;
+
+        m_contacts.insert(address, m_pending.take(address));
+        resolved.append(address);
+    }
+
+    if (!resolved.isEmpty())
+        emit contactsResolved(resolved);
+}
+
+void ContactCache::slotSettingsChanged()
+{
+    // names are built according to the settings, resolve again on demand
+    clear();
+}
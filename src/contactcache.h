@@ -0,0 +1,106 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** Contact: Reto Zingg <reto.zingg@nokia.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+#ifndef COMMHISTORY_CONTACTCACHE_H
+#define COMMHISTORY_CONTACTCACHE_H
+
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QPair>
+#include <QSharedPointer>
+#include <QWeakPointer>
+
+#include "event.h"
+#include "libcommhistoryexport.h"
+
+namespace CommHistory {
+
+class ContactListener;
+
+/*!
+ * \class ContactCache
+ *
+ * Process-wide map from (local uid, remote uid) addresses to the
+ * matching contacts, shared by models that leave the contacts out of
+ * their queries (see EventModel::setQueryContacts()).
+ *
+ * Unknown addresses are resolved in one ContactListener request per
+ * resolve() call. Addresses without a contact are remembered too.
+ * Entries are kept up to date with contact changes, and everything is
+ * dropped when the name display settings change.
+ */
+class LIBCOMMHISTORY_EXPORT ContactCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    typedef QPair<QString,QString> Address;
+
+    static QSharedPointer<ContactCache> instance();
+    ~ContactCache();
+
+    /*!
+     * Get the cached contacts of an address.
+     * \return true if the address has been resolved, even if it
+     * matched no contacts.
+     */
+    bool lookup(const QString &localUid, const QString &remoteUid,
+                QList<Event::Contact> &contacts) const;
+
+    /*!
+     * Start resolving the addresses that are neither cached nor
+     * already being resolved. contactsResolved() is emitted when done.
+     */
+    void resolve(const QList<Address> &addresses);
+
+    void clear();
+
+Q_SIGNALS:
+    /*!
+     * The contacts of addresses have been resolved or changed and can
+     * be looked up.
+     */
+    void contactsResolved(const QList<QPair<QString,QString> > &addresses);
+
+private Q_SLOTS:
+    void slotContactUpdated(quint32 localId,
+                            const QString &contactName,
+                            const QList< QPair<QString,QString> > &contactAddresses);
+    void slotContactRemoved(quint32 localId);
+    void slotContactsResolved(const QList< QPair<QString,QString> > &addresses);
+    void slotSettingsChanged();
+
+private:
+    ContactCache();
+
+    QSharedPointer<ContactListener> m_listener;
+    // (local id, remote id) -> (contact id, name)
+    QHash<Address, QList<Event::Contact> > m_contacts;
+    // addresses with a request in flight, and contacts found for them
+    QHash<Address, QList<Event::Contact> > m_pending;
+
+    static QWeakPointer<ContactCache> m_Instance;
+};
+
+}
+
+#endif
@@ -60,7 +60,8 @@ namespace {
 
 ContactListener::ContactListener(QObject *parent)
     : QObject(parent),
-      m_Initialized(false)
+      m_Initialized(false),
+      m_NextBatch(0)
 {
 }
 
@@ -136,6 +137,26 @@ QContactFetchRequest* ContactListener::buildRequest(const QContactFilter &filter
     return request;
 }
 
+QContactFilter ContactListener::addressFilter(const QPair<QString,QString> &address)
+{
+    QString number = CommHistory::normalizePhoneNumber(address.second,
+                                                       NormalizeFlagKeepDialString);
+    if (!number.isEmpty())
+        return QContactPhoneNumber::match(number);
+
+    QContactDetailFilter filterLocal;
+    filterLocal.setDetailDefinitionName(QContactOnlineAccount::DefinitionName,
+                                        QLatin1String("AccountPath"));
+    filterLocal.setValue(address.first);
+
+    QContactDetailFilter filterRemote;
+    filterRemote.setDetailDefinitionName(QContactOnlineAccount::DefinitionName,
+                                         QContactOnlineAccount::FieldAccountUri);
+    filterRemote.setValue(address.second);
+
+    return filterLocal & filterRemote;
+}
+
 void ContactListener::slotContactsUpdated(const QList<QContactLocalId> &contactIds)
 {
     if (contactIds.isEmpty())
@@ -166,27 +187,9 @@ void ContactListener::slotStartContactRequest()
     if (!m_PendingUnresolvedContacts.isEmpty()) {
         QContactFilter filter;
 
-        for (int i = 0; i < REQUEST_BATCH_SIZE && !m_PendingUnresolvedContacts.isEmpty(); i++) {
-            QPair<QString,QString> contact = m_PendingUnresolvedContacts.takeFirst();
-
-            QString number = CommHistory::normalizePhoneNumber(contact.second,
-                                                               NormalizeFlagKeepDialString);
-            if (number.isEmpty()) {
-                QContactDetailFilter filterLocal;
-                filterLocal.setDetailDefinitionName(QContactOnlineAccount::DefinitionName,
-                                                    QLatin1String("AccountPath"));
-                filterLocal.setValue(contact.first);
-
-                QContactDetailFilter filterRemote;
-                filterRemote.setDetailDefinitionName(QContactOnlineAccount::DefinitionName,
-                                                     QContactOnlineAccount::FieldAccountUri);
-                filterRemote.setValue(contact.second);
-
-                filter = addContactFilter(filter, filterLocal & filterRemote);
-            } else {
-                filter = addContactFilter(filter, QContactPhoneNumber::match(number));
-            }
-        }
+        for (int i = 0; i < REQUEST_BATCH_SIZE && !m_PendingUnresolvedContacts.isEmpty(); i++)
+            filter = addContactFilter(filter,
+                                      addressFilter(m_PendingUnresolvedContacts.takeFirst()));
         request = buildRequest(filter);
     }
 
@@ -217,6 +220,8 @@ void ContactListener::slotResultsAvailable()
 
     qDebug() << Q_FUNC_INFO << request->contacts().size() << "contacts";
 
+    bool batch = m_BatchRequests.contains(request);
+
     foreach (QContact contact, request->contacts()) {
         if (contact.localId() != m_ContactManager->selfContactId()) {
             QList< QPair<QString,QString> > addresses;
@@ -230,12 +235,22 @@ void ContactListener::slotResultsAvailable()
                 addresses += qMakePair(QString(), phoneNumber.number());
             }
 
-            emit contactUpdated(contact.localId(), contact.displayLabel(), addresses);
+            if (batch)
+                emit contactFound(contact.localId(), contact.displayLabel(), addresses);
+            else
+                emit contactUpdated(contact.localId(), contact.displayLabel(), addresses);
         } // if
     }
 
     request->deleteLater();
 
+    if (batch) {
+        int id = m_BatchRequests.take(request);
+        if (--m_Batches[id].pendingRequests == 0)
+            emit contactsResolved(m_Batches.take(id).addresses);
+        return;
+    }
+
     slotStartContactRequest();
 }
 
@@ -270,6 +285,40 @@ void ContactListener::resolveContact(const QString &localUid,
     }
 }
 
+void ContactListener::resolveContacts(const QList< QPair<QString,QString> > &addresses)
+{
+    if (addresses.isEmpty())
+        return;
+
+    qDebug() << Q_FUNC_INFO << addresses.size() << "addresses";
+
+    int id = m_NextBatch++;
+    Batch &batch = m_Batches[id];
+    batch.addresses = addresses;
+    batch.pendingRequests = 0;
+
+    // requested right away, the caller has already collected all
+    // addresses of a query chunk; split like slotStartContactRequest()
+    // to keep the filters small
+    for (int first = 0; first < addresses.size(); first += REQUEST_BATCH_SIZE) {
+        QContactFilter filter;
+        foreach (const QPair<QString,QString> &address,
+                 addresses.mid(first, REQUEST_BATCH_SIZE))
+            filter = addContactFilter(filter, addressFilter(address));
+
+        QContactFetchRequest *request = buildRequest(filter);
+        m_BatchRequests.insert(request, id);
+        batch.pendingRequests++;
+        connect(request, SIGNAL(resultsAvailable()),
+                this, SLOT(slotResultsAvailable()));
+    }
+
+    // started once all are counted, a request may finish right away
+    QList<QContactFetchRequest *> requests = m_BatchRequests.keys(id);
+    foreach (QContactFetchRequest *request, requests)
+        request->start();
+}
+
 void ContactListener::startRequestOrTimer()
 {
     // if it's only one new contact or conversation it's probably hand-added
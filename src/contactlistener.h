@@ -27,6 +27,7 @@
 #include <QObject>
 #include <QString>
 #include <QList>
+#include <QHash>
 #include <QTimer>
 #include <QPointer>
 
@@ -65,6 +66,16 @@ public:
     void resolveContact(const QString &localUid,
                         const QString &remoteUid);
 
+    /**
+     * Find the contacts for a list of (localUid, remoteUid) addresses,
+     * requested in batches. Matches are provided via contactFound(),
+     * followed by contactsResolved() for the whole list once all
+     * batches have finished. Unlike
+     * resolveContact(), this does not emit contactUpdated(), as nothing
+     * has changed for the other listeners.
+     */
+    void resolveContacts(const QList< QPair<QString,QString> > &addresses);
+
     /**
      * Get address book settings.
      */
@@ -77,6 +88,10 @@ Q_SIGNALS:
                         const QList< QPair<QString,QString> > &contactAddresses);
     void contactRemoved(quint32 localId);
     void contactSettingsChanged(const QHash<QString, QVariant> &changedSettings);
+    void contactFound(quint32 localId,
+                      const QString &contactName,
+                      const QList< QPair<QString,QString> > &contactAddresses);
+    void contactsResolved(const QList< QPair<QString,QString> > &addresses);
 
 private Q_SLOTS:
     void slotContactsUpdated(const QList<QContactLocalId> &contactIds);
@@ -90,6 +105,7 @@ private:
 
     void init();
     QContactFetchRequest *buildRequest(const QContactFilter &filter);
+    QContactFilter addressFilter(const QPair<QString,QString> &address);
     void startRequestOrTimer();
 
 private:
@@ -99,6 +115,14 @@ private:
     QPointer<QContactManager> m_ContactManager;
     QList<QContactLocalId> m_PendingContactIds;
     QList<QPair<QString,QString> > m_PendingUnresolvedContacts;
+    // resolveContacts() calls and their requests
+    struct Batch {
+        QList<QPair<QString,QString> > addresses;
+        int pendingRequests;
+    };
+    QHash<int, Batch> m_Batches;
+    QHash<QContactFetchRequest *, int> m_BatchRequests;
+    int m_NextBatch;
     QPointer<QctSettings> m_Settings;
 };
 
@@ -29,6 +29,7 @@
 #include "constants.h"
 #include "eventsquery.h"
 #include "queryrunner.h"
+#include "querytemplates.h"
 #include "contactlistener.h"
 
 namespace {
@@ -49,11 +50,11 @@ ConversationModelPrivate::ConversationModelPrivate(EventModel *model)
             , filterDirection(Event::UnknownDirection)
             , firstFetch(true)
             , eventsFilled(0)
-            , lastEventTrackerId(0)
             , activeQueries(0)
 
 {
     contactChangesEnabled = true;
+    cursorProperty = Event::EndTime;
     QDBusConnection::sessionBus().connect(
         QString(), QString(), "com.nokia.commhistory", "groupsUpdatedFull",
         this, SLOT(groupsUpdatedFullSlot(const QList<CommHistory::Group> &)));
@@ -164,48 +165,118 @@ bool ConversationModelPrivate::fillModel(int start, int end, QList<CommHistory::
     return true;
 }
 
-EventsQuery ConversationModelPrivate::buildQuery() const
+QString ConversationModelPrivate::buildQuery(QueryPart part,
+                                           QList<Event::Property> &properties) const
 {
-    EventsQuery query(propertyMask);
+    int limit = 0;
+    int offset = 0;
+    if (part == FirstChunk) {
+        limit = firstChunkSize;
+    } else if (part == NextChunk) {
+        // the next page of a non-streamed query continues in the same way
+        limit = isStreamed() ? chunkSize : queryLimit;
+    } else if (!isStreamed()) {
+        limit = queryLimit;
+        offset = queryOffset;
+    }
+
+    QList<int> sortedMask;
+    Event::PropertySet queryProps = queryProperties();
+    foreach (Event::Property property, queryProps)
+        sortedMask.append(property);
+    qSort(sortedMask);
+    QStringList maskKey;
+    foreach (int property, sortedMask)
+        maskKey.append(QString::number(property));
+
+    // limit and offset are appended to the bound text, so that distinct
+    // values do not each leave a template behind
+    QString shape = QString(QLatin1String("conversation:%1:%2:%3:%4:%5:%6"))
+        .arg(part)
+        .arg(filterAccount.isEmpty() ? 0 : 1)
+        .arg(filterType)
+        .arg(filterDirection)
+        .arg(limit ? 1 : 0)
+        .arg(maskKey.join(QLatin1String(",")));
+
+    QueryTemplates::Template queryTemplate;
+    if (!QueryTemplates::find(shape, queryTemplate)) {
+        EventsQuery query(queryProps);
+
+        if (!filterAccount.isEmpty()) {
+            query.addPattern(QLatin1String("{%1 nmo:to [nco:hasContactMedium ?:account]} "
+                                           "UNION "
+                                           "{%1 nmo:from [nco:hasContactMedium ?:account]}"))
+                    .variable(Event::Id);
+        }
+
+        if (filterType == Event::IMEvent) {
+            query.addPattern(QLatin1String("%1 rdf:type nmo:IMMessage ."))
+                            .variable(Event::Id);
+        } else if (filterType == Event::SMSEvent) {
+            query.addPattern(QLatin1String("%1 rdf:type nmo:SMSMessage ."))
+                            .variable(Event::Id);
+        }
 
-    if (!filterAccount.isEmpty()) {
-        query.addPattern(QString(QLatin1String("{%2 nmo:to [nco:hasContactMedium <telepathy:%1>]} "
-                                               "UNION "
-                                               "{%2 nmo:from [nco:hasContactMedium <telepathy:%1>]}"))
-                         .arg(filterAccount))
+        if (filterDirection == Event::Outbound) {
+            query.addPattern(QLatin1String("%1 nmo:isSent \"true\" ."))
+                            .variable(Event::Id);
+        } else if (filterDirection == Event::Inbound) {
+            query.addPattern(QLatin1String("%1 nmo:isSent \"false\" ."))
+                             .variable(Event::Id);
+        }
+
+        query.addPattern(QLatin1String("%1 nmo:isDraft \"false\"; nmo:isDeleted \"false\" .")).variable(Event::Id);
+        query.addPattern(QLatin1String("%1 nmo:communicationChannel ?:channel ."))
                 .variable(Event::Id);
-    }
 
-    if (filterType == Event::IMEvent) {
-        query.addPattern(QLatin1String("%1 rdf:type nmo:IMMessage ."))
-                        .variable(Event::Id);
-    } else if (filterType == Event::SMSEvent) {
-        query.addPattern(QLatin1String("%1 rdf:type nmo:SMSMessage ."))
-                        .variable(Event::Id);
-    }
+        if (part == NextChunk) {
+            query.addPattern(QLatin1String("FILTER (%1 < ?:endTime^^xsd:dateTime || "
+                                           "(%1 = ?:endTime^^xsd:dateTime && tracker:id(%2) < ?:trackerId))"))
+                .variable(Event::EndTime)
+                .variable(Event::Id);
+        }
+
+        if (part != AllEvents || limit)
+            query.addProjection(QLatin1String("tracker:id(%1)")).variable(Event::Id);
 
-    if (filterDirection == Event::Outbound) {
-        query.addPattern(QLatin1String("%1 nmo:isSent \"true\" ."))
-                        .variable(Event::Id);
-    } else if (filterDirection == Event::Inbound) {
-        query.addPattern(QLatin1String("%1 nmo:isSent \"false\" ."))
+        query.addModifier("ORDER BY DESC(%1) DESC(tracker:id(%2))")
+                         .variable(Event::EndTime)
                          .variable(Event::Id);
+
+        queryTemplate.text = query.query();
+        queryTemplate.properties = query.eventProperties();
+        QueryTemplates::insert(shape, queryTemplate);
     }
 
-    query.addPattern(QLatin1String("%1 nmo:isDraft \"false\"; nmo:isDeleted \"false\" .")).variable(Event::Id);
-    query.addPattern(QString(QLatin1String("%2 nmo:communicationChannel <%1> ."))
-                     .arg(Group::idToUrl(filterGroupId).toString()))
-            .variable(Event::Id);
+    QSparqlQuery query(queryTemplate.text);
+    if (!filterAccount.isEmpty())
+        query.bindValue(QLatin1String("account"),
+                        QUrl(QLatin1String("telepathy:") + filterAccount));
+    query.bindValue(QLatin1String("channel"), Group::idToUrl(filterGroupId));
+
+    if (part == NextChunk) {
+        query.bindValue(QLatin1String("endTime"),
+                        cursorTime.toUTC().toString(Qt::ISODate));
+        query.bindValue(QLatin1String("trackerId"), cursorTrackerId);
+    }
 
-    query.addModifier("ORDER BY DESC(%1) DESC(tracker:id(%2))")
-                     .variable(Event::EndTime)
-                     .variable(Event::Id);
+    properties = queryTemplate.properties;
 
-    return query;
+    QString text = QueryTemplates::queryText(query);
+    if (limit)
+        text.append(QLatin1String(" LIMIT ") + QString::number(limit));
+    if (offset)
+        text.append(QLatin1String(" OFFSET ") + QString::number(offset));
+
+    return text;
 }
 
 void ConversationModelPrivate::modelUpdatedSlot(bool successful)
 {
+    if (isStaleDelivery())
+        return;
+
     if (queryMode == EventModel::StreamedAsyncQuery) {
         activeQueries--;
         isReady = isModelReady();
@@ -231,18 +302,6 @@ void ConversationModelPrivate::modelUpdatedSlot(bool successful)
     }
 }
 
-void ConversationModelPrivate::extraReceivedSlot(QList<CommHistory::Event> events,
-                                                 QVariantList extra)
-{
-    Q_UNUSED(events);
-
-    if (!extra.isEmpty()) {
-        QVariant trackerId = extra.last();
-        if (trackerId.isValid())
-            lastEventTrackerId = trackerId.toInt();
-    }
-}
-
 bool ConversationModelPrivate::isModelReady() const
 {
     return activeQueries == 0
@@ -289,70 +348,65 @@ bool ConversationModel::getEvents(int groupId)
     Q_D(ConversationModel);
 
     d->filterGroupId = groupId;
+    d->queryRunner->setCacheScope(groupId);
 
     beginResetModel();
     d->clearEvents();
     endResetModel();
 
-    EventsQuery query = d->buildQuery();
+    QList<Event::Property> properties;
 
     if (d->queryMode == EventModel::StreamedAsyncQuery) {
         d->startContactListening();
 
+        d->supersedeQueries();
         d->isReady = false;
-        query.addModifier(QLatin1String("LIMIT ") + QString::number(d->firstChunkSize));
-        query.addProjection(QLatin1String("tracker:id(%1)")).variable(Event::Id);
+        QString query = d->buildQuery(ConversationModelPrivate::FirstChunk, properties);
 
         d->queryRunner->enableQueue();
 
-        QString sparqlQuery = query.query();
-        d->queryRunner->runEventsQuery(sparqlQuery, query.eventProperties());
+        d->queryRunner->runEventsQuery(query, properties);
         d->eventsFilled = 0;
         d->firstFetch = true;
         d->activeQueries = 1;
 
-        connect(d->queryRunner, SIGNAL(eventsReceivedExtra(QList<CommHistory::Event>,QVariantList)),
-                d, SLOT(extraReceivedSlot(QList<CommHistory::Event>,QVariantList)),
-                Qt::UniqueConnection);
-
         d->queryRunner->startQueue();
 
         return true;
     }
 
-    return d->executeQuery(query);
+    QString query = d->buildQuery(ConversationModelPrivate::AllEvents, properties);
+    return d->executeQuery(query, properties);
 }
 
 bool ConversationModel::canFetchMore(const QModelIndex &parent) const
 {
-    Q_UNUSED(parent);
     Q_D(const ConversationModel);
 
+    // adaptive streaming is driven by the query runner
+    if (d->queryMode == EventModel::StreamedAdaptiveQuery)
+        return EventModel::canFetchMore(parent);
+
     return !d->isModelReady();
 }
 
 void ConversationModel::fetchMore(const QModelIndex &parent)
 {
-    Q_UNUSED(parent);
     Q_D(ConversationModel);
 
+    if (d->queryMode == EventModel::StreamedAdaptiveQuery) {
+        EventModel::fetchMore(parent);
+        return;
+    }
+
     // isModelReady() is true when there are no more events to request
     if (d->isModelReady() || d->eventRootItem->childCount() < 1)
         return;
 
-    EventsQuery query = d->buildQuery();
-
-    Event &event = d->eventRootItem->eventAt(d->eventRootItem->childCount() - 1);
-
-    query.addProjection(QLatin1String("tracker:id(%1)")).variable(Event::Id);
-    query.addPattern(QString(QLatin1String("FILTER (%3 < \"%1\"^^xsd:dateTime || (%3 = \"%1\"^^xsd:dateTime && tracker:id(%4) < %2))"))
-                     .arg(event.endTime().toUTC().toString(Qt::ISODate)).arg(d->lastEventTrackerId))
-        .variable(Event::EndTime)
-        .variable(Event::Id);
-    query.addModifier(QLatin1String("LIMIT ") + QString::number(d->chunkSize));
+    QList<Event::Property> properties;
+    QString query = d->buildQuery(ConversationModelPrivate::NextChunk, properties);
 
-    QString sparqlQuery = query.query();
-    d->queryRunner->runEventsQuery(sparqlQuery, query.eventProperties());
+    d->queryRunner->runEventsQuery(query, properties);
     d->eventsFilled = 0;
     d->firstFetch = false;
     d->activeQueries++;
@@ -360,4 +414,16 @@ void ConversationModel::fetchMore(const QModelIndex &parent)
     d->queryRunner->startQueue();
 }
 
+bool ConversationModel::fetchNextPage()
+{
+    Q_D(ConversationModel);
+
+    if (!hasNextPage())
+        return false;
+
+    QList<Event::Property> properties;
+    QString query = d->buildQuery(ConversationModelPrivate::NextChunk, properties);
+    return d->executeQuery(query, properties);
+}
+
 }
@@ -88,6 +88,8 @@ public:
     virtual bool canFetchMore(const QModelIndex &parent) const;
     virtual void fetchMore(const QModelIndex &parent);
 
+    virtual bool fetchNextPage();
+
 private:
     Q_DECLARE_PRIVATE(ConversationModel);
 
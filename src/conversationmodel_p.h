@@ -23,6 +23,8 @@
 #ifndef COMMHISTORY_CONVERSATIONMODEL_P_H
 #define COMMHISTORY_CONVERSATIONMODEL_P_H
 
+#include <QSparqlQuery>
+
 #include "eventmodel_p.h"
 #include "conversationmodel.h"
 #include "group.h"
@@ -41,13 +43,28 @@ public:
                       const QString &remoteUid);
     bool acceptsEvent(const Event &event) const;
     bool fillModel(int start, int end, QList<CommHistory::Event> events);
-    EventsQuery buildQuery() const;
+    enum QueryPart {
+        AllEvents,
+        FirstChunk,
+        NextChunk
+    };
+
+    /*!
+     * Builds the query text for part of the conversation. The template
+     * is shared by queries of the same shape, filter values (and for
+     * NextChunk the position of the last received event) are bound and
+     * the limit and offset appended. Without streaming NextChunk is the
+     * next page of queryLimit events.
+     *
+     * \param properties Set to the event properties of the query.
+     */
+    QString buildQuery(QueryPart part,
+                       QList<Event::Property> &properties) const;
     bool isModelReady() const;
 
 public Q_SLOTS:
     void groupsUpdatedFullSlot(const QList<CommHistory::Group> &groups);
     virtual void modelUpdatedSlot(bool successful);
-    void extraReceivedSlot(QList<CommHistory::Event> events, QVariantList extra);
     void groupsDeletedSlot(const QList<int> &groupIds);
     void contactSettingsChangedSlot(const QHash<QString, QVariant> &changedSettings);
 
@@ -58,7 +75,6 @@ public:
     Event::EventDirection filterDirection;
     bool firstFetch;
     uint eventsFilled;
-    uint lastEventTrackerId;
 
     int activeQueries;
 };
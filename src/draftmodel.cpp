@@ -61,7 +61,7 @@ bool DraftModel::getEvents()
     d->clearEvents();
     endResetModel();
 
-    EventsQuery query(d->propertyMask);
+    EventsQuery query(d->queryProperties());
 
     query.addPattern(QLatin1String("%1 nmo:isDraft \"true\"; nmo:isDeleted \"false\" ."))
             .variable(Event::Id);
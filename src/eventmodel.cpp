@@ -31,7 +31,9 @@
 #include "event.h"
 #include "eventtreeitem.h"
 #include "queryrunner.h"
+#include "querytemplates.h"
 #include "committingtransaction.h"
+#include "pendinglookup.h"
 
 using namespace CommHistory;
 
@@ -44,6 +46,7 @@ EventModel::EventModel(QObject *parent)
     connect(d_ptr, SIGNAL(modelReady(bool)), this, SIGNAL(modelReady(bool)));
     connect(d_ptr, SIGNAL(eventsCommitted(const QList<CommHistory::Event>&,bool)),
             this, SIGNAL(eventsCommitted(const QList<CommHistory::Event>&,bool)));
+    connect(d_ptr, SIGNAL(markedAsRead(bool)), this, SIGNAL(markedAsRead(bool)));
 
     setupRoles();
 }
@@ -54,6 +57,7 @@ EventModel::EventModel(EventModelPrivate &dd, QObject *parent)
     connect(d_ptr, SIGNAL(modelReady(bool)), this, SIGNAL(modelReady(bool)));
     connect(d_ptr, SIGNAL(eventsCommitted(const QList<CommHistory::Event>&,bool)),
             this, SIGNAL(eventsCommitted(const QList<CommHistory::Event>&,bool)));
+    connect(d_ptr, SIGNAL(markedAsRead(bool)), this, SIGNAL(markedAsRead(bool)));
 
     setupRoles();
 }
@@ -123,6 +127,18 @@ uint EventModel::firstChunkSize() const
     return d->firstChunkSize;
 }
 
+int EventModel::decodeThreads() const
+{
+    Q_D(const EventModel);
+    return d->decodeThreads;
+}
+
+int EventModel::chunkLatencyTarget() const
+{
+    Q_D(const EventModel);
+    return d->chunkLatencyTarget;
+}
+
 int EventModel::limit() const
 {
     Q_D(const EventModel);
@@ -457,6 +473,18 @@ void EventModel::setFirstChunkSize(uint size)
     d->firstChunkSize = size;
 }
 
+void EventModel::setDecodeThreads(int threads)
+{
+    Q_D(EventModel);
+    d->decodeThreads = threads;
+}
+
+void EventModel::setChunkLatencyTarget(int msecs)
+{
+    Q_D(EventModel);
+    d->chunkLatencyTarget = msecs;
+}
+
 void EventModel::setLimit(int limit)
 {
     Q_D(EventModel);
@@ -481,6 +509,18 @@ void EventModel::enableContactChanges(bool enabled)
     d->contactChangesEnabled = enabled;
 }
 
+void EventModel::setQueryContacts(bool enabled)
+{
+    Q_D(EventModel);
+    d->queryContacts = enabled;
+}
+
+bool EventModel::queryContacts() const
+{
+    Q_D(const EventModel);
+    return d->queryContacts;
+}
+
 bool EventModel::addEvent(Event &event, bool toModelOnly)
 {
     Q_D(EventModel);
@@ -491,6 +531,10 @@ bool EventModel::addEvent(Event &event, bool toModelOnly)
     if ( toModelOnly ) {
         // set id to have a valid event
         event.setId( d->tracker()->nextEventId() );
+        if (event.id() == 0) {
+            qCritical() << Q_FUNC_INFO << "No event id available";
+            return false;
+        }
 
         if (d->acceptsEvent(event)) {
             d->addToModel(event);
@@ -543,6 +587,12 @@ bool EventModel::addEvents(QList<Event> &events, bool toModelOnly)
 
                 // set id to have a valid event
                 event.setId( d->tracker()->nextEventId() );
+                if (event.id() == 0) {
+                    qCritical() << Q_FUNC_INFO << "No event id available";
+                    if (!added.isEmpty())
+                        emit d->eventsAdded(added);
+                    return false;
+                }
 
                 if (d->acceptsEvent(event)) {
                     d->addToModel(event);
@@ -555,33 +605,39 @@ bool EventModel::addEvents(QList<Event> &events, bool toModelOnly)
             added.clear();
         }
     }
-    // otherwise execute proper db operations.
+    // otherwise execute proper db operations, one update request
+    // per batch. Batch size follows the commit latency.
     else {
-        while (i.hasNext()) {
+        int batchStart = 0;
+        while (batchStart < events.size()) {
+            added = events.mid(batchStart, d->addBatchSize);
+
             d->tracker()->transaction(d->syncOnCommit);
 
-            while (added.size() < MAX_ADD_EVENTS_SIZE && i.hasNext()) {
-                Event &event = i.next();
+            if (!d->doAddEvents(added)) {
+                d->tracker()->rollback();
+                return false;
+            }
 
-                if (!d->doAddEvent(event)) {
-                    d->tracker()->rollback();
-                    return false;
-                }
+            for (int j = 0; j < added.size(); j++) {
+                Event &event = added[j];
+                events[batchStart + j] = event;
 
                 if (d->acceptsEvent(event)) {
                     d->addToModel(event);
                 }
-
-                added.append(event);
             }
 
             CommittingTransaction *t = d->commitTransaction(added);
-            if (t)
+            if (t) {
                 t->addSignal(false,
                              d,
                              "eventsAdded",
                             Q_ARG(QList<CommHistory::Event>, added));
+                d->trackAddBatch(t, added.size());
+            }
 
+            batchStart += added.size();
             added.clear();
         }
     }
@@ -678,103 +734,104 @@ bool EventModel::modifyEvents(QList<Event> &events)
     return t != 0;
 }
 
-bool EventModel::deleteEvent(int id)
+bool EventModel::markAsRead(const QList<int> &ids)
 {
     Q_D(EventModel);
-    qDebug() << __FUNCTION__ << ":" << id;
+    qDebug() << Q_FUNC_INFO << ids.size();
 
-    d->tracker()->transaction(d->syncOnCommit);
+    if (ids.isEmpty())
+        return true;
 
-    Event event;
-    if (!d->doDeleteEvent(id, event)) {
+    d->tracker()->transaction(d->syncOnCommit);
+    if (!d->tracker()->markAsRead(ids)) {
         d->tracker()->rollback();
         return false;
     }
 
-    // update or delete group
-    const char *groupSignal = 0;
-    if (event.groupId() != -1 && !event.isDraft()) {
-        int total;
-        if (!d->tracker()->totalEventsInGroup(event.groupId(), total)) {
-            d->tracker()->rollback();
-            return false;
-        }
-        if (total == 1) {
-            qDebug() << __FUNCTION__ << ": deleting empty group";
-            if  (!d->tracker()->deleteGroup(event.groupId(), false)) {
-                d->tracker()->rollback();
-                return false;
-            } else {
-                groupSignal = "groupsDeleted";
-            }
-        } else {
-            groupSignal = "groupsUpdated";
+    QList<Event> events;
+    QList<int> groupIds;
+    foreach (int id, ids) {
+        Event event;
+        event.setId(id);
+        event.setIsRead(true);
+        events.append(event);
+
+        QModelIndex index = d->findEvent(id);
+        if (index.isValid()) {
+            EventTreeItem *item = static_cast<EventTreeItem *>(index.internalPointer());
+            int groupId = item->event().groupId();
+            if (groupId != -1 && !item->event().isDraft() && !groupIds.contains(groupId))
+                groupIds.append(groupId);
         }
     }
 
-    CommittingTransaction *t = d->commitTransaction(QList<Event>() << event);
-    if (t) {
-        t->addSignal(false, d, "eventDeleted",
-                    Q_ARG(int, id));
-
-        if (groupSignal)
-            t->addSignal(false, d, groupSignal,
-                        Q_ARG(QList<int>, QList<int>() << event.groupId()));
-    }
-
-    return t != 0;
+    return d->commitMarkAsRead(events, groupIds);
 }
 
-bool EventModel::deleteEvent(Event &event)
+bool EventModel::markAsReadBefore(Event::EventType type, const QDateTime &before)
 {
     Q_D(EventModel);
-    qDebug() << __FUNCTION__ << ":" << event.id();
+    qDebug() << Q_FUNC_INFO << type << before;
 
-    if (!event.isValid()) {
-        qWarning() << __FUNCTION__ << "Invalid event";
+    d->tracker()->transaction(d->syncOnCommit);
+    if (!d->tracker()->markAsReadBefore(type, before)) {
+        d->tracker()->rollback();
         return false;
     }
 
-    d->tracker()->transaction(d->syncOnCommit);
+    // the database update is predicate based, only the loaded top level
+    // events need to be updated in the model
+    QList<Event> events;
+    QList<int> groupIds;
+    for (int row = 0; row < d->eventRootItem->childCount(); row++) {
+        const Event &event = d->eventRootItem->eventAt(row);
+        if (event.type() != type || event.isRead() || event.startTime() >= before)
+            continue;
 
-    if (!d->tracker()->deleteEvent(event, d->bgThread)) {
-        d->tracker()->rollback();
-        return false;
+        Event partial;
+        partial.setId(event.id());
+        partial.setIsRead(true);
+        events.append(partial);
+
+        if (event.groupId() != -1 && !event.isDraft() && !groupIds.contains(event.groupId()))
+            groupIds.append(event.groupId());
     }
 
-        const char *groupSignal = 0;
-    if (event.groupId() != -1 && !event.isDraft()) {
-        int total;
-        if (!d->tracker()->totalEventsInGroup(event.groupId(), total)) {
-            d->tracker()->rollback();
-            return false;
-        }
+    return d->commitMarkAsRead(events, groupIds);
+}
 
-        if (total == 1) {
-            qDebug() << __FUNCTION__ << ": deleting empty group";
-            if (!d->tracker()->deleteGroup(event.groupId(), false)) {
-                d->tracker()->rollback();
-                return false;
-            } else {
-                groupSignal = "groupsDeleted";
-            }
-        } else {
-            groupSignal = "groupsUpdated";
-        }
+bool EventModel::deleteEvent(int id)
+{
+    Q_D(EventModel);
+    qDebug() << __FUNCTION__ << ":" << id;
+
+    // If event can be found already from the model then no need to fetch it from database
+    QModelIndex index = d->findEvent(id);
+    if (index.isValid()) {
+        Event event = this->event(index);
+        return d->doDeleteEvent(event);
     }
 
-    CommittingTransaction *t = d->commitTransaction(QList<Event>() << event);
+    qDebug() << __FUNCTION__ << "Event" << id << "not present in model, fetching from db";
+    PendingLookup *lookup = d->tracker()->getEventAsync(id);
+    connect(lookup, SIGNAL(finished(CommHistory::PendingLookup*)),
+            d, SLOT(deleteLookupFinished(CommHistory::PendingLookup*)));
+    d->pendingDeletes.insert(lookup, id);
 
-    if (t) {
-        t->addSignal(false, d, "eventDeleted",
-                    Q_ARG(int, event.id()));
+    return true;
+}
 
-        if (groupSignal)
-            t->addSignal(false, d, groupSignal,
-                        Q_ARG(QList<int>, QList<int>() << event.groupId()));
+bool EventModel::deleteEvent(Event &event)
+{
+    Q_D(EventModel);
+    qDebug() << __FUNCTION__ << ":" << event.id();
+
+    if (!event.isValid()) {
+        qWarning() << __FUNCTION__ << "Invalid event";
+        return false;
     }
 
-    return t != 0;
+    return d->doDeleteEvent(event);
 }
 
 bool EventModel::moveEvent(Event &event, int groupId)
@@ -792,49 +849,10 @@ bool EventModel::moveEvent(Event &event, int groupId)
         return true;
     }
 
-    d->tracker()->transaction(d->syncOnCommit);
-    if (!d->tracker()->moveEvent(event, groupId)) {
-        d->tracker()->rollback();
-        return false;
-    }
-
-    int groupDeleted = -1;
-    // update or delete old group
-    if (event.groupId() != -1 && !event.isDraft()) {
-        int total;
-        if (!d->tracker()->totalEventsInGroup(event.groupId(), total)) {
-            d->tracker()->rollback();
-            return false;
-        }
-
-        if (total == 1) {
-            qDebug() << __FUNCTION__ << ": deleting empty group";
-            if (!d->tracker()->deleteGroup(event.groupId(), false)) {
-                qWarning() << Q_FUNC_INFO << "error deleting empty group" ;
-                d->tracker()->rollback();
-                return false;
-            } else {
-                groupDeleted = event.groupId();
-            }
-        }
-    }
-
+    Event movedEvent = event;
     event.setGroupId(groupId);
 
-    CommittingTransaction *t = d->commitTransaction(QList<Event>() << event);
-    t->addSignal(false, d, "eventDeleted", Q_ARG(int, event.id()));
-
-    if (groupDeleted != -1)
-        t->addSignal(false, d, "groupsDeleted",
-                     Q_ARG(QList<int>, QList<int>() << groupDeleted));
-    else
-        t->addSignal(false, d, "groupsUpdated",
-                     Q_ARG(QList<int>, QList<int>() << event.groupId()));
-
-    t->addSignal(false, d, "eventsAdded",
-                 Q_ARG(QList<CommHistory::Event>, QList<CommHistory::Event>() << event));
-
-    return true;
+    return d->doMoveEvent(movedEvent, groupId);
 }
 
 bool EventModel::modifyEventsInGroup(QList<Event> &events, Group group)
@@ -941,6 +959,30 @@ void EventModel::fetchMore(const QModelIndex &parent)
         d->queryRunner->fetchMore();
 }
 
+bool EventModel::hasNextPage() const
+{
+    Q_D(const EventModel);
+
+    return d->isReady
+        && !d->isStreamed()
+        && d->queryLimit > 0
+        && d->cursorTrackerId >= 0
+        && d->pageRows >= d->queryLimit;
+}
+
+bool EventModel::fetchNextPage()
+{
+    Q_D(EventModel);
+
+    if (!hasNextPage() || d->pageQuery.isEmpty())
+        return false;
+
+    QSparqlQuery query(d->pageQuery);
+    d->bindCursor(query);
+
+    return d->executeQuery(QueryTemplates::queryText(query), d->pageProperties);
+}
+
 void EventModel::setBackgroundThread(QThread *thread)
 {
     Q_D(EventModel);
@@ -71,7 +71,7 @@ class LIBCOMMHISTORY_EXPORT EventModel: public QAbstractItemModel
     Q_PROPERTY(bool syncMode READ syncMode WRITE setSyncMode)
 
 public:
-    enum QueryMode { AsyncQuery, StreamedAsyncQuery, SyncQuery };
+    enum QueryMode { AsyncQuery, StreamedAsyncQuery, SyncQuery, StreamedAdaptiveQuery };
 
     enum ColumnId {
         EventId = 0,
@@ -176,6 +176,11 @@ public:
      *
      * SyncQuery: getEvents() blocks until all results have been fetched.
      *
+     * StreamedAdaptiveQuery: Same as StreamedAsyncQuery, but the size
+     * of each chunk after the first one is chosen from the measured
+     * decoding and model insertion cost per event, so that processing
+     * a chunk takes about chunkLatencyTarget() milliseconds.
+     *
      * \param mode Query mode.
      */
     virtual void setQueryMode(QueryMode mode);
@@ -196,6 +201,24 @@ public:
      */
     void setFirstChunkSize(uint size);
 
+    /*!
+     * Set the number of threads used to decode query results. With more
+     * than one thread, rows of each received chunk are decoded in
+     * parallel. Events are still added to the model in query order.
+     * Useful for large result sets on multicore devices.
+     *
+     * \param threads Number of decoding threads, default 1.
+     */
+    void setDecodeThreads(int threads);
+
+    /*!
+     * Set the time processing one chunk should take in
+     * StreamedAdaptiveQuery mode.
+     *
+     * \param msecs Latency target in milliseconds, default 50.
+     */
+    void setChunkLatencyTarget(int msecs);
+
     /*!
      * Set number of events to fetch in the next query.
      *
@@ -229,6 +252,18 @@ public:
      */
     void enableContactChanges(bool enabled);
 
+    /*!
+     * If disabled, contacts are left out of the queries and resolved
+     * afterwards with one lookup per received chunk through a cache
+     * shared by all models. Rows get their contacts once the lookup
+     * finishes, reported with dataChanged(). Enabled by default.
+     * NOTE: This method must be called before getEvents().
+     *
+     * \param enabled If true, query contacts together with the events.
+     */
+    void setQueryContacts(bool enabled);
+    bool queryContacts() const;
+
     /*!
      * Add a new event.
      *
@@ -241,7 +276,8 @@ public:
     virtual bool addEvent(Event &event, bool toModelOnly = false);
 
     /*!
-     * Add new events.
+     * Add new events. Events are written in batches, one update request
+     * per batch; the batch size adapts to the commit latency.
      *
      * \param events Events to be inserted into the database. If successful,
      * event ids are updated.
@@ -270,9 +306,11 @@ public:
     virtual bool modifyEvents(QList<Event> &events);
 
     /*!
-     * Delete an event from the model and the database.
+     * Delete an event from the model and the database. Events not in
+     * the model are fetched asynchronously first; the result is
+     * reported with eventsCommitted().
      * \param id id of the event to be deleted.
-     * \return true if successful
+     * \return true if the deletion was started
      */
     virtual bool deleteEvent(int id);
 
@@ -293,14 +331,35 @@ public:
 
     /*!
      * Updates groupId of the event. Modifies database, emits added/deleted signals for the event.
-     * Deletes group if it was the last event in a group.
+     * Deletes group if it was the last event in a group. The database is
+     * modified asynchronously, the result is reported with eventsCommitted().
      *
      * \param event Event to be changed.
      * \param groupId new group Id.
-     * \return true if successful
+     * \return true if the move was started
      */
     bool moveEvent(Event &event, int groupId);
 
+    /*!
+     * Mark events as read in the database and the model. The update is
+     * set-based and asynchronous, markedAsRead() is emitted when it has
+     * been committed.
+     *
+     * \param ids Ids of the events to be marked.
+     * \return true if the update was queued successfully
+     */
+    bool markAsRead(const QList<int> &ids);
+
+    /*!
+     * Mark all events of a type with start time before a date as read.
+     * markedAsRead() is emitted when the update has been committed.
+     *
+     * \param type Event type.
+     * \param before Events older than this are marked.
+     * \return true if the update was queued successfully
+     */
+    bool markAsReadBefore(Event::EventType type, const QDateTime &before);
+
     /*!
      * In StreamedAsyncQuery mode, returns true if the tracker query has
      * more data available.
@@ -316,10 +375,30 @@ public:
      */
     virtual void fetchMore(const QModelIndex &parent);
 
+    /*!
+     * With a limit set and a non-streamed query mode, returns true if
+     * the model is ready and the last page was full, so the query can
+     * be continued with fetchNextPage(). Only models ordered by time
+     * support this: CallModel sorted by time and ConversationModel.
+     */
+    bool hasNextPage() const;
+
+    /*!
+     * Appends the next limit() events after the last received one.
+     * The page is found by seeking past the time and tracker id of that
+     * event instead of with an offset, so deep pages cost as much as
+     * the first one. modelReady() is emitted when the page is in.
+     *
+     * \return true if the query was started
+     */
+    virtual bool fetchNextPage();
+
     virtual bool isTree() const;
     virtual QueryMode queryMode() const;
     virtual uint chunkSize() const;
     uint firstChunkSize() const;
+    int decodeThreads() const;
+    int chunkLatencyTarget() const;
     virtual int limit() const;
     virtual int offset() const;
     virtual bool isReady() const;
@@ -382,6 +461,21 @@ Q_SIGNALS:
      */
     void eventsCommitted(const QList<CommHistory::Event> &events, bool successful);
 
+    /*!
+     * Emitted when markAsRead() or markAsReadBefore() finishes.
+     *
+     * \param successful or false in case of an error
+     */
+    void markedAsRead(bool successful);
+
+    /*!
+     * Debug signal, emitted in StreamedAdaptiveQuery mode when the size
+     * of the next chunk has been chosen.
+     *
+     * \param size number of events in the next chunk
+     */
+    void chunkSizeAdapted(int size);
+
 protected:
     EventModelPrivate * const d_ptr;
     EventModel(EventModelPrivate &dd, QObject *parent = 0);
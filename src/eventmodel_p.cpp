@@ -22,10 +22,14 @@
 
 #include <QtDBus/QtDBus>
 #include <QDebug>
+#include <QTime>
+#include <QSparqlResult>
 
 #include "trackerio.h"
 #include "trackerio_p.h"
 #include "queryrunner.h"
+#include "querycache.h"
+#include "querytemplates.h"
 #include "eventmodel.h"
 #include "eventmodel_p.h"
 #include "updatesemitter.h"
@@ -34,29 +38,49 @@
 #include "constants.h"
 #include "commonutils.h"
 #include "contactlistener.h"
+#include "contactcache.h"
 #include "committingtransaction.h"
+#include "pendinglookup.h"
 #include "eventsquery.h"
 
 using namespace CommHistory;
 
 namespace {
-    static const int defaultChunkSize = 50;
+    // message part queries executed by tracker at the same time
+    static const int maxPartQueriesInFlight = 4;
+    // addEvents() batches: start size, commit latency to aim for and bounds
+    static const int defaultAddBatchSize = 25;
+    static const int addBatchLatency = 250; // msecs
+    static const int minAddBatchSize = 5;
+    static const int maxAddBatchSize = 250;
 }
 
 EventModelPrivate::EventModelPrivate(EventModel *model)
         : isInTreeMode(false)
         , queryMode(EventModel::AsyncQuery)
-        , chunkSize(defaultChunkSize)
+        , chunkSize(DEFAULT_CHUNK_SIZE)
         , firstChunkSize(0)
+        , decodeThreads(1)
+        , chunkLatencyTarget(DEFAULT_CHUNK_LATENCY)
         , queryLimit(0)
         , queryOffset(0)
+        , cursorProperty(Event::StartTime)
+        , cursorTrackerId(-1)
+        , pageRows(0)
+        , seekQuery(false)
         , isReady(true)
         , messagePartsReady(true)
         , threadCanFetchMore(false)
         , syncOnCommit(false)
         , contactChangesEnabled(false)
+        , queryContacts(true)
+        , addBatchSize(defaultAddBatchSize)
         , queryRunner(0)
         , partQueryRunner(0)
+        , firstValidQuery(0)
+        , activeQuery(0)
+        , firstValidPartQuery(0)
+        , activePartQuery(0)
         , propertyMask(Event::allProperties())
         , bgThread(0)
         , m_pTracker(0)
@@ -108,17 +132,26 @@ void EventModelPrivate::resetQueryRunners()
 
     queryRunner = new QueryRunner(tracker());
     partQueryRunner = new QueryRunner(tracker());
+    queryRunner->setQueryCache(QueryCache::instance());
+    firstValidQuery = activeQuery = 0;
+    firstValidPartQuery = activePartQuery = 0;
 
     connect(queryRunner, SIGNAL(eventsReceived(int, int, QList<CommHistory::Event>)),
             this, SLOT(eventsReceivedSlot(int, int, QList<CommHistory::Event>)));
     connect(queryRunner, SIGNAL(canFetchMoreChanged(bool)),
             this, SLOT(canFetchMoreChangedSlot(bool)));
     connect(queryRunner, SIGNAL(modelUpdated(bool)), this, SLOT(modelUpdatedSlot(bool)));
+    connect(queryRunner, SIGNAL(chunkSizeAdapted(int)), q_ptr, SIGNAL(chunkSizeAdapted(int)));
+    connect(queryRunner, SIGNAL(queryStarted(int)), this, SLOT(queryStartedSlot(int)));
+    connect(queryRunner, SIGNAL(eventsReceivedExtra(QList<CommHistory::Event>, QVariantList)),
+            this, SLOT(cursorReceivedSlot(QList<CommHistory::Event>, QVariantList)));
 
     connect(partQueryRunner, SIGNAL(messagePartsReceived(int, QList<CommHistory::MessagePart>)),
             this, SLOT(messagePartsReceivedSlot(int, QList<CommHistory::MessagePart>)));
     connect(partQueryRunner, SIGNAL(modelUpdated(bool)), this, SLOT(partsUpdatedSlot(bool)));
+    connect(partQueryRunner, SIGNAL(queryStarted(int)), this, SLOT(partQueryStartedSlot(int)));
     partQueryRunner->enableQueue(true);
+    partQueryRunner->setMaxInFlight(maxPartQueriesInFlight);
 
     if (bgThread) {
         qDebug() << Q_FUNC_INFO << "MOVE" << queryRunner
@@ -175,25 +208,139 @@ QModelIndex EventModelPrivate::findParent(const Event &event)
     return QModelIndex();
 }
 
+bool EventModelPrivate::isStreamed() const
+{
+    return queryMode == EventModel::StreamedAsyncQuery
+        || queryMode == EventModel::StreamedAdaptiveQuery;
+}
+
+void EventModelPrivate::setupStreaming()
+{
+    queryRunner->setupStreaming(chunkSize, firstChunkSize,
+                                queryMode == EventModel::StreamedAdaptiveQuery,
+                                chunkLatencyTarget);
+}
+
+void EventModelPrivate::supersedeQueries()
+{
+    firstValidQuery = queryRunner->cancelQueries();
+    firstValidPartQuery = partQueryRunner->cancelQueries();
+    // parts of superseded events will not arrive anymore
+    messagePartsReady = true;
+    threadCanFetchMore = false;
+}
+
+bool EventModelPrivate::isStaleDelivery() const
+{
+    return activeQuery < firstValidQuery;
+}
+
+bool EventModelPrivate::isStalePartDelivery() const
+{
+    return activePartQuery < firstValidPartQuery;
+}
+
+void EventModelPrivate::queryStartedSlot(int token)
+{
+    activeQuery = token;
+}
+
+void EventModelPrivate::partQueryStartedSlot(int token)
+{
+    activePartQuery = token;
+}
+
+void EventModelPrivate::cursorReceivedSlot(QList<CommHistory::Event> events,
+                                           QVariantList extra)
+{
+    if (isStaleDelivery() || events.isEmpty() || extra.isEmpty())
+        return;
+
+    QVariant trackerId = extra.last();
+    if (!trackerId.isValid())
+        return;
+
+    const Event &event = events.last();
+    cursorTime = cursorProperty == Event::EndTime ? event.endTime() : event.startTime();
+    cursorTrackerId = trackerId.toInt();
+    pageRows += events.size();
+}
+
+void EventModelPrivate::addSeekOrder(EventsQuery &query, Event::Property sortProperty)
+{
+    cursorProperty = sortProperty;
+    seekQuery = true;
+
+    query.addPattern(QLatin1String("FILTER (%1 < ?:cursorTime^^xsd:dateTime || "
+                                   "(%1 = ?:cursorTime^^xsd:dateTime && tracker:id(%2) < ?:cursorId))"))
+        .variable(sortProperty)
+        .variable(Event::Id);
+    query.addProjection(QLatin1String("tracker:id(%1)")).variable(Event::Id);
+    query.addModifier(QLatin1String("ORDER BY DESC(%1) DESC(tracker:id(%2))"))
+        .variable(sortProperty)
+        .variable(Event::Id);
+}
+
+void EventModelPrivate::bindCursor(QSparqlQuery &query, bool first) const
+{
+    if (first) {
+        // nothing sorts after the end of time
+        query.bindValue(QLatin1String("cursorTime"),
+                        QString(QLatin1String("9999-12-31T23:59:59Z")));
+        query.bindValue(QLatin1String("cursorId"), 0);
+    } else {
+        query.bindValue(QLatin1String("cursorTime"),
+                        cursorTime.toUTC().toString(Qt::ISODate));
+        query.bindValue(QLatin1String("cursorId"), cursorTrackerId);
+    }
+}
+
 bool EventModelPrivate::executeQuery(EventsQuery &query)
+{
+    bool seek = seekQuery;
+    seekQuery = false;
+
+    if (!isStreamed() && queryLimit)
+        query.addModifier(QLatin1String("LIMIT ") + QString::number(queryLimit));
+
+    if (!seek) {
+        if (!isStreamed() && queryOffset)
+            query.addModifier(QLatin1String("OFFSET ") + QString::number(queryOffset));
+
+        return executeQuery(query.query(), query.eventProperties());
+    }
+
+    // the same text serves the following pages with the cursor bound,
+    // the offset only applies to the first one
+    QString text = query.query();
+    QList<Event::Property> properties = query.eventProperties();
+    if (!isStreamed() && queryLimit) {
+        pageQuery = text;
+        pageProperties = properties;
+    }
+    if (!isStreamed() && queryOffset)
+        text.append(QLatin1String(" OFFSET ") + QString::number(queryOffset));
+
+    QSparqlQuery first(text);
+    bindCursor(first, true);
+
+    return executeQuery(QueryTemplates::queryText(first), properties);
+}
+
+bool EventModelPrivate::executeQuery(const QString &query,
+                                     const QList<Event::Property> &properties)
 {
     qDebug() << __PRETTY_FUNCTION__;
 
     startContactListening();
 
+    supersedeQueries();
     isReady = false;
-    if (queryMode == EventModel::StreamedAsyncQuery) {
-        queryRunner->setStreamedMode(true);
-        queryRunner->setChunkSize(chunkSize);
-        queryRunner->setFirstChunkSize(firstChunkSize);
-    } else {
-        if (queryLimit)
-            query.addModifier(QLatin1String("LIMIT ") + QString::number(queryLimit));
-        if (queryOffset)
-            query.addModifier(QLatin1String("OFFSET ") + QString::number(queryOffset));
-    }
-    QString sparqlQuery = query.query();
-    queryRunner->runEventsQuery(sparqlQuery, query.eventProperties());
+    pageRows = 0;
+    queryRunner->setDecodeThreads(decodeThreads);
+    if (isStreamed())
+        setupStreaming();
+    queryRunner->runEventsQuery(query, properties);
     if (queryMode == EventModel::SyncQuery) {
         QEventLoop loop;
         while (!isReady || !messagePartsReady) {
@@ -228,6 +375,10 @@ void EventModelPrivate::clearEvents()
     qDebug() << __PRETTY_FUNCTION__;
     delete eventRootItem;
     eventRootItem = new EventTreeItem(Event());
+
+    cursorTrackerId = -1;
+    pageRows = 0;
+    pageQuery.clear();
 }
 
 void EventModelPrivate::addToModel(Event &event)
@@ -302,7 +453,7 @@ void EventModelPrivate::deleteFromModel(int id)
     }
 }
 
-bool EventModelPrivate::doAddEvent( Event &event )
+bool EventModelPrivate::canAddEvent(const Event &event) const
 {
     if (event.type() == Event::UnknownType) {
         qWarning() << Q_FUNC_INFO << "Event type not set";
@@ -321,6 +472,14 @@ bool EventModelPrivate::doAddEvent( Event &event )
         }
     }
 
+    return true;
+}
+
+bool EventModelPrivate::doAddEvent( Event &event )
+{
+    if (!canAddEvent(event))
+        return false;
+
     if (!tracker()->addEvent(event)) {
         return false;
     }
@@ -328,33 +487,148 @@ bool EventModelPrivate::doAddEvent( Event &event )
     return true;
 }
 
-bool EventModelPrivate::doDeleteEvent(int id, Event &event)
+bool EventModelPrivate::doAddEvents(QList<Event> &events)
 {
-    QModelIndex index = findEvent(id);
-
-    // If event can be found already from the model then no need to fetch it from database:
-    if (index.isValid()) {
-        qDebug() << __PRETTY_FUNCTION__ << "Event " << id << " already present in model. No need to fetch from db.";
-        event = q_ptr->event(index);
-    } else {
-        qDebug() << __PRETTY_FUNCTION__ << "Event " << id << " not present in model. Need to fetch from db.";
-        // fetch event from database
-        if (!tracker()->getEvent(id, event)) {
+    foreach (const Event &event, events) {
+        if (!canAddEvent(event))
             return false;
-        }
     }
 
-    // delete it
+    return tracker()->addEvents(events);
+}
+
+void EventModelPrivate::trackAddBatch(CommittingTransaction *transaction,
+                                      int batchSize)
+{
+    addBatches.insert(transaction, batchSize);
+    connect(transaction, SIGNAL(finished()), this, SLOT(addBatchFinished()));
+}
+
+void EventModelPrivate::addBatchFinished()
+{
+    CommittingTransaction *t = qobject_cast<CommittingTransaction *>(sender());
+    if (!t || !addBatches.contains(t))
+        return;
+
+    int batchSize = addBatches.take(t);
+    int elapsed = t->elapsed();
+    if (elapsed < 0)
+        return;
+
+    // the batch size that would have met the latency target, averaged
+    // with the current one to damp single slow commits
+    int fitting = batchSize * addBatchLatency / qMax(elapsed, 1);
+    addBatchSize = qBound(minAddBatchSize,
+                          (addBatchSize + fitting) / 2,
+                          maxAddBatchSize);
+
+    qDebug() << Q_FUNC_INFO << batchSize << "events in" << elapsed
+             << "ms, next batch" << addBatchSize;
+}
+
+bool EventModelPrivate::doDeleteEvent(const Event &event)
+{
+    tracker()->transaction(syncOnCommit);
+
     if (!tracker()->deleteEvent(event, bgThread)) {
+        tracker()->rollback();
+        return false;
+    }
+
+    // group is deleted if this was its last event
+    bool inGroup = event.groupId() != -1 && !event.isDraft();
+    if (inGroup
+        && !tracker()->deleteGroupIfEmpty(event.groupId(), this, "emptyGroupChecked",
+                                          QVariantList() << event.groupId()
+                                                         << event.groupId())) {
+        tracker()->rollback();
+        return false;
+    }
+
+    CommittingTransaction *t = commitTransaction(QList<Event>() << event);
+    if (t)
+        t->addSignal(false, this, "eventDeleted",
+                     Q_ARG(int, event.id()));
+
+    return t != 0;
+}
+
+bool EventModelPrivate::doMoveEvent(Event event, int groupId)
+{
+    tracker()->transaction(syncOnCommit);
+    if (!tracker()->moveEvent(event, groupId)) {
+        tracker()->rollback();
         return false;
     }
+
+    // old group is deleted if this was its last event
+    bool inGroup = event.groupId() != -1 && !event.isDraft();
+    if (inGroup
+        && !tracker()->deleteGroupIfEmpty(event.groupId(), this, "emptyGroupChecked",
+                                          QVariantList() << event.groupId() << groupId)) {
+        qWarning() << Q_FUNC_INFO << "error deleting empty group" ;
+        tracker()->rollback();
+        return false;
+    }
+
+    event.setGroupId(groupId);
+
+    CommittingTransaction *t = commitTransaction(QList<Event>() << event);
+    if (!t)
+        return false;
+
+    t->addSignal(false, this, "eventDeleted", Q_ARG(int, event.id()));
+    if (!inGroup)
+        t->addSignal(false, this, "groupsUpdated",
+                     Q_ARG(QList<int>, QList<int>() << event.groupId()));
+    t->addSignal(false, this, "eventsAdded",
+                 Q_ARG(QList<CommHistory::Event>, QList<CommHistory::Event>() << event));
+
     return true;
 }
 
+void EventModelPrivate::emptyGroupChecked(CommittingTransaction *transaction,
+                                          QSparqlResult *result,
+                                          QVariant arg)
+{
+    // old group and the group updated if it was not deleted
+    QVariantList groups = arg.toList();
+    int oldGroupId = groups.value(0).toInt();
+    int updatedGroupId = groups.value(1).toInt();
+
+    if (!transaction || result->hasError())
+        return;
+
+    if (!result->boolValue()) {
+        qDebug() << Q_FUNC_INFO << "deleted empty group" << oldGroupId;
+        transaction->addSignal(false, this, "groupsDeleted",
+                               Q_ARG(QList<int>, QList<int>() << oldGroupId));
+    } else {
+        transaction->addSignal(false, this, "groupsUpdated",
+                               Q_ARG(QList<int>, QList<int>() << updatedGroupId));
+    }
+}
+
+void EventModelPrivate::deleteLookupFinished(CommHistory::PendingLookup *lookup)
+{
+    int id = pendingDeletes.take(lookup);
+
+    if (!lookup->isValid() || !doDeleteEvent(lookup->event())) {
+        qWarning() << Q_FUNC_INFO << "failed to delete event" << id;
+        Event event;
+        event.setId(id);
+        emit eventsCommitted(QList<Event>() << event, false);
+    }
+}
+
 void EventModelPrivate::eventsReceivedSlot(int start, int end, QList<Event> events)
 {
     qDebug() << __PRETTY_FUNCTION__ << ":" << start << end << events.count();
 
+    if (isStaleDelivery())
+        return;
+
+    QStringList mmsUris;
     QMutableListIterator<Event> i(events);
     while (i.hasNext()) {
         Event event = i.next();
@@ -369,17 +643,32 @@ void EventModelPrivate::eventsReceivedSlot(int start, int end, QList<Event> even
             contactCache.insert(qMakePair(event.localUid(), event.remoteUid()), event.contacts());
         }
 
-        if (event.type() == Event::MMSEvent && propertyMask.contains(Event::MessageParts)) {
-            messagePartsReady = false;
-            partQueryRunner->runMessagePartQuery(TrackerIOPrivate::prepareMessagePartQuery(event.url().toString()));
-        }
+        if (event.type() == Event::MMSEvent && propertyMask.contains(Event::MessageParts))
+            mmsUris.append(event.url().toString());
+    }
+
+    if (!queryContacts && !events.isEmpty())
+        resolveContacts(events);
+
+    // one part query per batch of messages instead of one per message
+    for (int batch = 0; batch < mmsUris.size(); batch += MAX_VARIABLES_IN_QUERY) {
+        messagePartsReady = false;
+        partQueryRunner->runMessagePartQuery(QueryTemplates::queryText(
+            TrackerIOPrivate::prepareMessagePartQuery(mmsUris.mid(batch, MAX_VARIABLES_IN_QUERY))));
     }
 
     if (!events.isEmpty()) {
         // now we have some content -> start tracking contacts if enabled
         startContactListening();
 
-        fillModel(start, end, events);
+        if (queryMode == EventModel::StreamedAdaptiveQuery) {
+            QTime insertTimer;
+            insertTimer.start();
+            fillModel(start, end, events);
+            queryRunner->reportInsertCost(events.count(), insertTimer.elapsed());
+        } else {
+            fillModel(start, end, events);
+        }
     }
 
     if (!messagePartsReady)
@@ -392,6 +681,9 @@ void EventModelPrivate::messagePartsReceivedSlot(int eventId,
     Q_Q(EventModel);
     qDebug() << __PRETTY_FUNCTION__ << ":" << eventId << parts.count();
 
+    if (isStalePartDelivery())
+        return;
+
     QModelIndex index = findEvent(eventId);
     if (index.isValid()) {
         EventTreeItem *item = static_cast<EventTreeItem *>(index.internalPointer());
@@ -409,6 +701,9 @@ void EventModelPrivate::modelUpdatedSlot(bool successful)
 {
     qDebug() << __PRETTY_FUNCTION__;
 
+    if (isStaleDelivery())
+        return;
+
     isReady = true;
     if (successful) {
         if (messagePartsReady)
@@ -422,6 +717,9 @@ void EventModelPrivate::partsUpdatedSlot(bool successful)
 {
     qDebug() << __PRETTY_FUNCTION__;
 
+    if (isStalePartDelivery())
+        return;
+
     messagePartsReady = true;
     if (successful) {
         if (isReady)
@@ -492,8 +790,30 @@ CommittingTransaction* EventModelPrivate::commitTransaction(const QList<Event> &
     return t;
 }
 
+bool EventModelPrivate::commitMarkAsRead(const QList<Event> &events,
+                                         const QList<int> &groupIds)
+{
+    CommittingTransaction *t = tracker()->commit();
+
+    if (t) {
+        if (!events.isEmpty())
+            t->addSignal(false, this, "eventsUpdated",
+                         Q_ARG(QList<CommHistory::Event>, events));
+        if (!groupIds.isEmpty())
+            t->addSignal(false, this, "groupsUpdated",
+                         Q_ARG(QList<int>, groupIds));
+        t->addSignal(false, this, "markedAsRead", Q_ARG(bool, true));
+        t->addSignal(true, this, "markedAsRead", Q_ARG(bool, false));
+    }
+
+    return t != 0;
+}
+
 void EventModelPrivate::canFetchMoreChangedSlot(bool canFetch)
 {
+    if (isStaleDelivery())
+        return;
+
     threadCanFetchMore = canFetch;
 }
 
@@ -669,6 +989,9 @@ TrackerIO* EventModelPrivate::tracker()
 bool EventModelPrivate::setContactFromCache(CommHistory::Event &event)
 {
     QList<Event::Contact> contacts = contactCache.value(qMakePair(event.localUid(), event.remoteUid()));
+    if (contacts.isEmpty() && sharedContacts)
+        sharedContacts->lookup(event.localUid(), event.remoteUid(), contacts);
+
     if (!contacts.isEmpty()) {
         event.setContacts(contacts);
         return true;
@@ -677,6 +1000,83 @@ bool EventModelPrivate::setContactFromCache(CommHistory::Event &event)
     return false;
 }
 
+Event::PropertySet EventModelPrivate::queryProperties() const
+{
+    if (queryContacts)
+        return propertyMask;
+
+    Event::PropertySet properties = propertyMask;
+    properties.remove(Event::Contacts);
+    properties.remove(Event::ContactId);
+    properties.remove(Event::ContactName);
+    return properties;
+}
+
+void EventModelPrivate::resolveContacts(QList<Event> &events)
+{
+    if (!sharedContacts) {
+        sharedContacts = ContactCache::instance();
+        connect(sharedContacts.data(),
+                SIGNAL(contactsResolved(const QList<QPair<QString,QString> >&)),
+                this,
+                SLOT(contactsResolvedSlot(const QList<QPair<QString,QString> >&)),
+                Qt::UniqueConnection);
+    }
+
+    QList<QPair<QString,QString> > unresolved;
+    QMutableListIterator<Event> i(events);
+    while (i.hasNext()) {
+        Event &event = i.next();
+        if (event.remoteUid().isEmpty())
+            continue;
+
+        QList<Event::Contact> contacts;
+        if (sharedContacts->lookup(event.localUid(), event.remoteUid(), contacts)) {
+            event.setContacts(contacts);
+            event.resetModifiedProperty(Event::Contacts);
+        } else {
+            unresolved.append(qMakePair(event.localUid(), event.remoteUid()));
+        }
+    }
+
+    // a single lookup for the whole chunk
+    sharedContacts->resolve(unresolved);
+}
+
+void EventModelPrivate::fillContactsRecursive(const QSet<QPair<QString,QString> > &addresses,
+                                              EventTreeItem *parent)
+{
+    Q_Q(EventModel);
+
+    for (int row = 0; row < parent->childCount(); row++) {
+        Event &event = parent->eventAt(row);
+        QPair<QString,QString> address(event.localUid(), event.remoteUid());
+        QList<Event::Contact> contacts;
+
+        if (addresses.contains(address)
+            && sharedContacts->lookup(address.first, address.second, contacts)
+            && contacts != event.contacts()) {
+            event.setContacts(contacts);
+            event.resetModifiedProperty(Event::Contacts);
+
+            QModelIndex left = q->createIndex(row, 0, parent->child(row));
+            QModelIndex right = q->createIndex(row, EventModel::NumberOfColumns - 1,
+                                               parent->child(row));
+            emit q->dataChanged(left, right);
+        }
+
+        if (parent->child(row)->childCount())
+            fillContactsRecursive(addresses, parent->child(row));
+    }
+}
+
+void EventModelPrivate::contactsResolvedSlot(const QList<QPair<QString,QString> > &addresses)
+{
+    qDebug() << Q_FUNC_INFO << addresses.size();
+
+    fillContactsRecursive(addresses.toSet(), eventRootItem);
+}
+
 void EventModelPrivate::startContactListening()
 {
     if (contactChangesEnabled && !contactListener) {
@@ -691,5 +1091,6 @@ void EventModelPrivate::startContactListening()
                 this,
                 SLOT(slotContactRemoved(quint32)),
                 Qt::UniqueConnection);
+        QueryCache::instance()->watchContacts(contactListener.data());
     }
 }
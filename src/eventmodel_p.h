@@ -24,6 +24,9 @@
 #define COMMHISTORY_EVENTMODEL_P_H
 
 #include <QList>
+#include <QHash>
+#include <QSet>
+#include <QDateTime>
 #include <QGenericArgument>
 
 #include "eventmodel.h"
@@ -33,11 +36,16 @@
 #include "trackerio.h"
 #include "libcommhistoryexport.h"
 
+class QSparqlQuery;
+class QSparqlResult;
+
 namespace CommHistory {
 
 class QueryRunner;
 class ContactListener;
+class ContactCache;
 class CommittingTransaction;
+class PendingLookup;
 class EventsQuery;
 class UpdatesEmitter;
 
@@ -99,6 +107,29 @@ public:
      */
     bool executeQuery(EventsQuery &query);
 
+    /*!
+     * Orders query newest first by sortProperty and tracker:id of the
+     * event and adds the seek constraint used by EventModel::fetchNextPage().
+     * executeQuery(EventsQuery&) then runs the first page with an open
+     * cursor and keeps the text for the next pages, which start after
+     * the last received event instead of skipping rows with OFFSET.
+     */
+    void addSeekOrder(EventsQuery &query, Event::Property sortProperty);
+
+    /*!
+     * Bind the position of the last received event to a query built
+     * with addSeekOrder(), or an open position before the first event.
+     */
+    void bindCursor(QSparqlQuery &query, bool first = false) const;
+
+    /*!
+     * Executes a ready query text returning the given event
+     * properties. Unlike executeQuery(EventsQuery&) queryLimit and
+     * queryOffset are not applied, they must be part of the text.
+     */
+    bool executeQuery(const QString &query,
+                      const QList<Event::Property> &properties);
+
     /*!
      * Add new events from the query results to the internal event
      * structure. You can reimplement this for non-trivial models, such
@@ -123,8 +154,38 @@ public:
     virtual void modifyInModel(Event &event);
     virtual void deleteFromModel(int id);
 
+    bool canAddEvent(const Event &event) const;
     virtual bool doAddEvent(Event &event);
-    virtual bool doDeleteEvent(int id, Event &event);
+
+    /*!
+     * Add events to the current transaction as one update request.
+     */
+    bool doAddEvents(QList<Event> &events);
+
+    /*!
+     * Follow the commit latency of an addEvents() batch of batchSize
+     * events to size the next batches, see addBatchFinished().
+     */
+    void trackAddBatch(CommittingTransaction *transaction, int batchSize);
+
+    /*!
+     * Delete event from the database in a new transaction. Its group is
+     * deleted in the same transaction if no events are left, see
+     * emptyGroupChecked().
+     */
+    bool doDeleteEvent(const Event &event);
+
+    /*!
+     * Move event to groupId in a new transaction, deleting the old group
+     * like doDeleteEvent().
+     */
+    bool doMoveEvent(Event event, int groupId);
+
+    /*!
+     * Commits the pending mark-as-read update and queues the completion
+     * signals. Events are the partial (id, isRead) updates for the model.
+     */
+    bool commitMarkAsRead(const QList<Event> &events, const QList<int> &groupIds);
 
     QModelIndex findEventRecursive(int id, EventTreeItem *parent) const;
 
@@ -153,7 +214,33 @@ public:
 
     TrackerIO *tracker();
     bool setContactFromCache(CommHistory::Event &event);
+
+    /*!
+     * Properties to query: propertyMask without the contacts when they
+     * are resolved through ContactCache.
+     */
+    Event::PropertySet queryProperties() const;
+
+    /*!
+     * Set the contacts of received events from ContactCache, and start
+     * one lookup for the addresses not cached yet.
+     */
+    void resolveContacts(QList<CommHistory::Event> &events);
+
+    void fillContactsRecursive(const QSet<QPair<QString,QString> > &addresses,
+                               EventTreeItem *parent);
     void startContactListening();
+    bool isStreamed() const;
+    void setupStreaming();
+
+    /*!
+     * Cancel running and queued queries before starting a new one. Rows
+     * of the old queries that are still on their way are dropped by the
+     * slots, see isStaleDelivery().
+     */
+    virtual void supersedeQueries();
+    bool isStaleDelivery() const;
+    bool isStalePartDelivery() const;
 
     // This is the root node for the internal event tree. In a standard
     // flat model, eventRootNode has rowCount() children with events.
@@ -165,16 +252,43 @@ public:
     EventModel::QueryMode queryMode;
     uint chunkSize;
     uint firstChunkSize;
+    int decodeThreads;
+    int chunkLatencyTarget;
     int queryLimit;
     int queryOffset;
+
+    // keyset paging, see addSeekOrder(): sort key and tracker:id of the
+    // last received event, and rows received by the last page query
+    Event::Property cursorProperty;
+    QDateTime cursorTime;
+    int cursorTrackerId;
+    int pageRows;
+    bool seekQuery;
+    QString pageQuery;
+    QList<Event::Property> pageProperties;
+
     bool isReady;
     bool messagePartsReady;
     bool threadCanFetchMore;
     bool syncOnCommit;
     bool contactChangesEnabled;
+    bool queryContacts;
+
+    // events per addEvents() transaction, adapted to commit latency
+    int addBatchSize;
+    QHash<CommittingTransaction *, int> addBatches;
+
+    // deleteEvent() waiting for lookups
+    QHash<PendingLookup *, int> pendingDeletes;
 
     QueryRunner *queryRunner;
     QueryRunner *partQueryRunner;
+    // query tokens: deliveries are accepted once the runner has started
+    // the first query issued after the last supersedeQueries()
+    int firstValidQuery;
+    int activeQuery;
+    int firstValidPartQuery;
+    int activePartQuery;
 
     Event::PropertySet propertyMask;
 
@@ -183,6 +297,9 @@ public:
     // (local id, remote id) -> (contact id, name)
     QMap<QPair<QString,QString>, QList<Event::Contact> > contactCache;
 
+    // contacts resolved outside the queries, see queryContacts
+    QSharedPointer<ContactCache> sharedContacts;
+
     QThread *bgThread;
 
     TrackerIO *m_pTracker;
@@ -205,12 +322,27 @@ public Q_SLOTS:
 
     void canFetchMoreChangedSlot(bool canFetch);
 
+    void queryStartedSlot(int token);
+    void partQueryStartedSlot(int token);
+
+    void cursorReceivedSlot(QList<CommHistory::Event> events, QVariantList extra);
+
+    void addBatchFinished();
+
+    void deleteLookupFinished(CommHistory::PendingLookup *lookup);
+    // queue groupsDeleted or groupsUpdated after deleteGroupIfEmpty()
+    void emptyGroupChecked(CommittingTransaction *transaction,
+                           QSparqlResult *result,
+                           QVariant arg);
+
     void slotContactUpdated(quint32 localId,
                             const QString &contactName,
                             const QList< QPair<QString,QString> > &contactAddresses);
 
     void slotContactRemoved(quint32 localId);
 
+    void contactsResolvedSlot(const QList<QPair<QString,QString> > &addresses);
+
 Q_SIGNALS:
     void eventsAdded(const QList<CommHistory::Event> &events);
 
@@ -225,6 +357,7 @@ Q_SIGNALS:
 
     void modelReady(bool successful);
     void eventsCommitted(const QList<CommHistory::Event> &events, bool successful);
+    void markedAsRead(bool successful);
 };
 
 }
@@ -22,11 +22,14 @@
 
 #include <QtDBus/QtDBus>
 #include <QDebug>
+#include <QTime>
 
 #include "commonutils.h"
 #include "trackerio.h"
 #include "trackerio_p.h"
 #include "queryrunner.h"
+#include "querycache.h"
+#include "querytemplates.h"
 #include "groupmodel.h"
 #include "groupmodel_p.h"
 #include "eventmodel.h"
@@ -35,7 +38,9 @@
 #include "event.h"
 #include "constants.h"
 #include "committingtransaction.h"
+#include "pendinglookup.h"
 #include "contactlistener.h"
+#include "contactcache.h"
 
 namespace {
 
@@ -44,7 +49,6 @@ bool groupLessThan(CommHistory::Group &a, CommHistory::Group &b)
     return a.endTime() > b.endTime(); // descending order
 }
 
-static const int defaultChunkSize = 50;
 
 static const int maxAddGroupsSize = 25;
 }
@@ -54,18 +58,24 @@ using namespace CommHistory;
 GroupModelPrivate::GroupModelPrivate(GroupModel *model)
         : q_ptr(model)
         , queryMode(EventModel::AsyncQuery)
-        , chunkSize(defaultChunkSize)
+        , chunkSize(DEFAULT_CHUNK_SIZE)
         , firstChunkSize(0)
+        , chunkLatencyTarget(DEFAULT_CHUNK_LATENCY)
         , queryLimit(0)
         , queryOffset(0)
+        , pageRows(0)
+        , cursorGroupId(-1)
         , isReady(true)
         , filterLocalUid(QString())
         , filterRemoteUid(QString())
         , queryRunner(0)
+        , firstValidQuery(0)
+        , activeQuery(0)
         , threadCanFetchMore(false)
         , bgThread(0)
         , m_pTracker(0)
         , contactChangesEnabled(true)
+        , queryContacts(true)
 {
     qRegisterMetaType<QList<CommHistory::Event> >();
     qRegisterMetaType<QList<CommHistory::Group> >();
@@ -130,6 +140,8 @@ void GroupModelPrivate::resetQueryRunner()
     deleteQueryRunner();
 
     queryRunner = new QueryRunner(tracker());
+    queryRunner->setQueryCache(QueryCache::instance());
+    firstValidQuery = activeQuery = 0;
 
     connect(queryRunner,
             SIGNAL(groupsReceived(int, int, QList<CommHistory::Group>)),
@@ -143,6 +155,14 @@ void GroupModelPrivate::resetQueryRunner()
             SIGNAL(modelUpdated(bool)),
             this,
             SLOT(modelUpdatedSlot(bool)));
+    connect(queryRunner,
+            SIGNAL(queryStarted(int)),
+            this,
+            SLOT(queryStartedSlot(int)));
+    connect(queryRunner,
+            SIGNAL(chunkSizeAdapted(int)),
+            q_ptr,
+            SIGNAL(chunkSizeAdapted(int)));
 
     if (bgThread) {
         qDebug() << Q_FUNC_INFO << "MOVE" << queryRunner;
@@ -201,16 +221,17 @@ void GroupModelPrivate::modifyInModel(Group &group, bool query)
     for (int row = 0; row < groups.count(); row++) {
         Group g = groups.at(row);
         if (g.id() == id) {
-            Group newGroup;
             if (query) {
-                if (!tracker()->getGroup(id, newGroup)) {
-                    return;
-                }
-            } else {
-                g.copyValidProperties(group);
-                newGroup = g;
+                // refetch without blocking, see groupLookupFinished()
+                PendingLookup *lookup = tracker()->getGroupAsync(id);
+                connect(lookup, SIGNAL(finished(CommHistory::PendingLookup*)),
+                        this, SLOT(groupLookupFinished(CommHistory::PendingLookup*)));
+                return;
             }
 
+            g.copyValidProperties(group);
+            Group newGroup = g;
+
             // preserve contact info if necessary
             if (!newGroup.validProperties().contains(Group::Contacts)
                 && g.validProperties().contains(Group::Contacts)) {
@@ -237,6 +258,15 @@ void GroupModelPrivate::modifyInModel(Group &group, bool query)
     }
 }
 
+void GroupModelPrivate::groupLookupFinished(CommHistory::PendingLookup *lookup)
+{
+    if (!lookup->isValid())
+        return;
+
+    Group group = lookup->group();
+    modifyInModel(group, false);
+}
+
 void GroupModelPrivate::groupsReceivedSlot(int start,
                                            int end,
                                            QList<CommHistory::Group> result)
@@ -247,11 +277,29 @@ void GroupModelPrivate::groupsReceivedSlot(int start,
     Q_Q(GroupModel);
     qDebug() << __PRETTY_FUNCTION__ << ": read" << result.count() << "groups";
 
+    if (isStaleDelivery())
+        return;
+
     if (result.count()) {
+        if (!queryContacts)
+            resolveContacts(result);
+
+        // rows in the model move as messages arrive, the cursor follows
+        // the query results only
+        pageRows += result.count();
+        cursorDate = result.last().endTime();
+        cursorGroupId = result.last().id();
+
+        QTime insertTimer;
+        insertTimer.start();
+
         q->beginInsertRows(QModelIndex(), q->rowCount(),
                            q->rowCount() + result.count() - 1);
         groups.append(result);
         q->endInsertRows();
+
+        if (queryMode == EventModel::StreamedAdaptiveQuery)
+            queryRunner->reportInsertCost(result.count(), insertTimer.elapsed());
     }
 }
 
@@ -259,22 +307,46 @@ void GroupModelPrivate::modelUpdatedSlot(bool successful)
 {
     Q_Q(GroupModel);
 
+    if (isStaleDelivery())
+        return;
+
     isReady = true;
     emit q->modelReady(successful);
 }
 
-void GroupModelPrivate::executeQuery(const QString query)
+void GroupModelPrivate::supersedeQueries()
+{
+    firstValidQuery = queryRunner->cancelQueries();
+    threadCanFetchMore = false;
+}
+
+bool GroupModelPrivate::isStaleDelivery() const
+{
+    return activeQuery < firstValidQuery;
+}
+
+void GroupModelPrivate::queryStartedSlot(int token)
+{
+    activeQuery = token;
+}
+
+void GroupModelPrivate::executeQuery(const QString query, bool nextPage)
 {
+    supersedeQueries();
     isReady = false;
+    pageRows = 0;
+    if (!nextPage)
+        cursorGroupId = -1;
     QString finalQuery(query);
-    if (queryMode == EventModel::StreamedAsyncQuery) {
-        queryRunner->setStreamedMode(true);
-        queryRunner->setChunkSize(chunkSize);
-        queryRunner->setFirstChunkSize(firstChunkSize);
+    if (queryMode == EventModel::StreamedAsyncQuery
+        || queryMode == EventModel::StreamedAdaptiveQuery) {
+        queryRunner->setupStreaming(chunkSize, firstChunkSize,
+                                    queryMode == EventModel::StreamedAdaptiveQuery,
+                                    chunkLatencyTarget);
     } else {
         if (queryLimit)
             finalQuery.append(QLatin1String(" LIMIT ") + QString::number(queryLimit));
-        if (queryOffset)
+        if (queryOffset && !nextPage)
             finalQuery.append(QLatin1String(" OFFSET ") + QString::number(queryOffset));
     }
     qDebug() << Q_FUNC_INFO << this << queryRunner;
@@ -477,6 +549,9 @@ void GroupModelPrivate::groupsDeletedSlot(const QList<int> &groupIds)
 
 void GroupModelPrivate::canFetchMoreChangedSlot(bool canFetch)
 {
+    if (isStaleDelivery())
+        return;
+
     threadCanFetchMore = canFetch;
 }
 
@@ -603,6 +678,84 @@ void GroupModelPrivate::slotContactSettingsChanged(const QHash<QString, QVariant
         q->getGroups(filterLocalUid, filterRemoteUid);
 }
 
+void GroupModelPrivate::resolveContacts(QList<Group> &result)
+{
+    if (!sharedContacts) {
+        sharedContacts = ContactCache::instance();
+        connect(sharedContacts.data(),
+                SIGNAL(contactsResolved(const QList<QPair<QString,QString> >&)),
+                this,
+                SLOT(contactsResolvedSlot(const QList<QPair<QString,QString> >&)),
+                Qt::UniqueConnection);
+    }
+
+    QList<QPair<QString,QString> > unresolved;
+    QMutableListIterator<Group> i(result);
+    while (i.hasNext()) {
+        Group &group = i.next();
+        if (group.remoteUids().isEmpty())
+            continue;
+
+        QList<Event::Contact> contacts;
+        lookupContacts(group, contacts, unresolved);
+        if (!contacts.isEmpty())
+            group.setContacts(contacts);
+    }
+
+    // a single lookup for the whole chunk
+    sharedContacts->resolve(unresolved);
+}
+
+void GroupModelPrivate::lookupContacts(const Group &group,
+                                       QList<Event::Contact> &contacts,
+                                       QList<QPair<QString,QString> > &unresolved)
+{
+    foreach (const QString &remoteUid, group.remoteUids()) {
+        QList<Event::Contact> found;
+        if (!sharedContacts->lookup(group.localUid(), remoteUid, found)) {
+            unresolved.append(qMakePair(group.localUid(), remoteUid));
+            continue;
+        }
+
+        foreach (const Event::Contact &contact, found) {
+            if (!contacts.contains(contact))
+                contacts.append(contact);
+        }
+    }
+}
+
+void GroupModelPrivate::contactsResolvedSlot(const QList<QPair<QString,QString> > &addresses)
+{
+    Q_Q(GroupModel);
+
+    QSet<QPair<QString,QString> > resolved = addresses.toSet();
+    for (int row = 0; row < groups.count(); row++) {
+        Group &group = groups[row];
+        if (group.remoteUids().isEmpty())
+            continue;
+
+        bool participantResolved = false;
+        foreach (const QString &remoteUid, group.remoteUids()) {
+            if (resolved.contains(qMakePair(group.localUid(), remoteUid))) {
+                participantResolved = true;
+                break;
+            }
+        }
+        if (!participantResolved)
+            continue;
+
+        // the others may be resolved already or still pending
+        QList<Event::Contact> contacts;
+        QList<QPair<QString,QString> > pending;
+        lookupContacts(group, contacts, pending);
+        if (contacts != group.contacts()) {
+            group.setContacts(contacts);
+            emit q->dataChanged(q->index(row, GroupModel::Contacts),
+                                q->index(row, GroupModel::Contacts));
+        }
+    }
+}
+
 void GroupModelPrivate::startContactListening()
 {
     if (contactChangesEnabled && !contactListener) {
@@ -620,6 +773,7 @@ void GroupModelPrivate::startContactListening()
                 SIGNAL(contactSettingsChanged(const QHash<QString, QVariant> &)),
                 this,
                 SLOT(slotContactSettingsChanged(const QHash<QString, QVariant> &)));
+        QueryCache::instance()->watchContacts(contactListener.data());
     }
 }
 
@@ -671,6 +825,11 @@ void GroupModel::setFirstChunkSize(uint size)
     d->firstChunkSize = size;
 }
 
+void GroupModel::setChunkLatencyTarget(int msecs)
+{
+    d->chunkLatencyTarget = msecs;
+}
+
 void GroupModel::setLimit(int limit)
 {
     d->queryLimit = limit;
@@ -964,8 +1123,38 @@ bool GroupModel::getGroups(const QString &localUid,
 
     d->startContactListening();
 
-    QSparqlQuery query(TrackerIOPrivate::prepareGroupQuery(localUid, remoteUid));
-    d->executeQuery(query.preparedQueryText());
+    QSparqlQuery query(TrackerIOPrivate::prepareGroupQuery(localUid, remoteUid, -1,
+                                                           d->queryContacts));
+    d->executeQuery(QueryTemplates::queryText(query));
+
+    return true;
+}
+
+bool GroupModel::hasNextPage() const
+{
+    return d->isReady
+        && d->queryMode != EventModel::StreamedAsyncQuery
+        && d->queryMode != EventModel::StreamedAdaptiveQuery
+        && d->queryLimit > 0
+        && d->cursorGroupId != -1
+        && d->pageRows >= d->queryLimit;
+}
+
+bool GroupModel::fetchNextPage()
+{
+    if (!hasNextPage())
+        return false;
+
+    // groups without messages are stored with time 0, see QueryResult
+    QDateTime lastDate = d->cursorDate.isValid() ? d->cursorDate
+                                                 : QDateTime::fromTime_t(0);
+    QSparqlQuery query(TrackerIOPrivate::prepareGroupQuery(d->filterLocalUid,
+                                                           d->filterRemoteUid,
+                                                           -1,
+                                                           d->queryContacts,
+                                                           d->cursorGroupId,
+                                                           lastDate));
+    d->executeQuery(QueryTemplates::queryText(query), true);
 
     return true;
 }
@@ -1081,6 +1270,11 @@ uint GroupModel::firstChunkSize() const
     return d->firstChunkSize;
 }
 
+int GroupModel::chunkLatencyTarget() const
+{
+    return d->chunkLatencyTarget;
+}
+
 int GroupModel::limit() const
 {
     return d->queryLimit;
@@ -1114,3 +1308,13 @@ void GroupModel::enableContactChanges(bool enabled)
 {
     d->contactChangesEnabled = enabled;
 }
+
+void GroupModel::setQueryContacts(bool enabled)
+{
+    d->queryContacts = enabled;
+}
+
+bool GroupModel::queryContacts() const
+{
+    return d->queryContacts;
+}
@@ -113,6 +113,14 @@ public:
      */
     void setFirstChunkSize(uint size);
 
+    /*!
+     * Set the time processing one chunk should take in
+     * StreamedAdaptiveQuery mode. See EventModel::setChunkLatencyTarget().
+     *
+     * \param msecs Latency target in milliseconds, default 50.
+     */
+    void setChunkLatencyTarget(int msecs);
+
     /*!
      * Set number of groups to fetch in the next query.
      *
@@ -175,6 +183,22 @@ public:
     bool getGroups(const QString &localUid = QString(),
                    const QString &remoteUid = QString());
 
+    /*!
+     * With a limit set and a non-streamed query mode, returns true if
+     * the model is ready and the last page of groups was full.
+     */
+    bool hasNextPage() const;
+
+    /*!
+     * Appends the next limit() groups after the last one received by
+     * the previous page, with the filters of getGroups(). The query seeks past the last
+     * message date and tracker id of that group instead of using an
+     * offset, see EventModel::fetchNextPage().
+     *
+     * \return true if the query was started
+     */
+    bool fetchNextPage();
+
     /*!
      * Delete groups from database.
      *
@@ -212,6 +236,7 @@ public:
     EventModel::QueryMode queryMode() const;
     uint chunkSize() const;
     uint firstChunkSize() const;
+    int chunkLatencyTarget() const;
     int limit() const;
     int offset() const;
 
@@ -246,6 +271,17 @@ public:
      */
     void enableContactChanges(bool enabled);
 
+    /*!
+     * If disabled, contacts are left out of the group query and
+     * resolved with one lookup per received chunk, see
+     * EventModel::setQueryContacts(). Enabled by default.
+     * NOTE: This method must be called before getGroups().
+     *
+     * \param enabled If true, query contacts together with the groups.
+     */
+    void setQueryContacts(bool enabled);
+    bool queryContacts() const;
+
     /* reimp */
     virtual bool canFetchMore(const QModelIndex &parent) const;
     virtual void fetchMore(const QModelIndex &parent);
@@ -272,6 +308,14 @@ Q_SIGNALS:
      */
     void groupsCommitted(const QList<int> &groupIds, bool successful);
 
+    /*!
+     * Debug signal, emitted in StreamedAdaptiveQuery mode when the size
+     * of the next chunk has been chosen.
+     *
+     * \param size number of groups in the next chunk
+     */
+    void chunkSizeAdapted(int size);
+
 private:
     friend class GroupModelPrivate;
     GroupModelPrivate *d;
@@ -36,7 +36,9 @@ namespace CommHistory {
 class QueryRunner;
 class TrackerIO;
 class ContactListener;
+class ContactCache;
 class CommittingTransaction;
+class PendingLookup;
 class UpdatesEmitter;
 
 class GroupModelPrivate: public QObject
@@ -59,11 +61,23 @@ public:
     QString newObjectPath();
 
     void addToModel(Group &group);
+    /*!
+     * Update group in the model. With query the group is fetched
+     * from tracker first, asynchronously.
+     */
     void modifyInModel(Group &group, bool query = true);
 
     bool canFetchMore() const;
 
-    void executeQuery(const QString query);
+    /*!
+     * Run a group query. The limit is applied to every query, the
+     * offset only when not continuing with the next page.
+     */
+    void executeQuery(const QString query, bool nextPage = false);
+
+    // see EventModelPrivate::supersedeQueries()
+    void supersedeQueries();
+    bool isStaleDelivery() const;
 
     CommittingTransaction* commitTransaction(QList<int> groupIds);
 
@@ -73,6 +87,20 @@ public:
     TrackerIO* tracker();
     void startContactListening();
 
+    /*!
+     * Set the contacts of all participants of received groups from
+     * ContactCache, and start one lookup for the addresses not cached yet.
+     */
+    void resolveContacts(QList<CommHistory::Group> &result);
+
+    /*!
+     * Collect the cached contacts of all participants of group, and the
+     * addresses not cached yet in unresolved.
+     */
+    void lookupContacts(const Group &group,
+                        QList<Event::Contact> &contacts,
+                        QList<QPair<QString,QString> > &unresolved);
+
 public Q_SLOTS:
     void eventsAddedSlot(const QList<CommHistory::Event> &events);
 
@@ -85,10 +113,14 @@ public Q_SLOTS:
 
     void groupsReceivedSlot(int start, int end, QList<CommHistory::Group> result);
 
+    void groupLookupFinished(CommHistory::PendingLookup *lookup);
+
     void modelUpdatedSlot(bool successful);
 
     void canFetchMoreChangedSlot(bool canFetch);
 
+    void queryStartedSlot(int token);
+
     void slotContactUpdated(quint32 localId,
                             const QString &contactName,
                             const QList< QPair<QString,QString> > &contactAddresses);
@@ -97,6 +129,8 @@ public Q_SLOTS:
 
     void slotContactSettingsChanged(const QHash<QString, QVariant> &changedSettings);
 
+    void contactsResolvedSlot(const QList<QPair<QString,QString> > &addresses);
+
 Q_SIGNALS:
     void groupsAdded(const QList<CommHistory::Group> &groups);
 
@@ -109,8 +143,14 @@ public:
     EventModel::QueryMode queryMode;
     uint chunkSize;
     uint firstChunkSize;
+    int chunkLatencyTarget;
     int queryLimit;
     int queryOffset;
+    // groups received by the last query and the last message date and
+    // id of the last one, see GroupModel::fetchNextPage()
+    int pageRows;
+    QDateTime cursorDate;
+    int cursorGroupId;
     bool isReady;
     QList<Group> groups;
 
@@ -118,6 +158,8 @@ public:
     QString filterRemoteUid;
 
     QueryRunner *queryRunner;
+    int firstValidQuery;
+    int activeQuery;
     bool threadCanFetchMore;
 
     QThread *bgThread;
@@ -126,6 +168,8 @@ public:
 
     QSharedPointer<ContactListener> contactListener;
     bool contactChangesEnabled;
+    bool queryContacts;
+    QSharedPointer<ContactCache> sharedContacts;
     QSharedPointer<UpdatesEmitter> emitter;
 };
 
@@ -22,6 +22,9 @@
 
 #include <QDir>
 #include <QDebug>
+#include <QMutexLocker>
+
+#include <cstddef>
 
 #include "idsource.h"
 
@@ -31,16 +34,36 @@
 using namespace CommHistory;
 
 static const int BASKET_SIZE = 5; //bits
-static const int BASKET_FULL = 0x1F;
+// blocks reserved quicker than this grow, slower ones start over small
+static const int BLOCK_GROW_MSECS = 1000;
 
 namespace CommHistory {
 struct IdSourceData {
     int lastEventId;
     int lastGroupId;
     int users;
+    // lastEventId and lastGroupId are above all ids in tracker
+    int valid;
+    // of the fields above, checked when loaded from the file
+    int checksum;
 };
 }
 
+namespace {
+int idsChecksum(const IdSourceData *data)
+{
+    return qChecksum(reinterpret_cast<const char*>(data),
+                     offsetof(IdSourceData, checksum));
+}
+}
+
+IdSource::IdBlock::IdBlock() :
+    next(0),
+    end(0),
+    size(MinBlockSize)
+{
+}
+
 IdSource::IdSource(QObject *parent) :
     QObject(parent),
     m_File(QDir::homePath()
@@ -51,7 +74,10 @@ IdSource::IdSource(QObject *parent) :
 IdSource::~IdSource()
 {
     if (m_IdSource.isAttached()) {
+        QMutexLocker locker(&m_BlockMutex);
         IdSourceData *ids = lockSharedData();
+        releaseBlock(m_EventBlock, &IdSourceData::lastEventId, ids);
+        releaseBlock(m_GroupBlock, &IdSourceData::lastGroupId, ids);
         ids->users--;
         save(ids);
         m_IdSource.unlock();
@@ -72,56 +98,120 @@ int IdSource::skipToNextBasket(int currentId)
     return ((currentId >> BASKET_SIZE) + 1)<< BASKET_SIZE;
 }
 
-bool IdSource::newBasket(int currentId) const
+int IdSource::takeId(IdBlock &block, int IdSourceData::*lastId)
 {
-    return !(currentId & BASKET_FULL);
+    forever {
+        int id = block.next;
+        if (id < block.end) {
+            if (block.next.testAndSetOrdered(id, id + 1))
+                return id;
+        } else {
+            QMutexLocker locker(&m_BlockMutex);
+            // another thread may have reserved a block meanwhile
+            if (block.next >= block.end) {
+                if (!openSharedMemory())
+                    return 0;
+                reserveBlock(block, lastId);
+            }
+        }
+    }
 }
 
-int IdSource::nextEventId()
+void IdSource::reserveBlock(IdBlock &block, int IdSourceData::*lastId)
 {
-    int nextId = 0;
+    if (block.lastReserved.isValid()
+        && block.lastReserved.elapsed() < BLOCK_GROW_MSECS)
+        block.size = qMin(block.size * 2, (int)MaxBlockSize);
+    else
+        block.size = MinBlockSize;
+    block.lastReserved.start();
 
-    if (openSharedMemory()) {
-        IdSourceData *ids = lockSharedData();
-        nextId = ++ids->lastEventId;
-        if (newBasket(ids->lastEventId))
-            save(ids);
-        m_IdSource.unlock();
-    }
+    // saved before any id of the block is used, so the block is
+    // skipped after a crash
+    IdSourceData *ids = lockSharedData();
+    int first = ids->*lastId + 1;
+    ids->*lastId += block.size;
+    save(ids);
+    m_IdSource.unlock();
+
+    // next before end: a racing takeId() may see the new next with the
+    // old end and retry, but never an old id with the new end
+    block.next.fetchAndStoreOrdered(first);
+    block.end.fetchAndStoreOrdered(first + block.size);
+}
+
+void IdSource::releaseBlock(IdBlock &block,
+                            int IdSourceData::*lastId,
+                            IdSourceData *data)
+{
+    // give back the unused ids if no one reserved after us
+    int next = block.next;
+    if (next < block.end && data->*lastId == block.end - 1)
+        data->*lastId = next - 1;
+    resetBlock(block);
+}
+
+void IdSource::resetBlock(IdBlock &block)
+{
+    block.end.fetchAndStoreOrdered(0);
+    block.next.fetchAndStoreOrdered(0);
+    block.size = MinBlockSize;
+    block.lastReserved = QTime();
+}
 
-    return nextId;
+int IdSource::nextEventId()
+{
+    return takeId(m_EventBlock, &IdSourceData::lastEventId);
 }
 
 int IdSource::nextGroupId()
 {
-    int nextId = 0;
+    return takeId(m_GroupBlock, &IdSourceData::lastGroupId);
+}
 
+void IdSource::setNextEventId(int eventId)
+{
     if (openSharedMemory()) {
+        QMutexLocker locker(&m_BlockMutex);
+        resetBlock(m_EventBlock);
+
         IdSourceData *ids = lockSharedData();
-        nextId = ++ids->lastGroupId;
-        if (newBasket(ids->lastGroupId))
-            save(ids);
+        // never hand out ids other processes still have reserved
+        ids->lastEventId = ids->users > 1 ? qMax(ids->lastEventId, eventId)
+                                          : eventId;
+        ids->valid = 1;
+        save(ids);
         m_IdSource.unlock();
     }
-
-    return nextId;
 }
 
-void IdSource::setNextEventId(int eventId)
+bool IdSource::lastIds(int &lastEventId, int &lastGroupId)
 {
+    bool valid = false;
+
     if (openSharedMemory()) {
         IdSourceData *ids = lockSharedData();
-        ids->lastEventId = eventId;
-        save(ids);
+        if (ids->valid) {
+            lastEventId = ids->lastEventId;
+            lastGroupId = ids->lastGroupId;
+            valid = true;
+        }
         m_IdSource.unlock();
     }
+
+    return valid;
 }
 
 void IdSource::setNextGroupId(int groupId)
 {
     if (openSharedMemory()) {
+        QMutexLocker locker(&m_BlockMutex);
+        resetBlock(m_GroupBlock);
+
         IdSourceData *ids = lockSharedData();
-        ids->lastGroupId = groupId;
+        ids->lastGroupId = ids->users > 1 ? qMax(ids->lastGroupId, groupId)
+                                          : groupId;
+        ids->valid = 1;
         save(ids);
         m_IdSource.unlock();
     }
@@ -133,6 +223,13 @@ bool IdSource::openSharedMemory()
         m_IdSource.setKey(QLatin1String("CommHistoryIdSource"));
 
         if (m_IdSource.attach()) {
+            if (m_IdSource.size() < (int)sizeof(IdSourceData)) {
+                qCritical() << Q_FUNC_INFO
+                        << "Shared mem created by an older version";
+                m_IdSource.detach();
+                return false;
+            }
+
             IdSourceData *ids = lockSharedData();
             ids->users++;
             m_IdSource.unlock();
@@ -145,14 +242,17 @@ bool IdSource::openSharedMemory()
                 return false;
             }
 
-            if (m_IdSource.create(sizeof(IdSource))) {
+            if (m_IdSource.create(sizeof(IdSourceData))) {
                 IdSourceData *ids = lockSharedData();
 
                 ids->lastEventId = 0;
                 ids->lastGroupId = 0;
                 ids->users = 0;
+                ids->valid = 0;
 
-                load(ids);
+                // ids of a corrupted file may be used already
+                if (!load(ids))
+                    ids->valid = 0;
 
                 if (ids->users != 0) {
                     qWarning() << "Skip ids after crash";
@@ -180,19 +280,29 @@ bool IdSource::openSharedMemory()
     return true;
 }
 
-void IdSource::load(IdSourceData *data)
+bool IdSource::load(IdSourceData *data)
 {
+    bool ok = false;
+
     if (m_File.open(QIODevice::ReadOnly)) {
         int read = m_File.read(reinterpret_cast<char*>(data),
                                sizeof(IdSourceData));
         if (read != sizeof(IdSourceData))
             qWarning() << "Failed read from "<< m_File.fileName();
+        else if (data->checksum != idsChecksum(data))
+            qWarning() << "Invalid checksum in" << m_File.fileName();
+        else
+            ok = true;
         m_File.close();
     } // it fails for the very first time when the file does not exist
+
+    return ok;
 }
 
 void IdSource::save(IdSourceData *data)
 {
+    data->checksum = idsChecksum(data);
+
     if (m_File.open(QIODevice::WriteOnly)) {
         int written = m_File.write(reinterpret_cast<char*>(data),
                                    sizeof(IdSourceData));
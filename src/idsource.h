@@ -26,16 +26,32 @@
 #include <QObject>
 #include <QSharedMemory>
 #include <QFile>
+#include <QAtomicInt>
+#include <QMutex>
+#include <QTime>
 
 namespace CommHistory {
 
 struct IdSourceData;
 
+/*!
+ * \class IdSource
+ *
+ * Allocates event and group ids unique across processes. The last
+ * reserved ids are kept in shared memory and in ~/.commhistoryd/ids.dat.
+ * Each process reserves a block of ids at a time and hands them out
+ * without taking the shared memory lock; the block grows while ids are
+ * consumed quickly (bulk imports) and shrinks back when idle. Unused
+ * ids of a process that crashed are skipped.
+ */
 class IdSource : public QObject
 {
     Q_OBJECT
 
 public:
+    static const int MinBlockSize = 32;
+    static const int MaxBlockSize = 4096;
+
     explicit IdSource(QObject *parent = 0);
     ~IdSource();
 
@@ -45,17 +61,42 @@ public:
     void setNextEventId(int eventId);
     void setNextGroupId(int groupId);
 
+    /*!
+     * Get the last reserved ids. They are saved before any of them is
+     * used, so they are at least as high as the ids in tracker.
+     *
+     * \return false if the ids file was missing or corrupted and the ids
+     *         have not been set since
+     */
+    bool lastIds(int &lastEventId, int &lastGroupId);
+
 private:
+    struct IdBlock {
+        IdBlock();
+        // next free id and the end of the reserved range
+        QAtomicInt next;
+        QAtomicInt end;
+        int size;
+        QTime lastReserved;
+    };
+
+    int takeId(IdBlock &block, int IdSourceData::*lastId);
+    void reserveBlock(IdBlock &block, int IdSourceData::*lastId);
+    void releaseBlock(IdBlock &block, int IdSourceData::*lastId, IdSourceData *data);
+    void resetBlock(IdBlock &block);
+
     bool openSharedMemory();
     void save(IdSourceData *data);
-    void load(IdSourceData *data);
+    bool load(IdSourceData *data);
     IdSourceData* lockSharedData();
     int skipToNextBasket(int currentId);
-    bool newBasket(int currentId) const;
 
 private:
     QSharedMemory m_IdSource;
     QFile m_File;
+    QMutex m_BlockMutex;
+    IdBlock m_EventBlock;
+    IdBlock m_GroupBlock;
 };
 
 } // namespace
@@ -0,0 +1,72 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** Contact: Reto Zingg <reto.zingg@nokia.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include <QCache>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include "knownresources.h"
+
+using namespace CommHistory;
+
+namespace {
+    QMutex resourceMutex;
+    QCache<QString, bool> resources(KnownResources::MaxResources);
+    int resourceGeneration = 0;
+}
+
+bool KnownResources::contains(const QString &uri)
+{
+    QMutexLocker lock(&resourceMutex);
+    // object() instead of contains() to refresh the LRU order
+    return resources.object(uri) != 0;
+}
+
+int KnownResources::generation()
+{
+    QMutexLocker lock(&resourceMutex);
+    return resourceGeneration;
+}
+
+void KnownResources::insert(const QStringList &uris, int generation)
+{
+    QMutexLocker lock(&resourceMutex);
+
+    if (generation != resourceGeneration)
+        return;
+
+    foreach (const QString &uri, uris)
+        resources.insert(uri, new bool(true));
+}
+
+void KnownResources::clear()
+{
+    QMutexLocker lock(&resourceMutex);
+    resources.clear();
+    resourceGeneration++;
+}
+
+int KnownResources::size()
+{
+    QMutexLocker lock(&resourceMutex);
+    return resources.size();
+}
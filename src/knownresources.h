@@ -0,0 +1,83 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** Contact: Reto Zingg <reto.zingg@nokia.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#ifndef COMMHISTORY_KNOWNRESOURCES_H
+#define COMMHISTORY_KNOWNRESOURCES_H
+
+#include <QString>
+#include <QStringList>
+
+namespace CommHistory {
+
+/*!
+ * \class KnownResources
+ *
+ * Process-wide, bounded set of contact medium resources (IM addresses
+ * and phone numbers) known to exist in tracker. TrackerIO skips the
+ * INSERT SILENT statements for these. Resources are added only after
+ * the transaction or query that created them has been stored
+ * successfully. TrackerIO clears the set when groups are deleted, also
+ * by other processes as told by the groupsDeleted D-Bus signal, and on
+ * delete-all.
+ *
+ * Every clear() starts a new generation; additions recorded in an
+ * older generation are dropped, so a transaction that was queued
+ * before a delete-all cannot bring back stale entries.
+ *
+ * Thread safe.
+ */
+class KnownResources
+{
+public:
+    /*!
+     * Maximum number of resources kept, least recently used ones are
+     * dropped first.
+     */
+    static const int MaxResources = 1000;
+
+    /*!
+     * \return true if the resource is known to exist.
+     */
+    static bool contains(const QString &uri);
+
+    /*!
+     * \return Current generation, to be passed to insert().
+     */
+    static int generation();
+
+    /*!
+     * Add resources created by a committed transaction. Ignored if the
+     * cache has been cleared after generation was obtained.
+     */
+    static void insert(const QStringList &uris, int generation);
+
+    /*!
+     * Forget all resources, e.g. after they may have been deleted.
+     */
+    static void clear();
+
+    static int size();
+};
+
+} // namespace CommHistory
+
+#endif
@@ -69,7 +69,7 @@ bool OutboxModel::getEvents()
     d->clearEvents();
     endResetModel();
 
-    EventsQuery query(d->propertyMask);
+    EventsQuery query(d->queryProperties());
 
     query.addPattern(QLatin1String("%1 nmo:isSent \"true\"; "
                                       "nmo:isDraft \"false\"; "
@@ -0,0 +1,215 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** Contact: Reto Zingg <reto.zingg@nokia.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include <QDebug>
+#include <QStringList>
+
+#include <QSparqlConnection>
+#include <QSparqlResult>
+#include <QSparqlResultRow>
+#include <QSparqlError>
+
+#include "pendinglookup.h"
+#include "queryresult.h"
+#include "messagepart.h"
+#include "trackerio_p.h"
+
+namespace CommHistory {
+
+class PendingLookupPrivate
+{
+public:
+    PendingLookupPrivate(PendingLookup::Type lookupType)
+        : type(lookupType),
+          connection(0),
+          result(0),
+          parts(0),
+          count(0),
+          finished(false),
+          valid(false)
+    {
+    }
+
+    PendingLookup::Type type;
+    QSparqlConnection *connection;
+    QSparqlResult *result;
+    QSparqlResult *parts;
+    QList<Event::Property> properties;
+    Event event;
+    Group group;
+    int count;
+    bool finished;
+    bool valid;
+};
+
+PendingLookup::PendingLookup(Type type,
+                             QSparqlConnection &connection,
+                             const QSparqlQuery &query,
+                             const QList<Event::Property> &properties)
+    : QObject(0),
+      d(new PendingLookupPrivate(type))
+{
+    d->connection = &connection;
+    d->properties = properties;
+    d->result = connection.exec(query);
+
+    // always finish from the event loop so that the caller can connect
+    if (d->result->hasError() || d->result->isFinished())
+        QMetaObject::invokeMethod(this, "resultFinished", Qt::QueuedConnection);
+    else
+        connect(d->result, SIGNAL(finished()), SLOT(resultFinished()));
+}
+
+PendingLookup::~PendingLookup()
+{
+    delete d;
+}
+
+PendingLookup::Type PendingLookup::type() const
+{
+    return d->type;
+}
+
+bool PendingLookup::isFinished() const
+{
+    return d->finished;
+}
+
+bool PendingLookup::isValid() const
+{
+    return d->finished && d->valid;
+}
+
+Event PendingLookup::event() const
+{
+    return d->event;
+}
+
+Group PendingLookup::group() const
+{
+    return d->group;
+}
+
+int PendingLookup::count() const
+{
+    return d->count;
+}
+
+void PendingLookup::resultFinished()
+{
+    if (d->finished)
+        return;
+
+    if (d->result->hasError()) {
+        qWarning() << Q_FUNC_INFO << d->result->lastError().message();
+        finish(false);
+        return;
+    }
+
+    QueryResult result;
+    result.result = d->result;
+
+    switch (d->type) {
+    case EventLookup:
+        if (!d->result->first()) {
+            qWarning() << "Event not found";
+            finish(false);
+            return;
+        }
+
+        result.properties = d->properties;
+        result.fillEventFromModel(d->event);
+
+        if (d->event.type() == Event::MMSEvent) {
+            QSparqlQuery partQuery = TrackerIOPrivate::prepareMessagePartQuery(
+                QStringList() << d->event.url().toString());
+            d->parts = d->connection->exec(partQuery);
+            if (d->parts->hasError() || d->parts->isFinished())
+                QMetaObject::invokeMethod(this, "partsFinished", Qt::QueuedConnection);
+            else
+                connect(d->parts, SIGNAL(finished()), SLOT(partsFinished()));
+            return;
+        }
+        break;
+
+    case GroupLookup:
+        if (d->result->size() == 0 || !d->result->first()) {
+            qWarning() << "Group not found";
+            finish(false);
+            return;
+        }
+
+        result.fillGroupFromModel(d->group);
+        break;
+
+    case CountLookup:
+        if (!d->result->first() || d->result->current().isEmpty()) {
+            finish(false);
+            return;
+        }
+
+        d->count = d->result->current().value(0).toInt();
+        break;
+    }
+
+    finish(true);
+}
+
+void PendingLookup::partsFinished()
+{
+    if (d->finished)
+        return;
+
+    // like TrackerIO::getEvent(), parts are optional
+    if (!d->parts->hasError() && d->parts->size() > 0 && d->parts->first()) {
+        QueryResult result;
+        result.result = d->parts;
+
+        do {
+            MessagePart part;
+            result.fillMessagePartFromModel(part);
+            d->event.addMessagePart(part);
+        } while (d->parts->next());
+    }
+    d->event.resetModifiedProperties();
+
+    finish(true);
+}
+
+void PendingLookup::finish(bool valid)
+{
+    d->finished = true;
+    d->valid = valid;
+
+    // delete results out of their slots, workaround qsparql bugs
+    if (d->result)
+        d->result->deleteLater();
+    if (d->parts)
+        d->parts->deleteLater();
+    d->result = 0;
+    d->parts = 0;
+
+    emit finished(this);
+    deleteLater();
+}
+
+} // namespace CommHistory
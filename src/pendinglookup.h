@@ -0,0 +1,103 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** Contact: Reto Zingg <reto.zingg@nokia.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#ifndef COMMHISTORY_PENDINGLOOKUP_H
+#define COMMHISTORY_PENDINGLOOKUP_H
+
+#include <QObject>
+#include <QList>
+
+#include "event.h"
+#include "group.h"
+#include "libcommhistoryexport.h"
+
+class QSparqlConnection;
+class QSparqlQuery;
+
+namespace CommHistory {
+
+class PendingLookupPrivate;
+
+/*!
+ * \class PendingLookup
+ *
+ * Result of an asynchronous single item lookup, see
+ * TrackerIO::getEventAsync() and friends. finished() is emitted once
+ * from the event loop, after which the object deletes itself.
+ */
+class LIBCOMMHISTORY_EXPORT PendingLookup : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Type { EventLookup, GroupLookup, CountLookup };
+
+    ~PendingLookup();
+
+    Type type() const;
+
+    bool isFinished() const;
+
+    /*!
+     * \return true if the lookup finished successfully and the item
+     * was found.
+     */
+    bool isValid() const;
+
+    /*!
+     * \return The event found by an EventLookup.
+     */
+    Event event() const;
+
+    /*!
+     * \return The group found by a GroupLookup.
+     */
+    Group group() const;
+
+    /*!
+     * \return The number of items counted by a CountLookup.
+     */
+    int count() const;
+
+Q_SIGNALS:
+    void finished(CommHistory::PendingLookup *lookup);
+
+private Q_SLOTS:
+    void resultFinished();
+    void partsFinished();
+
+private:
+    friend class TrackerIO;
+    friend class TrackerIOPrivate;
+    PendingLookup(Type type,
+                  QSparqlConnection &connection,
+                  const QSparqlQuery &query,
+                  const QList<Event::Property> &properties = QList<Event::Property>());
+
+    void finish(bool valid);
+
+    PendingLookupPrivate * const d;
+};
+
+} // namespace CommHistory
+
+#endif
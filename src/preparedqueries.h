@@ -23,32 +23,11 @@
 #ifndef COMMHISTORY_PREPAREDQUERIES_H
 #define COMMHISTORY_PREPAREDQUERIES_H
 
-// NOTE projections in the query should have same order as Group::Property
-#define GROUP_QUERY QLatin1String( \
-"SELECT ?channel" \
-"  nie:subject(?channel)" \
-"  nie:generator(?channel)" \
-"  nie:identifier(?channel)" \
-"  nie:title(?channel)" \
-"  ?_lastDate " \
-"  ( SELECT COUNT(?_total_messages_1)" \
-"    WHERE {" \
-"      ?_total_messages_1 nmo:communicationChannel ?channel ." \
-"      ?_total_messages_1 nmo:isDeleted false ." \
-"  })" \
-"  ( SELECT COUNT(?_total_unread_messages_1)" \
-"    WHERE {" \
-"      ?_total_unread_messages_1 nmo:communicationChannel ?channel ." \
-"      ?_total_unread_messages_1 nmo:isRead false ." \
-"      ?_total_unread_messages_1 nmo:isDeleted false ." \
-"  })" \
-"  ( SELECT COUNT(?_total_sent_messages_1)" \
-"    WHERE {" \
-"      ?_total_sent_messages_1 nmo:communicationChannel ?channel ." \
-"      ?_total_sent_messages_1 nmo:isSent true ." \
-"      ?_total_sent_messages_1 nmo:isDeleted false ." \
-"  })" \
-"  ?_lastMessage " \
+// Contacts matching the participant ?part of a channel, in the format
+// QueryResult::parseContacts() expects. Substituted for %2 in GROUP_QUERY
+// and GROUPED_CALL_QUERY, or replaced by an empty literal when the
+// contacts are resolved by the client (see ContactCache).
+#define PARTICIPANT_CONTACTS_COLUMN QLatin1String( \
 "  (SELECT GROUP_CONCAT(" \
 "    fn:concat(tracker:id(?contact), \"\\u001e\", " \
 "              tracker:coalesce(nco:nameGiven(?contact), \"\"), \"\\u001e\", " \
@@ -73,7 +52,36 @@
 "      ?part nco:hasPhoneNumber [ maemo:localPhoneNumber ?number ] . " \
 "      ?contact nco:hasAffiliation [ nco:hasPhoneNumber [ maemo:localPhoneNumber ?number ] ] . " \
 "    }}" \
-"  }) AS ?contacts " \
+"  }) AS ?contacts"
+)
+
+#define NO_CONTACTS_COLUMN QLatin1String("(\"\" AS ?contacts)")
+
+// NOTE projections in the query should have same order as Group::Property
+#define GROUP_QUERY QLatin1String( \
+"SELECT ?channel" \
+"  nie:subject(?channel)" \
+"  nie:generator(?channel)" \
+"  nie:identifier(?channel)" \
+"  nie:title(?channel)" \
+"  ?_lastDate " \
+"  ( SELECT nao:propertyValue(?_total_messages_1)" \
+"    WHERE {" \
+"      ?channel nao:hasProperty ?_total_messages_1 ." \
+"      ?_total_messages_1 nao:propertyName \"commhistory:totalMessages\" ." \
+"  })" \
+"  ( SELECT nao:propertyValue(?_total_unread_messages_1)" \
+"    WHERE {" \
+"      ?channel nao:hasProperty ?_total_unread_messages_1 ." \
+"      ?_total_unread_messages_1 nao:propertyName \"commhistory:unreadMessages\" ." \
+"  })" \
+"  ( SELECT nao:propertyValue(?_total_sent_messages_1)" \
+"    WHERE {" \
+"      ?channel nao:hasProperty ?_total_sent_messages_1 ." \
+"      ?_total_sent_messages_1 nao:propertyName \"commhistory:sentMessages\" ." \
+"  })" \
+"  ?_lastMessage " \
+"  %2 " \
 "  rdf:nil " \
 "  fn:string-join((nmo:messageSubject(?_lastMessage),nie:plainTextContent(?_lastMessage)),\"\\u001e\")" \
 "  nfo:fileName(nmo:fromVCard(?_lastMessage))" \
@@ -85,14 +93,7 @@
 "WHERE " \
 "{" \
 "  {" \
-"    SELECT ?channel ?_lastDate ?_lastModified ?part" \
-"      ( SELECT ?_message WHERE {" \
-"        ?_message nmo:communicationChannel ?channel ." \
-"        ?_message nmo:isDeleted false ." \
-"        ?_message nmo:sentDate ?messageSentDate ." \
-"      } ORDER BY DESC(?messageSentDate) DESC(tracker:id(?_message))" \
-"    LIMIT 1) AS ?_lastMessage " \
-"" \
+"    SELECT ?channel ?_lastDate ?_lastModified ?part ?_lastMessage" \
 "    WHERE" \
 "    {" \
 "      GRAPH <commhistory:message-channels> {" \
@@ -101,11 +102,16 @@
 "      ?channel nmo:lastMessageDate ?_lastDate ." \
 "      ?channel nie:contentLastModified ?_lastModified ." \
 "      ?channel nmo:hasParticipant ?part ." \
+"      OPTIONAL {" \
+"        GRAPH <commhistory:last-message> {" \
+"          ?channel nie:hasLogicalPart ?_lastMessage ." \
+"        }" \
+"      }" \
 "      %1 " \
 "    }" \
 "  }" \
 "}" \
-"ORDER BY DESC(?_lastDate)" \
+"ORDER BY DESC(?_lastDate) DESC(tracker:id(?channel))" \
 )
 
 // NOTE: check CallGroupColumns enum in queryresult.h if you change this!
@@ -127,31 +133,7 @@
 "  nmo:isEmergency(?lastCall)" \
 "  nmo:isRead(?lastCall)" \
 "  nie:contentLastModified(?lastCall)" \
-"  (SELECT GROUP_CONCAT(" \
-"    fn:concat(tracker:id(?contact), \"\\u001e\", " \
-"              tracker:coalesce(nco:nameGiven(?contact), \"\"), \"\\u001e\", " \
-"              tracker:coalesce(nco:nameFamily(?contact), \"\"), " \
-"              \"\\u001d\"," \
-"              tracker:coalesce(nco:nickname(?contact), \"\")," \
-"              \"\\u001d\"," \
-"              tracker:coalesce(?nicknames, \"\")), " \
-"    \"\\u001c\") " \
-"  WHERE {" \
-"    SELECT ?contact " \
-"    (SELECT GROUP_CONCAT(fn:string-join((nco:imID(?addr), ?nickname), \"\\u001f\"), \"\\u001e\")" \
-"    WHERE {" \
-"      ?contact nco:hasAffiliation [ nco:hasIMAddress ?addr ] . " \
-"      ?addr nco:imNickname ?nickname . " \
-"    }) AS ?nicknames " \
-"    WHERE {" \
-"    {" \
-"      ?part nco:hasIMAddress ?address . " \
-"      ?contact nco:hasAffiliation [ nco:hasIMAddress ?address ] . " \
-"    } UNION {" \
-"      ?part nco:hasPhoneNumber [ maemo:localPhoneNumber ?number ] . " \
-"      ?contact nco:hasAffiliation [ nco:hasPhoneNumber [ maemo:localPhoneNumber ?number ] ] . " \
-"    }}" \
-"  }) AS ?contacts " \
+"  %2 " \
 "  rdf:nil " \
 "  ?missedCalls " \
 "WHERE " \
@@ -164,11 +146,10 @@
 "        ?lastCall nmo:sentDate ?lastCallDate ." \
 "      } ORDER BY DESC(?lastCallDate) DESC(tracker:id(?lastCall))" \
 "    ) AS ?lastCall" \
-"    ( SELECT COUNT(?missed)" \
+"    ( SELECT nao:propertyValue(?_missed_calls_1)" \
 "      WHERE {" \
-"        ?missed a nmo:Call ." \
-"        ?missed nmo:communicationChannel ?channel ." \
-"        FILTER(nmo:sentDate(?missed) > nmo:lastSuccessfulMessageDate(?channel))" \
+"        ?channel nao:hasProperty ?_missed_calls_1 ." \
+"        ?_missed_calls_1 nao:propertyName \"commhistory:missedCalls\" ." \
 "      }" \
 "    ) AS ?missedCalls" \
 "" \
@@ -185,7 +166,363 @@
 "}" \
 )
 
+// Message counters of conversations, read by GROUP_QUERY. %1 is a
+// pattern selecting ?channel, empty for all conversations. Only for
+// recounting, event changes update the counters with
+// GROUP_COUNTER_CHANGE.
+#define GROUP_COUNTERS_QUERY QLatin1String( \
+"DELETE { ?channel nao:hasProperty ?_counter . ?_counter a rdfs:Resource } " \
+"WHERE {" \
+"  GRAPH <commhistory:message-channels> {" \
+"    ?channel a nmo:CommunicationChannel ." \
+"  }" \
+"  ?channel nao:hasProperty ?_counter ." \
+"  ?_counter nao:propertyName ?_name ." \
+"  FILTER(fn:starts-with(?_name, \"commhistory:\"))" \
+"  %1 " \
+"} " \
+"INSERT {" \
+"  ?channel nao:hasProperty _:total, _:unread, _:sent ." \
+"  _:total a nao:Property ;" \
+"    nao:propertyName \"commhistory:totalMessages\" ;" \
+"    nao:propertyValue ?_total ." \
+"  _:unread a nao:Property ;" \
+"    nao:propertyName \"commhistory:unreadMessages\" ;" \
+"    nao:propertyValue ?_unread ." \
+"  _:sent a nao:Property ;" \
+"    nao:propertyName \"commhistory:sentMessages\" ;" \
+"    nao:propertyValue ?_sent ." \
+"} " \
+"WHERE {" \
+"  SELECT DISTINCT ?channel" \
+"    ( SELECT COUNT(?_m) WHERE {" \
+"        ?_m nmo:communicationChannel ?channel ; nmo:isDeleted false ." \
+"    }) AS ?_total" \
+"    ( SELECT COUNT(?_m) WHERE {" \
+"        ?_m nmo:communicationChannel ?channel ; nmo:isRead false ; nmo:isDeleted false ." \
+"    }) AS ?_unread" \
+"    ( SELECT COUNT(?_m) WHERE {" \
+"        ?_m nmo:communicationChannel ?channel ; nmo:isSent true ; nmo:isDeleted false ." \
+"    }) AS ?_sent" \
+"  WHERE {" \
+"    GRAPH <commhistory:message-channels> {" \
+"      ?channel a nmo:CommunicationChannel ." \
+"    }" \
+"    %1 " \
+"  }" \
+"} " \
+)
+
+// Add (%3 is +) or subtract (%3 is -) the number of events matching
+// the pattern %1 on ?_event to or from the counter %2 of their
+// conversations. Subtracted before the events are changed and added
+// after.
+#define GROUP_COUNTER_CHANGE QLatin1String( \
+"DELETE { ?_counter nao:propertyValue ?_value } " \
+"INSERT { ?_counter nao:propertyValue ?_next } " \
+"WHERE {" \
+"  SELECT ?_counter ?_value (?_value %3 COUNT(?_event)) AS ?_next" \
+"  WHERE {" \
+"    %1 " \
+"    ?_event nmo:communicationChannel ?_channel ; nmo:isDeleted false ." \
+"    ?_channel nao:hasProperty ?_counter ." \
+"    ?_counter nao:propertyName \"%2\" ;" \
+"      nao:propertyValue ?_value ." \
+"  } GROUP BY ?_counter ?_value" \
+"} " \
+)
+
+// Set the counter %2 of the conversation %1 to zero.
+#define GROUP_COUNTER_RESET QLatin1String( \
+"DELETE { ?_counter nao:propertyValue ?_value } " \
+"INSERT { ?_counter nao:propertyValue 0 } " \
+"WHERE {" \
+"  <%1> nao:hasProperty ?_counter ." \
+"  ?_counter nao:propertyName \"%2\" ;" \
+"    nao:propertyValue ?_value ." \
+"} " \
+)
+
+// Zero message counters for the new conversation %1.
+#define GROUP_COUNTERS_INIT QLatin1String( \
+"INSERT {" \
+"  <%1> nao:hasProperty _:total, _:unread, _:sent ." \
+"  _:total a nao:Property ;" \
+"    nao:propertyName \"commhistory:totalMessages\" ;" \
+"    nao:propertyValue 0 ." \
+"  _:unread a nao:Property ;" \
+"    nao:propertyName \"commhistory:unreadMessages\" ;" \
+"    nao:propertyValue 0 ." \
+"  _:sent a nao:Property ;" \
+"    nao:propertyName \"commhistory:sentMessages\" ;" \
+"    nao:propertyValue 0 ." \
+"} " \
+)
+
+// Pattern for GROUP_COUNTERS_QUERY selecting the conversations stored
+// by older versions, without counters.
+#define GROUP_WITHOUT_COUNTERS QLatin1String( \
+"OPTIONAL {" \
+"  ?channel nao:hasProperty ?_old ." \
+"  ?_old nao:propertyName \"commhistory:totalMessages\" ." \
+"} " \
+"FILTER(!BOUND(?_old))" \
+)
+
+// Pattern for GROUP_LAST_MESSAGE_QUERY selecting the conversations with
+// messages stored by older versions, without the last message link.
+#define GROUP_WITHOUT_LAST_MESSAGE QLatin1String( \
+"?_any nmo:communicationChannel ?channel ; nmo:isDeleted false ." \
+"OPTIONAL {" \
+"  GRAPH <commhistory:last-message> {" \
+"    ?channel nie:hasLogicalPart ?_old ." \
+"  }" \
+"} " \
+"FILTER(!BOUND(?_old))" \
+)
+
+// Whether any channel in the graph %1 matches the pattern %2.
+#define GROUPS_MATCHING_QUERY QLatin1String( \
+"ASK {" \
+"  GRAPH <%1> {" \
+"    ?channel a nmo:CommunicationChannel ." \
+"  }" \
+"  %2 " \
+"}" \
+)
+
+// Last message of conversations, read by GROUP_QUERY. Kept in its own
+// graph to tell it from other nie:hasLogicalPart uses. %1 is a pattern
+// selecting ?channel, empty for all conversations. Only for finding it
+// again, event changes move the link with the queries below.
+#define GROUP_LAST_MESSAGE_QUERY QLatin1String( \
+"DELETE { GRAPH <commhistory:last-message> { ?channel nie:hasLogicalPart ?_message } } " \
+"WHERE {" \
+"  GRAPH <commhistory:last-message> {" \
+"    ?channel nie:hasLogicalPart ?_message ." \
+"  }" \
+"  %1 " \
+"} " \
+"INSERT { GRAPH <commhistory:last-message> { ?channel nie:hasLogicalPart ?_lastMessage } } " \
+"WHERE {" \
+"  SELECT DISTINCT ?channel" \
+"    ( SELECT ?_m WHERE {" \
+"        ?_m nmo:communicationChannel ?channel ;" \
+"          nmo:isDeleted false ;" \
+"          nmo:sentDate ?_date ." \
+"      } ORDER BY DESC(?_date) DESC(tracker:id(?_m))" \
+"      LIMIT 1) AS ?_lastMessage" \
+"  WHERE {" \
+"    GRAPH <commhistory:message-channels> {" \
+"      ?channel a nmo:CommunicationChannel ." \
+"    }" \
+"    %1 " \
+"  }" \
+"} " \
+)
+
+// Link the message %1 as the last one of its conversation, unless the
+// linked message is newer. The newer of messages sent at the same time
+// is the one added later.
+#define GROUP_LAST_MESSAGE_ADD QLatin1String( \
+"DELETE { GRAPH <commhistory:last-message> { ?_channel nie:hasLogicalPart ?_old } } " \
+"WHERE {" \
+"  <%1> nmo:communicationChannel ?_channel ;" \
+"    nmo:isDeleted false ;" \
+"    nmo:sentDate ?_date ." \
+"  GRAPH <commhistory:last-message> {" \
+"    ?_channel nie:hasLogicalPart ?_old ." \
+"  }" \
+"  FILTER(nmo:sentDate(?_old) < ?_date" \
+"         || (nmo:sentDate(?_old) = ?_date && tracker:id(?_old) < tracker:id(<%1>)))" \
+"} " \
+"INSERT { GRAPH <commhistory:last-message> { ?_channel nie:hasLogicalPart <%1> } } " \
+"WHERE {" \
+"  <%1> nmo:communicationChannel ?_channel ;" \
+"    nmo:isDeleted false ." \
+"  OPTIONAL {" \
+"    GRAPH <commhistory:last-message> {" \
+"      ?_channel nie:hasLogicalPart ?_old ." \
+"    }" \
+"  }" \
+"  FILTER(!BOUND(?_old))" \
+"} " \
+)
+
+// Before the message %1 is deleted, moved or its date or deleted state
+// changes, link its conversation to the last message other than %1 if
+// %1 is linked. Other conversations are not touched.
+#define GROUP_LAST_MESSAGE_REMOVE QLatin1String( \
+"DELETE { GRAPH <commhistory:last-message> { ?_channel nie:hasLogicalPart <%1> } } " \
+"WHERE {" \
+"  GRAPH <commhistory:last-message> {" \
+"    ?_channel nie:hasLogicalPart <%1> ." \
+"  }" \
+"} " \
+"INSERT { GRAPH <commhistory:last-message> { ?_channel nie:hasLogicalPart ?_lastMessage } } " \
+"WHERE {" \
+"  SELECT ?_channel" \
+"    ( SELECT ?_m WHERE {" \
+"        ?_m nmo:communicationChannel ?_channel ;" \
+"          nmo:isDeleted false ;" \
+"          nmo:sentDate ?_date ." \
+"        FILTER(?_m != <%1>)" \
+"      } ORDER BY DESC(?_date) DESC(tracker:id(?_m))" \
+"      LIMIT 1) AS ?_lastMessage" \
+"  WHERE {" \
+"    <%1> nmo:communicationChannel ?_channel ." \
+"    OPTIONAL {" \
+"      GRAPH <commhistory:last-message> {" \
+"        ?_channel nie:hasLogicalPart ?_old ." \
+"      }" \
+"    }" \
+"    FILTER(!BOUND(?_old))" \
+"  }" \
+"} " \
+)
+
+// Missed call counter of call groups, read by GROUPED_CALL_QUERY: the
+// calls after nmo:lastSuccessfulMessageDate. %1 is a pattern selecting
+// ?channel, empty for all call groups. Only for recounting, new calls
+// update the counter with the queries below.
+#define CALL_GROUP_MISSED_QUERY QLatin1String( \
+"DELETE { ?channel nao:hasProperty ?_counter . ?_counter a rdfs:Resource } " \
+"WHERE {" \
+"  GRAPH <commhistory:call-channels> {" \
+"    ?channel a nmo:CommunicationChannel ." \
+"  }" \
+"  ?channel nao:hasProperty ?_counter ." \
+"  ?_counter nao:propertyName \"commhistory:missedCalls\" ." \
+"  %1 " \
+"} " \
+"INSERT {" \
+"  ?channel nao:hasProperty _:missed ." \
+"  _:missed a nao:Property ;" \
+"    nao:propertyName \"commhistory:missedCalls\" ;" \
+"    nao:propertyValue ?_missed ." \
+"} " \
+"WHERE {" \
+"  SELECT DISTINCT ?channel" \
+"    ( SELECT COUNT(?_m) WHERE {" \
+"        ?_m a nmo:Call ; nmo:communicationChannel ?channel ." \
+"        FILTER(nmo:sentDate(?_m) > nmo:lastSuccessfulMessageDate(?channel))" \
+"    }) AS ?_missed" \
+"  WHERE {" \
+"    GRAPH <commhistory:call-channels> {" \
+"      ?channel a nmo:CommunicationChannel ." \
+"    }" \
+"    %1 " \
+"  }" \
+"} " \
+)
+
+// Count a new missed call started at %2 in the call group %1, unless it
+// is older than the last successful call.
+#define CALL_GROUP_MISSED_INCREMENT QLatin1String( \
+"DELETE { ?_counter nao:propertyValue ?_value } " \
+"INSERT { ?_counter nao:propertyValue ?_next } " \
+"WHERE {" \
+"  SELECT ?_counter ?_value (?_value + 1) AS ?_next" \
+"  WHERE {" \
+"    <%1> nao:hasProperty ?_counter ." \
+"    ?_counter nao:propertyName \"commhistory:missedCalls\" ;" \
+"      nao:propertyValue ?_value ." \
+"    FILTER(nmo:lastSuccessfulMessageDate(<%1>) < \"%2\"^^xsd:dateTime)" \
+"  }" \
+"} " \
+)
+
+// Reset the missed call counter of the call group %1 when its last
+// successful call moves to %2 from an earlier one.
+#define CALL_GROUP_MISSED_RESET QLatin1String( \
+"DELETE { ?_counter nao:propertyValue ?_value } " \
+"INSERT { ?_counter nao:propertyValue 0 } " \
+"WHERE {" \
+"  <%1> nao:hasProperty ?_counter ." \
+"  ?_counter nao:propertyName \"commhistory:missedCalls\" ;" \
+"    nao:propertyValue ?_value ." \
+"  FILTER(nmo:lastSuccessfulMessageDate(<%1>) < \"%2\"^^xsd:dateTime)" \
+"} " \
+)
+
+// Uncount the call %1 from its call group before it is deleted or
+// moved, if it was counted as missed.
+#define CALL_GROUP_MISSED_DECREMENT QLatin1String( \
+"DELETE { ?_counter nao:propertyValue ?_value } " \
+"INSERT { ?_counter nao:propertyValue ?_next } " \
+"WHERE {" \
+"  SELECT ?_counter ?_value (?_value - 1) AS ?_next" \
+"  WHERE {" \
+"    <%1> nmo:communicationChannel ?_channel ;" \
+"      nmo:sentDate ?_date ." \
+"    ?_channel nao:hasProperty ?_counter ." \
+"    ?_counter nao:propertyName \"commhistory:missedCalls\" ;" \
+"      nao:propertyValue ?_value ." \
+"    FILTER(?_date > nmo:lastSuccessfulMessageDate(?_channel) && ?_value > 0)" \
+"  }" \
+"} " \
+)
+
+// Zero missed call counter for the call group %1 unless it has one.
+#define CALL_GROUP_MISSED_COUNTER_INIT QLatin1String( \
+"INSERT {" \
+"  <%1> nao:hasProperty _:missed ." \
+"  _:missed a nao:Property ;" \
+"    nao:propertyName \"commhistory:missedCalls\" ;" \
+"    nao:propertyValue 0 ." \
+"} " \
+"WHERE {" \
+"  OPTIONAL {" \
+"    <%1> nao:hasProperty ?_old ." \
+"    ?_old nao:propertyName \"commhistory:missedCalls\" ." \
+"  }" \
+"  FILTER(!BOUND(?_old))" \
+"} " \
+)
+
+// Pattern for CALL_GROUP_MISSED_QUERY selecting the call groups stored
+// by older versions, without a counter.
+#define CALL_GROUP_WITHOUT_MISSED_COUNTER QLatin1String( \
+"OPTIONAL {" \
+"  ?channel nao:hasProperty ?_old ." \
+"  ?_old nao:propertyName \"commhistory:missedCalls\" ." \
+"} " \
+"FILTER(!BOUND(?_old))" \
+)
+
+// Delete the conversation %1 with its stored counters if no message is
+// left in it.
+#define DELETE_EMPTY_GROUP_QUERY QLatin1String( \
+"DELETE { ?counter a rdfs:Resource } WHERE { " \
+"  <%1> nao:hasProperty ?counter . " \
+"  OPTIONAL { " \
+"    ?msg nmo:communicationChannel <%1> ; " \
+"    nmo:isDeleted false . " \
+"  } " \
+"  FILTER (!BOUND(?msg)) " \
+"} " \
+"DELETE { <%1> a rdfs:Resource } WHERE { " \
+"  <%1> a nmo:CommunicationChannel . " \
+"  OPTIONAL { " \
+"    ?msg nmo:communicationChannel <%1> ; " \
+"    nmo:isDeleted false . " \
+"  } " \
+"  FILTER (!BOUND(?msg)) " \
+"}" \
+)
+
 #define DELETE_EMPTY_CALL_GROUPS_QUERY QLatin1String( \
+"DELETE { ?counter a rdfs:Resource } WHERE { " \
+"  GRAPH <commhistory:call-channels> { " \
+"    ?chan a nmo:CommunicationChannel . " \
+"  } " \
+"  ?chan nao:hasProperty ?counter . " \
+"  OPTIONAL { " \
+"    ?call a nmo:Call ; " \
+"    nmo:communicationChannel ?chan . " \
+"  } " \
+"  FILTER (!BOUND(?call)) " \
+"} " \
 "DELETE { ?chan a rdfs:Resource } WHERE { " \
 "  GRAPH <commhistory:call-channels> { " \
 "    ?chan a nmo:CommunicationChannel . " \
@@ -0,0 +1,479 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** Contact: Reto Zingg <reto.zingg@nokia.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include <QDebug>
+#include <QtDBus/QtDBus>
+#include <QStringList>
+
+#include "querycache.h"
+#include "updatesemitter.h"
+#include "contactlistener.h"
+#include "constants.h"
+
+using namespace CommHistory;
+
+namespace {
+
+// rough size of an object without its strings
+static const int eventOverhead = 400;
+static const int groupOverhead = 300;
+static const int partOverhead = 200;
+
+int stringCost(const QString &string)
+{
+    return string.size() * sizeof(QChar);
+}
+
+int eventCost(const Event &event)
+{
+    int cost = eventOverhead
+        + stringCost(event.localUid())
+        + stringCost(event.remoteUid())
+        + stringCost(event.freeText())
+        + stringCost(event.subject())
+        + stringCost(event.messageToken())
+        + stringCost(event.mmsId())
+        + stringCost(event.contentLocation())
+        + stringCost(event.fromVCardFileName())
+        + stringCost(event.fromVCardLabel());
+
+    foreach (const Event::Contact &contact, event.contacts())
+        cost += sizeof(contact) + stringCost(contact.second);
+    foreach (const MessagePart &part, event.messageParts())
+        cost += partOverhead + stringCost(part.plainTextContent());
+
+    return cost;
+}
+
+int groupCost(const Group &group)
+{
+    int cost = groupOverhead
+        + stringCost(group.localUid())
+        + stringCost(group.chatName())
+        + stringCost(group.lastMessageText())
+        + stringCost(group.lastVCardFileName())
+        + stringCost(group.lastVCardLabel());
+
+    foreach (const QString &remoteUid, group.remoteUids())
+        cost += stringCost(remoteUid);
+    foreach (const Event::Contact &contact, group.contacts())
+        cost += sizeof(contact) + stringCost(contact.second);
+
+    return cost;
+}
+
+}
+
+int QueryCache::m_budget = 0;
+QMutex QueryCache::m_budgetMutex;
+QWeakPointer<QueryCache> QueryCache::m_Instance;
+
+QueryCache::QueryCache()
+    : m_cost(0)
+    , m_generation(0)
+    , m_hits(0)
+    , m_misses(0)
+{
+    // local changes are seen right away, other processes' over D-Bus
+    m_emitter = UpdatesEmitter::instance();
+    connect(m_emitter.data(), SIGNAL(eventsAdded(const QList<CommHistory::Event>&)),
+            this, SLOT(eventsAddedSlot(const QList<CommHistory::Event>&)));
+    connect(m_emitter.data(), SIGNAL(eventsUpdated(const QList<CommHistory::Event>&)),
+            this, SLOT(eventsUpdatedSlot(const QList<CommHistory::Event>&)));
+    connect(m_emitter.data(), SIGNAL(eventDeleted(int)),
+            this, SLOT(eventDeletedSlot(int)));
+    connect(m_emitter.data(), SIGNAL(groupsAdded(const QList<CommHistory::Group>&)),
+            this, SLOT(groupsAddedSlot(const QList<CommHistory::Group>&)));
+    connect(m_emitter.data(), SIGNAL(groupsUpdated(const QList<int>&)),
+            this, SLOT(groupsUpdatedSlot(const QList<int>&)));
+    connect(m_emitter.data(), SIGNAL(groupsUpdatedFull(const QList<CommHistory::Group>&)),
+            this, SLOT(groupsUpdatedFullSlot(const QList<CommHistory::Group>&)));
+    connect(m_emitter.data(), SIGNAL(groupsDeleted(const QList<int>&)),
+            this, SLOT(groupsDeletedSlot(const QList<int>&)));
+
+    QDBusConnection bus = QDBusConnection::sessionBus();
+    bus.connect(QString(), QString(), COMM_HISTORY_SERVICE_NAME, EVENTS_ADDED_SIGNAL,
+                this, SLOT(eventsAddedSlot(const QList<CommHistory::Event> &)));
+    bus.connect(QString(), QString(), COMM_HISTORY_SERVICE_NAME, EVENTS_UPDATED_SIGNAL,
+                this, SLOT(eventsUpdatedSlot(const QList<CommHistory::Event> &)));
+    bus.connect(QString(), QString(), COMM_HISTORY_SERVICE_NAME, EVENT_DELETED_SIGNAL,
+                this, SLOT(eventDeletedSlot(int)));
+    bus.connect(QString(), QString(), COMM_HISTORY_SERVICE_NAME, GROUPS_ADDED_SIGNAL,
+                this, SLOT(groupsAddedSlot(const QList<CommHistory::Group> &)));
+    bus.connect(QString(), QString(), COMM_HISTORY_SERVICE_NAME, GROUPS_UPDATED_SIGNAL,
+                this, SLOT(groupsUpdatedSlot(const QList<int> &)));
+    bus.connect(QString(), QString(), COMM_HISTORY_SERVICE_NAME, GROUPS_UPDATED_FULL_SIGNAL,
+                this, SLOT(groupsUpdatedFullSlot(const QList<CommHistory::Group> &)));
+    bus.connect(QString(), QString(), COMM_HISTORY_SERVICE_NAME, GROUPS_DELETED_SIGNAL,
+                this, SLOT(groupsDeletedSlot(const QList<int> &)));
+}
+
+QueryCache::~QueryCache()
+{
+}
+
+QSharedPointer<QueryCache> QueryCache::instance()
+{
+    QSharedPointer<QueryCache> result;
+    if (!m_Instance) {
+        result = QSharedPointer<QueryCache>(new QueryCache());
+        m_Instance = result.toWeakRef();
+    } else {
+        result = m_Instance.toStrongRef();
+    }
+
+    return result;
+}
+
+void QueryCache::setMemoryBudget(int bytes)
+{
+    {
+        QMutexLocker budgetLocker(&m_budgetMutex);
+        m_budget = qMax(0, bytes);
+    }
+
+    QSharedPointer<QueryCache> cache = m_Instance.toStrongRef();
+    if (cache) {
+        QMutexLocker locker(&cache->m_mutex);
+        int budget = memoryBudget();
+        while (cache->m_cost > budget)
+            cache->remove(cache->m_lru.first());
+    }
+}
+
+int QueryCache::memoryBudget()
+{
+    QMutexLocker budgetLocker(&m_budgetMutex);
+    return m_budget;
+}
+
+bool QueryCache::isEnabled()
+{
+    return memoryBudget() > 0;
+}
+
+int QueryCache::cost()
+{
+    QMutexLocker locker(&m_mutex);
+    return m_cost;
+}
+
+int QueryCache::hits()
+{
+    QMutexLocker locker(&m_mutex);
+    return m_hits;
+}
+
+int QueryCache::misses()
+{
+    QMutexLocker locker(&m_mutex);
+    return m_misses;
+}
+
+void QueryCache::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    m_generation++;
+    m_entries.clear();
+    m_lru.clear();
+    m_cost = 0;
+}
+
+void QueryCache::watchContacts(ContactListener *listener)
+{
+    connect(listener,
+            SIGNAL(contactUpdated(quint32, const QString&, const QList<QPair<QString,QString> >&)),
+            this, SLOT(contactsChangedSlot()),
+            Qt::UniqueConnection);
+    connect(listener, SIGNAL(contactRemoved(quint32)),
+            this, SLOT(contactsChangedSlot()),
+            Qt::UniqueConnection);
+    connect(listener, SIGNAL(contactSettingsChanged(const QHash<QString, QVariant> &)),
+            this, SLOT(contactsChangedSlot()),
+            Qt::UniqueConnection);
+}
+
+int QueryCache::generation()
+{
+    QMutexLocker locker(&m_mutex);
+    return m_generation;
+}
+
+QString QueryCache::cacheKey(QueryType type, const QString &query) const
+{
+    return QString::number(type) + QLatin1Char(':') + query;
+}
+
+bool QueryCache::findEvents(QueryType type, const QString &query,
+                            QList<Event> &events, QVariantList &extra)
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (!isEnabled())
+        return false;
+
+    Entry *entry = find(cacheKey(type, query));
+    if (!entry) {
+        m_misses++;
+        return false;
+    }
+
+    m_hits++;
+    events = entry->events;
+    extra = entry->extra;
+    return true;
+}
+
+bool QueryCache::findGroups(const QString &query, QList<Group> &groups)
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (!isEnabled())
+        return false;
+
+    Entry *entry = find(cacheKey(GroupQuery, query));
+    if (!entry) {
+        m_misses++;
+        return false;
+    }
+
+    m_hits++;
+    groups = entry->groups;
+    return true;
+}
+
+void QueryCache::insertEvents(QueryType type, const QString &query, int scopeGroupId,
+                              const QList<Event> &events, const QVariantList &extra,
+                              int generation)
+{
+    if (!isEnabled())
+        return;
+
+    Entry entry;
+    entry.type = type;
+    entry.scopeGroupId = scopeGroupId;
+    entry.events = events;
+    entry.extra = extra;
+    entry.cost = extra.size() * sizeof(QVariant);
+
+    foreach (const Event &event, events) {
+        entry.eventIds.insert(event.id());
+        if (event.groupId() != -1)
+            entry.groupIds.insert(event.groupId());
+        entry.cost += eventCost(event);
+    }
+
+    insert(cacheKey(type, query), entry, generation);
+}
+
+void QueryCache::insertGroups(const QString &query, const QList<Group> &groups,
+                              int generation)
+{
+    if (!isEnabled())
+        return;
+
+    Entry entry;
+    entry.type = GroupQuery;
+    entry.scopeGroupId = -1;
+    entry.groups = groups;
+    entry.cost = 0;
+
+    foreach (const Group &group, groups) {
+        entry.groupIds.insert(group.id());
+        entry.cost += groupCost(group);
+    }
+
+    insert(cacheKey(GroupQuery, query), entry, generation);
+}
+
+void QueryCache::insert(const QString &key, const Entry &entry, int generation)
+{
+    QMutexLocker locker(&m_mutex);
+
+    // something changed while the query was running
+    if (generation != m_generation)
+        return;
+
+    int budget = memoryBudget();
+    if (entry.cost > budget) {
+        qDebug() << Q_FUNC_INFO << "result too large to cache:" << entry.cost;
+        return;
+    }
+
+    if (m_entries.contains(key))
+        remove(key);
+
+    // evict least recently used entries
+    while (!m_lru.isEmpty() && m_cost + entry.cost > budget)
+        remove(m_lru.first());
+
+    Entry &stored = m_entries[key];
+    stored = entry;
+    stored.lru = m_lru.insert(m_lru.end(), key);
+    m_cost += entry.cost;
+}
+
+void QueryCache::remove(const QString &key)
+{
+    QHash<QString, Entry>::iterator i = m_entries.find(key);
+    if (i == m_entries.end())
+        return;
+
+    m_cost -= i->cost;
+    m_lru.erase(i->lru);
+    m_entries.erase(i);
+}
+
+QueryCache::Entry* QueryCache::find(const QString &key)
+{
+    QHash<QString, Entry>::iterator i = m_entries.find(key);
+    if (i == m_entries.end())
+        return 0;
+
+    // most recently used
+    m_lru.erase(i->lru);
+    i->lru = m_lru.insert(m_lru.end(), key);
+
+    return &i.value();
+}
+
+bool QueryCache::eventChangeAffects(const Entry &entry, const Event &event, bool added) const
+{
+    bool knownGroup = event.validProperties().contains(Event::GroupId);
+
+    switch (entry.type) {
+    case EventQuery:
+        if (!added && entry.eventIds.contains(event.id()))
+            return true;
+        return entry.scopeGroupId == -1
+            || !knownGroup
+            || entry.scopeGroupId == event.groupId();
+    case GroupQuery:
+        // group additions are signalled separately
+        return !knownGroup || entry.groupIds.contains(event.groupId());
+    case GroupedCallQuery:
+        return !event.validProperties().contains(Event::Type)
+            || event.type() == Event::CallEvent;
+    default:
+        return true;
+    }
+}
+
+void QueryCache::invalidateEvents(const QList<Event> &events, bool added)
+{
+    QMutexLocker locker(&m_mutex);
+    m_generation++;
+
+    foreach (const QString &key, m_entries.keys()) {
+        const Entry &entry = m_entries[key];
+        foreach (const Event &event, events) {
+            if (eventChangeAffects(entry, event, added)) {
+                remove(key);
+                break;
+            }
+        }
+    }
+}
+
+void QueryCache::invalidateGroups(const QSet<int> &groupIds, bool deleted)
+{
+    QMutexLocker locker(&m_mutex);
+    m_generation++;
+
+    foreach (const QString &key, m_entries.keys()) {
+        const Entry &entry = m_entries[key];
+        bool affected = false;
+        if (entry.type == GroupQuery)
+            affected = entry.groupIds.intersects(groupIds);
+        else if (deleted && entry.type == EventQuery)
+            affected = groupIds.contains(entry.scopeGroupId)
+                || entry.groupIds.intersects(groupIds);
+        if (affected)
+            remove(key);
+    }
+}
+
+void QueryCache::invalidateAll(QueryType type)
+{
+    QMutexLocker locker(&m_mutex);
+    m_generation++;
+
+    foreach (const QString &key, m_entries.keys()) {
+        if (m_entries[key].type == type)
+            remove(key);
+    }
+}
+
+void QueryCache::eventsAddedSlot(const QList<CommHistory::Event> &events)
+{
+    invalidateEvents(events, true);
+}
+
+void QueryCache::eventsUpdatedSlot(const QList<CommHistory::Event> &events)
+{
+    invalidateEvents(events, false);
+}
+
+void QueryCache::eventDeletedSlot(int id)
+{
+    QMutexLocker locker(&m_mutex);
+    m_generation++;
+
+    // no way to tell whether a call was deleted, or from which
+    // conversation; its summary and counters may have changed
+    foreach (const QString &key, m_entries.keys()) {
+        const Entry &entry = m_entries[key];
+        if (entry.type == GroupedCallQuery
+            || entry.type == GroupQuery
+            || (entry.type == EventQuery && entry.eventIds.contains(id)))
+            remove(key);
+    }
+}
+
+void QueryCache::groupsAddedSlot(const QList<CommHistory::Group> &groups)
+{
+    Q_UNUSED(groups);
+    invalidateAll(GroupQuery);
+}
+
+void QueryCache::groupsUpdatedSlot(const QList<int> &groupIds)
+{
+    invalidateGroups(groupIds.toSet(), false);
+}
+
+void QueryCache::groupsUpdatedFullSlot(const QList<CommHistory::Group> &groups)
+{
+    QSet<int> groupIds;
+    foreach (const Group &group, groups)
+        groupIds.insert(group.id());
+    invalidateGroups(groupIds, false);
+}
+
+void QueryCache::groupsDeletedSlot(const QList<int> &groupIds)
+{
+    invalidateGroups(groupIds.toSet(), true);
+}
+
+void QueryCache::contactsChangedSlot()
+{
+    clear();
+}
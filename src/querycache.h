@@ -0,0 +1,171 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** Contact: Reto Zingg <reto.zingg@nokia.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#ifndef COMMHISTORY_QUERYCACHE_H
+#define COMMHISTORY_QUERYCACHE_H
+
+#include <QObject>
+#include <QHash>
+#include <QLinkedList>
+#include <QMutex>
+#include <QSet>
+#include <QSharedPointer>
+#include <QWeakPointer>
+#include <QVariantList>
+
+#include "event.h"
+#include "group.h"
+#include "queryresult.h"
+#include "libcommhistoryexport.h"
+
+namespace CommHistory {
+
+class UpdatesEmitter;
+class ContactListener;
+
+/*!
+ * \class QueryCache
+ *
+ * Process-wide cache of decoded event, group and grouped call query
+ * results, keyed by the final query text. Entries are dropped when the
+ * update signals (local or over D-Bus) say their content may have
+ * changed, and the least recently used ones are evicted when the cache
+ * exceeds its memory budget.
+ *
+ * The cache is disabled (budget 0) by default. It cannot see changes
+ * made to tracker behind libcommhistory's back.
+ */
+class LIBCOMMHISTORY_EXPORT QueryCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    static QSharedPointer<QueryCache> instance();
+    ~QueryCache();
+
+    /*!
+     * Set the approximate memory used by cached results, in bytes.
+     * 0 disables the cache and drops all entries.
+     */
+    static void setMemoryBudget(int bytes);
+    static int memoryBudget();
+
+    /*!
+     * \returns true if the memory budget is above 0. Callers can skip
+     * building lookup keys otherwise.
+     */
+    static bool isEnabled();
+
+    /*!
+     * \returns Approximate memory used by cached results, in bytes.
+     */
+    int cost();
+    int hits();
+    int misses();
+
+    void clear();
+
+    /*!
+     * Drop entries on contact and name display setting changes, as
+     * cached results carry resolved contact names.
+     */
+    void watchContacts(ContactListener *listener);
+
+    /*!
+     * \returns Invalidation generation. Pass it to insert(), which
+     * ignores results of queries that ran while entries were invalidated.
+     */
+    int generation();
+
+    /*!
+     * Look up results for a query. Hits and misses are counted.
+     */
+    bool findEvents(QueryType type, const QString &query,
+                    QList<Event> &events, QVariantList &extra);
+    bool findGroups(const QString &query, QList<Group> &groups);
+
+    /*!
+     * Store complete results of a query.
+     * \param scopeGroupId Group the query is restricted to, or -1.
+     */
+    void insertEvents(QueryType type, const QString &query, int scopeGroupId,
+                      const QList<Event> &events, const QVariantList &extra,
+                      int generation);
+    void insertGroups(const QString &query, const QList<Group> &groups,
+                      int generation);
+
+private Q_SLOTS:
+    void eventsAddedSlot(const QList<CommHistory::Event> &events);
+    void eventsUpdatedSlot(const QList<CommHistory::Event> &events);
+    void eventDeletedSlot(int id);
+    void groupsAddedSlot(const QList<CommHistory::Group> &groups);
+    void groupsUpdatedSlot(const QList<int> &groupIds);
+    void groupsUpdatedFullSlot(const QList<CommHistory::Group> &groups);
+    void groupsDeletedSlot(const QList<int> &groupIds);
+    void contactsChangedSlot();
+
+private:
+    QueryCache();
+
+    struct Entry {
+        QueryType type;
+        // group the query was restricted to, -1 if any
+        int scopeGroupId;
+        QList<Event> events;
+        QVariantList extra;
+        QList<Group> groups;
+        QSet<int> eventIds;
+        QSet<int> groupIds;
+        int cost;
+        // position in m_lru
+        QLinkedList<QString>::iterator lru;
+    };
+
+    QString cacheKey(QueryType type, const QString &query) const;
+    void insert(const QString &key, const Entry &entry, int generation);
+    void remove(const QString &key);
+    Entry* find(const QString &key);
+    bool eventChangeAffects(const Entry &entry, const Event &event, bool added) const;
+    void invalidateEvents(const QList<Event> &events, bool added);
+    void invalidateGroups(const QSet<int> &groupIds, bool deleted);
+    void invalidateAll(QueryType type);
+
+    QMutex m_mutex;
+    QHash<QString, Entry> m_entries;
+    // least recently used first
+    QLinkedList<QString> m_lru;
+    int m_cost;
+    int m_generation;
+    int m_hits;
+    int m_misses;
+
+    QSharedPointer<UpdatesEmitter> m_emitter;
+
+    // guarded by m_budgetMutex, taken after m_mutex when both are held
+    static int m_budget;
+    static QMutex m_budgetMutex;
+    static QWeakPointer<QueryCache> m_Instance;
+};
+
+}
+
+#endif
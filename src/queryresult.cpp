@@ -25,12 +25,15 @@
 #include "queryresult.h"
 #include "contactlistener.h"
 
-#include <QSettings>
+#include <QHash>
+#include <QStringMatcher>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThreadPool>
 using namespace CommHistory;
 
 // used for filling data from tracker result rows
-#define RESULT_INDEX(COL) result.result->value(result.columns[QLatin1String(COL)])
-#define RESULT_INDEX2(COL) result->value(properties.indexOf(COL))
+#define RESULT_INDEX2(COL) columnValue(row, columns.at(COL))
 
 #define LAT(STR) QLatin1String(STR)
 
@@ -41,195 +44,587 @@ using namespace CommHistory;
 
 namespace {
 
+struct TypeCode {
+    QString uri;
+    Event::EventType type;
+};
+
+// message classes in rdf:type, in order of precedence
+const TypeCode typeCodes[] = {
+    { LAT(NMO_ "MMSMessage"), Event::MMSEvent },
+    { LAT(NMO_ "SMSMessage"), Event::SMSEvent },
+    { LAT(NMO_ "IMMessage"), Event::IMEvent },
+    { LAT(NMO_ "Call"), Event::CallEvent }
+};
+
+const int NumTypeCodes = sizeof(typeCodes) / sizeof(typeCodes[0]);
+
+QHash<QString, Event::EventStatus> deliveryStatusCodes()
+{
+    QHash<QString, Event::EventStatus> codes;
+    codes.insert(LAT(NMO_ "delivery-status-sent"), Event::SentStatus);
+    codes.insert(LAT(NMO_ "delivery-status-delivered"), Event::DeliveredStatus);
+    codes.insert(LAT(NMO_ "delivery-status-temporarily-failed"), Event::TemporarilyFailedStatus);
+    codes.insert(LAT(NMO_ "delivery-status-temporarily-failed-offline"), Event::TemporarilyFailedOfflineStatus);
+    codes.insert(LAT(NMO_ "delivery-status-permanently-failed"), Event::PermanentlyFailedStatus);
+    return codes;
+}
+
+QHash<QString, Event::EventReadStatus> readStatusCodes()
+{
+    QHash<QString, Event::EventReadStatus> codes;
+    codes.insert(LAT(NMO_ "read-status-read"), Event::ReadStatusRead);
+    codes.insert(LAT(NMO_ "read-status-deleted"), Event::ReadStatusDeleted);
+    return codes;
+}
+
+const QHash<QString, Event::EventStatus> statusCodes = deliveryStatusCodes();
+const QHash<QString, Event::EventReadStatus> readCodes = readStatusCodes();
+
+// decode comma separated rdf:type list without splitting it
+Event::EventType nmoTypesToEventType(const QString &types)
+{
+    int best = NumTypeCodes;
+    int start = 0;
+
+    while (start < types.length() && best > 0) {
+        int end = types.indexOf(QLatin1Char(','), start);
+        if (end < 0)
+            end = types.length();
+
+        QStringRef uri(&types, start, end - start);
+        for (int i = 0; i < best; i++) {
+            if (uri.length() == typeCodes[i].uri.length()
+                && uri == typeCodes[i].uri) {
+                best = i;
+                break;
+            }
+        }
+
+        start = end + 1;
+    }
+
+    return best < NumTypeCodes ? typeCodes[best].type : Event::UnknownType;
+}
+
 Event::EventStatus nmoStatusToEventStatus(const QString &status)
 {
-    if (status == LAT(NMO_ "delivery-status-sent"))
-         return Event::SentStatus;
-    else if (status == LAT(NMO_ "delivery-status-delivered"))
-         return Event::DeliveredStatus;
-    else if (status == LAT(NMO_ "delivery-status-temporarily-failed"))
-        return Event::TemporarilyFailedStatus;
-    else if (status == LAT(NMO_ "delivery-status-temporarily-failed-offline"))
-        return Event::TemporarilyFailedOfflineStatus;
-    else if(status == LAT(NMO_ "delivery-status-permanently-failed"))
-            return Event::PermanentlyFailedStatus;
+    return statusCodes.value(status, Event::UnknownStatus);
+}
+
+/*
+ * Walks the separator delimited fields of a packed column without
+ * copying them. Fields are returned like QString::split() would return
+ * them, including empty ones.
+ */
+class FieldTokenizer
+{
+public:
+    FieldTokenizer(const QStringRef &ref, char separator)
+        : m_data(ref.unicode()),
+          m_string(ref.string()),
+          m_offset(ref.position()),
+          m_pos(0),
+          m_size(ref.size()),
+          m_separator(QLatin1Char(separator))
+    {
+    }
+
+    FieldTokenizer(const QString *string, char separator)
+        : m_data(string->unicode()),
+          m_string(string),
+          m_offset(0),
+          m_pos(0),
+          m_size(string->size()),
+          m_separator(QLatin1Char(separator))
+    {
+    }
+
+    bool next(QStringRef &field)
+    {
+        if (m_pos > m_size)
+            return false;
+
+        int end = m_pos;
+        while (end < m_size && m_data[end] != m_separator)
+            ++end;
+
+        field = QStringRef(m_string, m_offset + m_pos, end - m_pos);
+        m_pos = end + 1;
+
+        return true;
+    }
+
+    // same as next(), but skips empty fields like QString::SkipEmptyParts
+    bool nextNonEmpty(QStringRef &field)
+    {
+        while (next(field)) {
+            if (!field.isEmpty())
+                return true;
+        }
+
+        return false;
+    }
+
+private:
+    const QChar *m_data;
+    const QString *m_string;
+    int m_offset;
+    int m_pos;
+    int m_size;
+    QChar m_separator;
+};
+
+bool refStartsWith(const QStringRef &ref, const char *prefix)
+{
+    const QChar *data = ref.unicode();
+    int i = 0;
+
+    for (; prefix[i]; i++) {
+        if (i >= ref.size() || data[i] != QLatin1Char(prefix[i]))
+            return false;
+    }
+
+    return true;
+}
+
+// QString::toInt() for a field that is expected to contain only digits
+int refToInt(const QStringRef &ref)
+{
+    const QChar *data = ref.unicode();
+    int value = 0;
+
+    for (int i = 0; i < ref.size(); i++) {
+        if (!data[i].isDigit())
+            return 0;
+        value = value * 10 + data[i].digitValue();
+    }
+
+    return value;
+}
+
+QStringList fieldList(const QString &string, char separator)
+{
+    QStringList result;
+
+    FieldTokenizer fields(&string, separator);
+    QStringRef field;
+    while (fields.nextNonEmpty(field))
+        result << field.toString();
+
+    return result;
+}
+
+QString firstField(const QString &string, char separator)
+{
+    FieldTokenizer fields(&string, separator);
+    QStringRef field;
+    if (fields.nextNonEmpty(field))
+        return field.toString();
 
-    return Event::UnknownStatus;
+    return QString();
 }
 
 // parse concatted & coalesced sip/tel/IM remote id column
 QString parseRemoteUid(const QString &remoteUid)
 {
-    QString result;
+    QStringRef first;
+
+    FieldTokenizer uids(&remoteUid, '\x1e');
+    QStringRef id;
+    while (uids.nextNonEmpty(id)) {
+        if (refStartsWith(id, "sip:") || refStartsWith(id, "sips:"))
+            return id.toString();
+        if (first.isNull())
+            first = id;
+    }
+
+    if (first.isNull())
+        return QString();
+
+    // same as section(IM_ADDRESS_SEPARATOR, -1)
+    const QChar *data = first.unicode();
+    int start = first.size();
+    while (start > 0 && data[start - 1] != IM_ADDRESS_SEPARATOR)
+        --start;
+
+    return QString(data + start, first.size() - start);
+}
+
+inline QVariant columnValue(const QSparqlResultRow &row, int column)
+{
+    return column >= 0 ? row.value(column) : QVariant();
+}
+
+// minimum number of rows worth handing to a worker thread
+#define MIN_DECODE_SLICE 64
 
-    QStringList uids = remoteUid.split('\x1e', QString::SkipEmptyParts);
-    foreach (QString id, uids) {
-        if (id.startsWith(LAT("sip:")) || id.startsWith(LAT("sips:")))
-            return id;
+void decodeRows(QueryResult *result, const QList<QSparqlResultRow> &rows,
+                int begin, int end, Event *events)
+{
+    for (int i = begin; i < end && !result->isCancelled(); i++)
+        result->fillEventFromRow(rows.at(i), events[i]);
+}
+
+class DecodeTask : public QRunnable
+{
+public:
+    DecodeTask(QueryResult *result, const QList<QSparqlResultRow> &rows,
+               int begin, int end, Event *events, QSemaphore *done)
+        : m_result(result), m_rows(rows), m_begin(begin), m_end(end),
+          m_events(events), m_done(done)
+    {
     }
 
-    if (!uids.isEmpty())
-        result = uids.first().section(IM_ADDRESS_SEPARATOR, -1);
+    void run()
+    {
+        decodeRows(m_result, m_rows, m_begin, m_end, m_events);
+        m_done->release();
+    }
 
-    return result;
+private:
+    QueryResult *m_result;
+    const QList<QSparqlResultRow> &m_rows;
+    int m_begin;
+    int m_end;
+    Event *m_events;
+    QSemaphore *m_done;
+};
+
+// column decoders, one per projected property; see decoderFor()
+#define DECODER(NAME) \
+    void NAME(const QueryResult &result, const QSparqlResultRow &row, \
+              int column, Event &event)
+#define VALUE row.value(column)
+
+DECODER(decodeId)
+{
+    Q_UNUSED(result);
+    event.setId(Event::urlToId(VALUE.toString()));
 }
 
-QString getAddresbookNameOrder()
+DECODER(decodeType)
 {
-    QSettings addressBookSettings(QSettings::IniFormat, QSettings::UserScope,
-                                  LAT("Nokia"), LAT("Contacts"));
-    return addressBookSettings.value(LAT("nameOrder")).toString();
+    Q_UNUSED(result);
+    Event::EventType type = nmoTypesToEventType(VALUE.toString());
+    if (type != Event::UnknownType)
+        event.setType(type);
 }
 
-bool isLastNameFirst = getAddresbookNameOrder() == LAT("last-first");
+DECODER(decodeDirection)
+{
+    Q_UNUSED(result);
+    event.setDirection(VALUE.toBool() ? Event::Outbound : Event::Inbound);
+}
 
+DECODER(decodeMessageToken)
+{
+    Q_UNUSED(result);
+    event.setMessageToken(VALUE.toString());
 }
 
-void QueryResult::fillEventFromModel(Event &event)
+DECODER(decodeMmsId)
 {
-    Event eventToFill;
+    Q_UNUSED(result);
+    event.setMmsId(VALUE.toString());
+}
 
-    // handle properties common to all events
-    foreach (Event::Property property, properties) {
-        switch (property) {
-        case Event::Id:
-            eventToFill.setId(Event::urlToId(RESULT_INDEX2(Event::Id).toString()));
-            break;
-        case Event::Type: {
-            QStringList types = RESULT_INDEX2(Event::Type).toString().split(QChar(','));
-            if (types.contains(LAT(NMO_ "MMSMessage"))) {
-                eventToFill.setType(Event::MMSEvent);
-            } else if (types.contains(LAT(NMO_ "SMSMessage"))) {
-                eventToFill.setType(Event::SMSEvent);
-            } else if (types.contains(LAT(NMO_ "IMMessage"))) {
-                eventToFill.setType(Event::IMEvent);
-            } else if (types.contains(LAT(NMO_ "Call"))) {
-                eventToFill.setType(Event::CallEvent);
-            }
-            break;
-        }
-        case Event::Direction:
-            if (RESULT_INDEX2(Event::Direction).toBool()) {
-                eventToFill.setDirection(Event::Outbound);
-            } else {
-                eventToFill.setDirection(Event::Inbound);
-            }
-            break;
-        case Event::MessageToken:
-            eventToFill.setMessageToken(RESULT_INDEX2(Event::MessageToken).toString());
-            break;
-        case Event::MmsId:
-            eventToFill.setMmsId(RESULT_INDEX2(Event::MmsId).toString());
-            break;
-        case Event::IsDraft:
-            eventToFill.setIsDraft(RESULT_INDEX2(Event::IsDraft).toBool());
-            break;
-        case Event::Subject:
-            eventToFill.setSubject(RESULT_INDEX2(Event::Subject).toString());
-            break;
-        case Event::FreeText:
-            eventToFill.setFreeText(RESULT_INDEX2(Event::FreeText).toString());
-            break;
-        case Event::ReportDelivery:
-            eventToFill.setReportDelivery(RESULT_INDEX2(Event::ReportDelivery).toBool());
-            break;
-        case Event::ReportRead:
-            eventToFill.setReportRead(RESULT_INDEX2(Event::ReportRead).toBool());
-            break;
-        case Event::ReportReadRequested:
-            eventToFill.setReportReadRequested(RESULT_INDEX2(Event::ReportReadRequested).toBool());
-            break;
-        case Event::BytesReceived:
-            eventToFill.setBytesReceived(RESULT_INDEX2(Event::BytesReceived).toInt());
-            break;
-        case Event::ContentLocation:
-            eventToFill.setContentLocation(RESULT_INDEX2(Event::ContentLocation).toString());
-            break;
-        case Event::GroupId: {
-            QString channel = RESULT_INDEX2(Event::GroupId).toString();
-            if (!channel.isEmpty())
-                eventToFill.setGroupId(Group::urlToId(channel));
-            break;
-        }
-        case Event::StartTime:
-            eventToFill.setStartTime(RESULT_INDEX2(Event::StartTime).toDateTime());
-            break;
-        case Event::EndTime:
-            eventToFill.setEndTime(RESULT_INDEX2(Event::EndTime).toDateTime());
-            break;
-        case Event::IsRead:
-            eventToFill.setIsRead(RESULT_INDEX2(Event::IsRead).toBool());
-            break;
-        case Event::Status: {
-            QString status = RESULT_INDEX2(Event::Status).toString();
-            if (!status.isEmpty())
-                eventToFill.setStatus(nmoStatusToEventStatus(status));
-            break;
-        }
-        case Event::ReadStatus: {
-            QString status = RESULT_INDEX2(Event::ReadStatus).toString();
-            if (!status.isEmpty()) {
-                if (status == LAT(NMO_ "read-status-read")) {
-                    eventToFill.setReadStatus(Event::ReadStatusRead);
-                } else if (status == LAT(NMO_ "read-status-deleted")) {
-                    eventToFill.setReadStatus(Event::ReadStatusDeleted);
-                } else {
-                    eventToFill.setReadStatus(Event::UnknownReadStatus);
-                }
-            }
-            break;
-        }
-        case Event::LastModified:
-            eventToFill.setLastModified(RESULT_INDEX2(Event::LastModified).toDateTime());
-            break;
-        case Event::IsMissedCall:
-            eventToFill.setIsMissedCall(!(RESULT_INDEX2(Event::IsMissedCall).toBool()));
-            break;
-        case Event::IsEmergencyCall:
-            eventToFill.setIsEmergencyCall(RESULT_INDEX2(Event::IsEmergencyCall).toBool());
-            break;
-        case Event::ParentId:
-            eventToFill.setParentId(RESULT_INDEX2(Event::ParentId).toInt());
-            break;
-        case Event::FromVCardFileName: { // handle Event::FromVCardLabel as well
-            QString filename = RESULT_INDEX2(Event::FromVCardFileName).toString();
-            if (!filename.isEmpty())
-                eventToFill.setFromVCard(filename, RESULT_INDEX2(Event::FromVCardLabel).toString());
-            break;
-        }
-        case Event::Encoding:
-            eventToFill.setEncoding(RESULT_INDEX2(Event::Encoding).toString());
-            break;
-        case Event::CharacterSet:
-            eventToFill.setCharacterSet(RESULT_INDEX2(Event::CharacterSet).toString());
-            break;
-        case Event::IsDeleted:
-            eventToFill.setDeleted(RESULT_INDEX2(Event::IsDeleted).toBool());
-            break;
-        case Event::ValidityPeriod:
-            eventToFill.setValidityPeriod(RESULT_INDEX2(Event::ValidityPeriod).toInt());
-            break;
-        case Event::Cc:
-            eventToFill.setCcList(RESULT_INDEX2(Event::Cc).toString().split('\x1e', QString::SkipEmptyParts));
-            break;
-        case Event::Bcc:
-            eventToFill.setBccList(RESULT_INDEX2(Event::Bcc).toString().split('\x1e', QString::SkipEmptyParts));
-            break;
-        case Event::To:
-        case Event::Headers: {
-            QHash<QString, QString> headers;
-            parseHeaders(RESULT_INDEX2(Event::Headers).toString(), headers);
-            eventToFill.setHeaders(headers);
-            break;
-        }
-        default:
-            break;// handle below
+DECODER(decodeIsDraft)
+{
+    Q_UNUSED(result);
+    event.setIsDraft(VALUE.toBool());
+}
+
+DECODER(decodeSubject)
+{
+    Q_UNUSED(result);
+    event.setSubject(VALUE.toString());
+}
+
+DECODER(decodeFreeText)
+{
+    Q_UNUSED(result);
+    event.setFreeText(VALUE.toString());
+}
+
+DECODER(decodeReportDelivery)
+{
+    Q_UNUSED(result);
+    event.setReportDelivery(VALUE.toBool());
+}
+
+DECODER(decodeReportRead)
+{
+    Q_UNUSED(result);
+    event.setReportRead(VALUE.toBool());
+}
+
+DECODER(decodeReportReadRequested)
+{
+    Q_UNUSED(result);
+    event.setReportReadRequested(VALUE.toBool());
+}
+
+DECODER(decodeBytesReceived)
+{
+    Q_UNUSED(result);
+    event.setBytesReceived(VALUE.toInt());
+}
+
+DECODER(decodeContentLocation)
+{
+    Q_UNUSED(result);
+    event.setContentLocation(VALUE.toString());
+}
+
+DECODER(decodeGroupId)
+{
+    Q_UNUSED(result);
+    QString channel = VALUE.toString();
+    if (!channel.isEmpty())
+        event.setGroupId(Group::urlToId(channel));
+}
+
+DECODER(decodeStartTime)
+{
+    Q_UNUSED(result);
+    event.setStartTime(VALUE.toDateTime());
+}
+
+DECODER(decodeEndTime)
+{
+    Q_UNUSED(result);
+    event.setEndTime(VALUE.toDateTime());
+}
+
+DECODER(decodeIsRead)
+{
+    Q_UNUSED(result);
+    event.setIsRead(VALUE.toBool());
+}
+
+DECODER(decodeStatus)
+{
+    Q_UNUSED(result);
+    QString status = VALUE.toString();
+    if (!status.isEmpty())
+        event.setStatus(nmoStatusToEventStatus(status));
+}
+
+DECODER(decodeReadStatus)
+{
+    Q_UNUSED(result);
+    QString status = VALUE.toString();
+    if (!status.isEmpty())
+        event.setReadStatus(readCodes.value(status, Event::UnknownReadStatus));
+}
+
+DECODER(decodeLastModified)
+{
+    Q_UNUSED(result);
+    event.setLastModified(VALUE.toDateTime());
+}
+
+DECODER(decodeIsMissedCall)
+{
+    Q_UNUSED(result);
+    event.setIsMissedCall(!VALUE.toBool());
+}
+
+DECODER(decodeIsEmergencyCall)
+{
+    Q_UNUSED(result);
+    event.setIsEmergencyCall(VALUE.toBool());
+}
+
+DECODER(decodeParentId)
+{
+    Q_UNUSED(result);
+    event.setParentId(VALUE.toInt());
+}
+
+// handles Event::FromVCardLabel as well
+DECODER(decodeFromVCard)
+{
+    QString filename = VALUE.toString();
+    if (!filename.isEmpty())
+        event.setFromVCard(filename,
+                           columnValue(row, result.columns.at(Event::FromVCardLabel)).toString());
+}
+
+DECODER(decodeEncoding)
+{
+    Q_UNUSED(result);
+    event.setEncoding(VALUE.toString());
+}
+
+DECODER(decodeCharacterSet)
+{
+    Q_UNUSED(result);
+    event.setCharacterSet(VALUE.toString());
+}
+
+DECODER(decodeIsDeleted)
+{
+    Q_UNUSED(result);
+    event.setDeleted(VALUE.toBool());
+}
+
+DECODER(decodeValidityPeriod)
+{
+    Q_UNUSED(result);
+    event.setValidityPeriod(VALUE.toInt());
+}
+
+DECODER(decodeCc)
+{
+    Q_UNUSED(result);
+    event.setCcList(fieldList(VALUE.toString(), '\x1e'));
+}
+
+DECODER(decodeBcc)
+{
+    Q_UNUSED(result);
+    event.setBccList(fieldList(VALUE.toString(), '\x1e'));
+}
+
+DECODER(decodeHeaders)
+{
+    Q_UNUSED(result);
+    QHash<QString, QString> headers;
+    QueryResult::parseHeaders(VALUE.toString(), headers);
+    event.setHeaders(headers);
+}
+
+#undef VALUE
+#undef DECODER
+
+// Properties without a decoder are handled after the decoders run
+// (local and remote uid, contacts, IsAction) or not read at all. To is
+// part of Headers, EventsQuery never projects it on its own.
+QueryResult::ColumnDecoder decoderFor(Event::Property property)
+{
+    switch (property) {
+    case Event::Id: return decodeId;
+    case Event::Type: return decodeType;
+    case Event::Direction: return decodeDirection;
+    case Event::MessageToken: return decodeMessageToken;
+    case Event::MmsId: return decodeMmsId;
+    case Event::IsDraft: return decodeIsDraft;
+    case Event::Subject: return decodeSubject;
+    case Event::FreeText: return decodeFreeText;
+    case Event::ReportDelivery: return decodeReportDelivery;
+    case Event::ReportRead: return decodeReportRead;
+    case Event::ReportReadRequested: return decodeReportReadRequested;
+    case Event::BytesReceived: return decodeBytesReceived;
+    case Event::ContentLocation: return decodeContentLocation;
+    case Event::GroupId: return decodeGroupId;
+    case Event::StartTime: return decodeStartTime;
+    case Event::EndTime: return decodeEndTime;
+    case Event::IsRead: return decodeIsRead;
+    case Event::Status: return decodeStatus;
+    case Event::ReadStatus: return decodeReadStatus;
+    case Event::LastModified: return decodeLastModified;
+    case Event::IsMissedCall: return decodeIsMissedCall;
+    case Event::IsEmergencyCall: return decodeIsEmergencyCall;
+    case Event::ParentId: return decodeParentId;
+    case Event::FromVCardFileName: return decodeFromVCard;
+    case Event::Encoding: return decodeEncoding;
+    case Event::CharacterSet: return decodeCharacterSet;
+    case Event::IsDeleted: return decodeIsDeleted;
+    case Event::ValidityPeriod: return decodeValidityPeriod;
+    case Event::Cc: return decodeCc;
+    case Event::Bcc: return decodeBcc;
+    case Event::Headers: return decodeHeaders;
+    default: return 0;
+    }
+}
+
+}
+
+void QueryResult::compileColumns()
+{
+    columns.fill(-1, Event::NumProperties);
+
+    for (int i = 0; i < properties.size(); i++) {
+        int &column = columns[properties.at(i)];
+        if (column < 0)
+            column = i;
+    }
+
+    steps.clear();
+    for (int p = 0; p < Event::NumProperties; p++) {
+        ColumnDecoder decode = decoderFor((Event::Property)p);
+        if (decode && columns.at(p) >= 0) {
+            ColumnStep step = { columns.at(p), decode };
+            steps.append(step);
         }
     }
 
+    QSharedPointer<ContactListener> listener = ContactListener::instance();
+    lastNameFirst = listener->isLastNameFirst();
+    preferNickname = listener->preferNickname();
+}
+
+void QueryResult::fillEventFromModel(Event &event)
+{
+    fillEventFromRow(result->current(), event);
+}
+
+QList<Event> QueryResult::fillEventsFromRows(const QList<QSparqlResultRow> &rows,
+                                             QThreadPool *pool)
+{
+    if (rows.isEmpty())
+        return QList<Event>();
+
+    // workers only read the plan, so it must be complete before they start
+    if (columns.isEmpty())
+        compileColumns();
+
+    QVector<Event> events(rows.size());
+    Event *data = events.data();
+
+    int slices = pool ? qMin(pool->maxThreadCount() + 1,
+                             rows.size() / MIN_DECODE_SLICE) : 1;
+    if (slices < 1)
+        slices = 1;
+    int sliceSize = (rows.size() + slices - 1) / slices;
+
+    QSemaphore done;
+    int started = 0;
+    for (int begin = sliceSize; begin < rows.size(); begin += sliceSize) {
+        DecodeTask *task = new DecodeTask(this, rows, begin,
+                                          qMin(begin + sliceSize, rows.size()),
+                                          data, &done);
+        pool->start(task);
+        started++;
+    }
+
+    // decode the first slice here while the pool handles the rest
+    decodeRows(this, rows, 0, sliceSize, data);
+    done.acquire(started);
+
+    if (isCancelled())
+        return QList<Event>();
+
+    return events.toList();
+}
+
+void QueryResult::fillEventFromRow(const QSparqlResultRow &row, Event &event)
+{
+    Event eventToFill;
+
+    if (columns.isEmpty())
+        compileColumns();
+
+    // typed setters for the projected columns, see compileColumns()
+    const ColumnStep *step = steps.constData();
+    for (int i = 0; i < steps.size(); i++)
+        step[i].decode(*this, row, step[i].column, eventToFill);
+
     // local/remote id and direction are common to all events
-    if (properties.contains(Event::LocalUid)
-        || properties.contains(Event::RemoteUid)) {
+    if (columns.at(Event::LocalUid) >= 0
+        || columns.at(Event::RemoteUid) >= 0) {
         // local contact: <telepathy:/org/.../gabble/jabber/dut_40localhost0>
         // remote contact: <telepathy:<account>!<imid>> or <tel:+35801234567>
         QString fromId = RESULT_INDEX2(Event::LocalUid).toString();
@@ -259,10 +654,11 @@ void QueryResult::fillEventFromModel(Event &event)
     // TODO: what to do with the contact id and nickname columns if
     // Event::ContactId and Event::ContactName are replaced with
     // Event::Contacts?
-    if (properties.contains(Event::ContactId)) {
+    if (columns.at(Event::ContactId) >= 0) {
         QList<Event::Contact> contacts;
         parseContacts(RESULT_INDEX2(Event::ContactId).toString(),
-                      eventToFill.localUid(), contacts);
+                      eventToFill.localUid(), lastNameFirst, preferNickname,
+                      contacts);
         eventToFill.setContacts(contacts);
     }
 
@@ -275,14 +671,9 @@ void QueryResult::fillGroupFromModel(Group &group)
 {
     Group groupToFill;
 
-    QStringList types = result->value(Group::LastEventType).toString().split(QChar(','));
-    if (types.contains(LAT(NMO_ "MMSMessage"))) {
-        groupToFill.setLastEventType(Event::MMSEvent);
-    } else if (types.contains(LAT(NMO_ "SMSMessage"))) {
-        groupToFill.setLastEventType(Event::SMSEvent);
-    } else if (types.contains(LAT(NMO_ "IMMessage"))) {
-        groupToFill.setLastEventType(Event::IMEvent);
-    }
+    Event::EventType type = nmoTypesToEventType(result->value(Group::LastEventType).toString());
+    if (type != Event::UnknownType && type != Event::CallEvent)
+        groupToFill.setLastEventType(type);
 
     QString status = result->value(Group::LastEventStatus).toString();
     if (!status.isEmpty())
@@ -316,9 +707,9 @@ void QueryResult::fillGroupFromModel(Group &group)
     groupToFill.setLastVCardFileName(result->value(Group::LastVCardFileName).toString());
     groupToFill.setLastVCardLabel(result->value(Group::LastVCardLabel).toString());
 
-    QStringList text = result->value(Group::LastMessageText).toString().split("\x1e", QString::SkipEmptyParts);
+    QString text = firstField(result->value(Group::LastMessageText).toString(), '\x1e');
     if (!text.isEmpty())
-        groupToFill.setLastMessageText(text[0]);
+        groupToFill.setLastMessageText(text);
 
     // tracker query returns 0 for non-existing messages... make the
     // value api-compatible
@@ -355,6 +746,11 @@ void QueryResult::fillMessagePartFromModel(MessagePart &messagePart)
     messagePart = newPart;
 }
 
+int QueryResult::messagePartEventId()
+{
+    return Event::urlToId(result->value(MessagePartColumnMessage).toString());
+}
+
 void QueryResult::fillCallGroupFromModel(Event &event)
 {
     Event eventToFill;
@@ -401,16 +797,34 @@ void QueryResult::parseHeaders(const QString &result,
      * key1 1D value1 1F key2 1D value2 1F ...
      */
 
-    QStringList headerList = result.split("\x1f", QString::SkipEmptyParts);
-    foreach (QString header, headerList) {
-        QStringList keyValue = header.split("\x1d");
-        if (keyValue.isEmpty() || keyValue[0].isEmpty()) continue;
-        headers.insert(keyValue[0], keyValue[1]);
+    FieldTokenizer headerList(&result, '\x1f');
+    QStringRef header;
+    while (headerList.nextNonEmpty(header)) {
+        FieldTokenizer keyValue(header, '\x1d');
+        QStringRef key, value;
+        keyValue.next(key);
+        if (key.isEmpty()) continue;
+        // tolerate headers without a value separator
+        keyValue.next(value);
+        headers.insert(key.toString(), value.toString());
     }
 }
 
 void QueryResult::parseContacts(const QString &result, const QString &localUid,
                                 QList<Event::Contact> &contacts)
+{
+    if (result.isEmpty())
+        return;
+
+    QSharedPointer<ContactListener> listener = ContactListener::instance();
+    parseContacts(result, localUid,
+                  listener->isLastNameFirst(), listener->preferNickname(),
+                  contacts);
+}
+
+void QueryResult::parseContacts(const QString &result, const QString &localUid,
+                                bool lastNameFirst, bool preferNickname,
+                                QList<Event::Contact> &contacts)
 {
     /*
      * Query result format:
@@ -422,38 +836,47 @@ void QueryResult::parseContacts(const QString &result, const QString &localUid,
      * imAddress   ::= 'telepathy:' imAccountPath '!' remoteUid
      */
 
-    // first split each contact to separate string
-    QStringList contactStringList = result.split('\x1c', QString::SkipEmptyParts);
-    foreach (QString contactString, contactStringList) {
+    QStringMatcher localUidMatcher(localUid);
+
+    // walk each contact in place, only names are copied out
+    FieldTokenizer contactList(&result, '\x1c');
+    QStringRef contactString;
+    while (contactList.nextNonEmpty(contactString)) {
         // split contact to namePart and nickPart
-        QStringList contactPartList = contactString.split('\x1d');
+        FieldTokenizer contactParts(contactString, '\x1d');
+        QStringRef namePart, nickPart, imNickPart;
+        contactParts.next(namePart);
 
         // get nickname
         QString contactNickname;
         QString imNickname;
-        if (contactPartList.size() > 1) {
+        if (contactParts.next(nickPart)) {
             // nco:nickname
-            contactNickname = contactPartList[1];
+            contactNickname = nickPart.toString();
         }
 
-        if (contactPartList.size() > 2) {
+        if (contactParts.next(imNickPart)) {
             // split nickPart to separate nickContacts
-            QStringList nickList = contactPartList[2].split('\x1e', QString::SkipEmptyParts);
-
-            foreach (QString nickContact, nickList) {
+            FieldTokenizer nickList(imNickPart, '\x1e');
+            QStringRef nickContact;
+            while (nickList.nextNonEmpty(nickContact)) {
                 // split nickContact to imAddress and nickname
-                QStringList imPartList = nickContact.split('\x1f', QString::SkipEmptyParts);
+                FieldTokenizer imParts(nickContact, '\x1f');
+                QStringRef imAddress, nickname;
+                if (!imParts.nextNonEmpty(imAddress)
+                    || !imParts.nextNonEmpty(nickname))
+                    continue;
 
                 // get nickname from part that matches localUid
-                if (imPartList[0].contains(localUid) && imPartList.size() > 1) {
-                    imNickname = imPartList[1];
+                if (localUidMatcher.indexIn(imAddress.unicode(), imAddress.size()) >= 0) {
+                    imNickname = nickname.toString();
                     break;
                 }
 
                 // if localUid doesn't match to any imAddress (for example in call/SMS case),
                 // first nickname in the list is used
-                if (imNickname.isEmpty() && imPartList.size() > 1) {
-                    imNickname = imPartList[1];
+                if (imNickname.isEmpty()) {
+                    imNickname = nickname.toString();
                 }
             }
         }
@@ -461,20 +884,19 @@ void QueryResult::parseContacts(const QString &result, const QString &localUid,
         // create contact
         Event::Contact contact;
         // split namePart to contact id, first name, last name and nickname
-        QStringList namePartList = contactPartList[0].split('\x1e');
-        if (!namePartList.isEmpty()) {
-            contact.first = namePartList[0].toInt();
-
-            QString firstName, lastName;
-            if (namePartList.size() >= 2)
-                firstName = namePartList[1];
-            if (namePartList.size() >= 3)
-                lastName = namePartList[2];
-            contact.second = buildContactName(firstName, lastName, contactNickname, imNickname);
-
-            if (!contacts.contains(contact))
-                contacts << contact;
-        }
+        FieldTokenizer nameParts(namePart, '\x1e');
+        QStringRef contactId, firstName, lastName;
+        nameParts.next(contactId);
+        nameParts.next(firstName);
+        nameParts.next(lastName);
+
+        contact.first = refToInt(contactId);
+        contact.second = buildContactName(firstName.toString(), lastName.toString(),
+                                          contactNickname, imNickname,
+                                          lastNameFirst, preferNickname);
+
+        if (!contacts.contains(contact))
+            contacts << contact;
     }
 }
 
@@ -482,13 +904,25 @@ QString QueryResult::buildContactName(const QString &firstName,
                                       const QString &lastName,
                                       const QString &contactNickname,
                                       const QString &imNickname)
+{
+    QSharedPointer<ContactListener> listener = ContactListener::instance();
+    return buildContactName(firstName, lastName, contactNickname, imNickname,
+                            listener->isLastNameFirst(), listener->preferNickname());
+}
+
+QString QueryResult::buildContactName(const QString &firstName,
+                                      const QString &lastName,
+                                      const QString &contactNickname,
+                                      const QString &imNickname,
+                                      bool lastNameFirst,
+                                      bool preferNickname)
 {
     QString name;
 
     QString realName;
     if (!firstName.isEmpty() || !lastName.isEmpty()) {
         QString lname;
-        if (ContactListener::instance()->isLastNameFirst())  {
+        if (lastNameFirst)  {
             realName = lastName;
             lname = firstName;
         } else {
@@ -503,7 +937,7 @@ QString QueryResult::buildContactName(const QString &firstName,
         }
     }
 
-    if (ContactListener::instance()->preferNickname()) {
+    if (preferNickname) {
         if (!contactNickname.isEmpty())
             name = contactNickname;
         else if (!realName.isEmpty())
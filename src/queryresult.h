@@ -25,8 +25,13 @@
 
 #include <QString>
 #include <QPointer>
+#include <QVector>
+#include <QAtomicInt>
 #include <QSparqlQuery>
 #include <QSparqlResult>
+#include <QSparqlResultRow>
+
+class QThreadPool;
 
 namespace CommHistory {
 
@@ -46,12 +51,60 @@ struct QueryResult {
     // for message part queries
     int eventId;
     QList<Event::Property> properties;
+    // decode plan: result column for each Event::Property, -1 if the
+    // property is not projected, and the typed setter for each projected
+    // column. See compileColumns().
+    typedef void (*ColumnDecoder)(const QueryResult &result,
+                                  const QSparqlResultRow &row,
+                                  int column, Event &event);
+    struct ColumnStep {
+        int column;
+        ColumnDecoder decode;
+    };
+    QVector<int> columns;
+    QVector<ColumnStep> steps;
+    // contact name settings, captured by compileColumns() so that rows
+    // can be decoded without touching ContactListener
+    bool lastNameFirst;
+    bool preferNickname;
+    // supersession token assigned by QueryRunner; the query is cancelled
+    // once the runner's cancel mark moves past it
+    int token;
+    const QAtomicInt *cancelledBefore;
+    // group the query is restricted to, -1 if unknown. See QueryCache.
+    int scopeGroupId;
+
+    QueryResult() : eventId(0), lastNameFirst(false), preferNickname(false),
+                    token(0), cancelledBefore(0), scopeGroupId(-1) {}
 
-    QueryResult() : eventId(0) {}
+    bool isCancelled() const {
+        return cancelledBefore && token < (int)*cancelledBefore;
+    }
+
+    /*!
+     * Build the decode plan from properties: the column of each
+     * property and the setters to run per row. QueryRunner does this once
+     * per query before reading any rows; fillEventFromModel() compiles
+     * it on demand for callers that set properties themselves.
+     */
+    void compileColumns();
 
     void fillEventFromModel(Event &event);
+    void fillEventFromRow(const QSparqlResultRow &row, Event &event);
+
+    /*!
+     * Decode rows into events, splitting the work between the calling
+     * thread and the threads of pool. Events are returned in row order.
+     * If pool is 0, all rows are decoded on the calling thread.
+     * Decoding stops early and an empty list is returned if the query
+     * is cancelled meanwhile.
+     */
+    QList<Event> fillEventsFromRows(const QList<QSparqlResultRow> &rows,
+                                    QThreadPool *pool);
     void fillGroupFromModel(Group &group);
     void fillMessagePartFromModel(MessagePart &part);
+    // id of the message the current message part row belongs to
+    int messagePartEventId();
     void fillCallGroupFromModel(Event &event);
 
     static void parseHeaders(const QString &result,
@@ -59,11 +112,20 @@ struct QueryResult {
 
     static void parseContacts(const QString &result, const QString &localUid,
                               QList<Event::Contact> &contacts);
+    static void parseContacts(const QString &result, const QString &localUid,
+                              bool lastNameFirst, bool preferNickname,
+                              QList<Event::Contact> &contacts);
 
     static QString buildContactName(const QString &firstName,
                                     const QString &lastName,
                                     const QString &contactNickname,
                                     const QString &imNickname);
+    static QString buildContactName(const QString &firstName,
+                                    const QString &lastName,
+                                    const QString &contactNickname,
+                                    const QString &imNickname,
+                                    bool lastNameFirst,
+                                    bool preferNickname);
 
     // columns for message part query
     enum {
@@ -21,6 +21,8 @@
 ******************************************************************************/
 
 #include <QMutex>
+#include <QThreadPool>
+#include <QTime>
 #include <QDebug>
 
 #include <QSparqlResultRow>
@@ -33,9 +35,13 @@
 #include "messagepart.h"
 #include "trackerio.h"
 #include "trackerio_p.h"
+#include "querycache.h"
 
 using namespace CommHistory;
 
+#define MIN_ADAPTIVE_CHUNK_SIZE 10
+#define MAX_ADAPTIVE_CHUNK_SIZE 1000
+
 QueryRunner::QueryRunner(TrackerIO *trackerIO, QObject *parent)
         : QObject(parent)
         , m_streamedMode(false)
@@ -43,6 +49,21 @@ QueryRunner::QueryRunner(TrackerIO *trackerIO, QObject *parent)
         , m_firstChunkSize(0)
         , m_enableQueue(false)
         , m_canFetchMore(false)
+        , m_decodeThreads(1)
+        , m_adaptive(false)
+        , m_latencyTarget(DEFAULT_CHUNK_LATENCY)
+        , m_adaptiveChunkSize(0)
+        , m_nextChunkSize(0)
+        , m_chunkStart(0)
+        , m_decodeCost(0)
+        , m_insertCost(0)
+        , m_decodePool(0)
+        , m_maxInFlight(1)
+        , m_nextToken(1)
+        , m_cancelledBefore(0)
+        , m_cacheScope(-1)
+        , m_caching(false)
+        , m_cacheGeneration(0)
         , m_pTracker(trackerIO)
 {
     qDebug() << __PRETTY_FUNCTION__;
@@ -53,6 +74,11 @@ QueryRunner::~QueryRunner()
     qDebug() << __PRETTY_FUNCTION__ << this << this->thread();
 
     endActiveQuery();
+
+    foreach (const QueryResult &query, m_prefetchedQueries) {
+        if (query.result)
+            QMetaObject::invokeMethod(query.result, "deleteLater", Qt::QueuedConnection);
+    }
 }
 
 void QueryRunner::setStreamedMode(bool mode)
@@ -70,14 +96,65 @@ void QueryRunner::setFirstChunkSize(int size)
     m_firstChunkSize = size;
 }
 
+void QueryRunner::setAdaptiveMode(bool adaptive)
+{
+    m_adaptive = adaptive;
+}
+
+void QueryRunner::setLatencyTarget(int msecs)
+{
+    m_latencyTarget = msecs;
+}
+
+void QueryRunner::setupStreaming(int chunkSize, int firstChunkSize,
+                                 bool adaptive, int latencyTarget)
+{
+    setStreamedMode(true);
+    setChunkSize(chunkSize);
+    setFirstChunkSize(firstChunkSize);
+    setAdaptiveMode(adaptive);
+    setLatencyTarget(latencyTarget);
+}
+
+void QueryRunner::reportInsertCost(int rows, int msecs)
+{
+    if (rows <= 0)
+        return;
+
+    qreal cost = (qreal)msecs / rows;
+
+    QMutexLocker locker(&m_mutex);
+    m_insertCost = m_insertCost > 0 ? (3 * m_insertCost + cost) / 4 : cost;
+}
+
+void QueryRunner::setMaxInFlight(int queries)
+{
+    m_maxInFlight = queries;
+}
+
+void QueryRunner::setQueryCache(QSharedPointer<QueryCache> cache)
+{
+    m_cache = cache;
+}
+
+void QueryRunner::setCacheScope(int groupId)
+{
+    m_cacheScope = groupId;
+}
+
+void QueryRunner::setDecodeThreads(int threads)
+{
+    m_decodeThreads = threads;
+}
+
 void QueryRunner::enableQueue(bool enable)
 {
     m_enableQueue = enable;
 }
 
-void QueryRunner::addQueryToQueue(QueryType type,
-                                  const QSparqlQuery &query,
-                                  const QList<Event::Property> &properties)
+int QueryRunner::addQueryToQueue(QueryType type,
+                                 const QSparqlQuery &query,
+                                 const QList<Event::Property> &properties)
 {
     qDebug() << Q_FUNC_INFO << QThread::currentThread()  << this << "->";
 
@@ -88,6 +165,9 @@ void QueryRunner::addQueryToQueue(QueryType type,
     result.queryType = type;
     result.properties = properties;
     result.eventId = 0;
+    result.token = m_nextToken++;
+    result.cancelledBefore = &m_cancelledBefore;
+    result.scopeGroupId = m_cacheScope;
 
     m_queries.append(result);
 
@@ -99,45 +179,61 @@ void QueryRunner::addQueryToQueue(QueryType type,
         QMetaObject::invokeMethod(this, "nextSlot", Qt::QueuedConnection);
 
     qDebug() << Q_FUNC_INFO << QThread::currentThread()  << this << "<-";
+
+    return result.token;
 }
 
-void QueryRunner::runEventsQuery(const QString &query, const QList<Event::Property> &properties)
+int QueryRunner::runEventsQuery(const QString &query, const QList<Event::Property> &properties)
 {
     qDebug() << Q_FUNC_INFO << QThread::currentThread()  << this << "->";
 
     QSparqlQuery sparqlQuery(query);
-    addQueryToQueue(EventQuery, sparqlQuery, properties);
+    return addQueryToQueue(EventQuery, sparqlQuery, properties);
 }
 
-void QueryRunner::runGroupQuery(const QString &query)
+int QueryRunner::runGroupQuery(const QString &query)
 {
     qDebug() << Q_FUNC_INFO << QThread::currentThread()  << this << "->";
 
     QSparqlQuery sparqlQuery(query);
-    addQueryToQueue(GroupQuery, sparqlQuery);
+    return addQueryToQueue(GroupQuery, sparqlQuery);
 }
 
-void QueryRunner::runGroupedCallQuery(const QString &query)
+int QueryRunner::runGroupedCallQuery(const QString &query)
 {
     qDebug() << Q_FUNC_INFO << QThread::currentThread()  << this << "->";
 
     QSparqlQuery sparqlQuery(query);
-    addQueryToQueue(GroupedCallQuery, sparqlQuery);
+    return addQueryToQueue(GroupedCallQuery, sparqlQuery);
 }
 
-void QueryRunner::runMessagePartQuery(const QString &query)
+int QueryRunner::runMessagePartQuery(const QString &query)
 {
     qDebug() << Q_FUNC_INFO << QThread::currentThread()  << this << "->";
 
     QSparqlQuery sparqlQuery(query);
-    addQueryToQueue(MessagePartQuery, sparqlQuery);
+    return addQueryToQueue(MessagePartQuery, sparqlQuery);
 }
 
-void QueryRunner::runQuery(const QSparqlQuery &query)
+int QueryRunner::runQuery(const QSparqlQuery &query)
 {
     qDebug() << Q_FUNC_INFO << QThread::currentThread()  << this << "->";
 
-    addQueryToQueue(GenericQuery, query);
+    return addQueryToQueue(GenericQuery, query);
+}
+
+int QueryRunner::cancelQueries()
+{
+    qDebug() << Q_FUNC_INFO << QThread::currentThread() << this;
+
+    QMutexLocker locker(&m_mutex);
+
+    // queued queries are dropped here, running ones are cleaned up by
+    // the runner thread when it next looks at them
+    m_queries.clear();
+    m_cancelledBefore.fetchAndStoreOrdered(m_nextToken);
+
+    return m_nextToken;
 }
 
 void QueryRunner::startQueue()
@@ -154,24 +250,67 @@ void QueryRunner::fetchMore()
 
 void QueryRunner::startNextQueryIfReady()
 {
-    if (m_enableQueue && m_activeQuery.result)
-        return;  // ongoing query and queue mode enabled
+    // a cancelled query does not block the queue, even if its result
+    // has nothing more to signal
+    if (m_activeQuery.result && m_activeQuery.isCancelled())
+        endActiveQuery();
+
+    if (m_enableQueue && m_activeQuery.result) {
+        // ongoing query and queue mode enabled, only start more
+        // queries in the background if allowed
+        prefetchQueries();
+        return;
+    }
 
     endActiveQuery();
 
+    bool prefetched = false;
     m_mutex.lock();
-    if (!m_queries.isEmpty()) {
+    while (!m_prefetchedQueries.isEmpty()
+           && m_prefetchedQueries.first().isCancelled()) {
+        QueryResult cancelled = m_prefetchedQueries.takeFirst();
+        if (cancelled.result)
+            QMetaObject::invokeMethod(cancelled.result, "deleteLater", Qt::QueuedConnection);
+    }
+    if (!m_prefetchedQueries.isEmpty()) {
+        // continue with the oldest query already running in the background
+        m_activeQuery = m_prefetchedQueries.takeFirst();
+        prefetched = true;
+    } else if (!m_queries.isEmpty()) {
         // start new query
         m_activeQuery = m_queries.takeFirst();
+        if (m_activeQuery.queryType == EventQuery)
+            m_activeQuery.compileColumns();
 
         qDebug() << &(m_pTracker->d->connection()) << QThread::currentThread();
     }
     m_mutex.unlock();
 
-    if (!m_activeQuery.query.query().isEmpty() && m_activeQuery.result.isNull()) {
+    if (!m_activeQuery.query.query().isEmpty()
+        && (m_activeQuery.result.isNull() || prefetched)) {
         // TODO: try to put query execution to trackerIOPrivate
         lastReadPos = QSparql::BeforeFirstRow;
-        m_syncMode = m_streamedMode && m_pTracker->d->connection().hasFeature(QSparqlConnection::SyncExec);
+        m_chunkStart = 0;
+        m_adaptiveChunkSize = m_firstChunkSize > 0 ? m_firstChunkSize : m_chunkSize;
+        m_nextChunkSize = m_adaptiveChunkSize;
+        m_syncMode = !prefetched
+                     && m_streamedMode
+                     && m_pTracker->d->connection().hasFeature(QSparqlConnection::SyncExec);
+
+        // the first query after a cancellation starts from a clean
+        // state, the receiver has reset its own
+        if (m_activeQuery.token == (int)m_cancelledBefore)
+            m_canFetchMore = false;
+        emit queryStarted(m_activeQuery.token);
+
+        if (!prefetched && deliverFromCache())
+            return;
+
+        // results of queries already running may predate the generation
+        m_caching = m_cache && !prefetched && m_activeQuery.queryType != MessagePartQuery
+            && m_activeQuery.queryType != GenericQuery && QueryCache::isEnabled();
+        if (m_caching)
+            m_cacheGeneration = m_cache->generation();
 
         if (m_syncMode) {
             m_activeQuery.result = m_pTracker->d->connection().syncExec(m_activeQuery.query);
@@ -180,7 +319,8 @@ void QueryRunner::startNextQueryIfReady()
             else
                 readData();
         } else {
-            m_activeQuery.result = m_pTracker->d->connection().exec(m_activeQuery.query);
+            if (!prefetched)
+                m_activeQuery.result = m_pTracker->d->connection().exec(m_activeQuery.query);
 
             if (m_activeQuery.result->hasError()) {
                 finished();
@@ -191,11 +331,55 @@ void QueryRunner::startNextQueryIfReady()
                 connect(m_activeQuery.result.data(),
                         SIGNAL(finished()),
                         this, SLOT(finished()));
+
+                prefetchQueries();
+
+                if (prefetched) {
+                    // rows that arrived while the query was waiting for
+                    // its turn were not signalled to us
+                    if (m_activeQuery.result->size() > 0)
+                        dataReady(m_activeQuery.result->size());
+                    if (m_activeQuery.result && m_activeQuery.result->isFinished())
+                        finished();
+                }
             }
         }
     }
 }
 
+void QueryRunner::prefetchQueries()
+{
+    if (!m_enableQueue)
+        return;
+
+    // m_prefetchedQueries is only changed in the runner thread, but
+    // m_queries is shared with the callers of addQueryToQueue(): take
+    // the queries out under the lock and start them without it.
+    QList<QueryResult> started;
+    m_mutex.lock();
+    while (m_prefetchedQueries.size() + started.size() + 1 < m_maxInFlight
+           && !m_queries.isEmpty())
+        started.append(m_queries.takeFirst());
+    m_mutex.unlock();
+
+    if (started.isEmpty())
+        return;
+
+    for (int i = 0; i < started.size(); i++) {
+        QueryResult &query = started[i];
+        if (query.queryType == EventQuery)
+            query.compileColumns();
+
+        // results are delivered when the query becomes the active one
+        query.result = m_pTracker->d->connection().exec(query.query);
+    }
+
+    QMutexLocker locker(&m_mutex);
+    m_prefetchedQueries << started;
+
+    qDebug() << Q_FUNC_INFO << "in flight:" << m_prefetchedQueries.size() + 1;
+}
+
 void QueryRunner::nextSlot()
 {
     qDebug() << Q_FUNC_INFO << QThread::currentThread() << this;
@@ -208,6 +392,15 @@ void QueryRunner::fetchMoreSlot()
     qDebug() << Q_FUNC_INFO << QThread::currentThread();
 
     if (m_activeQuery.result) {
+        if (m_activeQuery.isCancelled()) {
+            abandonActiveQuery();
+            return;
+        }
+        if (m_adaptive) {
+            // start a new chunk with the size chosen for it
+            m_chunkStart = lastReadPos == QSparql::BeforeFirstRow ? 0 : lastReadPos + 1;
+            m_adaptiveChunkSize = m_nextChunkSize;
+        }
         readData();
     }
 }
@@ -220,6 +413,9 @@ bool QueryRunner::reallyFetchMore(int pos)
         if (pos == QSparql::AfterLastRow)
             return false;
 
+        if (m_adaptive && m_adaptiveChunkSize > 0)
+            return pos - m_chunkStart < m_adaptiveChunkSize - 1;
+
         qDebug() << Q_FUNC_INFO << pos << m_firstChunkSize << m_chunkSize;
 
         if (pos == m_firstChunkSize - 1)
@@ -234,6 +430,45 @@ bool QueryRunner::reallyFetchMore(int pos)
     return true;
 }
 
+void QueryRunner::updateDecodeCost(int rows, int msecs)
+{
+    if (rows <= 0)
+        return;
+
+    qreal cost = (qreal)msecs / rows;
+    m_decodeCost = m_decodeCost > 0 ? (3 * m_decodeCost + cost) / 4 : cost;
+
+    // size the next chunk once the current one is complete
+    if (reallyFetchMore(lastReadPos))
+        return;
+
+    qreal rowCost;
+    {
+        QMutexLocker locker(&m_mutex);
+        rowCost = m_decodeCost + m_insertCost;
+    }
+
+    int size = rowCost > 0 ? (int)(m_latencyTarget / rowCost) : MAX_ADAPTIVE_CHUNK_SIZE;
+    m_nextChunkSize = qBound(MIN_ADAPTIVE_CHUNK_SIZE, size, MAX_ADAPTIVE_CHUNK_SIZE);
+
+    qDebug() << Q_FUNC_INFO << "decode" << m_decodeCost << "insert" << m_insertCost
+             << "ms/row, next chunk" << m_nextChunkSize;
+    emit chunkSizeAdapted(m_nextChunkSize);
+}
+
+QThreadPool* QueryRunner::decodePool()
+{
+    if (m_decodeThreads <= 1)
+        return 0;
+
+    if (!m_decodePool)
+        m_decodePool = new QThreadPool(this);
+    // the runner thread decodes one slice itself
+    m_decodePool->setMaxThreadCount(m_decodeThreads - 1);
+
+    return m_decodePool;
+}
+
 void QueryRunner::dataReady(int totalCount)
 {
     qDebug() << Q_FUNC_INFO << totalCount;
@@ -250,20 +485,35 @@ void QueryRunner::readData()
     else
         ++start;
     int added = 0;
+    int decodeTime = 0;
 
     qDebug() << Q_FUNC_INFO << "read from:" << start;
 
+    if (m_activeQuery.isCancelled()) {
+        abandonActiveQuery();
+        return;
+    }
+
+    QTime decodeTimer;
+    decodeTimer.start();
+
     m_activeQuery.result->setPos(lastReadPos);
 
     if (m_activeQuery.queryType == EventQuery) {
         QList<Event> events;
+        QList<QSparqlResultRow> rows;
         QVariantList extra;
+        QThreadPool *pool = decodePool();
 
-        while (m_activeQuery.result->next()) {
-            Event event;
-
-            m_activeQuery.fillEventFromModel(event);
-            events.append(event);
+        while (!m_activeQuery.isCancelled() && m_activeQuery.result->next()) {
+            if (pool) {
+                // decoded below in one go
+                rows.append(m_activeQuery.result->current());
+            } else {
+                Event event;
+                m_activeQuery.fillEventFromModel(event);
+                events.append(event);
+            }
 
             int max = m_activeQuery.result->current().count();
             for(int i = m_activeQuery.properties.size(); i < max; i++) {
@@ -275,6 +525,20 @@ void QueryRunner::readData()
             if (!reallyFetchMore(lastReadPos))
                 break;
         }
+        if (!rows.isEmpty())
+            events = m_activeQuery.fillEventsFromRows(rows, pool);
+        decodeTime = decodeTimer.elapsed();
+
+        if (m_activeQuery.isCancelled()) {
+            abandonActiveQuery();
+            return;
+        }
+
+        if (m_caching) {
+            m_cachedEvents.append(events);
+            m_cachedExtra.append(extra);
+        }
+
         checkCanFetchMoreChange();
         if (added) {
             emit eventsReceived(start, start + added - 1, events);
@@ -285,7 +549,7 @@ void QueryRunner::readData()
     } else if (m_activeQuery.queryType == GroupQuery) {
         QList<Group> groups;
 
-        while (m_activeQuery.result->next()) {
+        while (!m_activeQuery.isCancelled() && m_activeQuery.result->next()) {
             Group group;
             m_activeQuery.fillGroupFromModel(group);
             groups.append(group);
@@ -294,13 +558,31 @@ void QueryRunner::readData()
             if (!reallyFetchMore(lastReadPos))
                 break;
         }
+        decodeTime = decodeTimer.elapsed();
+
+        if (m_activeQuery.isCancelled()) {
+            abandonActiveQuery();
+            return;
+        }
+
+        if (m_caching)
+            m_cachedGroups.append(groups);
 
         checkCanFetchMoreChange();
         if (added)
             emit groupsReceived(start, start + added - 1, groups);
     } else if (m_activeQuery.queryType == MessagePartQuery) {
+        // rows of one query may belong to several messages, in order
         QList<MessagePart> parts;
-        while (m_activeQuery.result->next()) {
+        int eventId = 0;
+        while (!m_activeQuery.isCancelled() && m_activeQuery.result->next()) {
+            int partEventId = m_activeQuery.messagePartEventId();
+            if (partEventId != eventId && !parts.isEmpty()) {
+                emit messagePartsReceived(eventId, parts);
+                parts.clear();
+            }
+            eventId = partEventId;
+
             MessagePart part;
             m_activeQuery.fillMessagePartFromModel(part);
             parts.append(part);
@@ -309,14 +591,20 @@ void QueryRunner::readData()
             if (!reallyFetchMore(lastReadPos))
                 break;
         }
+        decodeTime = decodeTimer.elapsed();
+
+        if (m_activeQuery.isCancelled()) {
+            abandonActiveQuery();
+            return;
+        }
 
         checkCanFetchMoreChange();
-        if (added)
-            emit messagePartsReceived(m_activeQuery.eventId, parts);
+        if (!parts.isEmpty())
+            emit messagePartsReceived(eventId, parts);
     } else if (m_activeQuery.queryType == GroupedCallQuery) {
         QList<Event> events;
 
-        while (m_activeQuery.result->next()) {
+        while (!m_activeQuery.isCancelled() && m_activeQuery.result->next()) {
             Event event;
             m_activeQuery.fillCallGroupFromModel(event);
             events.append(event);
@@ -325,12 +613,24 @@ void QueryRunner::readData()
             if (!reallyFetchMore(lastReadPos))
                 break;
         }
+        decodeTime = decodeTimer.elapsed();
+
+        if (m_activeQuery.isCancelled()) {
+            abandonActiveQuery();
+            return;
+        }
+
+        if (m_caching)
+            m_cachedEvents.append(events);
 
         checkCanFetchMoreChange();
         if (added)
             emit eventsReceived(start, start + added - 1, events);
     }
 
+    if (m_adaptive && m_streamedMode)
+        updateDecodeCost(added, decodeTime);
+
     // really finish current query in case more date than chunk size were read
     if (m_streamedMode && !m_canFetchMore)
         finished();
@@ -356,9 +656,14 @@ void QueryRunner::finished()
 
     bool continueNext = false;
 
+    if (m_activeQuery.result && m_activeQuery.isCancelled()) {
+        abandonActiveQuery();
+        return;
+    }
+
     if (m_activeQuery.queryType == GenericQuery) {
         emit resultsReceived(m_activeQuery.result);
-        continueNext = m_enableQueue && !m_queries.isEmpty();
+        continueNext = m_enableQueue && hasQueuedQueries();
     } else {
         // ignore if there is no query or not all data were sent yet
         if (m_activeQuery.result.isNull()
@@ -372,10 +677,8 @@ void QueryRunner::finished()
             qCritical() << m_activeQuery.result->lastError().message();
         } else {
             checkCanFetchMoreChange();
-            {
-                QMutexLocker locker(&m_mutex);
-                continueNext = m_enableQueue && !m_queries.isEmpty();
-            }
+            storeInCache();
+            continueNext = m_enableQueue && hasQueuedQueries();
         }
 
         if (!continueNext)
@@ -390,8 +693,96 @@ void QueryRunner::finished()
     }
 }
 
+bool QueryRunner::hasQueuedQueries()
+{
+    QMutexLocker locker(&m_mutex);
+    return !m_queries.isEmpty() || !m_prefetchedQueries.isEmpty();
+}
+
+void QueryRunner::abandonActiveQuery()
+{
+    qDebug() << Q_FUNC_INFO << "cancelled query" << m_activeQuery.token;
+
+    endActiveQuery();
+
+    // in queue mode, queries added after the cancellation may have been
+    // started while this one was still active; nobody else restarts them
+    if (m_enableQueue && hasQueuedQueries())
+        nextSlot();
+}
+
+bool QueryRunner::deliverFromCache()
+{
+    // no key is built while the cache is disabled
+    if (!m_cache
+        || !QueryCache::isEnabled()
+        || m_activeQuery.queryType == MessagePartQuery
+        || m_activeQuery.queryType == GenericQuery)
+        return false;
+
+    QString key = m_activeQuery.query.preparedQueryText();
+
+    if (m_activeQuery.queryType == GroupQuery) {
+        QList<Group> groups;
+        if (!m_cache->findGroups(key, groups))
+            return false;
+
+        if (!groups.isEmpty())
+            emit groupsReceived(0, groups.size() - 1, groups);
+    } else {
+        QList<Event> events;
+        QVariantList extra;
+        if (!m_cache->findEvents(m_activeQuery.queryType, key, events, extra))
+            return false;
+
+        if (!events.isEmpty()) {
+            emit eventsReceived(0, events.size() - 1, events);
+            if (!extra.isEmpty())
+                emit eventsReceivedExtra(events, extra);
+        }
+    }
+
+    qDebug() << Q_FUNC_INFO << "cache hit for query" << m_activeQuery.token;
+
+    // everything was delivered in one go
+    if (m_canFetchMore) {
+        m_canFetchMore = false;
+        emit canFetchMoreChanged(m_canFetchMore);
+    }
+
+    bool continueNext = m_enableQueue && hasQueuedQueries();
+    if (!continueNext)
+        emit modelUpdated(true);
+
+    endActiveQuery();
+
+    if (continueNext)
+        nextSlot();
+
+    return true;
+}
+
+void QueryRunner::storeInCache()
+{
+    if (!m_caching)
+        return;
+
+    QString key = m_activeQuery.query.preparedQueryText();
+
+    if (m_activeQuery.queryType == GroupQuery)
+        m_cache->insertGroups(key, m_cachedGroups, m_cacheGeneration);
+    else
+        m_cache->insertEvents(m_activeQuery.queryType, key, m_activeQuery.scopeGroupId,
+                              m_cachedEvents, m_cachedExtra, m_cacheGeneration);
+}
+
 void QueryRunner::endActiveQuery()
 {
+    m_caching = false;
+    m_cachedEvents.clear();
+    m_cachedGroups.clear();
+    m_cachedExtra.clear();
+
     if (m_activeQuery.result) {
         m_activeQuery.result->disconnect(this);
         if (m_activeQuery.queryType != GenericQuery)
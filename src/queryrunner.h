@@ -24,14 +24,23 @@
 #define COMMHISTORY_QUERYTHREAD_H
 
 #include <QMutex>
+#include <QSharedPointer>
+
+class QThreadPool;
 
 #include "event.h"
 #include "group.h"
 #include "queryresult.h"
 
+// defaults of the streamed query modes of the models, see
+// EventModel::setChunkSize() and EventModel::setChunkLatencyTarget()
+#define DEFAULT_CHUNK_SIZE 50
+#define DEFAULT_CHUNK_LATENCY 50 // msecs
+
 namespace CommHistory {
 
 class TrackerIO;
+class QueryCache;
 
 /*!
  * \class QueryRunner
@@ -52,27 +61,69 @@ public:
 
     void setFirstChunkSize(int size);
 
+    // If true, streamed queries pick chunk sizes on their own: the
+    // first chunk uses the first chunk size (or chunk size), later ones
+    // are sized from the measured per-row decode and insert costs so
+    // that a chunk takes about latencyTarget milliseconds.
+    void setAdaptiveMode(bool adaptive);
+    void setLatencyTarget(int msecs);
+
+    // Switch to streamed mode with the chunk settings of a model.
+    void setupStreaming(int chunkSize, int firstChunkSize,
+                        bool adaptive, int latencyTarget);
+
+    // Report the time the model spent inserting rows of a received
+    // chunk. Used in adaptive mode, may be called from any thread.
+    void reportInsertCost(int rows, int msecs);
+
+    // Number of threads used for decoding event rows. With more than one
+    // thread, each chunk of rows is decoded in parallel by a worker pool;
+    // results are still delivered in row order. Default is 1.
+    void setDecodeThreads(int threads);
+
     // If false (default), runQuery() cancels any ongoing queries before
     // starting a new one.
 
     // If true, runQuery() will queue multiple queries and results will
-    // be returned sequentially. The queue will not be started until you
-    // call startQueue(). Note that queued queries are only started
-    // after the previous query has been fully completed, so streamed
-    // queries will block the queue until all available rows have been
-    // fetched.
+    // be returned sequentially, in the order the queries were added.
+    // The queue will not be started until you call startQueue(). By
+    // default a queued query is only started after the previous one
+    // has been fully completed, so streamed queries block the queue
+    // until all available rows have been fetched; see setMaxInFlight().
     void enableQueue(bool enable = true);
 
-    void addQueryToQueue(QueryType type,
-                         const QSparqlQuery &query,
-                         const QList<Event::Property> &properties = Event::allProperties().toList());
-
-    void runEventsQuery(const QString &query, const QList<Event::Property> &properties);
-    void runGroupQuery(const QString &query);
-    void runGroupedCallQuery(const QString &query);
-    void runMessagePartQuery(const QString &query);
+    // In queue mode, allow up to this many queries to be executed by
+    // tracker at the same time. Results are still delivered one query
+    // at a time in the order the queries were added. Default is 1.
+    void setMaxInFlight(int queries);
+
+    // Serve event, group and grouped call queries from cache if
+    // possible, and store complete results of others there.
+    void setQueryCache(QSharedPointer<QueryCache> cache);
+    // Group the following queries are restricted to, -1 (default) if
+    // unknown. Helps the cache to keep results over unrelated changes.
+    void setCacheScope(int groupId);
+
+    // Queue a query. Returns the token of the query, which is announced
+    // with queryStarted() before any of its results are delivered.
+    int addQueryToQueue(QueryType type,
+                        const QSparqlQuery &query,
+                        const QList<Event::Property> &properties = Event::allProperties().toList());
+
+    int runEventsQuery(const QString &query, const QList<Event::Property> &properties);
+    int runGroupQuery(const QString &query);
+    int runGroupedCallQuery(const QString &query);
+    int runMessagePartQuery(const QString &query);
     // Run generic sparql query. Caller is responsible for deleting the result.
-    void runQuery(const QSparqlQuery &query);
+    int runQuery(const QSparqlQuery &query);
+
+    // Cancel all queued and running queries. Decoding of a running query
+    // stops at the next row and none of its results are emitted anymore.
+    // Results already emitted through queued connections are still on
+    // their way: receivers should drop deliveries until queryStarted()
+    // announces a token at least as large as the returned one, which is
+    // the token of the next query added. May be called from any thread.
+    int cancelQueries();
 
     void startQueue();
 
@@ -86,6 +137,10 @@ Q_SIGNALS:
     void resultsReceived(QSparqlResult *result);
     void canFetchMoreChanged(bool canFetch);
     void modelUpdated(bool successful);
+    // debug: chunk size chosen for the next chunk in adaptive mode
+    void chunkSizeAdapted(int size);
+    // Results emitted after this belong to the query with token.
+    void queryStarted(int token);
 
 private Q_SLOTS:
     void dataReady(int totalCount);
@@ -97,8 +152,15 @@ private:
     void checkCanFetchMoreChange();
     void startNextQueryIfReady();
     bool reallyFetchMore(int pos);
+    QThreadPool* decodePool();
+    void updateDecodeCost(int rows, int msecs);
     void readData();
     void endActiveQuery();
+    void abandonActiveQuery();
+    bool deliverFromCache();
+    void storeInCache();
+    void prefetchQueries();
+    bool hasQueuedQueries();
 
 private:
     bool m_streamedMode;
@@ -106,10 +168,35 @@ private:
     int m_firstChunkSize;
     bool m_enableQueue;
     bool m_canFetchMore;
+    int m_decodeThreads;
+
+    bool m_adaptive;
+    int m_latencyTarget;
+    int m_adaptiveChunkSize;
+    int m_nextChunkSize;
+    int m_chunkStart;
+    // moving averages in msecs per row
+    qreal m_decodeCost;
+    qreal m_insertCost;
+    QThreadPool *m_decodePool;
 
-    QMutex m_mutex; // protects m_queries
+    QMutex m_mutex; // protects m_queries and m_prefetchedQueries
 
     QList<CommHistory::QueryResult> m_queries;
+    // queries executing in the background, waiting for their turn
+    QList<CommHistory::QueryResult> m_prefetchedQueries;
+    int m_maxInFlight;
+    int m_nextToken; // protected by m_mutex
+    QAtomicInt m_cancelledBefore;
+
+    QSharedPointer<QueryCache> m_cache;
+    int m_cacheScope;
+    // results of the active query collected for the cache
+    bool m_caching;
+    int m_cacheGeneration;
+    QList<Event> m_cachedEvents;
+    QList<Group> m_cachedGroups;
+    QVariantList m_cachedExtra;
     CommHistory::QueryResult m_activeQuery;
     int lastReadPos;
 
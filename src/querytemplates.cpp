@@ -0,0 +1,128 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** Contact: Reto Zingg <reto.zingg@nokia.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include <QCache>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QUrl>
+
+#include "querytemplates.h"
+
+using namespace CommHistory;
+
+namespace {
+    QMutex templateMutex;
+    QCache<QString, QueryTemplates::Template> templates(QueryTemplates::MaxTemplates);
+    QueryTemplates::Stats templateStats;
+
+    int valueLength(const QVariant &value)
+    {
+        if (value.type() == QVariant::Url)
+            return value.toUrl().toEncoded().size();
+        return value.toString().size();
+    }
+}
+
+bool QueryTemplates::find(const QString &shape, Template &result)
+{
+    QMutexLocker lock(&templateMutex);
+
+    // object() refreshes the LRU order
+    Template *cached = templates.object(shape);
+    if (!cached) {
+        templateStats.misses++;
+        return false;
+    }
+
+    templateStats.hits++;
+    result = *cached;
+    return true;
+}
+
+void QueryTemplates::insert(const QString &shape, const Template &queryTemplate)
+{
+    QMutexLocker lock(&templateMutex);
+
+    templates.insert(shape, new Template(queryTemplate));
+    templateStats.templateBytes += queryTemplate.text.size() * sizeof(QChar);
+}
+
+QString QueryTemplates::listPlaceholder(char prefix, int index)
+{
+    return QString(QLatin1String("%1%2"))
+        .arg(QLatin1Char(prefix))
+        .arg(index, 3, 10, QLatin1Char('0'));
+}
+
+int QueryTemplates::listLength(int size)
+{
+    int length = 1;
+    while (length < size)
+        length *= 2;
+    return length;
+}
+
+void QueryTemplates::bindList(QSparqlQuery &query,
+                              char prefix,
+                              const QVariantList &values)
+{
+    if (values.isEmpty())
+        return;
+
+    int length = listLength(values.size());
+    for (int i = 0; i < length; i++)
+        query.bindValue(listPlaceholder(prefix, i),
+                        values.at(qMin(i, values.size() - 1)));
+}
+
+QString QueryTemplates::queryText(const QSparqlQuery &query)
+{
+    QString text = query.preparedQueryText();
+
+    qint64 boundBytes = 0;
+    foreach (const QVariant &value, query.boundValues())
+        boundBytes += valueLength(value) * sizeof(QChar);
+
+    QMutexLocker lock(&templateMutex);
+    templateStats.boundBytes += boundBytes;
+    templateStats.queryBytes += text.size() * sizeof(QChar);
+
+    return text;
+}
+
+QueryTemplates::Stats QueryTemplates::stats()
+{
+    QMutexLocker lock(&templateMutex);
+    return templateStats;
+}
+
+void QueryTemplates::resetStats()
+{
+    QMutexLocker lock(&templateMutex);
+    templateStats = Stats();
+}
+
+void QueryTemplates::clear()
+{
+    QMutexLocker lock(&templateMutex);
+    templates.clear();
+}
@@ -0,0 +1,130 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** Contact: Reto Zingg <reto.zingg@nokia.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#ifndef COMMHISTORY_QUERYTEMPLATES_H
+#define COMMHISTORY_QUERYTEMPLATES_H
+
+#include <QString>
+#include <QList>
+#include <QVariant>
+#include <QSparqlQuery>
+
+#include "event.h"
+
+namespace CommHistory {
+
+/*!
+ * \class QueryTemplates
+ *
+ * Process-wide cache of query text templates. Each query shape (the
+ * set of constraints, modifiers and list lengths used) is formatted once
+ * with ?:name placeholders; later queries of the same shape copy the
+ * template and bind their values with QSparqlQuery::bindValue() instead
+ * of rebuilding the whole text with QString::arg().
+ *
+ * Only client-side formatting is saved: the tracker driver of QtSparql
+ * has no prepared statements and substitutes the bound values itself,
+ * so tracker still parses every query text. At most MaxTemplates shapes
+ * are kept, the least recently used ones are dropped. Bound lists use
+ * listLength() placeholders so that lists of similar length share a
+ * shape.
+ *
+ * Thread safe.
+ */
+class QueryTemplates
+{
+public:
+    struct Template {
+        QString text;
+        QList<Event::Property> properties;
+    };
+
+    static const int MaxTemplates = 64;
+
+    /*!
+     * Byte counters for query text produced on the client side.
+     * templateBytes counts text formatted when a new shape is built,
+     * boundBytes the values bound into templates and queryBytes the
+     * final queries handed to tracker, i.e. what every query had to
+     * format from scratch without templates. Bound values and queries
+     * are counted by queryText().
+     */
+    struct Stats {
+        Stats() : templateBytes(0), boundBytes(0), queryBytes(0),
+                  hits(0), misses(0) {}
+        qint64 templateBytes;
+        qint64 boundBytes;
+        qint64 queryBytes;
+        int hits;
+        int misses;
+    };
+
+    /*!
+     * Look up the template for shape.
+     * \return true if found.
+     */
+    static bool find(const QString &shape, Template &result);
+
+    /*!
+     * Register the template for shape.
+     */
+    static void insert(const QString &shape, const Template &queryTemplate);
+
+    /*!
+     * Placeholder name for the index'th item of a bound list, fixed
+     * width so that no name is a prefix of another one.
+     */
+    static QString listPlaceholder(char prefix, int index);
+
+    /*!
+     * \return Number of placeholders for a list of size items, the next
+     * power of two.
+     */
+    static int listLength(int size);
+
+    /*!
+     * Bind values to the listLength() placeholders with prefix. The
+     * placeholders after the values repeat the last one, for use in
+     * IN lists.
+     */
+    static void bindList(QSparqlQuery &query,
+                         char prefix,
+                         const QVariantList &values);
+
+    /*!
+     * \return Final text of query with values substituted, counted
+     * in the stats with the bound values.
+     */
+    static QString queryText(const QSparqlQuery &query);
+
+    static Stats stats();
+    static void resetStats();
+
+    /*!
+     * Drop all templates.
+     */
+    static void clear();
+};
+
+} // namespace CommHistory
+
+#endif
@@ -66,7 +66,8 @@ QT_LIKE_HEADERS += headers/CallEvent \
                    headers/SingleEventModel \
                    headers/Events \
                    headers/Models \
-                   headers/TrackerIO
+                   headers/TrackerIO \
+                   headers/QueryCache
 
 include(sources.pri)
 
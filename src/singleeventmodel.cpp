@@ -97,7 +97,7 @@ bool SingleEventModel::getEventByUri(const QUrl &uri)
 
     d->m_url = uri;
 
-    EventsQuery query(d->propertyMask);
+    EventsQuery query(d->queryProperties());
 
     query.addPattern(QString(QLatin1String("FILTER(%2 = <%1>) ")).arg(uri.toString()))
             .variable(Event::Id);
@@ -121,7 +121,7 @@ bool SingleEventModel::getEventByTokens(const QString &token,
     d->m_mmsId = mmsId;
     d->m_groupId = groupId;
 
-    EventsQuery query(d->propertyMask);
+    EventsQuery query(d->queryProperties());
 
     QStringList pattern;
     if (!token.isEmpty()) {
@@ -64,7 +64,7 @@ bool SMSInboxModel::getEvents()
     d->clearEvents();
     endResetModel();
 
-    EventsQuery query(d->propertyMask);
+    EventsQuery query(d->queryProperties());
 
     query.addPattern(QLatin1String("%1 nmo:isSent \"false\"; "
                                       "nmo:isDraft \"false\"; "
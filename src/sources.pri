@@ -2,6 +2,8 @@ HEADERS += trackerio.h \
            commonutils.h \
            eventmodel.h \
            queryrunner.h \
+           querycache.h \
+           querytemplates.h \
            eventmodel_p.h \
            event.h \
            messagepart.h \
@@ -25,13 +27,17 @@ HEADERS += trackerio.h \
            mmscontentdeleter.h \
            updatequery.h \
            contactlistener.h \
+           contactcache.h \
            libcommhistoryexport.h \
            idsource.h \
+           writejournal.h \
+           knownresources.h \
            trackerio_p.h \
            queryresult.h \
            singleeventmodel.h \
            committingtransaction.h \
            committingtransaction_p.h \
+           pendinglookup.h \
            eventsquery.h \
            preparedqueries.h \
            updatesemitter.h \
@@ -41,6 +47,8 @@ SOURCES += trackerio.cpp \
            commonutils.cpp \
            eventmodel.cpp \
            queryrunner.cpp \
+           querycache.cpp \
+           querytemplates.cpp \
            eventmodel_p.cpp \
            eventtreeitem.cpp \
            conversationmodel.cpp \
@@ -58,10 +66,14 @@ SOURCES += trackerio.cpp \
            classzerosmsmodel.cpp \
            mmscontentdeleter.cpp \
            contactlistener.cpp \
+           contactcache.cpp \
            idsource.cpp \
+           writejournal.cpp \
+           knownresources.cpp \
            queryresult.cpp \
            singleeventmodel.cpp \
            committingtransaction.cpp \
+           pendinglookup.cpp \
            eventsquery.cpp \
            updatequery.cpp \
            updatesemitter.cpp
@@ -161,7 +161,7 @@ bool SyncSMSModel::getEvents()
     d->clearEvents();
     endResetModel();
 
-    EventsQuery query(d->propertyMask);
+    EventsQuery query(d->queryProperties());
 
     if (d->parentId != ALL) {
         query.addPattern(QString(QLatin1String("%2 nmo:phoneMessageId \"%1\" . "))
@@ -29,6 +29,7 @@
 #include <QDBusMessage>
 #include <QDBusConnection>
 #include <QDBusPendingCall>
+#include <QDir>
 
 #include <qtcontacts-tracker/phoneutils.h>
 
@@ -43,6 +44,11 @@
 #include "committingtransaction_p.h"
 #include "eventsquery.h"
 #include "preparedqueries.h"
+#include "querytemplates.h"
+#include "knownresources.h"
+#include "pendinglookup.h"
+#include "writejournal.h"
+#include "constants.h"
 
 #include "trackerio_p.h"
 #include "trackerio.h"
@@ -54,18 +60,14 @@ using namespace CommHistory;
 #define QSPARQL_DRIVER QLatin1String("QTRACKER_DIRECT")
 #define QSPARQL_DATA_READY_INTERVAL 25
 
-#define MAX_VARIABLES_IN_QUERY 100
-
 #define NMO_ "http://www.semanticdesktop.org/ontologies/2007/03/22/nmo#"
 
+#define JOURNAL_DIR "/.commhistoryd/"
+#define JOURNAL_MAX_ATTEMPTS 3
+
 Q_GLOBAL_STATIC(TrackerIO, trackerIO)
 
 namespace {
-    QString escapeForQSparql(const QString &string) {
-        QSparqlBinding binding;
-        binding.setValue(string);
-        return binding.toString();
-    }
     QString encodeUri(const QUrl &uri) {
         return QString::fromAscii(uri.toEncoded());
     }
@@ -74,9 +76,22 @@ namespace {
 TrackerIOPrivate::TrackerIOPrivate(TrackerIO *parent)
     : q(parent),
     m_pTransaction(0),
+    m_resourceGeneration(0),
     m_MmsContentDeleter(0),
+    m_groupCommit(false),
+    m_refreshAllGroups(false),
+    m_journal(0),
+    m_journalEventId(-1),
     m_bgThread(0)
 {
+    // deleted in another process
+    QDBusConnection::sessionBus().connect(
+        QString(),
+        QString(),
+        COMM_HISTORY_SERVICE_NAME,
+        GROUPS_DELETED_SIGNAL,
+        this,
+        SLOT(groupsDeletedSlot(const QList<int> &)));
 }
 
 TrackerIOPrivate::~TrackerIOPrivate()
@@ -88,11 +103,15 @@ TrackerIOPrivate::~TrackerIOPrivate()
         m_MmsContentDeleter->deleteLater();
         m_MmsContentDeleter = 0;
     }
+
+    delete m_journal;
 }
 
 TrackerIO::TrackerIO()
     : d(new TrackerIOPrivate(this))
 {
+    d->upgradeGroups();
+    recoverIds();
 }
 
 TrackerIO::~TrackerIO()
@@ -136,71 +155,198 @@ QString TrackerIOPrivate::makeCallGroupURI(const CommHistory::Event &event)
         .arg(videoSuffix);
 }
 
-QString TrackerIOPrivate::prepareMessagePartQuery(const QString &messageUri)
+QSparqlQuery TrackerIOPrivate::prepareMessagePartQuery(const QStringList &messageUris)
 {
-    // NOTE: check MessagePartColumns in queryresult.h if you change this!
-    QString query(LAT(
-            "SELECT ?message "
-              "?part "
-              "?contentId "
-              "nie:plainTextContent(?part) "
-              "nie:mimeType(?part) "
-              "nie:characterSet(?part) "
-              "nie:contentSize(?part) "
-              "nfo:fileName(?part) "
-            "WHERE { "
-              "?message  nmo:mmsHasContent [nie:hasPart ?part] . "
-              "?part nmo:contentId ?contentId "
-            "FILTER(?message = <%1>)} "
-            "ORDER BY ?contentId"));
+    int length = QueryTemplates::listLength(messageUris.size());
+    QString shape = QString(LAT("parts:%1")).arg(length);
+    QueryTemplates::Template queryTemplate;
+
+    if (!QueryTemplates::find(shape, queryTemplate)) {
+        // NOTE: check MessagePartColumns in queryresult.h if you change this!
+        QString query(LAT(
+                "SELECT ?message "
+                  "?part "
+                  "?contentId "
+                  "nie:plainTextContent(?part) "
+                  "nie:mimeType(?part) "
+                  "nie:characterSet(?part) "
+                  "nie:contentSize(?part) "
+                  "nfo:fileName(?part) "
+                "WHERE { "
+                  "?message  nmo:mmsHasContent [nie:hasPart ?part] . "
+                  "?part nmo:contentId ?contentId "
+                "FILTER(?message IN (%1))} "
+                "ORDER BY ?message ?contentId"));
+
+        QStringList placeholders;
+        for (int i = 0; i < length; i++)
+            placeholders.append(LAT("?:") + QueryTemplates::listPlaceholder('m', i));
 
-    return query.arg(messageUri);
+        queryTemplate.text = query.arg(placeholders.join(LAT(",")));
+        QueryTemplates::insert(shape, queryTemplate);
+    }
+
+    QVariantList messages;
+    foreach (const QString &uri, messageUris)
+        messages << QUrl(uri);
+
+    QSparqlQuery query(queryTemplate.text);
+    QueryTemplates::bindList(query, 'm', messages);
+
+    return query;
 }
 
-QString TrackerIOPrivate::prepareGroupQuery(const QString &localUid,
-                                            const QString &remoteUid,
-                                            int groupId)
-{
-    QString queryFormat(GROUP_QUERY);
-    QStringList constraints;
+QSparqlQuery TrackerIOPrivate::prepareGroupQuery(const QString &localUid,
+                                                 const QString &remoteUid,
+                                                 int groupId,
+                                                 bool withContacts,
+                                                 int afterGroupId,
+                                                 const QDateTime &afterDate)
+{
+    enum {
+        HiddenNumber = 0x01,
+        IMAddress    = 0x02,
+        PhoneNumber  = 0x04,
+        LocalUid     = 0x08,
+        GroupId      = 0x10,
+        AfterGroup   = 0x20
+    };
+
+    int constraintFlags = 0;
+    QString number;
     if (!remoteUid.isNull() && remoteUid.isEmpty()) {
-        // special case for hidden phone numbers
-        constraints << QString(LAT("OPTIONAL { ?channel nmo:hasParticipant [ nco:hasContactMedium ?m ] . } "
-                                   "FILTER(!BOUND(?m))"));
+        constraintFlags |= HiddenNumber;
     } else if (!remoteUid.isEmpty()) {
-        QString number = normalizePhoneNumber(remoteUid);
-        if (number.isEmpty()) {
-            constraints << QString(LAT("?channel nmo:hasParticipant [nco:hasIMAddress [nco:imID %1]] ."))
-                          .arg(escapeForQSparql(remoteUid));
-        } else {
-            constraints << QString(LAT("?channel nmo:hasParticipant [nco:hasPhoneNumber [maemo:localPhoneNumber \"%1\"]] ."))
-                          .arg(number.right(CommHistory::phoneNumberMatchLength()));
-        }
-    }
-    if (!localUid.isEmpty()) {
-        constraints << QString(LAT("FILTER(nie:subject(?channel) = %1) ")).arg(escapeForQSparql(localUid));
+        number = normalizePhoneNumber(remoteUid);
+        constraintFlags |= number.isEmpty() ? IMAddress : PhoneNumber;
     }
+    if (!localUid.isEmpty())
+        constraintFlags |= LocalUid;
     if (groupId != -1)
-        constraints << QString(LAT("FILTER(?channel = <%1>) ")).arg(Group::idToUrl(groupId).toString());
+        constraintFlags |= GroupId;
+    if (afterGroupId != -1)
+        constraintFlags |= AfterGroup;
+
+    QString shape = QString(LAT("groups:%1:%2")).arg(constraintFlags).arg(withContacts);
+    QueryTemplates::Template queryTemplate;
+
+    if (!QueryTemplates::find(shape, queryTemplate)) {
+        QStringList constraints;
+        if (constraintFlags & HiddenNumber) {
+            // special case for hidden phone numbers
+            constraints << QString(LAT("OPTIONAL { ?channel nmo:hasParticipant [ nco:hasContactMedium ?m ] . } "
+                                       "FILTER(!BOUND(?m))"));
+        } else if (constraintFlags & IMAddress) {
+            constraints << QString(LAT("?channel nmo:hasParticipant [nco:hasIMAddress [nco:imID ?:remoteUid]] ."));
+        } else if (constraintFlags & PhoneNumber) {
+            constraints << QString(LAT("?channel nmo:hasParticipant [nco:hasPhoneNumber [maemo:localPhoneNumber ?:number]] ."));
+        }
+        if (constraintFlags & LocalUid)
+            constraints << QString(LAT("FILTER(nie:subject(?channel) = ?:localUid) "));
+        if (constraintFlags & GroupId)
+            constraints << QString(LAT("FILTER(?channel = ?:channel) "));
+        // seek past the given group in the order of GROUP_QUERY
+        if (constraintFlags & AfterGroup)
+            constraints << QString(LAT("FILTER(?_lastDate < ?:afterDate^^xsd:dateTime || "
+                                       "(?_lastDate = ?:afterDate^^xsd:dateTime && "
+                                       "tracker:id(?channel) < tracker:id(?:afterChannel))) "));
+
+        queryTemplate.text = QString(GROUP_QUERY).arg(constraints.join(LAT(" ")),
+                                                      withContacts ? PARTICIPANT_CONTACTS_COLUMN
+                                                                   : NO_CONTACTS_COLUMN);
+        QueryTemplates::insert(shape, queryTemplate);
+    }
+
+    QSparqlQuery query(queryTemplate.text);
+    if (constraintFlags & IMAddress)
+        query.bindValue(LAT("remoteUid"), remoteUid);
+    else if (constraintFlags & PhoneNumber)
+        query.bindValue(LAT("number"),
+                        number.right(CommHistory::phoneNumberMatchLength()));
+    if (constraintFlags & LocalUid)
+        query.bindValue(LAT("localUid"), localUid);
+    if (constraintFlags & GroupId)
+        query.bindValue(LAT("channel"), Group::idToUrl(groupId));
+    if (constraintFlags & AfterGroup) {
+        query.bindValue(LAT("afterDate"),
+                        afterDate.toUTC().toString(Qt::ISODate));
+        query.bindValue(LAT("afterChannel"), Group::idToUrl(afterGroupId));
+    }
 
-    return queryFormat.arg(constraints.join(LAT(" ")));
+    return query;
 }
 
-QString TrackerIOPrivate::prepareGroupedCallQuery(const QStringList &channels)
+QSparqlQuery TrackerIOPrivate::prepareGroupedCallQuery(const QStringList &channels,
+                                                       bool withContacts)
 {
-    QString query;
-    QString queryFormat(GROUPED_CALL_QUERY);
-    if (channels.isEmpty()) {
-        query = queryFormat.arg(QString());
-    } else {
-        QStringList channelList;
-        foreach (QString channel, channels)
-            channelList.append(QString(LAT("<%1>")).arg(channel));
-        query = queryFormat.arg(QString(LAT("FILTER(?channel IN (%1))"))
-                                .arg(channelList.join(LAT(","))));
-        qDebug() << Q_FUNC_INFO << query;
+    int length = channels.isEmpty() ? 0 : QueryTemplates::listLength(channels.size());
+    QString shape = QString(LAT("groupedCalls:%1:%2")).arg(length).arg(withContacts);
+    QueryTemplates::Template queryTemplate;
+
+    if (!QueryTemplates::find(shape, queryTemplate)) {
+        QString queryFormat(GROUPED_CALL_QUERY);
+        QString contactsColumn(withContacts ? PARTICIPANT_CONTACTS_COLUMN
+                                            : NO_CONTACTS_COLUMN);
+        if (channels.isEmpty()) {
+            queryTemplate.text = queryFormat.arg(QString(), contactsColumn);
+        } else {
+            QStringList placeholders;
+            for (int i = 0; i < length; i++)
+                placeholders.append(LAT("?:") + QueryTemplates::listPlaceholder('c', i));
+            queryTemplate.text = queryFormat.arg(QString(LAT("FILTER(?channel IN (%1))"))
+                                                 .arg(placeholders.join(LAT(","))),
+                                                 contactsColumn);
+        }
+        QueryTemplates::insert(shape, queryTemplate);
     }
 
+    QVariantList channelUrls;
+    foreach (const QString &channel, channels)
+        channelUrls << QUrl(channel);
+
+    QSparqlQuery query(queryTemplate.text);
+    QueryTemplates::bindList(query, 'c', channelUrls);
+
+    if (!channels.isEmpty())
+        qDebug() << Q_FUNC_INFO << channels;
+
+    return query;
+}
+
+QSparqlQuery TrackerIOPrivate::prepareMarkAsReadQuery(const QList<int> &eventIds)
+{
+    int length = QueryTemplates::listLength(eventIds.size());
+    QString shape = QString(LAT("markAsRead:%1")).arg(length);
+    QueryTemplates::Template queryTemplate;
+
+    if (!QueryTemplates::find(shape, queryTemplate)) {
+        QStringList placeholders;
+        for (int i = 0; i < length; i++)
+            placeholders.append(LAT("?:") + QueryTemplates::listPlaceholder('e', i));
+        QString events = placeholders.join(LAT(","));
+
+        // uncounted from the unread messages of their conversations
+        // first. Separate deletes for events missing either property.
+        queryTemplate.text = groupCountersQuery(QString(LAT("FILTER(?_event IN (%1))")).arg(events),
+                                                false, true)
+            + QString(LAT(
+                "DELETE {?e nmo:isRead ?r} "
+                "WHERE {?e nmo:isRead ?r FILTER(?e IN (%1))} "
+                "DELETE {?e nie:contentLastModified ?d} "
+                "WHERE {?e nie:contentLastModified ?d FILTER(?e IN (%1))} "
+                "INSERT {?e nmo:isRead true; nie:contentLastModified ?:date} "
+                "WHERE {?e rdf:type nmo:Message FILTER(?e IN (%1))}"))
+            .arg(events);
+        QueryTemplates::insert(shape, queryTemplate);
+    }
+
+    QSparqlQuery query(queryTemplate.text, QSparqlQuery::InsertStatement);
+    QVariantList events;
+    foreach (int id, eventIds)
+        events << Event::idToUrl(id);
+    QueryTemplates::bindList(query, 'e', events);
+    query.bindValue(LAT("date"), QDateTime::currentDateTime());
+
     return query;
 }
 
@@ -209,6 +355,37 @@ QUrl TrackerIOPrivate::uriForIMAddress(const QString &account, const QString &re
     return QUrl(QString(LAT("telepathy:")) + account + QLatin1Char('!') + remoteUid);
 }
 
+bool TrackerIOPrivate::needsResource(const QString &uri)
+{
+    if (KnownResources::contains(uri))
+        return false;
+
+    if (m_newResources.isEmpty())
+        m_resourceGeneration = KnownResources::generation();
+    m_newResources.append(uri);
+
+    return true;
+}
+
+void TrackerIOPrivate::addKnownResources(const QStringList &uris, int generation)
+{
+    KnownResources::insert(uris, generation);
+}
+
+void TrackerIOPrivate::newResourcesDone(bool stored)
+{
+    if (stored && !m_newResources.isEmpty())
+        KnownResources::insert(m_newResources, m_resourceGeneration);
+    m_newResources.clear();
+}
+
+void TrackerIOPrivate::groupsDeletedSlot(const QList<int> &groupIds)
+{
+    Q_UNUSED(groupIds);
+
+    KnownResources::clear();
+}
+
 QString TrackerIOPrivate::findLocalContact(UpdateQuery &query,
                                            const QString &accountPath)
 {
@@ -272,9 +449,11 @@ void TrackerIOPrivate::addSIPContact(UpdateQuery &query,
 
     // cache only used to avoid redundant inserts, ignore value
     if (!m_contactCache.contains(sipAddressIRI)) {
-        ensureIMAddress(query, sipAddressIRI, remoteUid);
-        QString shortNumber = makeShortNumber(phoneNumber);
-        ensurePhoneNumber(query, phoneIRI, phoneNumber, shortNumber);
+        if (needsResource(sipAddressIRI.toString())) {
+            ensureIMAddress(query, sipAddressIRI, remoteUid);
+            QString shortNumber = makeShortNumber(phoneNumber);
+            ensurePhoneNumber(query, phoneIRI, phoneNumber, shortNumber);
+        }
         m_contactCache.insert(sipAddressIRI, remoteUid);
     }
 
@@ -302,7 +481,8 @@ void TrackerIOPrivate::addIMContact(UpdateQuery &query,
     if (m_contactCache.contains(imAddressURI)) {
         contact = m_contactCache[imAddressURI];
     } else {
-        ensureIMAddress(query, imAddressURI, imID);
+        if (needsResource(imAddressURI.toString()))
+            ensureIMAddress(query, imAddressURI, imID);
 
         contact = QString(LAT("[rdf:type nco:Contact; nco:hasIMAddress <%2>]"))
                   .arg(encodeUri(imAddressURI));
@@ -330,8 +510,10 @@ void TrackerIOPrivate::addPhoneContact(UpdateQuery &query,
 
         // cache only used to avoid redundant inserts, ignore value
         if (!m_contactCache.contains(phoneNumber)) {
-            QString shortNumber = makeShortNumber(phoneNumber, normalizeFlags);
-            ensurePhoneNumber(query, phoneIRI, phoneNumber, shortNumber);
+            if (needsResource(phoneIRI)) {
+                QString shortNumber = makeShortNumber(phoneNumber, normalizeFlags);
+                ensurePhoneNumber(query, phoneIRI, phoneNumber, shortNumber);
+            }
             m_contactCache.insert(phoneNumber, phoneIRI);
         }
 
@@ -680,6 +862,7 @@ void TrackerIOPrivate::writeCallProperties(UpdateQuery &query, Event &event, boo
         qDebug() << Q_FUNC_INFO << "headers modified";
         // move call to the video/non-video group
         QUrl channelUri = makeCallGroupURI(event);
+        query.deletion(QString(CALL_GROUP_MISSED_DECREMENT).arg(event.url().toString()));
         query.insertionSilent(
             QString(LAT("GRAPH <%1> { <%2> a nmo:CommunicationChannel }"))
             .arg(COMMHISTORY_GRAPH_CALL_CHANNEL)
@@ -691,6 +874,13 @@ void TrackerIOPrivate::writeCallProperties(UpdateQuery &query, Event &event, boo
 
         query.insertion(event.url(), "nmo:communicationChannel", makeCallGroupURI(event), true);
 
+        query.appendInsertion(QString(CALL_GROUP_MISSED_COUNTER_INIT).arg(encodeUri(channelUri)));
+        if (event.isMissedCall()) {
+            query.appendInsertion(QString(CALL_GROUP_MISSED_INCREMENT)
+                                  .arg(encodeUri(channelUri))
+                                  .arg(event.startTime().toUTC().toString(Qt::ISODate)));
+        }
+
         // ugh. appendInsertion just appends the raw statement, so it
         // works for deletions as well
         query.appendInsertion(DELETE_EMPTY_CALL_GROUPS_QUERY);
@@ -919,7 +1109,14 @@ void TrackerIOPrivate::addCallEvent(UpdateQuery &query, Event &event)
     addRemoteContact(query, channelUri, "nmo:hasParticipant", event.localUid(), event.remoteUid(),
                      NormalizeFlagKeepDialString);
 
+    QString startTime = event.startTime().toUTC().toString(Qt::ISODate);
+
     if (!event.isMissedCall()) {
+        // nothing after a newer successful call is missed, compared
+        // before the date is replaced
+        query.deletion(QString(CALL_GROUP_MISSED_RESET)
+                       .arg(encodeUri(channelUri))
+                       .arg(startTime));
         query.insertion(channelUri, "nmo:lastSuccessfulMessageDate", event.startTime(), true);
     } else {
         // ensure existence of nmo:lastSuccessfulMessageDate
@@ -930,6 +1127,15 @@ void TrackerIOPrivate::addCallEvent(UpdateQuery &query, Event &event)
     }
 
     query.insertion(eventSubject, "nmo:communicationChannel", channelUri);
+
+    // stored missed call counter, created for new call groups: a
+    // missed call adds one
+    query.appendInsertion(QString(CALL_GROUP_MISSED_COUNTER_INIT).arg(encodeUri(channelUri)));
+    if (event.isMissedCall()) {
+        query.appendInsertion(QString(CALL_GROUP_MISSED_INCREMENT)
+                              .arg(encodeUri(channelUri))
+                              .arg(startTime));
+    }
 }
 
 void TrackerIOPrivate::setChannel(UpdateQuery &query, Event &event, int channelId, bool modify)
@@ -988,32 +1194,51 @@ void TrackerIOPrivate::doUpdateGroupTimestamps(CommittingTransaction *transactio
 
     QDateTime lastMessageDate;
     QDateTime lastSuccessfulMessageDate;
+    QDateTime storedSuccessfulMessageDate;
 
     if (result && result->first()) {
         lastMessageDate = result->value(0).toDateTime();
         lastSuccessfulMessageDate = result->value(1).toDateTime();
+        storedSuccessfulMessageDate = result->value(2).toDateTime();
     }
 
-    if (lastMessageDate.isValid() || lastSuccessfulMessageDate.isValid()) {
-        UpdateQuery update;
-        if (lastMessageDate.isValid()) {
-            update.insertion(groupUri,
-                             "nmo:lastMessageDate",
-                             lastMessageDate,
-                             true);
-        }
-
-        if (lastSuccessfulMessageDate.isValid()) {
-            update.insertion(groupUri,
-                             "nmo:lastSuccessfulMessageDate",
-                             lastSuccessfulMessageDate,
-                             true);
-        }
+    UpdateQuery update;
 
+    // missed calls of call groups are the ones after the last
+    // successful call: none if it advanced, the ones before a deleted
+    // last successful call need counting. Compared before the date is
+    // replaced.
+    if (groupUri.startsWith(LAT("callgroup:"))
+        && lastSuccessfulMessageDate.isValid()
+        && storedSuccessfulMessageDate.isValid()) {
+        if (lastSuccessfulMessageDate > storedSuccessfulMessageDate)
+            update.deletion(QString(CALL_GROUP_MISSED_RESET)
+                            .arg(encodeUri(QUrl(groupUri)))
+                            .arg(lastSuccessfulMessageDate.toUTC().toString(Qt::ISODate)));
+        else if (lastSuccessfulMessageDate < storedSuccessfulMessageDate)
+            update.appendInsertion(missedCallsQuery(QString(LAT("FILTER(?channel = <%1>)"))
+                                                    .arg(encodeUri(QUrl(groupUri)))));
+    }
+
+    if (lastMessageDate.isValid()) {
+        update.insertion(groupUri,
+                         "nmo:lastMessageDate",
+                         lastMessageDate,
+                         true);
+    }
+
+    if (lastSuccessfulMessageDate.isValid()) {
+        update.insertion(groupUri,
+                         "nmo:lastSuccessfulMessageDate",
+                         lastSuccessfulMessageDate,
+                         true);
+    }
+
+    QString text = update.query();
+    if (!text.isEmpty())
         addToTransactionOrRunQuery(transaction,
-                                   QSparqlQuery(update.query(),
+                                   QSparqlQuery(text,
                                                 QSparqlQuery::InsertStatement));
-    }
 }
 
 void TrackerIOPrivate::updateGroupTimestamps(CommittingTransaction *transaction,
@@ -1056,6 +1281,7 @@ void TrackerIOPrivate::updateGroupTimestamps(CommittingTransaction *transaction,
                     " FILTER(nmo:isSent(?lastMessage) = true || "
                     "   nmo:isAnswered(?lastMessage) = true) "
                     "} ORDER BY DESC(?lastSuccessfulDate) DESC(tracker:id(?lastMessage)))"
+                    "nmo:lastSuccessfulMessageDate(?channel) "
                     "WHERE { "
                     " ?channel a nmo:CommunicationChannel . "
                     " FILTER(?channel = ?:channel) }"))
@@ -1071,6 +1297,104 @@ void TrackerIOPrivate::updateGroupTimestamps(CommittingTransaction *transaction,
                                QVariant(groupUri));
 }
 
+bool TrackerIOPrivate::groupSummaryChanged()
+{
+    if (m_pTransaction) {
+        m_refreshAllGroups = true;
+        return true;
+    }
+
+    return handleQuery(QSparqlQuery(QString(GROUP_LAST_MESSAGE_QUERY).arg(QString()),
+                                    QSparqlQuery::InsertStatement));
+}
+
+QString TrackerIOPrivate::groupCountersQuery(const QString &eventPattern,
+                                             bool add,
+                                             bool unreadOnly)
+{
+    QString op = add ? LAT("+") : LAT("-");
+
+    QString query = QString(GROUP_COUNTER_CHANGE)
+        .arg(eventPattern + LAT(" ?_event nmo:isRead false ."),
+             LAT("commhistory:unreadMessages"),
+             op);
+    if (!unreadOnly) {
+        query += QString(GROUP_COUNTER_CHANGE)
+            .arg(eventPattern, LAT("commhistory:totalMessages"), op);
+        query += QString(GROUP_COUNTER_CHANGE)
+            .arg(eventPattern + LAT(" ?_event nmo:isSent true ."),
+                 LAT("commhistory:sentMessages"),
+                 op);
+    }
+
+    return query;
+}
+
+QString TrackerIOPrivate::missedCallsQuery(const QString &constraint)
+{
+    return QString(CALL_GROUP_MISSED_QUERY).arg(constraint);
+}
+
+void TrackerIOPrivate::upgradeGroups()
+{
+    // conversations stored by older versions have no counters
+    upgradeGroups(COMMHISTORY_GRAPH_MESSAGE_CHANNEL,
+                  GROUP_WITHOUT_COUNTERS,
+                  QString(GROUP_COUNTERS_QUERY).arg(GROUP_WITHOUT_COUNTERS));
+    // nor a link to their last message
+    upgradeGroups(COMMHISTORY_GRAPH_MESSAGE_CHANNEL,
+                  GROUP_WITHOUT_LAST_MESSAGE,
+                  QString(GROUP_LAST_MESSAGE_QUERY).arg(GROUP_WITHOUT_LAST_MESSAGE));
+    // call groups stored by older versions have no missed call counter
+    upgradeGroups(COMMHISTORY_GRAPH_CALL_CHANNEL,
+                  CALL_GROUP_WITHOUT_MISSED_COUNTER,
+                  missedCallsQuery(CALL_GROUP_WITHOUT_MISSED_COUNTER));
+
+    runNextTransaction();
+}
+
+void TrackerIOPrivate::upgradeGroups(const char *graph,
+                                     const QString &pattern,
+                                     const QString &update)
+{
+    CommittingTransaction *t = new CommittingTransaction(q);
+
+    QSparqlQuery ask(QString(GROUPS_MATCHING_QUERY).arg(LAT(graph), pattern),
+                     QSparqlQuery::AskStatement);
+    t->addQuery(ask, this, "groupsUpgradeChecked");
+    t->addQuery(QSparqlQuery(update, QSparqlQuery::InsertStatement));
+
+    m_pendingTransactions.enqueue(t);
+}
+
+void TrackerIOPrivate::groupsUpgradeChecked(CommittingTransaction *transaction,
+                                            QSparqlResult *result,
+                                            QVariant arg)
+{
+    Q_UNUSED(arg);
+
+    if (result->hasError() || !result->boolValue())
+        transaction->abort(false);
+    else
+        qDebug() << Q_FUNC_INFO << "upgrading groups";
+}
+
+void TrackerIOPrivate::flushGroupSummaries()
+{
+    Q_ASSERT(m_pTransaction);
+
+    if (m_refreshAllGroups)
+        m_pTransaction->addQuery(QSparqlQuery(QString(GROUP_LAST_MESSAGE_QUERY).arg(QString()),
+                                              QSparqlQuery::InsertStatement));
+
+    clearGroupSummaries();
+}
+
+void TrackerIOPrivate::clearGroupSummaries()
+{
+    m_refreshAllGroups = false;
+}
+
 bool TrackerIOPrivate::markGroupAsRead(const QString &channelIRI)
 {
     QSparqlQuery query(LAT(
@@ -1137,24 +1461,38 @@ void TrackerIO::recreateIds()
     qDebug() << Q_FUNC_INFO << "max event id =" << maxMessageId << ", group id =" << maxGroupId;
 }
 
-bool TrackerIO::addEvent(Event &event)
+void TrackerIO::recoverIds()
 {
-    UpdateQuery query;
+    qDebug() << Q_FUNC_INFO;
 
+    // The ids saved by IdSource are enough unless the file was lost or
+    // corrupted, scanning all messages takes seconds on a large store.
+    int lastEventId, lastGroupId;
+    if (d->m_IdSource.lastIds(lastEventId, lastGroupId)) {
+        qDebug() << Q_FUNC_INFO << "stored event id =" << lastEventId
+                 << ", group id =" << lastGroupId;
+        return;
+    }
+
+    recreateIds();
+}
+
+bool TrackerIOPrivate::prepareAddEvent(UpdateQuery &query, Event &event)
+{
     // TODO: maybe check uri prefix for localUid?
     if (event.type() == Event::IMEvent
         || event.type() == Event::SMSEvent
         || event.type() == Event::MMSEvent) {
         if (event.type() == Event::IMEvent) {
-            d->addIMEvent(query, event);
+            addIMEvent(query, event);
         } else {
             if (event.parentId() < 0) {
-                d->calculateParentId(event);
+                calculateParentId(event);
             }
-            d->addSMSEvent(query, event);
+            addSMSEvent(query, event);
 
             //setting the time at which the folder was last updated
-            d->setFolderLastModifiedTime(query, event.parentId(), QDateTime::currentDateTime());
+            setFolderLastModifiedTime(query, event.parentId(), QDateTime::currentDateTime());
         }
 
         // specify not-inherited classes only when adding events, not during modifications
@@ -1164,25 +1502,71 @@ bool TrackerIO::addEvent(Event &event)
                            LAT("nie:DataObject"));
 
         if (!event.isDraft()) {
-            d->setChannel(query, event, event.groupId());
+            setChannel(query, event, event.groupId());
+            query.appendInsertion(groupCountersQuery(QString(LAT("FILTER(?_event = <%1>)"))
+                                                     .arg(event.url().toString()),
+                                                     true));
+            query.appendInsertion(QString(GROUP_LAST_MESSAGE_ADD).arg(event.url().toString()));
         }
     } else if (event.type() == Event::CallEvent) {
-        d->addCallEvent(query, event);
+        addCallEvent(query, event);
     } else if (event.type() != Event::StatusMessageEvent) {
         qWarning() << "event type not implemented";
         return false;
     }
 
+    // IdSource returns 0 if it cannot reach the shared ids
+    if (event.id() == 0) {
+        qCritical() << Q_FUNC_INFO << "No event id available";
+        return false;
+    }
 
     event.setLastModified(QDateTime::currentDateTime());
     query.insertion(event.url(),
                     "nie:contentLastModified",
                     event.lastModified());
 
+    if (m_journal && m_journalEventId == -1)
+        m_journalEventId = event.id();
+
+    return true;
+}
+
+bool TrackerIO::addEvent(Event &event)
+{
+    UpdateQuery query;
+
+    if (!d->prepareAddEvent(query, event))
+        return false;
+
     return d->handleQuery(QSparqlQuery(query.query(),
                                        QSparqlQuery::InsertStatement));
 }
 
+bool TrackerIO::addEvents(QList<Event> &events)
+{
+    // every event keeps its own update operations (they touch shared
+    // channel and folder resources), all of them go in one request
+    QStringList updates;
+
+    QMutableListIterator<Event> i(events);
+    while (i.hasNext()) {
+        UpdateQuery query;
+        if (!d->prepareAddEvent(query, i.next())) {
+            if (!d->m_pTransaction)
+                d->newResourcesDone(false);
+            return false;
+        }
+        updates << query.query();
+    }
+
+    if (updates.isEmpty())
+        return true;
+
+    return d->handleQuery(QSparqlQuery(updates.join(LAT(" ")),
+                                       QSparqlQuery::InsertStatement));
+}
+
 bool TrackerIO::addGroup(Group &group)
 {
     UpdateQuery query;
@@ -1198,6 +1582,10 @@ bool TrackerIO::addGroup(Group &group)
     }
 
     group.setId(d->nextGroupId());
+    if (group.id() == 0) {
+        qCritical() << Q_FUNC_INFO << "No group id available";
+        return false;
+    }
 
     qDebug() << __FUNCTION__ << group.url() << group.localUid() << group.remoteUids();
 
@@ -1246,6 +1634,9 @@ bool TrackerIO::addGroup(Group &group)
                     "nie:contentLastModified",
                     group.lastModified());
 
+    // counted by the events added to it
+    query.appendInsertion(QString(GROUP_COUNTERS_INIT).arg(channelSubject));
+
     return d->handleQuery(QSparqlQuery(query.query(),
                                        QSparqlQuery::InsertStatement));
 }
@@ -1271,9 +1662,10 @@ bool TrackerIOPrivate::querySingleEvent(EventsQuery &query, Event &event)
     result.fillEventFromModel(event);
 
     if (event.type() == Event::MMSEvent) {
-        QString partQuery = TrackerIOPrivate::prepareMessagePartQuery(event.url().toString());
+        QSparqlQuery partQuery = TrackerIOPrivate::prepareMessagePartQuery(
+            QStringList() << event.url().toString());
 
-        QScopedPointer<QSparqlResult> parts(connection().exec(QSparqlQuery(partQuery)));
+        QScopedPointer<QSparqlResult> parts(connection().exec(partQuery));
 
         if (runBlockedQuery(parts.data()) &&
             parts->size() > 0) {
@@ -1294,14 +1686,70 @@ bool TrackerIOPrivate::querySingleEvent(EventsQuery &query, Event &event)
     return true;
 }
 
-bool TrackerIO::getEvent(int id, Event &event)
+PendingLookup* TrackerIOPrivate::lookupSingleEvent(EventsQuery &query)
 {
-    qDebug() << Q_FUNC_INFO << id;
-    EventsQuery query(Event::allProperties());
+    // eventProperties() is valid only after query()
+    QSparqlQuery sparqlQuery(query.query());
+    return new PendingLookup(PendingLookup::EventLookup,
+                             connection(),
+                             sparqlQuery,
+                             query.eventProperties());
+}
 
+void TrackerIOPrivate::addEventIdPattern(EventsQuery &query, int id)
+{
     query.addPattern(QString(LAT("FILTER(%2 = <%1>)"))
                      .arg(Event::idToUrl(id).toString()))
                     .variable(Event::Id);
+}
+
+void TrackerIOPrivate::addMessageTokenPattern(EventsQuery &query,
+                                              const QString &token,
+                                              int groupId)
+{
+    if (groupId == -1) {
+        query.addPattern(QString(LAT("%2 nmo:messageId \"%1\" ."))
+                         .arg(token))
+                        .variable(Event::Id);
+    } else {
+        query.addPattern(QString(LAT("%3 nmo:messageId \"%1\";"
+                                               "nmo:communicationChannel <%2> ."))
+                         .arg(token)
+                         .arg(Group::idToUrl(groupId).toString()))
+                        .variable(Event::Id);
+    }
+}
+
+void TrackerIOPrivate::addMmsIdPattern(EventsQuery &query,
+                                       const QString &mmsId,
+                                       int groupId)
+{
+    query.addPattern(QString(LAT("%3 nmo:mmsId \"%1\";"
+                                           "nmo:isSent \"true\";"
+                                           "nmo:communicationChannel <%2> ."))
+                     .arg(mmsId)
+                     .arg(Group::idToUrl(groupId).toString()))
+                    .variable(Event::Id);
+}
+
+QSparqlQuery TrackerIOPrivate::prepareTotalEventsQuery(int groupId)
+{
+    QSparqlQuery query(LAT(
+            "SELECT COUNT(?message) "
+            "WHERE {"
+              "?message rdf:type nmo:Message; nmo:isDeleted \"false\";"
+              "nmo:communicationChannel ?:conversation}"));
+
+    query.bindValue(LAT("conversation"), Group::idToUrl(groupId));
+
+    return query;
+}
+
+bool TrackerIO::getEvent(int id, Event &event)
+{
+    qDebug() << Q_FUNC_INFO << id;
+    EventsQuery query(Event::allProperties());
+    TrackerIOPrivate::addEventIdPattern(query, id);
 
     return d->querySingleEvent(query, event);
 }
@@ -1309,10 +1757,7 @@ bool TrackerIO::getEvent(int id, Event &event)
 bool TrackerIO::getEventByMessageToken(const QString& token, Event &event)
 {
     EventsQuery query(Event::allProperties());
-
-    query.addPattern(QString(LAT("%2 nmo:messageId \"%1\" ."))
-                     .arg(token))
-                    .variable(Event::Id);
+    TrackerIOPrivate::addMessageTokenPattern(query, token, -1);
 
     return d->querySingleEvent(query, event);
 }
@@ -1320,12 +1765,7 @@ bool TrackerIO::getEventByMessageToken(const QString& token, Event &event)
 bool TrackerIO::getEventByMessageToken(const QString &token, int groupId, Event &event)
 {
     EventsQuery query(Event::allProperties());
-
-    query.addPattern(QString(LAT("%3 nmo:messageId \"%1\";"
-                                           "nmo:communicationChannel <%2> ."))
-                     .arg(token)
-                     .arg(Group::idToUrl(groupId).toString()))
-                    .variable(Event::Id);
+    TrackerIOPrivate::addMessageTokenPattern(query, token, groupId);
 
     return d->querySingleEvent(query, event);
 }
@@ -1333,17 +1773,50 @@ bool TrackerIO::getEventByMessageToken(const QString &token, int groupId, Event
 bool TrackerIO::getEventByMmsId(const QString& mmsId, int groupId, Event &event)
 {
     EventsQuery query(Event::allProperties());
-
-    query.addPattern(QString(LAT("%3 nmo:mmsId \"%1\";"
-                                           "nmo:isSent \"true\";"
-                                           "nmo:communicationChannel <%2> ."))
-                     .arg(mmsId)
-                     .arg(Group::idToUrl(groupId).toString()))
-                    .variable(Event::Id);
+    TrackerIOPrivate::addMmsIdPattern(query, mmsId, groupId);
 
     return d->querySingleEvent(query, event);
 }
 
+PendingLookup* TrackerIO::getEventAsync(int id)
+{
+    qDebug() << Q_FUNC_INFO << id;
+    EventsQuery query(Event::allProperties());
+    TrackerIOPrivate::addEventIdPattern(query, id);
+
+    return d->lookupSingleEvent(query);
+}
+
+PendingLookup* TrackerIO::getEventByMessageTokenAsync(const QString &token, int groupId)
+{
+    EventsQuery query(Event::allProperties());
+    TrackerIOPrivate::addMessageTokenPattern(query, token, groupId);
+
+    return d->lookupSingleEvent(query);
+}
+
+PendingLookup* TrackerIO::getEventByMmsIdAsync(const QString &mmsId, int groupId)
+{
+    EventsQuery query(Event::allProperties());
+    TrackerIOPrivate::addMmsIdPattern(query, mmsId, groupId);
+
+    return d->lookupSingleEvent(query);
+}
+
+PendingLookup* TrackerIO::getGroupAsync(int id)
+{
+    return new PendingLookup(PendingLookup::GroupLookup,
+                             d->connection(),
+                             TrackerIOPrivate::prepareGroupQuery(QString(), QString(), id));
+}
+
+PendingLookup* TrackerIO::totalEventsInGroupAsync(int groupId)
+{
+    return new PendingLookup(PendingLookup::CountLookup,
+                             d->connection(),
+                             TrackerIOPrivate::prepareTotalEventsQuery(groupId));
+}
+
 bool TrackerIO::getEventByUri(const QUrl &uri, Event &event)
 {
     int eventId = Event::urlToId(uri.toString());
@@ -1356,7 +1829,25 @@ bool TrackerIO::modifyEvent(Event &event)
 
     event.setLastModified(QDateTime::currentDateTime()); // always update modified times in case of modifyEvent
                                                          // irrespective whether client sets or not
-                                                         // allow uid changes for drafts
+
+    // uncounted from the conversation and counted again with the new
+    // state after the changes
+    Event::PropertySet modified = event.modifiedProperties();
+    bool unreadOnly = !modified.contains(Event::IsDeleted)
+        && !modified.contains(Event::Direction);
+    bool countersChanged = event.type() != Event::CallEvent
+        && (modified.contains(Event::IsRead) || !unreadOnly);
+    QString eventPattern = QString(LAT("FILTER(?_event = <%1>)")).arg(event.url().toString());
+    if (countersChanged)
+        query.deletion(TrackerIOPrivate::groupCountersQuery(eventPattern, false, unreadOnly));
+    // and the same for the last message of the conversation
+    bool lastMessageChanged = event.type() != Event::CallEvent
+        && (modified.contains(Event::IsDeleted)
+            || modified.contains(Event::StartTime));
+    if (lastMessageChanged)
+        query.deletion(QString(GROUP_LAST_MESSAGE_REMOVE).arg(event.url().toString()));
+
+    // allow uid changes for drafts
     if (event.isDraft()
         && (event.validProperties().contains(Event::LocalUid)
             || event.validProperties().contains(Event::RemoteUid))) {
@@ -1406,6 +1897,11 @@ bool TrackerIO::modifyEvent(Event &event)
 
     d->writeCommonProperties(query, event, true);
 
+    if (countersChanged)
+        query.appendInsertion(TrackerIOPrivate::groupCountersQuery(eventPattern, true, unreadOnly));
+    if (lastMessageChanged)
+        query.appendInsertion(QString(GROUP_LAST_MESSAGE_ADD).arg(event.url().toString()));
+
     return d->handleQuery(QSparqlQuery(query.query(), QSparqlQuery::InsertStatement),
                           d, "updateGroupTimestamps",
                           QVariant::fromValue(event));
@@ -1449,6 +1945,12 @@ bool TrackerIO::moveEvent(Event &event, int groupId)
 {
     UpdateQuery query;
 
+    // uncounted from the old conversation, counted in the new one, and
+    // the same for the last message
+    QString eventPattern = QString(LAT("FILTER(?_event = <%1>)")).arg(event.url().toString());
+    query.deletion(TrackerIOPrivate::groupCountersQuery(eventPattern, false));
+    query.deletion(QString(GROUP_LAST_MESSAGE_REMOVE).arg(event.url().toString()));
+
     d->setChannel(query, event, groupId, true); // true means modify
 
     if (event.direction() == Event::Inbound) {
@@ -1457,6 +1959,9 @@ bool TrackerIO::moveEvent(Event &event, int groupId)
                             NormalizeFlagKeepDialString);
     }
 
+    query.appendInsertion(TrackerIOPrivate::groupCountersQuery(eventPattern, true));
+    query.appendInsertion(QString(GROUP_LAST_MESSAGE_ADD).arg(event.url().toString()));
+
     return d->handleQuery(QSparqlQuery(query.query(),
                                        QSparqlQuery::InsertStatement));
 }
@@ -1489,7 +1994,9 @@ bool TrackerIO::deleteEvent(Event &event, QThread *backgroundThread)
                 + query;
         break;
     case Event::CallEvent:
-        query += DELETE_EMPTY_CALL_GROUPS_QUERY;
+        query = QString(CALL_GROUP_MISSED_DECREMENT).arg(event.url().toString())
+                + query
+                + DELETE_EMPTY_CALL_GROUPS_QUERY;
         break;
     case Event::MMSEvent:
         // delete message parts and header
@@ -1504,6 +2011,13 @@ bool TrackerIO::deleteEvent(Event &event, QThread *backgroundThread)
         break;
     }
 
+    // uncounted from its conversation, and unlinked as its last
+    // message, while the conversation can still be found
+    if (event.type() != Event::CallEvent)
+        query = TrackerIOPrivate::groupCountersQuery(LAT("FILTER(?_event = ?:uri)"), false)
+                + QString(GROUP_LAST_MESSAGE_REMOVE).arg(event.url().toString())
+                + query;
+
     QSparqlQuery deleteQuery(query, QSparqlQuery::DeleteStatement);
     deleteQuery.bindValue(LAT("uri"), event.url());
 
@@ -1626,6 +2140,12 @@ bool TrackerIOPrivate::doDeleteGroups(CommittingTransaction *transaction,
                         .arg(groups.join(LAT(","))));
     }
 
+    // stored message counters, see GROUP_COUNTERS_QUERY
+    update.deletion(QString(LAT("DELETE {?counter rdf:type rdfs:Resource}"
+                                "WHERE {?channel nao:hasProperty ?counter "
+                                "FILTER(?channel IN (%1))}"))
+                    .arg(groups.join(LAT(","))));
+
     update.deletion(QString(LAT("DELETE {?channel rdf:type rdfs:Resource}"
                                 "WHERE {?channel rdf:type nmo:CommunicationChannel "
                                 "FILTER(?channel IN (%1))}"))
@@ -1686,12 +2206,35 @@ bool TrackerIO::deleteGroup(int groupId, bool deleteMessages, QThread *backgroun
     return deleteGroups(QList<int>() << groupId, deleteMessages, backgroundThread);
 }
 
+bool TrackerIO::deleteGroupIfEmpty(int groupId,
+                                   QObject *caller,
+                                   const char *callback,
+                                   QVariant arg)
+{
+    qDebug() << Q_FUNC_INFO << groupId;
+
+    QString groupUri = Group::idToUrl(groupId).toString();
+    if (!d->handleQuery(QSparqlQuery(QString(DELETE_EMPTY_GROUP_QUERY).arg(groupUri),
+                                     QSparqlQuery::DeleteStatement)))
+        return false;
+
+    if (!caller)
+        return true;
+
+    return d->handleQuery(QSparqlQuery(QString(LAT("ASK {<%1> a nmo:CommunicationChannel}"))
+                                       .arg(groupUri),
+                                       QSparqlQuery::AskStatement),
+                          caller, callback, arg);
+}
+
 bool TrackerIO::deleteGroups(QList<int> groupIds, bool deleteMessages, QThread *backgroundThread)
 {
     qDebug() << Q_FUNC_INFO << groupIds << deleteMessages << backgroundThread;
 
     d->m_bgThread = backgroundThread;
 
+    KnownResources::clear();
+
     if (deleteMessages)
         return d->queryMmsTokensForGroups(groupIds);
 
@@ -1700,13 +2243,7 @@ bool TrackerIO::deleteGroups(QList<int> groupIds, bool deleteMessages, QThread *
 
 bool TrackerIO::totalEventsInGroup(int groupId, int &totalEvents)
 {
-    QSparqlQuery query(LAT(
-            "SELECT COUNT(?message) "
-            "WHERE {"
-              "?message rdf:type nmo:Message; nmo:isDeleted \"false\";"
-              "nmo:communicationChannel ?:conversation}"));
-
-    query.bindValue(LAT("conversation"), Group::idToUrl(groupId));
+    QSparqlQuery query(TrackerIOPrivate::prepareTotalEventsQuery(groupId));
 
     QScopedPointer<QSparqlResult> queryResult(d->connection().exec(query));
 
@@ -1726,7 +2263,13 @@ bool TrackerIO::totalEventsInGroup(int groupId, int &totalEvents)
 
 bool TrackerIO::markAsReadGroup(int groupId)
 {
-    return d->markGroupAsRead(Group::idToUrl(groupId).toString());
+    QString groupUri = Group::idToUrl(groupId).toString();
+    if (!d->markGroupAsRead(groupUri))
+        return false;
+
+    return d->handleQuery(QSparqlQuery(QString(GROUP_COUNTER_RESET)
+                                       .arg(groupUri, LAT("commhistory:unreadMessages")),
+                                       QSparqlQuery::InsertStatement));
 }
 
 bool TrackerIO::markAsReadCallGroup(Event &event)
@@ -1738,10 +2281,45 @@ bool TrackerIO::markAsReadAll(Event::EventType eventType)
 {
     qDebug() << __FUNCTION__ << eventType;
 
-    QString query("DELETE {?e nmo:isRead ?r; nie:contentLastModified ?d}"
-                  "WHERE {?e rdf:type ?:eventType; nmo:isRead ?r; nie:contentLastModified ?d}"
-                  "INSERT {?e nmo:isRead true; nie:contentLastModified ?:date}"
-                  "WHERE {?e rdf:type ?:eventType}");
+    return d->markTypeAsRead(eventType, QDateTime());
+}
+
+bool TrackerIO::markAsReadBefore(Event::EventType eventType, const QDateTime &before)
+{
+    qDebug() << __FUNCTION__ << eventType << before;
+
+    if (!before.isValid()) {
+        qWarning() << __FUNCTION__ << "Invalid date";
+        return false;
+    }
+
+    return d->markTypeAsRead(eventType, before);
+}
+
+bool TrackerIOPrivate::markTypeAsRead(Event::EventType eventType, const QDateTime &before)
+{
+    // uncounted from the unread messages of their conversations first
+    QString query;
+    if (eventType != Event::CallEvent) {
+        query = groupCountersQuery(before.isValid()
+                                   ? LAT("?_event rdf:type ?:eventType; nmo:sentDate ?_t "
+                                         "FILTER(?_t < ?:before)")
+                                   : LAT("?_event rdf:type ?:eventType ."),
+                                   false, true);
+    }
+
+    if (before.isValid()) {
+        query += LAT("DELETE {?e nmo:isRead ?r; nie:contentLastModified ?d}"
+                     "WHERE {?e rdf:type ?:eventType; nmo:sentDate ?t; nmo:isRead ?r; nie:contentLastModified ?d "
+                     "FILTER(?t < ?:before)}"
+                     "INSERT {?e nmo:isRead true; nie:contentLastModified ?:date}"
+                     "WHERE {?e rdf:type ?:eventType; nmo:sentDate ?t FILTER(?t < ?:before)}");
+    } else {
+        query += LAT("DELETE {?e nmo:isRead ?r; nie:contentLastModified ?d}"
+                     "WHERE {?e rdf:type ?:eventType; nmo:isRead ?r; nie:contentLastModified ?d}"
+                     "INSERT {?e nmo:isRead true; nie:contentLastModified ?:date}"
+                     "WHERE {?e rdf:type ?:eventType}");
+    }
 
     QUrl eventTypeUrl;
 
@@ -1766,8 +2344,10 @@ bool TrackerIO::markAsReadAll(Event::EventType eventType)
     QSparqlQuery markAllQuery(query, QSparqlQuery::InsertStatement);
     markAllQuery.bindValue(LAT("eventType"), eventTypeUrl);
     markAllQuery.bindValue(LAT("date"), QDateTime::currentDateTime());
+    if (before.isValid())
+        markAllQuery.bindValue(LAT("before"), before);
 
-    return d->handleQuery(markAllQuery);
+    return handleQuery(markAllQuery);
 }
 
 void TrackerIO::transaction(bool syncOnCommit)
@@ -1777,6 +2357,8 @@ void TrackerIO::transaction(bool syncOnCommit)
     d->syncOnCommit = syncOnCommit;
     d->m_pTransaction = new CommittingTransaction(this);
     d->m_mmsTokens.clear();
+    d->m_journalEventId = -1;
+    d->clearGroupSummaries();
 }
 
 CommittingTransaction* TrackerIO::commit(bool isBlocking)
@@ -1785,6 +2367,16 @@ CommittingTransaction* TrackerIO::commit(bool isBlocking)
 
     CommittingTransaction *returnTransaction = 0;
 
+    d->flushGroupSummaries();
+
+    // remember the inserted resources once they exist
+    if (!d->m_newResources.isEmpty()) {
+        d->m_pTransaction->addSignal(false, d, "addKnownResources",
+                                     Q_ARG(QStringList, d->m_newResources),
+                                     Q_ARG(int, d->m_resourceGeneration));
+        d->m_newResources.clear();
+    }
+
     if (isBlocking) {
         d->m_pTransaction->run(d->connection(), true);
         if (d->syncOnCommit)
@@ -1795,6 +2387,8 @@ CommittingTransaction* TrackerIO::commit(bool isBlocking)
             if (d->syncOnCommit)
                 connect(d->m_pTransaction, SIGNAL(finished()),
                         d, SLOT(syncTracker()));
+            if (d->m_journal)
+                d->journalTransaction(d->m_pTransaction, d->m_journalEventId);
             d->m_pendingTransactions.enqueue(d->m_pTransaction);
             d->runNextTransaction();
             // if m_pTransaction is not in pending transactions,
@@ -1818,41 +2412,72 @@ void TrackerIOPrivate::runNextTransaction()
 {
     qDebug() << Q_FUNC_INFO;
 
-    if (m_pendingTransactions.isEmpty())
-        return;
+    while (!m_pendingTransactions.isEmpty()) {
+        CommittingTransaction *t = m_pendingTransactions.head();
 
-    CommittingTransaction *t = m_pendingTransactions.head();
+        Q_ASSERT(t);
 
-    Q_ASSERT(t);
+        // coalesced transactions finish with the one they were merged to
+        if (t->isFinished()) {
+            t->deleteLater(); // allow other finished() slots to be invoked
+            m_pendingTransactions.dequeue();
+            continue;
+        }
 
-    if (t->isFinished()) {
-        t->deleteLater(); // allow other finished() slots to be invoked
-        m_pendingTransactions.dequeue();
-        t = 0;
+        if (t->isRunning())
+            return;
 
-        if (!m_pendingTransactions.isEmpty())
-            t = m_pendingTransactions.head();
-    }
+        if (m_groupCommit)
+            coalesceTransactions(t);
 
-    if (t && !t->isRunning()) {
         if (!t->run(connection())) {
             qWarning() << Q_FUNC_INFO << "abort transaction" << t;
+            t->abort();
+            t->d->sendSignals();
             emit t->finished();
+            t->d->finishCoalesced();
             m_pendingTransactions.dequeue();
             delete t;
-            t = 0;
-        } else {
-            connect(t,
-                    SIGNAL(finished()),
-                    this,
-                    SLOT(runNextTransaction()));
+            continue;
         }
+
+        connect(t,
+                SIGNAL(finished()),
+                this,
+                SLOT(runNextTransaction()));
+        return;
+    }
+}
+
+void TrackerIOPrivate::coalesceTransactions(CommittingTransaction *head)
+{
+    if (!head->d->canCoalesce())
+        return;
+
+    // only adjacent transactions, to keep the commit order
+    int merged = 0;
+    for (int i = 1; i < m_pendingTransactions.size()
+             && merged < MAX_COALESCED_TRANSACTIONS; i++) {
+        CommittingTransaction *next = m_pendingTransactions.at(i);
+        if (!next->d->canCoalesce())
+            break;
+
+        head->d->coalesce(next);
+        merged++;
+    }
+
+    if (merged) {
+        qDebug() << Q_FUNC_INFO << "group commit of" << merged + 1 << "transactions";
+        head->d->joinQueries();
     }
 }
 
 void TrackerIO::rollback()
 {
     d->m_contactCache.clear();
+    d->m_newResources.clear();
+    d->m_journalEventId = -1;
+    d->clearGroupSummaries();
     d->m_mmsTokens.clear(); // Clear cache to avoid deletion after rollback
     delete d->m_pTransaction;
     d->m_pTransaction = 0;
@@ -1863,6 +2488,177 @@ CommittingTransaction *TrackerIO::currentTransaction() const
     return d->m_pTransaction;
 }
 
+void TrackerIO::setGroupCommit(bool enabled)
+{
+    d->m_groupCommit = enabled;
+}
+
+bool TrackerIO::groupCommit() const
+{
+    return d->m_groupCommit;
+}
+
+bool TrackerIO::setJournal(const QString &name)
+{
+    // finished records must be marked done in the file they came from
+    if (!d->m_journalRecords.isEmpty()) {
+        qWarning() << Q_FUNC_INFO << "journaled transactions in progress";
+        return false;
+    }
+
+    // records not stored stay in the old file for replay
+    delete d->m_journal;
+    d->m_journal = 0;
+    d->m_journalStored.clear();
+
+    if (name.isEmpty())
+        return true;
+
+    WriteJournal *journal = new WriteJournal;
+    if (!journal->open(QDir::homePath() + LAT(JOURNAL_DIR) + name + LAT(".journal"))) {
+        delete journal;
+        return false;
+    }
+
+    d->m_journal = journal;
+    d->replayJournal();
+
+    return true;
+}
+
+bool TrackerIO::isJournaling() const
+{
+    return d->m_journal != 0;
+}
+
+void TrackerIOPrivate::journalTransaction(CommittingTransaction *transaction, int eventId)
+{
+    // only plain updates, joined to one request so that it is
+    // stored by tracker as a whole or not at all
+    if (!transaction->d->canCoalesce())
+        return;
+
+    transaction->d->joinQueries();
+
+    JournalRecord record;
+    record.eventId = eventId;
+    record.query = transaction->d->queryText();
+    record.attempts = 0;
+    if (!m_journal->append(record.query, eventId, record.end))
+        return;
+
+    addJournalRecord(transaction, record);
+
+    // acknowledge from the event loop, callers add the delayed signals
+    // after commit()
+    if (m_journalAcks.isEmpty())
+        QMetaObject::invokeMethod(this, "acknowledgeJournaled", Qt::QueuedConnection);
+    m_journalAcks.append(transaction);
+}
+
+void TrackerIOPrivate::acknowledgeJournaled()
+{
+    QList<QPointer<CommittingTransaction> > acks = m_journalAcks;
+    m_journalAcks.clear();
+
+    // sent only once, not again when tracker finishes
+    foreach (QPointer<CommittingTransaction> t, acks) {
+        if (t)
+            t->d->sendSignals();
+    }
+}
+
+void TrackerIOPrivate::replayJournal()
+{
+    QList<WriteJournal::Record> records = m_journal->pendingRecords();
+    if (records.isEmpty())
+        return;
+
+    qDebug() << Q_FUNC_INFO << "replaying" << records.size() << "journaled transactions";
+
+    foreach (const WriteJournal::Record &pending, records) {
+        JournalRecord record;
+        record.end = pending.end;
+        record.eventId = pending.eventId;
+        record.query = pending.query;
+        record.attempts = 0;
+
+        CommittingTransaction *t = new CommittingTransaction(q);
+
+        // the update may have been stored before the crash
+        if (record.eventId != -1) {
+            QSparqlQuery ask(QString(LAT("ASK {<%1> a nmo:Message}"))
+                             .arg(Event::idToUrl(record.eventId).toString()),
+                             QSparqlQuery::AskStatement);
+            t->addQuery(ask, this, "journalReplayChecked", QVariant(record.eventId));
+        }
+        t->addQuery(QSparqlQuery(record.query, QSparqlQuery::InsertStatement));
+
+        addJournalRecord(t, record);
+        m_pendingTransactions.enqueue(t);
+    }
+
+    runNextTransaction();
+}
+
+void TrackerIOPrivate::addJournalRecord(CommittingTransaction *transaction,
+                                        const JournalRecord &record)
+{
+    m_journalRecords.insert(transaction, record);
+    m_journalStored.insert(record.end, false);
+    connect(transaction, SIGNAL(finished()), SLOT(journalTransactionFinished()));
+}
+
+void TrackerIOPrivate::journalTransactionFinished()
+{
+    CommittingTransaction *t = qobject_cast<CommittingTransaction*>(sender());
+    if (!t || !m_journal || !m_journalRecords.contains(t))
+        return;
+
+    JournalRecord record = m_journalRecords.take(t);
+
+    if (t->d->hasError()) {
+        // the record stays pending either way, only done records are
+        // dropped from the journal
+        if (++record.attempts < JOURNAL_MAX_ATTEMPTS) {
+            qWarning() << Q_FUNC_INFO << "journaled transaction failed, retrying";
+            CommittingTransaction *retry = new CommittingTransaction(q);
+            retry->addQuery(QSparqlQuery(record.query, QSparqlQuery::InsertStatement));
+            addJournalRecord(retry, record);
+            m_pendingTransactions.enqueue(retry);
+            runNextTransaction();
+        } else {
+            qCritical() << Q_FUNC_INFO << "journaled transaction failed, kept for replay";
+            emit q->journalWriteFailed(record.eventId);
+        }
+        return;
+    }
+
+    m_journalStored.insert(record.end, true);
+
+    // records are marked done in journal order, up to the first one
+    // not stored yet
+    quint32 done = 0;
+    QMap<quint32, bool>::iterator i = m_journalStored.begin();
+    while (i != m_journalStored.end() && i.value()) {
+        done = i.key();
+        i = m_journalStored.erase(i);
+    }
+
+    if (done)
+        m_journal->markDone(done);
+}
+
+void TrackerIOPrivate::journalReplayChecked(CommittingTransaction *transaction,
+                                            QSparqlResult *result,
+                                            QVariant arg)
+{
+    if (!result->hasError() && result->boolValue()) {
+        qDebug() << Q_FUNC_INFO << "event" << arg.toInt() << "already stored";
+        transaction->abort(false);
+    }
+}
+
 bool TrackerIO::deleteAllEvents(Event::EventType eventType)
 {
     qDebug() << __FUNCTION__ << eventType;
@@ -1881,7 +2677,12 @@ bool TrackerIO::deleteAllEvents(Event::EventType eventType)
         break;
     case Event::CallEvent:
         eventTypeUrl = QUrl(LAT(NMO_ "Call"));
-        query += QString(LAT("DELETE { ?chan a rdfs:Resource } WHERE { "
+        query += QString(LAT("DELETE { ?counter a rdfs:Resource } WHERE { "
+                             "GRAPH ?:graph { "
+                             "?chan a nmo:CommunicationChannel . "
+                             "} "
+                             "?chan nao:hasProperty ?counter }"
+                             "DELETE { ?chan a rdfs:Resource } WHERE { "
                              "GRAPH ?:graph { "
                              "?chan a nmo:CommunicationChannel . "
                              "} }"));
@@ -1900,12 +2701,32 @@ bool TrackerIO::deleteAllEvents(Event::EventType eventType)
         return false;
     }
 
+    KnownResources::clear();
+
+    // uncounted from their conversations first
+    if (eventType != Event::CallEvent)
+        query = TrackerIOPrivate::groupCountersQuery(LAT("?_event rdf:type ?:eventType ."), false)
+                + query;
+
     QSparqlQuery deleteQuery(query, QSparqlQuery::DeleteStatement);
     deleteQuery.bindValue(LAT("eventType"), eventTypeUrl);
     if (eventType == Event::CallEvent)
         deleteQuery.bindValue(LAT("graph"), COMMHISTORY_GRAPH_CALL_CHANNEL);
 
-    return d->handleQuery(deleteQuery);
+    if (!d->handleQuery(deleteQuery))
+        return false;
+
+    return eventType == Event::CallEvent || d->groupSummaryChanged();
+}
+
+bool TrackerIO::recountGroups()
+{
+    qDebug() << Q_FUNC_INFO;
+
+    return d->handleQuery(QSparqlQuery(QString(GROUP_COUNTERS_QUERY).arg(QString())
+                                       + TrackerIOPrivate::missedCallsQuery(QString()),
+                                       QSparqlQuery::InsertStatement))
+        && d->groupSummaryChanged();
 }
 
 void TrackerIOPrivate::calculateParentId(Event& event)
@@ -1952,16 +2773,13 @@ void TrackerIOPrivate::setFolderLastModifiedTime(UpdateQuery &query,
 
 bool TrackerIO::markAsRead(const QList<int> &eventIds)
 {
-    UpdateQuery query;
-    foreach (int id, eventIds) {
-        query.insertion(Event::idToUrl(id),
-                        "nmo:isRead",
-                        true,
-                        true);
+    for (int batch = 0; batch < eventIds.size(); batch += MAX_VARIABLES_IN_QUERY) {
+        QList<int> ids = eventIds.mid(batch, MAX_VARIABLES_IN_QUERY);
+        if (!d->handleQuery(TrackerIOPrivate::prepareMarkAsReadQuery(ids)))
+            return false;
     }
 
-    return d->handleQuery(QSparqlQuery(query.query(),
-                                       QSparqlQuery::InsertStatement));
+    return true;
 }
 
 MmsContentDeleter& TrackerIOPrivate::getMmsDeleter(QThread *backgroundThread)
@@ -2156,11 +2974,19 @@ bool TrackerIOPrivate::handleQuery(const QSparqlQuery &query,
                                    const char *callback,
                                    QVariant argument)
 {
-    return addToTransactionOrRunQuery(m_pTransaction,
-                                      query,
-                                      caller,
-                                      callback,
-                                      argument);
+    if (m_pTransaction)
+        return addToTransactionOrRunQuery(m_pTransaction,
+                                          query,
+                                          caller,
+                                          callback,
+                                          argument);
+
+    // the resources inserted by a query run right away are known once
+    // it succeeded, not after some later commit
+    bool stored = addToTransactionOrRunQuery(0, query, caller, callback, argument);
+    newResourcesDone(stored);
+
+    return stored;
 }
 
 bool TrackerIOPrivate::runBlockedQuery(QSparqlResult *result)
@@ -25,6 +25,7 @@
 
 #include <QObject>
 #include <QUrl>
+#include <QVariant>
 
 #include "event.h"
 #include "libcommhistoryexport.h"
@@ -37,6 +38,7 @@ class TrackerIOPrivate;
 class Group;
 class UpdateQuery;
 class CommittingTransaction;
+class PendingLookup;
 
 /**
  * \class TrackerIO
@@ -67,6 +69,16 @@ public:
      */
     bool addEvent(Event &event);
 
+    /*!
+     * Add several new events into the database with a single update
+     * request. The id fields of the events are updated if successfully
+     * added.
+     *
+     * \param events New events.
+     * \return true if successful, otherwise false
+     */
+    bool addEvents(QList<Event> &events);
+
     /*!
      * Add a new group into the database. The id field of the group is
      * updated if successfully added.
@@ -123,6 +135,20 @@ public:
      */
     bool getEventByMmsId(const QString &mmsId, int groupId, Event &event);
 
+    /*!
+     * Non-blocking counterparts of getEvent(), getEventByMessageToken(),
+     * getEventByMmsId(), getGroup() and totalEventsInGroup(). The
+     * returned lookup emits PendingLookup::finished() with the result
+     * and deletes itself afterwards.
+     *
+     * \return the pending lookup
+     */
+    PendingLookup* getEventAsync(int id);
+    PendingLookup* getEventByMessageTokenAsync(const QString &token, int groupId = -1);
+    PendingLookup* getEventByMmsIdAsync(const QString &mmsId, int groupId);
+    PendingLookup* getGroupAsync(int id);
+    PendingLookup* totalEventsInGroupAsync(int groupId);
+
     /*!
      * Modifye an event.
      *
@@ -179,6 +205,24 @@ public:
      */
     bool deleteGroup(int groupId, bool deleteMessages = true, QThread *backgroundThread = 0);
 
+    /*!
+     * Delete a group if it has no events left. The check is part of the
+     * update, so events added meanwhile keep the group.
+     *
+     * \param groupId Existing group id
+     * \param caller optional object told whether the group still exists
+     * \param callback slot of caller called with the result of an ASK
+     *                 query for the group after the deletion, see
+     *                 CommittingTransaction::addQuery()
+     * \param arg argument passed to callback
+     *
+     * \return true if successful, otherwise false
+     */
+    bool deleteGroupIfEmpty(int groupId,
+                            QObject *caller = 0,
+                            const char *callback = 0,
+                            QVariant arg = QVariant());
+
     /*!
      * Delete groups
      *
@@ -219,7 +263,9 @@ public:
     bool markAsReadCallGroup(Event &event);
 
     /*!
-     * Mark messages as read
+     * Mark messages as read. Updates nie:contentLastModified as well.
+     * The ids are matched in chunks of MAX_VARIABLES_IN_QUERY, one
+     * update per chunk.
      *
      * \param eventIds list of events to mark
      *
@@ -227,6 +273,16 @@ public:
      */
     bool markAsRead(const QList<int> &eventIds);
 
+    /*!
+     * Mark all messages of a certain type sent before a date as read.
+     *
+     * \param eventType
+     * \param before Events with start time before this are marked.
+     *
+     * \return true if successful, otherwise false
+     */
+    bool markAsReadBefore(Event::EventType eventType, const QDateTime &before);
+
     /*!
      * Mark all messages of a certain type as read
      *
@@ -266,16 +322,78 @@ public:
      */
     void rollback();
 
+    /*!
+     * Recount the total, unread and sent message counters and find the
+     * last message stored for every conversation, and the missed calls
+     * of every call group. They are kept up to date by the methods
+     * changing events; this repairs them. The summaries of conversations
+     * and call groups created by older versions are filled in when
+     * TrackerIO is created.
+     *
+     * \return true if successful
+     */
+    bool recountGroups();
+
     /*!
      * Do NOT call this unless you know what you are doing.
+     *
+     * Makes sure new ids are above the ids in tracker by scanning it,
+     * needed after tracker was restored or reset.
      */
     void recreateIds();
 
+    /*!
+     * Makes sure new ids are above the ids in tracker when starting
+     * after a crash. The saved ids are used as they are, tracker is
+     * only scanned (see recreateIds()) if they are missing or corrupted.
+     * Called when TrackerIO is created.
+     */
+    void recoverIds();
+
     /*!
      * Get the ongoing transaction.
      */
     CommittingTransaction *currentTransaction() const;
 
+    /*!
+     * Enable group commit: queued transactions without query callbacks
+     * are merged into one update request when they get to run. Each
+     * transaction still emits its own finished() and delayed signals.
+     * If the merged request fails, all merged transactions fail.
+     * Disabled by default.
+     */
+    void setGroupCommit(bool enabled);
+    bool groupCommit() const;
+
+    /*!
+     * Enable the local write journal. Committed transactions that only
+     * contain updates are appended to a memory mapped journal file and
+     * their delayed signals are sent right away, before tracker has
+     * stored them. A failed update is retried and, if it still fails,
+     * kept in the journal for replay and reported with
+     * journalWriteFailed(). Records left from a previous run are
+     * replayed first, skipping the ones whose events are already in
+     * tracker.
+     *
+     * The journal is ~/.commhistoryd/<name>.journal and can be used by
+     * one process at a time. Empty name disables the journal. The
+     * journal can't be changed while journaled transactions are in
+     * progress.
+     *
+     * \return true if successful
+     */
+    bool setJournal(const QString &name);
+    bool isJournaling() const;
+
+Q_SIGNALS:
+    /*!
+     * A journaled update was acknowledged but tracker failed to store
+     * it. The record is replayed when the journal is opened again.
+     *
+     * \param eventId First event added by the update, -1 if none.
+     */
+    void journalWriteFailed(int eventId);
+
 private:
     friend class TrackerIOPrivate;
     friend class QueryRunner;
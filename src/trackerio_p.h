@@ -26,6 +26,7 @@
 #include <QObject>
 #include <QUrl>
 #include <QHash>
+#include <QMap>
 #include <QSet>
 #include <QThreadStorage>
 #include <QSparqlQuery>
@@ -33,11 +34,17 @@
 #include <QThread>
 #include <QThreadStorage>
 #include <QStringList>
+#include <QPointer>
 
 #include "idsource.h"
 #include "event.h"
 #include "commonutils.h"
 
+// query in batches of this many uris to avoid "too many variables" error
+#define MAX_VARIABLES_IN_QUERY 100
+// at most this many queued transactions are merged to one group commit
+#define MAX_COALESCED_TRANSACTIONS 50
+
 class MmsContentDeleter;
 class QSparqlConnection;
 class QSparqlResult;
@@ -49,6 +56,8 @@ class UpdateQuery;
 class TrackerIO;
 class CommittingTransaction;
 class EventsQuery;
+class PendingLookup;
+class WriteJournal;
 
 /**
  * \class TrackerIOPrivate
@@ -77,22 +86,56 @@ public:
     static QString makeCallGroupURI(const CommHistory::Event &event);
 
     /*!
-     * Adds required message part properties to the query.
+     * Query message parts of several messages, at most
+     * MAX_VARIABLES_IN_QUERY. Rows are ordered by message, use
+     * QueryResult::messagePartEventId() to tell them apart.
+     * The query text is shared by all lists of the same length.
      */
-    static QString prepareMessagePartQuery(const QString &messageUri);
+    static QSparqlQuery prepareMessagePartQuery(const QStringList &messageUris);
 
     /*!
      * Adds required message part properties to the query.
+     * Without \a withContacts the contacts column is left empty and
+     * the caller is expected to resolve the participants itself.
+     * With \a afterGroupId only groups ordered after that group, last
+     * updated at \a afterDate, are included (keyset paging).
      */
-    static QString prepareGroupQuery(const QString &localUid = QString(),
+    static QSparqlQuery prepareGroupQuery(const QString &localUid = QString(),
                                      const QString &remoteUid = QString(),
-                                     int groupId = -1);
+                                     int groupId = -1,
+                                     bool withContacts = true,
+                                     int afterGroupId = -1,
+                                     const QDateTime &afterDate = QDateTime());
 
     /*!
      * Create query for calls grouped by contacts.
-     * Optionally restrict to specific call groups.
+     * Optionally restrict to specific call groups and leave out
+     * the contacts column.
+     */
+    static QSparqlQuery prepareGroupedCallQuery(const QStringList &channels = QStringList(),
+                                                bool withContacts = true);
+
+    /*!
+     * Create update marking events as read, at most
+     * MAX_VARIABLES_IN_QUERY.
+     */
+    static QSparqlQuery prepareMarkAsReadQuery(const QList<int> &eventIds);
+
+    /*!
+     * Patterns shared by the blocking and asynchronous single event
+     * lookups. groupId -1 matches any group.
      */
-    static QString prepareGroupedCallQuery(const QStringList &channels = QStringList());
+    static void addEventIdPattern(EventsQuery &query, int id);
+    static void addMessageTokenPattern(EventsQuery &query, const QString &token, int groupId);
+    static void addMmsIdPattern(EventsQuery &query, const QString &mmsId, int groupId);
+    static QSparqlQuery prepareTotalEventsQuery(int groupId);
+
+    /*!
+     * Writes the statements adding a new event to query and assigns the
+     * event id.
+     * \return false if the event type is not supported.
+     */
+    bool prepareAddEvent(UpdateQuery &query, Event &event);
 
     /*!
      * Return IMContact node as blank anonymous SPARQL string
@@ -103,6 +146,18 @@ public:
     QString findLocalContact(UpdateQuery &query,
                              const QString &accountPath);
 
+    /*!
+     * Check whether the insert for a contact medium resource is needed
+     * and record it for KnownResources if so.
+     */
+    bool needsResource(const QString &uri);
+    /*!
+     * Add the resources recorded by needsResource() to KnownResources
+     * if the query inserting them outside of a transaction was stored,
+     * and forget them.
+     */
+    void newResourcesDone(bool stored);
+
     /*!
      * Update the query to ensure the existence of the nco:IMAddress resource in tracker.
      */
@@ -184,6 +239,7 @@ public:
 
     // Helper for getEvent*().
     bool querySingleEvent(EventsQuery &query, Event &event);
+    PendingLookup* lookupSingleEvent(EventsQuery &query);
 
     static void calculateParentId(Event& event);
     static void setFolderLastModifiedTime(UpdateQuery &query,
@@ -217,11 +273,76 @@ public:
 
     bool markGroupAsRead(const QString &channelIRI);
 
+    /*!
+     * Find the stored last message of all conversations again, after
+     * changes to many events. Within a transaction it is done once at
+     * commit, otherwise right away.
+     */
+    bool groupSummaryChanged();
+    /*!
+     * Update of the stored message counters of the conversations of the
+     * events matching pattern on ?_event, see GROUP_COUNTER_CHANGE.
+     * Subtract before the events change and add after.
+     */
+    static QString groupCountersQuery(const QString &eventPattern,
+                                      bool add,
+                                      bool unreadOnly = false);
+    // refresh the missed call counter of the call groups selected by
+    // constraint, see CALL_GROUP_MISSED_QUERY
+    static QString missedCallsQuery(const QString &constraint);
+    void flushGroupSummaries();
+    void clearGroupSummaries();
+
+    /*!
+     * Fill in the stored summaries of the groups stored by older
+     * versions, without blocking. Runs when TrackerIO is created.
+     */
+    void upgradeGroups();
+    // queue update if any channel in graph matches pattern
+    void upgradeGroups(const char *graph,
+                       const QString &pattern,
+                       const QString &update);
+    // mark events of type as read, only ones before the date if valid
+    bool markTypeAsRead(Event::EventType eventType, const QDateTime &before);
+
+    /*!
+     * Group commit: merge the pending transactions following head
+     * into it, see TrackerIO::setGroupCommit().
+     */
+    void coalesceTransactions(CommittingTransaction *head);
+
+    /*!
+     * Append transaction to the write journal and acknowledge it.
+     */
+    void journalTransaction(CommittingTransaction *transaction, int eventId);
+    void replayJournal();
+
+    struct JournalRecord {
+        quint32 end;
+        int eventId;
+        QString query;
+        int attempts;
+    };
+    // transaction stores record, see journalTransactionFinished()
+    void addJournalRecord(CommittingTransaction *transaction,
+                          const JournalRecord &record);
+
 public Q_SLOTS:
+    void acknowledgeJournaled();
+    void journalTransactionFinished();
+    void journalReplayChecked(CommittingTransaction *transaction,
+                              QSparqlResult *result,
+                              QVariant arg);
+    void groupsUpgradeChecked(CommittingTransaction *transaction,
+                              QSparqlResult *result,
+                              QVariant arg);
+    void addKnownResources(const QStringList &uris, int generation);
+    // contact medium resources may be gone with the groups
+    void groupsDeletedSlot(const QList<int> &groupIds);
     void runNextTransaction();
     /*!
      * Update nmo:lastMessageDate and nmo:lastSuccessfulMessageDate for
-     * channel and delete empty call groups.
+     * channel, and reset the missed call counter of call groups.
      */
     void doUpdateGroupTimestamps(CommittingTransaction *transaction,
                                  QSparqlResult *result,
@@ -249,9 +370,26 @@ public:
 
     // Temporary contact cache, valid during a transaction
     QHash<QUrl, QString> m_contactCache;
+    // resources inserted by the current transaction, see KnownResources
+    QStringList m_newResources;
+    int m_resourceGeneration;
     MmsContentDeleter *m_MmsContentDeleter;
     QSet<QString> m_mmsTokens;
     bool syncOnCommit;
+    bool m_groupCommit;
+
+    // refresh the last message of all conversations at commit
+    bool m_refreshAllGroups;
+
+    WriteJournal *m_journal;
+    // first event added in the current transaction, for the journal
+    int m_journalEventId;
+    // journaled transactions not yet finished
+    QHash<CommittingTransaction*, JournalRecord> m_journalRecords;
+    // end offsets of records not marked done, in journal order, true
+    // when stored by tracker
+    QMap<quint32, bool> m_journalStored;
+    QList<QPointer<CommittingTransaction> > m_journalAcks;
 
     IdSource m_IdSource;
 
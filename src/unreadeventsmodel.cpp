@@ -95,7 +95,7 @@ bool UnreadEventsModel::getEvents(bool includeSentEvents)
     d->clearEvents();
     endResetModel();
 
-    EventsQuery query(d->propertyMask);
+    EventsQuery query(d->queryProperties());
 
     query.addPattern(QLatin1String("%1 nmo:isRead \"false\"; "
                                       "nmo:isDraft \"false\"; "
@@ -36,25 +36,22 @@ QString encloseUrl(const QUrl &url)
         || urlString.startsWith(LAT("?")))
         return urlString;
 
-    return QString(LAT("<%1>")).arg(urlString);
+    return LAT("<") % urlString % LAT(">");
 }
 
-void copyReverse(const QStringList &src, QStringList &target, const QString &delim = QString())
+// append part to buffer, separated by a space
+void appendPart(QString &buffer, const QString &part)
 {
-    QStringListIterator i(src);
-    i.toBack();
-    while(i.hasPrevious()) {
-        if (!delim.isEmpty() && i.hasNext())
-            target << delim;
-        target << i.previous();
-    }
+    if (!buffer.isEmpty())
+        buffer += QLatin1Char(' ');
+    buffer += part;
 }
 
 }
 
 namespace CommHistory {
 
-UpdateQuery::UpdateQuery() : nextVar(0)
+UpdateQuery::UpdateQuery() : nextVar(0), lastSubjectIndex(-1)
 {
 }
 
@@ -64,30 +61,28 @@ void UpdateQuery::deletion(const QUrl &subject,
                            const QString &object)
 {
     QString obj = object.isEmpty() ? nextVariable() : object;
+    QString s = encloseUrl(subject);
 
-    deletions << LAT("DELETE {")
-            << encloseUrl(subject)
-            << LAT(predicate) << obj
-            << LAT("} WHERE {")
-            << encloseUrl(subject) << LAT(predicate) << obj
-            << LAT("}");
+    appendPart(deletions,
+               LAT("DELETE { ") % s % LAT(" ") % LAT(predicate) % LAT(" ") % obj
+               % LAT(" } WHERE { ") % s % LAT(" ") % LAT(predicate) % LAT(" ") % obj
+               % LAT(" }"));
 }
 
 void UpdateQuery::resourceDeletion(const QUrl &subject,
                                    const char *predicate)
 {
     QString r = nextVariable();
-    deletions << LAT("DELETE {")
-            << encloseUrl(subject)
-            << LAT(predicate) << r << LAT(".")
-            << r << LAT("rdf:type rdfs:Resource .")
-            << LAT("} WHERE {")
-            << encloseUrl(subject) << LAT(predicate) << r
-            << LAT("} ");
+    QString s = encloseUrl(subject);
+
+    appendPart(deletions,
+               LAT("DELETE { ") % s % LAT(" ") % LAT(predicate) % LAT(" ") % r % LAT(" . ")
+               % r % LAT(" rdf:type rdfs:Resource . } WHERE { ")
+               % s % LAT(" ") % LAT(predicate) % LAT(" ") % r % LAT(" } "));
 }
 
 void UpdateQuery::deletion(const QString &query) {
-    deletions << query;
+    appendPart(deletions, query);
 }
 
 
@@ -97,7 +92,17 @@ void UpdateQuery::insertionRaw(const QUrl &subject,
                                bool modify) {
     Q_UNUSED(modify); // was in use with separate deletes
 
-    insertions.insertMulti(subject, LAT(predicate) % LAT(" ") % object);
+    if (subject.isEmpty()) {
+        appendPart(statements, LAT(predicate) % LAT(" ") % object);
+        return;
+    }
+
+    QString &subjectBuffer = subjectStatements(subject);
+    if (!subjectBuffer.isEmpty())
+        subjectBuffer += LAT(" ; ");
+    subjectBuffer += LAT(predicate);
+    subjectBuffer += QLatin1Char(' ');
+    subjectBuffer += object;
 }
 
 void UpdateQuery::insertion(const QUrl &subject,
@@ -152,47 +157,56 @@ void UpdateQuery::insertion(const QUrl &subject,
 
 void UpdateQuery::insertion(const QString &statement)
 {
-    insertions.insertMulti(QUrl(), statement);
+    appendPart(statements, statement);
 }
 
 void UpdateQuery::insertionSilent(const QString &statement)
 {
-    silents << statement;
+    appendPart(silents, statement);
 }
 
 void UpdateQuery::appendInsertion(const QString &statement)
 {
-    postInsertions << statement;
+    appendPart(postInsertions, statement);
 }
 
 QString UpdateQuery::query()
 {
-    QStringList query;
-    query << deletions;
-
-    if (!silents.isEmpty())
-        query << LAT("INSERT SILENT {")
-              << silents
-              << LAT("}");
-
-    if (!insertions.isEmpty()) {
-        query << LAT("INSERT OR REPLACE {");
-        copyReverse(insertions.values(QUrl()), query);
-
-        foreach (QUrl subject, insertions.uniqueKeys()) {
-            if (subject.isEmpty())
-                continue;
+    // size the result once, with room for the keywords
+    int size = deletions.size() + silents.size() + statements.size()
+        + postInsertions.size() + 64;
+    foreach (const Subject &subject, subjects)
+        size += subject.enclosed.size() + subject.statements.size() + 4;
+
+    QString query;
+    query.reserve(size);
+    query += deletions;
+
+    if (!silents.isEmpty()) {
+        appendPart(query, LAT("INSERT SILENT {"));
+        appendPart(query, silents);
+        query += LAT(" }");
+    }
 
-            query << encloseUrl(subject);
-            copyReverse(insertions.values(subject), query, LAT("; "));
-            query << LAT(" .");
+    if (!statements.isEmpty() || !subjects.isEmpty()) {
+        appendPart(query, LAT("INSERT OR REPLACE {"));
+        if (!statements.isEmpty())
+            appendPart(query, statements);
+
+        foreach (const Subject &subject, subjects) {
+            query += QLatin1Char(' ');
+            query += subject.enclosed;
+            query += QLatin1Char(' ');
+            query += subject.statements;
+            query += LAT(" .");
         }
-        query << LAT("}");
+        query += LAT(" }");
     }
 
-    query << postInsertions;
+    if (!postInsertions.isEmpty())
+        appendPart(query, postInsertions);
 
-    return query.join(LAT(" "));
+    return query;
 }
 
 QString UpdateQuery::nextVariable()
@@ -200,5 +214,28 @@ QString UpdateQuery::nextVariable()
     return LAT("?_") % QString::number(nextVar++);
 }
 
+QString &UpdateQuery::subjectStatements(const QUrl &subject)
+{
+    // statements for one subject usually come in a row, only look up
+    // (and enclose) the subject when it changes
+    if (lastSubjectIndex < 0 || subject != lastSubject) {
+        QString enclosed = encloseUrl(subject);
+
+        QHash<QString, int>::const_iterator i = subjectIndex.constFind(enclosed);
+        if (i == subjectIndex.constEnd()) {
+            Subject s;
+            s.enclosed = enclosed;
+            subjects.append(s);
+            lastSubjectIndex = subjects.size() - 1;
+            subjectIndex.insert(enclosed, lastSubjectIndex);
+        } else {
+            lastSubjectIndex = i.value();
+        }
+        lastSubject = subject;
+    }
+
+    return subjects[lastSubjectIndex].statements;
+}
+
 } //namespace
 
@@ -26,9 +26,18 @@
 #include <QUrl>
 #include <QStringList>
 #include <QDateTime>
+#include <QHash>
+#include <QVector>
 
 namespace CommHistory {
 
+/*!
+ * \class UpdateQuery
+ *
+ * Builder for tracker update requests. Statements are appended to
+ * growing buffers as they are added; insertions are grouped by subject
+ * in the order the subjects first appear.
+ */
 class UpdateQuery {
 public:
     UpdateQuery();
@@ -83,13 +92,24 @@ public:
 
 private:
     QString nextVariable();
+    QString &subjectStatements(const QUrl &subject);
 
 private:
+    struct Subject {
+        QString enclosed;
+        QString statements;
+    };
+
     int nextVar;
-    QStringList deletions;
-    QMultiMap<QUrl, QString> insertions;
-    QStringList postInsertions;
-    QStringList silents;
+    QString deletions;
+    QString silents;
+    // insertions without a subject, go before the grouped ones
+    QString statements;
+    QVector<Subject> subjects;
+    QHash<QString, int> subjectIndex;
+    QUrl lastSubject;
+    int lastSubjectIndex;
+    QString postInsertions;
 };
 
 } // namespace
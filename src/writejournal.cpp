@@ -0,0 +1,295 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** Contact: Reto Zingg <reto.zingg@nokia.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "writejournal.h"
+
+using namespace CommHistory;
+
+#define JOURNAL_MAGIC 0x4a484843 // "CHHJ"
+#define JOURNAL_VERSION 1
+
+namespace CommHistory {
+struct WriteJournal::Header {
+    quint32 magic;
+    quint32 version;
+    // end of the last appended record
+    quint32 writeOffset;
+    // start of the first record not marked done
+    quint32 replayOffset;
+};
+}
+
+namespace {
+struct RecordHeader {
+    quint32 size;
+    qint32 eventId;
+};
+
+quint32 aligned(quint32 size)
+{
+    return (size + 3) & ~3;
+}
+}
+
+WriteJournal::WriteJournal() :
+    m_Data(0),
+    m_Size(0)
+{
+}
+
+WriteJournal::~WriteJournal()
+{
+    close();
+}
+
+bool WriteJournal::open(const QString &fileName)
+{
+    close();
+
+    QDir dir = QFileInfo(fileName).absoluteDir();
+    if (!dir.exists() && !dir.mkpath(dir.path())) {
+        qWarning() << Q_FUNC_INFO << "Failed to create" << dir.path();
+        return false;
+    }
+
+    m_File.setFileName(fileName);
+    if (!m_File.open(QIODevice::ReadWrite)) {
+        qWarning() << Q_FUNC_INFO << "Failed to open" << fileName << m_File.errorString();
+        return false;
+    }
+
+    if (flock(m_File.handle(), LOCK_EX | LOCK_NB) != 0) {
+        qWarning() << Q_FUNC_INFO << fileName << "is in use";
+        m_File.close();
+        return false;
+    }
+
+    bool created = m_File.size() < (qint64)sizeof(Header);
+    if (!map(qMax((quint32)m_File.size(), InitialSize))) {
+        close();
+        return false;
+    }
+
+    Header *h = header();
+    if (!created
+        && (h->magic != JOURNAL_MAGIC
+            || h->version != JOURNAL_VERSION
+            || h->replayOffset < sizeof(Header)
+            || h->replayOffset > h->writeOffset
+            || h->writeOffset > m_Size)) {
+        qWarning() << Q_FUNC_INFO << "Invalid journal, discarding" << fileName;
+        created = true;
+    }
+
+    if (created) {
+        h->magic = JOURNAL_MAGIC;
+        h->version = JOURNAL_VERSION;
+        h->writeOffset = sizeof(Header);
+        h->replayOffset = sizeof(Header);
+        sync();
+    }
+
+    return true;
+}
+
+void WriteJournal::close()
+{
+    if (m_Data) {
+        sync();
+        m_File.unmap(m_Data);
+        m_Data = 0;
+        m_Size = 0;
+    }
+
+    if (m_File.isOpen()) {
+        flock(m_File.handle(), LOCK_UN);
+        m_File.close();
+    }
+}
+
+bool WriteJournal::isOpen() const
+{
+    return m_Data != 0;
+}
+
+QList<WriteJournal::Record> WriteJournal::pendingRecords() const
+{
+    QList<Record> records;
+    if (!m_Data)
+        return records;
+
+    quint32 offset = header()->replayOffset;
+    quint32 writeOffset = header()->writeOffset;
+    while (offset + sizeof(RecordHeader) <= writeOffset) {
+        const RecordHeader *rh = reinterpret_cast<const RecordHeader*>(m_Data + offset);
+        // a corrupted size must not wrap the end around
+        if (rh->size > writeOffset - offset - sizeof(RecordHeader)) {
+            qWarning() << Q_FUNC_INFO << "Invalid record size at" << offset;
+            break;
+        }
+        quint32 end = offset + sizeof(RecordHeader) + aligned(rh->size);
+        if (end > writeOffset) {
+            qWarning() << Q_FUNC_INFO << "Truncated record at" << offset;
+            break;
+        }
+
+        Record record;
+        record.end = end;
+        record.eventId = rh->eventId;
+        record.query = QString::fromUtf8(reinterpret_cast<const char*>(rh + 1), rh->size);
+        records.append(record);
+
+        offset = end;
+    }
+
+    return records;
+}
+
+bool WriteJournal::append(const QString &query, int eventId, quint32 &end)
+{
+    if (!m_Data)
+        return false;
+
+    QByteArray data = query.toUtf8();
+    quint32 recordSize = sizeof(RecordHeader) + aligned(data.size());
+    if (!reserve(recordSize))
+        return false;
+
+    Header *h = header();
+    RecordHeader *rh = reinterpret_cast<RecordHeader*>(m_Data + h->writeOffset);
+    rh->size = data.size();
+    rh->eventId = eventId;
+    memcpy(rh + 1, data.constData(), data.size());
+
+    // the record must be on disk before the header points past it, a
+    // crash in between leaves only unused space after writeOffset
+    quint32 start = h->writeOffset;
+    sync(start, recordSize);
+    // the record is acknowledged, it must survive a crash from now on
+    h->writeOffset += recordSize;
+    sync(0, sizeof(Header));
+
+    end = h->writeOffset;
+    return true;
+}
+
+void WriteJournal::markDone(quint32 end)
+{
+    if (!m_Data)
+        return;
+
+    Header *h = header();
+    if (end <= h->replayOffset || end > h->writeOffset)
+        return;
+
+    h->replayOffset = end;
+    // rewind when empty, the old records are garbage now
+    if (h->replayOffset == h->writeOffset) {
+        h->writeOffset = sizeof(Header);
+        h->replayOffset = sizeof(Header);
+    }
+
+    // a lost update only causes a replay, no need to wait
+    sync(0, sizeof(Header), false);
+}
+
+bool WriteJournal::isEmpty() const
+{
+    return !m_Data || header()->replayOffset == header()->writeOffset;
+}
+
+bool WriteJournal::map(quint32 size)
+{
+    if (m_Data) {
+        m_File.unmap(m_Data);
+        m_Data = 0;
+        m_Size = 0;
+    }
+
+    if (m_File.size() < size && !m_File.resize(size)) {
+        qWarning() << Q_FUNC_INFO << "Failed to resize" << m_File.fileName() << m_File.errorString();
+        return false;
+    }
+
+    m_Data = m_File.map(0, size);
+    if (!m_Data) {
+        qWarning() << Q_FUNC_INFO << "Failed to map" << m_File.fileName() << m_File.errorString();
+        return false;
+    }
+
+    m_Size = size;
+    return true;
+}
+
+bool WriteJournal::reserve(quint32 bytes)
+{
+    quint32 needed = header()->writeOffset + bytes;
+    if (needed <= m_Size)
+        return true;
+
+    quint32 size = m_Size;
+    while (size < needed)
+        size *= 2;
+
+    if (size > MaxSize) {
+        qWarning() << Q_FUNC_INFO << "Journal full";
+        return false;
+    }
+
+    quint32 oldSize = m_Size;
+    if (!map(size)) {
+        map(oldSize);
+        return false;
+    }
+
+    return true;
+}
+
+WriteJournal::Header* WriteJournal::header() const
+{
+    return reinterpret_cast<Header*>(m_Data);
+}
+
+void WriteJournal::sync(bool wait)
+{
+    sync(0, m_Size, wait);
+}
+
+void WriteJournal::sync(quint32 offset, quint32 length, bool wait)
+{
+    if (!m_Data)
+        return;
+
+    // msync() takes a page aligned address, the mapping itself is
+    static const quint32 pageSize = sysconf(_SC_PAGESIZE);
+    quint32 start = offset - offset % pageSize;
+    if (msync(m_Data + start, offset + length - start, wait ? MS_SYNC : MS_ASYNC) != 0)
+        qWarning() << Q_FUNC_INFO << "msync failed";
+}
@@ -0,0 +1,112 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** Contact: Reto Zingg <reto.zingg@nokia.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#ifndef COMMHISTORY_WRITEJOURNAL_H
+#define COMMHISTORY_WRITEJOURNAL_H
+
+#include <QFile>
+#include <QList>
+#include <QString>
+
+namespace CommHistory {
+
+/*!
+ * \class WriteJournal
+ *
+ * Append-only, memory mapped journal of update requests not yet stored
+ * by tracker. TrackerIO appends a record when a transaction is
+ * committed and marks it done when tracker has finished it; records
+ * left after a crash are replayed on the next open.
+ *
+ * Records are marked done in the order they were appended. The file is
+ * rewound when all records are done, and grows up to MaxSize.
+ *
+ * The file is locked while open, only one process can use a journal.
+ */
+class WriteJournal
+{
+public:
+    struct Record {
+        // offset after the record, see markDone()
+        quint32 end;
+        // first event added by the update, -1 if none
+        int eventId;
+        QString query;
+    };
+
+    static const quint32 InitialSize = 256 * 1024;
+    static const quint32 MaxSize = 4 * 1024 * 1024;
+
+    WriteJournal();
+    ~WriteJournal();
+
+    /*!
+     * Open or create the journal file and map it.
+     * \return true if successful
+     */
+    bool open(const QString &fileName);
+    void close();
+    bool isOpen() const;
+
+    /*!
+     * \return Records appended but not marked done, in order.
+     */
+    QList<Record> pendingRecords() const;
+
+    /*!
+     * Append a record and flush it to disk.
+     *
+     * \param query Update request text.
+     * \param eventId First event added by query, -1 if none.
+     * \param end Set to the offset after the record.
+     * \return true if successful, false if the journal is full or closed
+     */
+    bool append(const QString &query, int eventId, quint32 &end);
+
+    /*!
+     * Mark records up to end as done.
+     */
+    void markDone(quint32 end);
+
+    /*!
+     * \return true if there are no pending records.
+     */
+    bool isEmpty() const;
+
+private:
+    struct Header;
+
+    bool map(quint32 size);
+    bool reserve(quint32 bytes);
+    Header* header() const;
+    void sync(bool wait = true);
+    // sync pages containing the range
+    void sync(quint32 offset, quint32 length, bool wait = true);
+
+    QFile m_File;
+    uchar *m_Data;
+    quint32 m_Size;
+};
+
+} // namespace CommHistory
+
+#endif // COMMHISTORY_WRITEJOURNAL_H
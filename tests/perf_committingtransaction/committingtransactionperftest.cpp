@@ -0,0 +1,209 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** Contact: Reto Zingg <reto.zingg@nokia.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include <QtTest/QtTest>
+#include <QDateTime>
+#include <cstdlib>
+#include "committingtransactionperftest.h"
+#include "committingtransaction.h"
+#include "trackerio.h"
+#include "event.h"
+#include "group.h"
+#include "common.h"
+
+using namespace CommHistory;
+
+Group group1, group2;
+
+const int TIMEOUT = 5000;
+// time spent in each busy GUI loop iteration, roughly one frame
+const int BUSY_MSECS = 16;
+
+void CommittingTransactionPerfTest::initTestCase()
+{
+    logFile = new QFile("libcommhistory-performance-test.log");
+    if(!logFile->open(QIODevice::Append)) {
+        qDebug() << "!!!! Failed to open log file !!!!";
+        logFile = 0;
+    }
+
+    qsrand( QDateTime::currentDateTime().toTime_t() );
+}
+
+void CommittingTransactionPerfTest::init()
+{
+    deleteAll();
+    QTest::qWait(TIMEOUT);
+    waitForIdle();
+}
+
+void CommittingTransactionPerfTest::commitLatency_data()
+{
+    // Number of update queries in one transaction
+    QTest::addColumn<int>("queries");
+
+    // Keep the event loop busy with a zero timer, like a GUI painting
+    QTest::addColumn<bool>("busy");
+
+    QTest::newRow("1 query, idle") << 1 << false;
+    QTest::newRow("1 query, busy") << 1 << true;
+    QTest::newRow("10 queries, idle") << 10 << false;
+    QTest::newRow("10 queries, busy") << 10 << true;
+    QTest::newRow("50 queries, idle") << 50 << false;
+    QTest::newRow("50 queries, busy") << 50 << true;
+}
+
+void CommittingTransactionPerfTest::commitLatency()
+{
+    QFETCH(int, queries);
+    QFETCH(bool, busy);
+
+    addTestGroups(group1, group2);
+
+    TrackerIO *tracker = TrackerIO::instance();
+    QDateTime when = QDateTime::currentDateTime();
+    int count = iterations();
+    QList<int> times;
+
+    QTimer busyTimer;
+    busyTimer.setInterval(0);
+    connect(&busyTimer, SIGNAL(timeout()), this, SLOT(busySlot()));
+
+    qDebug() << __FUNCTION__ << "- Committing" << queries << "queries per transaction."
+             << count << "iterations";
+
+    for (int i = 0; i < count; i++) {
+        tracker->transaction();
+        for (int j = 0; j < queries; j++) {
+            // TrackerIO::addEvent() adds a single update query
+            Event e;
+            e.setType(Event::IMEvent);
+            e.setDirection(Event::Inbound);
+            e.setGroupId(group1.id());
+            e.setStartTime(when.addSecs(i * queries + j));
+            e.setEndTime(when.addSecs(i * queries + j));
+            e.setLocalUid(group1.localUid());
+            e.setRemoteUid(group1.remoteUids().first());
+            e.setFreeText(randomMessage(qrand() % 9 + 1));
+            QVERIFY(tracker->addEvent(e));
+        }
+
+        if (busy)
+            busyTimer.start();
+
+        finished = false;
+        QTime time;
+        time.start();
+
+        CommittingTransaction *t = tracker->commit();
+        QVERIFY(t);
+        connect(t, SIGNAL(finished()), this, SLOT(transactionFinished()));
+
+        while (!finished && time.elapsed() < TIMEOUT * 10)
+            QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents, 100);
+
+        times << time.elapsed();
+        busyTimer.stop();
+
+        QVERIFY(finished);
+    }
+
+    logTimes(times, queries);
+}
+
+void CommittingTransactionPerfTest::transactionFinished()
+{
+    finished = true;
+}
+
+void CommittingTransactionPerfTest::busySlot()
+{
+    QTime time;
+    time.start();
+    while (time.elapsed() < BUSY_MSECS)
+        ;
+}
+
+void CommittingTransactionPerfTest::cleanupTestCase()
+{
+    if(logFile) {
+        logFile->close();
+        delete logFile;
+        logFile = 0;
+    }
+}
+
+int CommittingTransactionPerfTest::iterations() const
+{
+    int iterations = 10;
+
+    #ifdef PERF_ITERATIONS
+    iterations = PERF_ITERATIONS;
+    #endif
+
+    char *iterVar = getenv("PERF_ITERATIONS");
+    if (iterVar) {
+        int iters = QString::fromAscii(iterVar).toInt();
+        if (iters > 0) {
+            iterations = iters;
+        }
+    }
+
+    return iterations;
+}
+
+void CommittingTransactionPerfTest::logTimes(QList<int> times, int queries)
+{
+    if(logFile) {
+        QTextStream out(logFile);
+
+        out << QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss") << ": "
+            << metaObject()->className() << "::" << QTest::currentTestFunction() << "("
+            << QTest::currentDataTag() << ", " << times.size() << " iterations)"
+            << "\n";
+
+        for (int i = 0; i < times.size(); i++) {
+            out << times.at(i) << " ";
+        }
+        out << "\n";
+    }
+
+    qSort(times);
+    float median = 0.0;
+    if(times.size() % 2 > 0) {
+        median = times[times.size() / 2];
+    } else {
+        median = (times[times.size() / 2] + times[times.size() / 2 - 1]) / 2.0f;
+    }
+
+    float perQuery = median / queries;
+
+    qDebug("##### Median: %.1f ms per transaction; %.1f ms per query", median, perQuery);
+
+    if(logFile) {
+        QTextStream out(logFile);
+        out << "Median average: " << (int)median << " ms per transaction, "
+            << perQuery << " ms per query\n";
+    }
+}
+
+QTEST_MAIN(CommittingTransactionPerfTest)
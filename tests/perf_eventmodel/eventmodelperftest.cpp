@@ -0,0 +1,164 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** Contact: Reto Zingg <reto.zingg@nokia.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include <QtTest/QtTest>
+#include <QDateTime>
+#include <cstdlib>
+#include "eventmodelperftest.h"
+#include "common.h"
+#include "group.h"
+
+using namespace CommHistory;
+
+Group group1, group2;
+
+const int TIMEOUT = 5000;
+// give up waiting for commits after this long without progress
+const int COMMIT_TIMEOUT = 60000;
+
+void EventModelPerfTest::initTestCase()
+{
+    logFile = new QFile("libcommhistory-performance-test.log");
+    if(!logFile->open(QIODevice::Append)) {
+        qDebug() << "!!!! Failed to open log file !!!!";
+        logFile = 0;
+    }
+
+    qsrand( QDateTime::currentDateTime().toTime_t() );
+}
+
+void EventModelPerfTest::init()
+{
+    deleteAll();
+    QTest::qWait(TIMEOUT);
+    waitForIdle();
+}
+
+void EventModelPerfTest::importEvents_data()
+{
+    // Number of messages imported
+    QTest::addColumn<int>("messages");
+
+    // Add with one addEvents() call instead of addEvent() per message
+    QTest::addColumn<bool>("bulk");
+
+    QTest::newRow("100 messages, addEvent") << 100 << false;
+    QTest::newRow("100 messages, addEvents") << 100 << true;
+    QTest::newRow("1000 messages, addEvent") << 1000 << false;
+    QTest::newRow("1000 messages, addEvents") << 1000 << true;
+    QTest::newRow("10000 messages, addEvents") << 10000 << true;
+}
+
+void EventModelPerfTest::importEvents()
+{
+    QFETCH(int, messages);
+    QFETCH(bool, bulk);
+
+    addTestGroups(group1, group2);
+
+    QDateTime when = QDateTime::currentDateTime();
+    QList<Event> eventList;
+
+    for (int i = 0; i < messages; i++) {
+        const Group &group = i % 2 ? group1 : group2;
+
+        Event e;
+        e.setType(Event::IMEvent);
+        e.setDirection(qrand() % 2 > 0 ? Event::Inbound : Event::Outbound);
+        e.setGroupId(group.id());
+        e.setStartTime(when.addSecs(i));
+        e.setEndTime(when.addSecs(i));
+        e.setLocalUid(group.localUid());
+        e.setRemoteUid(group.remoteUids().first());
+        e.setFreeText(randomMessage(qrand() % 49 + 1)); // Max 50 words / message
+        e.setIsDraft(false);
+        e.setIsMissedCall(false);
+        eventList << e;
+    }
+
+    EventModel model;
+    model.enableContactChanges(false);
+    connect(&model, SIGNAL(eventsCommitted(const QList<CommHistory::Event>&, bool)),
+            this, SLOT(eventsCommittedSlot(const QList<CommHistory::Event>&, bool)));
+    committed = 0;
+    commitFailed = false;
+
+    qDebug() << __FUNCTION__ << "- Importing" << messages << "messages";
+
+    QTime time;
+    time.start();
+
+    if (bulk) {
+        QVERIFY(model.addEvents(eventList, false));
+    } else {
+        for (int i = 0; i < eventList.size(); i++)
+            QVERIFY(model.addEvent(eventList[i], false));
+    }
+
+    QTime idle;
+    idle.start();
+    int lastCommitted = 0;
+    while (committed < messages && !commitFailed && idle.elapsed() < COMMIT_TIMEOUT) {
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents, 100);
+        if (committed != lastCommitted) {
+            lastCommitted = committed;
+            idle.restart();
+        }
+    }
+
+    int elapsed = time.elapsed();
+
+    QVERIFY(!commitFailed);
+    QCOMPARE(committed, messages);
+
+    int eventsPerSec = elapsed > 0 ? (int)(messages * 1000.0 / elapsed) : 0;
+    qDebug("##### Imported %d messages in %d ms; %d events/s", messages, elapsed, eventsPerSec);
+
+    if(logFile) {
+        QTextStream out(logFile);
+
+        out << QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss") << ": "
+            << metaObject()->className() << "::" << QTest::currentTestFunction() << "("
+            << QTest::currentDataTag() << ")"
+            << "\n";
+        out << elapsed << " ms, " << eventsPerSec << " events/s\n";
+    }
+}
+
+void EventModelPerfTest::eventsCommittedSlot(const QList<CommHistory::Event> &events,
+                                             bool successful)
+{
+    committed += events.size();
+    if (!successful)
+        commitFailed = true;
+}
+
+void EventModelPerfTest::cleanupTestCase()
+{
+    if(logFile) {
+        logFile->close();
+        delete logFile;
+        logFile = 0;
+    }
+}
+
+QTEST_MAIN(EventModelPerfTest)
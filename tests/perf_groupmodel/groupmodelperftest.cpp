@@ -54,11 +54,22 @@ void GroupModelPerfTest::getGroups_data()
 {
     QTest::addColumn<int>("groups");
     QTest::addColumn<int>("messages");
-
-    QTest::newRow("10 groups, 1 message each") << 10 << 1;
-    QTest::newRow("10 groups, 10 messages each") << 10 << 10;
-    QTest::newRow("100 groups, 1 message each") << 100 << 1;
-    QTest::newRow("100 groups, 10 messages each") << 100 << 10;
+    QTest::addColumn<bool>("queryContacts");
+
+    QTest::newRow("10 groups, 1 message each") << 10 << 1 << true;
+    QTest::newRow("10 groups, 10 messages each") << 10 << 10 << true;
+    QTest::newRow("100 groups, 1 message each") << 100 << 1 << true;
+    QTest::newRow("100 groups, 10 messages each") << 100 << 10 << true;
+    // same number of groups, growing message volume: load time should
+    // stay flat with the stored message counters
+    QTest::newRow("10 groups, 100 messages each") << 10 << 100 << true;
+    QTest::newRow("10 groups, 500 messages each") << 10 << 500 << true;
+    // one contact per group, resolved in the query or in one batch
+    // after it (time includes waiting for all contacts)
+    QTest::newRow("3 contacts, queried") << 3 << 10 << true;
+    QTest::newRow("3 contacts, batched") << 3 << 10 << false;
+    QTest::newRow("300 contacts, queried") << 300 << 10 << true;
+    QTest::newRow("300 contacts, batched") << 300 << 10 << false;
 }
 
 void GroupModelPerfTest::getGroups()
@@ -69,6 +80,7 @@ void GroupModelPerfTest::getGroups()
 
     QFETCH(int, groups);
     QFETCH(int, messages);
+    QFETCH(bool, queryContacts);
 
     int commitBatchSize = 75;
     #ifdef PERF_BATCH_SIZE
@@ -166,10 +178,22 @@ void GroupModelPerfTest::getGroups()
         bool result = false;
 
         fetchModel.setQueryMode(EventModel::SyncQuery);
+        fetchModel.setQueryContacts(queryContacts);
 
         QTime time;
         time.start();
         result = fetchModel.getGroups();
+        if (!queryContacts) {
+            int resolved = 0;
+            while (resolved < fetchModel.rowCount() && time.elapsed() < TIMEOUT) {
+                QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents, 100);
+                resolved = 0;
+                for (int row = 0; row < fetchModel.rowCount(); row++)
+                    if (!fetchModel.group(fetchModel.index(row, 0)).contacts().isEmpty())
+                        resolved++;
+            }
+            QCOMPARE(resolved, groups);
+        }
         int elapsed = time.elapsed();
         times << elapsed;
         sum += elapsed;
@@ -0,0 +1,206 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** Contact: Reto Zingg <reto.zingg@nokia.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include <QtTest/QtTest>
+#include <QDateTime>
+#include <cstdlib>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "idsourceperftest.h"
+#include "idsource.h"
+
+using namespace CommHistory;
+
+namespace {
+
+QString idFile(int writer)
+{
+    return QDir::tempPath() + QString(QLatin1String("/perf_idsource_%1")).arg(writer);
+}
+
+// runs in the forked writer process
+int writeIds(int writer, int ids)
+{
+    QFile file(idFile(writer));
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return 1;
+
+    QVector<int> taken(ids);
+    {
+        IdSource source;
+        for (int i = 0; i < ids; i++)
+            taken[i] = source.nextEventId();
+    }
+
+    file.write(reinterpret_cast<const char*>(taken.constData()),
+               ids * sizeof(int));
+    return 0;
+}
+
+}
+
+void IdSourcePerfTest::initTestCase()
+{
+    logFile = new QFile("libcommhistory-performance-test.log");
+    if(!logFile->open(QIODevice::Append)) {
+        qDebug() << "!!!! Failed to open log file !!!!";
+        logFile = 0;
+    }
+}
+
+void IdSourcePerfTest::contention_data()
+{
+    // Number of processes allocating ids at the same time
+    QTest::addColumn<int>("writers");
+
+    // Number of event ids allocated by each process
+    QTest::addColumn<int>("ids");
+
+    QTest::newRow("1 writer, 1000 ids") << 1 << 1000;
+    QTest::newRow("1 writer, 10000 ids") << 1 << 10000;
+    QTest::newRow("4 writers, 1000 ids") << 4 << 1000;
+    QTest::newRow("4 writers, 10000 ids") << 4 << 10000;
+    QTest::newRow("8 writers, 10000 ids") << 8 << 10000;
+}
+
+void IdSourcePerfTest::contention()
+{
+    QFETCH(int, writers);
+    QFETCH(int, ids);
+
+    int count = iterations();
+    QList<int> times;
+
+    // keep the shared memory alive between the writers
+    IdSource source;
+    source.nextEventId();
+
+    qDebug() << __FUNCTION__ << "-" << writers << "writers allocating"
+             << ids << "ids." << count << "iterations";
+
+    for (int i = 0; i < count; i++) {
+        QTime time;
+        time.start();
+
+        QList<pid_t> children;
+        for (int w = 0; w < writers; w++) {
+            pid_t pid = fork();
+            QVERIFY(pid >= 0);
+            if (pid == 0)
+                _exit(writeIds(w, ids));
+            children << pid;
+        }
+
+        foreach (pid_t pid, children) {
+            int status = 0;
+            QCOMPARE(waitpid(pid, &status, 0), pid);
+            QVERIFY(WIFEXITED(status));
+            QCOMPARE(WEXITSTATUS(status), 0);
+        }
+
+        times << time.elapsed();
+
+        // ids must be unique across the writers
+        QSet<int> all;
+        for (int w = 0; w < writers; w++) {
+            QFile file(idFile(w));
+            QVERIFY(file.open(QIODevice::ReadOnly));
+            QByteArray data = file.readAll();
+            QCOMPARE(data.size(), ids * (int)sizeof(int));
+            const int *taken = reinterpret_cast<const int*>(data.constData());
+            for (int j = 0; j < ids; j++) {
+                QVERIFY(taken[j] > 0);
+                QVERIFY(!all.contains(taken[j]));
+                all.insert(taken[j]);
+            }
+            file.remove();
+        }
+    }
+
+    logTimes(times, writers, ids);
+}
+
+void IdSourcePerfTest::cleanupTestCase()
+{
+    if(logFile) {
+        logFile->close();
+        delete logFile;
+        logFile = 0;
+    }
+}
+
+int IdSourcePerfTest::iterations() const
+{
+    int iterations = 10;
+
+    #ifdef PERF_ITERATIONS
+    iterations = PERF_ITERATIONS;
+    #endif
+
+    char *iterVar = getenv("PERF_ITERATIONS");
+    if (iterVar) {
+        int iters = QString::fromAscii(iterVar).toInt();
+        if (iters > 0) {
+            iterations = iters;
+        }
+    }
+
+    return iterations;
+}
+
+void IdSourcePerfTest::logTimes(QList<int> times, int writers, int ids)
+{
+    if(logFile) {
+        QTextStream out(logFile);
+
+        out << QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss") << ": "
+            << metaObject()->className() << "::" << QTest::currentTestFunction() << "("
+            << QTest::currentDataTag() << ", " << times.size() << " iterations)"
+            << "\n";
+
+        for (int i = 0; i < times.size(); i++) {
+            out << times.at(i) << " ";
+        }
+        out << "\n";
+    }
+
+    qSort(times);
+    float median = 0.0;
+    if(times.size() % 2 > 0) {
+        median = times[times.size() / 2];
+    } else {
+        median = (times[times.size() / 2] + times[times.size() / 2 - 1]) / 2.0f;
+    }
+
+    float perThousand = median * 1000 / (writers * ids);
+
+    qDebug("##### Median: %.1f ms per run; %.2f ms per 1000 ids", median, perThousand);
+
+    if(logFile) {
+        QTextStream out(logFile);
+        out << "Median average: " << (int)median << " ms per run, "
+            << perThousand << " ms per 1000 ids\n";
+    }
+}
+
+QTEST_MAIN(IdSourcePerfTest)
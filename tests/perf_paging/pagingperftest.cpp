@@ -0,0 +1,216 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** Contact: Reto Zingg <reto.zingg@nokia.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include <QtTest/QtTest>
+#include <QDateTime>
+#include <QDBusConnection>
+#include <cstdlib>
+#include "pagingperftest.h"
+#include "common.h"
+
+using namespace CommHistory;
+
+const int TIMEOUT = 5000;
+const int EVENTS = 10000;
+const int CONTACTS = 300;
+// pages at each end of the list that are compared
+const int SAMPLE_PAGES = 10;
+
+void PagingPerfTest::initTestCase()
+{
+    logFile = new QFile("libcommhistory-performance-test.log");
+    if(!logFile->open(QIODevice::Append)) {
+        qDebug() << "!!!! Failed to open log file !!!!";
+        logFile = 0;
+    }
+
+    qsrand( QDateTime::currentDateTime().toTime_t() );
+
+    deleteAll();
+    QTest::qWait(TIMEOUT);
+    waitForIdle();
+
+    int commitBatchSize = 75;
+    #ifdef PERF_BATCH_SIZE
+    commitBatchSize = PERF_BATCH_SIZE;
+    #endif
+
+    EventModel addModel;
+    QDateTime when = QDateTime::currentDateTime().addSecs(-EVENTS);
+
+    qDebug() << __FUNCTION__ << "- Creating" << EVENTS << "new events";
+
+    QList<Event> eventList;
+
+    int ei = 0;
+    while(ei < EVENTS) {
+        ei++;
+
+        Event e;
+        e.setType(Event::CallEvent);
+        e.setDirection(qrand() % 2 > 0 ? Event::Inbound : Event::Outbound);
+        e.setGroupId(-1);
+        // pairs of calls share a start time to exercise the tracker:id tie-break
+        e.setStartTime(when.addSecs(ei / 2));
+        e.setEndTime(when.addSecs(ei / 2));
+        e.setLocalUid(ACCOUNT1);
+        e.setRemoteUid(QString().setNum(qrand() % CONTACTS));
+        e.setFreeText("");
+        e.setIsDraft(false);
+
+        eventList << e;
+
+        if(ei % commitBatchSize == 0 && ei != EVENTS) {
+            QVERIFY(addModel.addEvents(eventList, false));
+            eventList.clear();
+            waitForIdle();
+        }
+    }
+
+    QVERIFY(addModel.addEvents(eventList, false));
+    eventList.clear();
+    waitForIdle();
+    QTest::qWait(TIMEOUT);
+}
+
+void PagingPerfTest::nextPage_data()
+{
+    QTest::addColumn<int>("pageSize");
+    QTest::addColumn<bool>("seek");
+
+    QTest::newRow("100 events per page, offset") << 100 << false;
+    QTest::newRow("100 events per page, cursor") << 100 << true;
+    QTest::newRow("500 events per page, offset") << 500 << false;
+    QTest::newRow("500 events per page, cursor") << 500 << true;
+}
+
+void PagingPerfTest::nextPage()
+{
+    QFETCH(int, pageSize);
+    QFETCH(bool, seek);
+
+    QDateTime startTime = QDateTime::currentDateTime();
+
+    int iterations = 3;
+    #ifdef PERF_ITERATIONS
+    iterations = PERF_ITERATIONS;
+    #endif
+
+    char *iterVar = getenv("PERF_ITERATIONS");
+    if (iterVar) {
+        int iters = QString::fromAscii(iterVar).toInt();
+        if (iters > 0) {
+            iterations = iters;
+        }
+    }
+
+    QList<int> firstTimes;
+    QList<int> lastTimes;
+
+    qDebug() << __FUNCTION__ << "- Paging through events." << iterations << "iterations";
+    for(int i = 0; i < iterations; i++) {
+        CallModel fetchModel;
+        fetchModel.enableContactChanges(false);
+        fetchModel.setQueryMode(EventModel::SyncQuery);
+        fetchModel.setTreeMode(false);
+        fetchModel.setFilter(CallModel::SortByTime);
+        fetchModel.setLimit(pageSize);
+
+        QList<int> pageTimes;
+        QTime time;
+        int fetched = 0;
+
+        time.start();
+        QVERIFY(fetchModel.getEvents());
+        pageTimes << time.elapsed();
+        fetched = fetchModel.rowCount();
+
+        while (fetched < EVENTS) {
+            time.start();
+            if (seek) {
+                QVERIFY(fetchModel.fetchNextPage());
+                pageTimes << time.elapsed();
+                QVERIFY(fetchModel.rowCount() > fetched);
+                fetched = fetchModel.rowCount();
+            } else {
+                fetchModel.setOffset(fetched);
+                QVERIFY(fetchModel.getEvents());
+                pageTimes << time.elapsed();
+                QVERIFY(fetchModel.rowCount() > 0);
+                fetched += fetchModel.rowCount();
+            }
+        }
+        QCOMPARE(fetched, EVENTS);
+
+        int firstSum = 0;
+        int lastSum = 0;
+        int samples = qMin(SAMPLE_PAGES, pageTimes.size());
+        for (int p = 0; p < samples; p++) {
+            firstSum += pageTimes.at(p);
+            lastSum += pageTimes.at(pageTimes.size() - 1 - p);
+        }
+        firstTimes << firstSum / samples;
+        lastTimes << lastSum / samples;
+        qDebug("Pages: %d; first pages: %d ms; last pages: %d ms",
+               pageTimes.size(), firstTimes.last(), lastTimes.last());
+
+        waitForIdle();
+    }
+
+    qSort(firstTimes);
+    qSort(lastTimes);
+    int firstMedian = firstTimes.at(iterations / 2);
+    int lastMedian = lastTimes.at(iterations / 2);
+    int testSecs = startTime.secsTo(QDateTime::currentDateTime());
+
+    qDebug("##### Median page time: first %d ms, last %d ms; Test time: %dsec",
+           firstMedian, lastMedian, testSecs);
+
+    if(logFile) {
+        QTextStream out(logFile);
+
+        out << QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss") << ": "
+            << metaObject()->className() << "::" << QTest::currentTestFunction() << "("
+            << QTest::currentDataTag() << ", " << iterations << " iterations)"
+            << "\n";
+        out << "Median page time, first " << SAMPLE_PAGES << " pages: " << firstMedian
+            << " ms, last " << SAMPLE_PAGES << " pages: " << lastMedian << " ms. Test time: ";
+        if (testSecs > 3600) { out << (testSecs / 3600) << "h "; }
+        if (testSecs > 60) { out << ((testSecs % 3600) / 60) << "m "; }
+        out << ((testSecs % 3600) % 60) << "s\n";
+    }
+}
+
+void PagingPerfTest::cleanupTestCase()
+{
+    deleteAll();
+    QTest::qWait(TIMEOUT);
+    waitForIdle();
+
+    if(logFile) {
+        logFile->close();
+        delete logFile;
+        logFile = 0;
+    }
+}
+
+QTEST_MAIN(PagingPerfTest)
@@ -0,0 +1,531 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** Contact: Reto Zingg <reto.zingg@nokia.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include <QtTest/QtTest>
+#include <QDateTime>
+#include <QSparqlBinding>
+#include <QThread>
+#include <QThreadPool>
+#include <cstdlib>
+#include "queryresultperftest.h"
+#include "eventsquery.h"
+#include "queryresult.h"
+#include "common.h"
+
+using namespace CommHistory;
+
+#define NMO_ "http://www.semanticdesktop.org/ontologies/2007/03/22/nmo#"
+
+namespace {
+
+const char *eventTypes[] = {
+    NMO_ "SMSMessage",
+    NMO_ "MMSMessage",
+    NMO_ "IMMessage",
+    NMO_ "Call"
+};
+
+const char *deliveryStatuses[] = {
+    NMO_ "delivery-status-sent",
+    NMO_ "delivery-status-delivered",
+    NMO_ "delivery-status-temporarily-failed",
+    NMO_ "delivery-status-permanently-failed"
+};
+
+QVariant columnData(Event::Property property, int row, bool mixed)
+{
+    int variant = mixed ? row % 4 : 0;
+
+    switch (property) {
+    case Event::Id:
+        return QString("message:%1").arg(row + 1);
+    case Event::Type:
+        return QString("http://www.w3.org/2000/01/rdf-schema#Resource,"
+                       NMO_ "Message,") + eventTypes[variant];
+    case Event::StartTime:
+    case Event::EndTime:
+    case Event::LastModified:
+        return QDateTime::fromTime_t(1290000000 + row);
+    case Event::Direction:
+        return bool(row % 2);
+    case Event::IsRead:
+    case Event::IsMissedCall:
+        return true;
+    case Event::Status:
+        return QString(deliveryStatuses[variant]);
+    case Event::LocalUid:
+    case Event::RemoteUid:
+        if (row % 2 == (property == Event::LocalUid ? 1 : 0))
+            return QString("telepathy:" + RING_ACCOUNT);
+        return QString("+3580%1\x1e" "telepathy:%2!+3580%1").arg(row % 100).arg(RING_ACCOUNT);
+    case Event::ContactId:
+        return QString("%1\x1e" "First\x1e" "Last\x1d" "nick\x1d"
+                       "\x1e" "telepathy:%2!+3580%1\x1f" "imnick")
+            .arg(row % 100).arg(RING_ACCOUNT);
+    case Event::FreeText:
+        return randomMessage(10);
+    case Event::GroupId:
+        return QString("conversation:%1").arg(row % 100);
+    case Event::MessageToken:
+        return QString("token-%1").arg(row);
+    case Event::Headers:
+        return QString("x-mms-to\x1d" "+35801\x1f" "x-mms-delivery\x1d" "yes");
+    default:
+        return QVariant();
+    }
+}
+
+QList<QSparqlResultRow> eventRows(const QList<Event::Property> &properties,
+                                  int count, bool mixed)
+{
+    QList<QSparqlResultRow> rows;
+
+    for (int i = 0; i < count; i++) {
+        QSparqlResultRow row;
+        foreach (Event::Property property, properties)
+            row.append(QSparqlBinding(QString(), columnData(property, i, mixed)));
+        rows << row;
+    }
+
+    return rows;
+}
+
+// Reference decoder: the per-row property lookups QueryResult used
+// before the column plan was compiled once per query.
+#define ROW_VALUE(COL) row.value(properties.indexOf(COL))
+#define TELEPATHY_URI_PREFIX_LEN (sizeof("telepathy:") - 1)
+
+Event::EventStatus referenceStatus(const QString &status)
+{
+    if (status == QLatin1String(NMO_ "delivery-status-sent"))
+        return Event::SentStatus;
+    else if (status == QLatin1String(NMO_ "delivery-status-delivered"))
+        return Event::DeliveredStatus;
+    else if (status == QLatin1String(NMO_ "delivery-status-temporarily-failed"))
+        return Event::TemporarilyFailedStatus;
+    else if (status == QLatin1String(NMO_ "delivery-status-temporarily-failed-offline"))
+        return Event::TemporarilyFailedOfflineStatus;
+    else if (status == QLatin1String(NMO_ "delivery-status-permanently-failed"))
+        return Event::PermanentlyFailedStatus;
+
+    return Event::UnknownStatus;
+}
+
+QString referenceRemoteUid(const QString &remoteUid)
+{
+    QStringList uids = remoteUid.split('\x1e', QString::SkipEmptyParts);
+    foreach (QString id, uids) {
+        if (id.startsWith(QLatin1String("sip:")) || id.startsWith(QLatin1String("sips:")))
+            return id;
+    }
+
+    if (!uids.isEmpty())
+        return uids.first().section(QLatin1Char('!'), -1);
+
+    return QString();
+}
+
+void referenceFillEvent(const QList<Event::Property> &properties,
+                        const QSparqlResultRow &row,
+                        Event &event)
+{
+    Event eventToFill;
+
+    foreach (Event::Property property, properties) {
+        switch (property) {
+        case Event::Id:
+            eventToFill.setId(Event::urlToId(ROW_VALUE(Event::Id).toString()));
+            break;
+        case Event::Type: {
+            QStringList types = ROW_VALUE(Event::Type).toString().split(QChar(','));
+            if (types.contains(QLatin1String(NMO_ "MMSMessage")))
+                eventToFill.setType(Event::MMSEvent);
+            else if (types.contains(QLatin1String(NMO_ "SMSMessage")))
+                eventToFill.setType(Event::SMSEvent);
+            else if (types.contains(QLatin1String(NMO_ "IMMessage")))
+                eventToFill.setType(Event::IMEvent);
+            else if (types.contains(QLatin1String(NMO_ "Call")))
+                eventToFill.setType(Event::CallEvent);
+            break;
+        }
+        case Event::Direction:
+            eventToFill.setDirection(ROW_VALUE(Event::Direction).toBool()
+                                     ? Event::Outbound : Event::Inbound);
+            break;
+        case Event::MessageToken:
+            eventToFill.setMessageToken(ROW_VALUE(Event::MessageToken).toString());
+            break;
+        case Event::MmsId:
+            eventToFill.setMmsId(ROW_VALUE(Event::MmsId).toString());
+            break;
+        case Event::IsDraft:
+            eventToFill.setIsDraft(ROW_VALUE(Event::IsDraft).toBool());
+            break;
+        case Event::Subject:
+            eventToFill.setSubject(ROW_VALUE(Event::Subject).toString());
+            break;
+        case Event::FreeText:
+            eventToFill.setFreeText(ROW_VALUE(Event::FreeText).toString());
+            break;
+        case Event::ReportDelivery:
+            eventToFill.setReportDelivery(ROW_VALUE(Event::ReportDelivery).toBool());
+            break;
+        case Event::ReportRead:
+            eventToFill.setReportRead(ROW_VALUE(Event::ReportRead).toBool());
+            break;
+        case Event::ReportReadRequested:
+            eventToFill.setReportReadRequested(ROW_VALUE(Event::ReportReadRequested).toBool());
+            break;
+        case Event::BytesReceived:
+            eventToFill.setBytesReceived(ROW_VALUE(Event::BytesReceived).toInt());
+            break;
+        case Event::ContentLocation:
+            eventToFill.setContentLocation(ROW_VALUE(Event::ContentLocation).toString());
+            break;
+        case Event::GroupId: {
+            QString channel = ROW_VALUE(Event::GroupId).toString();
+            if (!channel.isEmpty())
+                eventToFill.setGroupId(Group::urlToId(channel));
+            break;
+        }
+        case Event::StartTime:
+            eventToFill.setStartTime(ROW_VALUE(Event::StartTime).toDateTime());
+            break;
+        case Event::EndTime:
+            eventToFill.setEndTime(ROW_VALUE(Event::EndTime).toDateTime());
+            break;
+        case Event::IsRead:
+            eventToFill.setIsRead(ROW_VALUE(Event::IsRead).toBool());
+            break;
+        case Event::Status: {
+            QString status = ROW_VALUE(Event::Status).toString();
+            if (!status.isEmpty())
+                eventToFill.setStatus(referenceStatus(status));
+            break;
+        }
+        case Event::ReadStatus: {
+            QString status = ROW_VALUE(Event::ReadStatus).toString();
+            if (status == QLatin1String(NMO_ "read-status-read"))
+                eventToFill.setReadStatus(Event::ReadStatusRead);
+            else if (status == QLatin1String(NMO_ "read-status-deleted"))
+                eventToFill.setReadStatus(Event::ReadStatusDeleted);
+            else if (!status.isEmpty())
+                eventToFill.setReadStatus(Event::UnknownReadStatus);
+            break;
+        }
+        case Event::LastModified:
+            eventToFill.setLastModified(ROW_VALUE(Event::LastModified).toDateTime());
+            break;
+        case Event::IsMissedCall:
+            eventToFill.setIsMissedCall(!(ROW_VALUE(Event::IsMissedCall).toBool()));
+            break;
+        case Event::IsEmergencyCall:
+            eventToFill.setIsEmergencyCall(ROW_VALUE(Event::IsEmergencyCall).toBool());
+            break;
+        case Event::ParentId:
+            eventToFill.setParentId(ROW_VALUE(Event::ParentId).toInt());
+            break;
+        case Event::FromVCardFileName: {
+            QString filename = ROW_VALUE(Event::FromVCardFileName).toString();
+            if (!filename.isEmpty())
+                eventToFill.setFromVCard(filename, ROW_VALUE(Event::FromVCardLabel).toString());
+            break;
+        }
+        case Event::Encoding:
+            eventToFill.setEncoding(ROW_VALUE(Event::Encoding).toString());
+            break;
+        case Event::CharacterSet:
+            eventToFill.setCharacterSet(ROW_VALUE(Event::CharacterSet).toString());
+            break;
+        case Event::IsDeleted:
+            eventToFill.setDeleted(ROW_VALUE(Event::IsDeleted).toBool());
+            break;
+        case Event::ValidityPeriod:
+            eventToFill.setValidityPeriod(ROW_VALUE(Event::ValidityPeriod).toInt());
+            break;
+        case Event::Cc:
+            eventToFill.setCcList(ROW_VALUE(Event::Cc).toString().split('\x1e', QString::SkipEmptyParts));
+            break;
+        case Event::Bcc:
+            eventToFill.setBccList(ROW_VALUE(Event::Bcc).toString().split('\x1e', QString::SkipEmptyParts));
+            break;
+        case Event::To:
+        case Event::Headers: {
+            QHash<QString, QString> headers;
+            QueryResult::parseHeaders(ROW_VALUE(Event::Headers).toString(), headers);
+            eventToFill.setHeaders(headers);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    if (properties.contains(Event::LocalUid)
+        || properties.contains(Event::RemoteUid)) {
+        QString fromId = ROW_VALUE(Event::LocalUid).toString();
+        QString toId = ROW_VALUE(Event::RemoteUid).toString();
+
+        if (eventToFill.direction() == Event::Outbound) {
+            eventToFill.setLocalUid(fromId.mid(TELEPATHY_URI_PREFIX_LEN));
+            eventToFill.setRemoteUid(referenceRemoteUid(toId));
+        } else {
+            eventToFill.setLocalUid(toId.mid(TELEPATHY_URI_PREFIX_LEN));
+            eventToFill.setRemoteUid(referenceRemoteUid(fromId));
+        }
+    }
+
+    if (eventToFill.status() == Event::UnknownStatus
+        && (eventToFill.type() == Event::SMSEvent || eventToFill.type() == Event::MMSEvent)
+        && !eventToFill.isDraft()
+        && eventToFill.direction() == Event::Outbound)
+        eventToFill.setStatus(Event::SendingStatus);
+
+    if (eventToFill.type() == Event::IMEvent)
+        eventToFill.setIsAction(ROW_VALUE(Event::IsAction).toBool());
+
+    if (properties.contains(Event::ContactId)) {
+        QList<Event::Contact> contacts;
+        QueryResult::parseContacts(ROW_VALUE(Event::ContactId).toString(),
+                                   eventToFill.localUid(), contacts);
+        eventToFill.setContacts(contacts);
+    }
+
+    event = eventToFill;
+    event.resetModifiedProperties();
+}
+
+}
+
+void QueryResultPerfTest::initTestCase()
+{
+    logFile = new QFile("libcommhistory-performance-test.log");
+    if(!logFile->open(QIODevice::Append)) {
+        qDebug() << "!!!! Failed to open log file !!!!";
+        logFile = 0;
+    }
+
+    qsrand( QDateTime::currentDateTime().toTime_t() );
+}
+
+void QueryResultPerfTest::decodeEvents_data()
+{
+    QTest::addColumn<int>("rows");
+    QTest::addColumn<bool>("mixed");
+
+    QTest::newRow("1000 SMS rows") << 1000 << false;
+    QTest::newRow("5000 SMS rows") << 5000 << false;
+    QTest::newRow("5000 mixed SMS/MMS/IM/call rows") << 5000 << true;
+}
+
+void QueryResultPerfTest::decodeEvents()
+{
+    QFETCH(int, rows);
+    QFETCH(bool, mixed);
+
+    EventsQuery query(Event::allProperties());
+    query.query();
+
+    QueryResult result;
+    result.queryType = EventQuery;
+    result.properties = query.eventProperties();
+    result.compileColumns();
+
+    QList<QSparqlResultRow> resultRows = eventRows(result.properties, rows, mixed);
+
+    int count = iterations();
+    QList<int> times;
+    QList<int> referenceTimes;
+
+    qDebug() << __FUNCTION__ << "- Decoding" << rows << "rows." << count << "iterations";
+    for (int i = 0; i < count; i++) {
+        QList<Event> reference;
+
+        QTime time;
+        time.start();
+        foreach (const QSparqlResultRow &row, resultRows) {
+            Event event;
+            referenceFillEvent(result.properties, row, event);
+            reference << event;
+        }
+        int elapsed = time.elapsed();
+        referenceTimes << elapsed;
+        qDebug("Time elapsed, per-row lookups: %d ms", elapsed);
+
+        QList<Event> events;
+
+        time.start();
+        foreach (const QSparqlResultRow &row, resultRows) {
+            Event event;
+            result.fillEventFromRow(row, event);
+            events << event;
+        }
+        elapsed = time.elapsed();
+        times << elapsed;
+        qDebug("Time elapsed, compiled columns: %d ms", elapsed);
+
+        QCOMPARE(events.size(), rows);
+        QCOMPARE(events.last().id(), rows);
+        QCOMPARE(events.first().type(), Event::SMSEvent);
+        if (mixed)
+            QCOMPARE(events.at(3).type(), Event::CallEvent);
+
+        // both decoders read the same events
+        QCOMPARE(reference.size(), rows);
+        for (int j = 0; j < 4 && j < rows; j++) {
+            QCOMPARE(reference.at(j).id(), events.at(j).id());
+            QCOMPARE(reference.at(j).type(), events.at(j).type());
+            QCOMPARE(reference.at(j).remoteUid(), events.at(j).remoteUid());
+            QCOMPARE(reference.at(j).freeText(), events.at(j).freeText());
+        }
+    }
+
+    logTimes(referenceTimes, rows, QLatin1String("before, per-row lookups"));
+    logTimes(times, rows, QLatin1String("after, compiled columns"));
+}
+
+void QueryResultPerfTest::decodeParallel_data()
+{
+    QTest::addColumn<int>("threads");
+
+    QTest::newRow("1 thread") << 1;
+    QTest::newRow("2 threads") << 2;
+    QTest::newRow("4 threads") << 4;
+
+    int ideal = QThread::idealThreadCount();
+    if (ideal > 0 && ideal != 1 && ideal != 2 && ideal != 4)
+        QTest::newRow(qPrintable(QString("%1 threads").arg(ideal))) << ideal;
+}
+
+void QueryResultPerfTest::decodeParallel()
+{
+    QFETCH(int, threads);
+
+    const int rows = 50000;
+
+    EventsQuery query(Event::allProperties());
+    query.query();
+
+    QueryResult result;
+    result.queryType = EventQuery;
+    result.properties = query.eventProperties();
+    result.compileColumns();
+
+    QList<QSparqlResultRow> resultRows = eventRows(result.properties, rows, true);
+
+    QThreadPool pool;
+    if (threads > 1)
+        pool.setMaxThreadCount(threads - 1);
+
+    int count = iterations();
+    QList<int> times;
+
+    qDebug() << __FUNCTION__ << "- Decoding" << rows << "rows with" << threads
+             << "threads." << count << "iterations";
+    for (int i = 0; i < count; i++) {
+        QTime time;
+        time.start();
+        QList<Event> events = result.fillEventsFromRows(resultRows,
+                                                        threads > 1 ? &pool : 0);
+        int elapsed = time.elapsed();
+        times << elapsed;
+        qDebug("Time elapsed: %d ms", elapsed);
+
+        QCOMPARE(events.size(), rows);
+        // order must match the rows
+        QCOMPARE(events.first().id(), 1);
+        QCOMPARE(events.at(rows / 2).id(), rows / 2 + 1);
+        QCOMPARE(events.last().id(), rows);
+    }
+
+    logTimes(times, rows);
+}
+
+void QueryResultPerfTest::cleanupTestCase()
+{
+    if(logFile) {
+        logFile->close();
+        delete logFile;
+        logFile = 0;
+    }
+}
+
+int QueryResultPerfTest::iterations() const
+{
+    int iterations = 10;
+
+    #ifdef PERF_ITERATIONS
+    iterations = PERF_ITERATIONS;
+    #endif
+
+    char *iterVar = getenv("PERF_ITERATIONS");
+    if (iterVar) {
+        int iters = QString::fromAscii(iterVar).toInt();
+        if (iters > 0) {
+            iterations = iters;
+        }
+    }
+
+    return iterations;
+}
+
+void QueryResultPerfTest::logTimes(QList<int> times, int rows, const QString &label)
+{
+    QString tag(QTest::currentDataTag());
+    if (!label.isEmpty())
+        tag += QLatin1String(", ") + label;
+
+    if(logFile) {
+        QTextStream out(logFile);
+
+        out << QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss") << ": "
+            << metaObject()->className() << "::" << QTest::currentTestFunction() << "("
+            << tag << ", " << times.size() << " iterations)"
+            << "\n";
+
+        for (int i = 0; i < times.size(); i++) {
+            out << times.at(i) << " ";
+        }
+        out << "\n";
+    }
+
+    qSort(times);
+    float median = 0.0;
+    if(times.size() % 2 > 0) {
+        median = times[times.size() / 2];
+    } else {
+        median = (times[times.size() / 2] + times[times.size() / 2 - 1]) / 2.0f;
+    }
+
+    int rowsPerSec = median > 0 ? (int)(rows * 1000 / median) : 0;
+
+    QString prefix = label.isEmpty() ? QString() : label + QLatin1String(": ");
+    qDebug("##### %sMedian: %.1f ms; %d rows/s", qPrintable(prefix), median, rowsPerSec);
+
+    if(logFile) {
+        QTextStream out(logFile);
+        out << "Median average: " << (int)median << " ms. "
+            << rowsPerSec << " rows/s\n";
+    }
+}
+
+QTEST_MAIN(QueryResultPerfTest)
@@ -0,0 +1,244 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** Contact: Reto Zingg <reto.zingg@nokia.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include <QtTest/QtTest>
+#include <QDateTime>
+#include <cstdlib>
+#include "querytemplatesperftest.h"
+#include "trackerio_p.h"
+#include "conversationmodel.h"
+#include "groupmodel.h"
+#include "callmodel.h"
+#include "common.h"
+
+using namespace CommHistory;
+
+namespace {
+
+Group group1, group2;
+
+QStringList uriList(const QString &format, int count)
+{
+    QStringList uris;
+    for (int i = 0; i < count; i++)
+        uris.append(format.arg(i + 1));
+    return uris;
+}
+
+}
+
+void QueryTemplatesPerfTest::initTestCase()
+{
+    logFile = new QFile("libcommhistory-performance-test.log");
+    if(!logFile->open(QIODevice::Append)) {
+        qDebug() << "!!!! Failed to open log file !!!!";
+        logFile = 0;
+    }
+
+    qsrand( QDateTime::currentDateTime().toTime_t() );
+}
+
+void QueryTemplatesPerfTest::init()
+{
+    QueryTemplates::clear();
+    QueryTemplates::resetStats();
+}
+
+void QueryTemplatesPerfTest::groupQuery_data()
+{
+    QTest::addColumn<QString>("localUid");
+    QTest::addColumn<QString>("remoteUid");
+
+    QTest::newRow("all groups") << QString() << QString();
+    QTest::newRow("account") << ACCOUNT1 << QString();
+    QTest::newRow("account, IM contact") << ACCOUNT1 << QString("user%1@example.com");
+    QTest::newRow("account, phone number") << RING_ACCOUNT << QString("+35850%1");
+}
+
+void QueryTemplatesPerfTest::groupQuery()
+{
+    QFETCH(QString, localUid);
+    QFETCH(QString, remoteUid);
+
+    int count = iterations();
+    qint64 formattedBytes = 0;
+
+    for (int i = 0; i < count; i++) {
+        QString uid = remoteUid.isEmpty() ? remoteUid : remoteUid.arg(qrand() % 10000000);
+        QSparqlQuery query = TrackerIOPrivate::prepareGroupQuery(localUid, uid);
+        formattedBytes += QueryTemplates::queryText(query).size() * sizeof(QChar);
+    }
+
+    logBytes(formattedBytes, count);
+}
+
+void QueryTemplatesPerfTest::groupedCallQuery_data()
+{
+    QTest::addColumn<int>("channels");
+
+    QTest::newRow("all calls") << 0;
+    QTest::newRow("1 call group") << 1;
+    QTest::newRow("25 call groups") << 25;
+    QTest::newRow("100 call groups") << MAX_VARIABLES_IN_QUERY;
+}
+
+void QueryTemplatesPerfTest::groupedCallQuery()
+{
+    QFETCH(int, channels);
+
+    int count = iterations();
+    qint64 formattedBytes = 0;
+
+    for (int i = 0; i < count; i++) {
+        QStringList uris = uriList(QString("callgroup:%1!+35850%2").arg(RING_ACCOUNT).arg(i)
+                                   + QLatin1String("%1"), channels);
+        QSparqlQuery query = TrackerIOPrivate::prepareGroupedCallQuery(uris);
+        formattedBytes += QueryTemplates::queryText(query).size() * sizeof(QChar);
+    }
+
+    logBytes(formattedBytes, count);
+}
+
+void QueryTemplatesPerfTest::messagePartQuery_data()
+{
+    QTest::addColumn<int>("messages");
+
+    QTest::newRow("1 message") << 1;
+    QTest::newRow("25 messages") << 25;
+    QTest::newRow("100 messages") << MAX_VARIABLES_IN_QUERY;
+}
+
+void QueryTemplatesPerfTest::messagePartQuery()
+{
+    QFETCH(int, messages);
+
+    int count = iterations();
+    qint64 formattedBytes = 0;
+
+    for (int i = 0; i < count; i++) {
+        QStringList uris = uriList(QString("message:%1%2").arg(i).arg("%1"), messages);
+        QSparqlQuery query = TrackerIOPrivate::prepareMessagePartQuery(uris);
+        formattedBytes += QueryTemplates::queryText(query).size() * sizeof(QChar);
+    }
+
+    logBytes(formattedBytes, count);
+}
+
+void QueryTemplatesPerfTest::modelLoad_data()
+{
+    QTest::addColumn<QString>("model");
+
+    QTest::newRow("ConversationModel") << QString("ConversationModel");
+    QTest::newRow("GroupModel") << QString("GroupModel");
+    QTest::newRow("CallModel, grouped by contact") << QString("CallModel");
+}
+
+void QueryTemplatesPerfTest::modelLoad()
+{
+    QFETCH(QString, model);
+
+    if (group1.id() == -1) {
+        deleteAll();
+        addTestGroups(group1, group2);
+    }
+
+    int count = iterations();
+
+    for (int i = 0; i < count; i++) {
+        if (model == QLatin1String("ConversationModel")) {
+            ConversationModel conversationModel;
+            conversationModel.setQueryMode(EventModel::SyncQuery);
+            QVERIFY(conversationModel.getEvents(i % 2 ? group1.id() : group2.id()));
+        } else if (model == QLatin1String("GroupModel")) {
+            GroupModel groupModel;
+            groupModel.setQueryMode(EventModel::SyncQuery);
+            QVERIFY(groupModel.getGroups(i % 2 ? ACCOUNT1 : ACCOUNT2));
+        } else {
+            CallModel callModel;
+            callModel.setQueryMode(EventModel::SyncQuery);
+            QVERIFY(callModel.setFilter(CallModel::SortByContact));
+        }
+    }
+
+    // the models hand their queries to tracker through
+    // QueryTemplates::queryText(), which counts the formatted text
+    logBytes(QueryTemplates::stats().queryBytes, count);
+}
+
+void QueryTemplatesPerfTest::cleanupTestCase()
+{
+    if(logFile) {
+        logFile->close();
+        delete logFile;
+        logFile = 0;
+    }
+}
+
+int QueryTemplatesPerfTest::iterations() const
+{
+    int iterations = 10;
+
+    #ifdef PERF_ITERATIONS
+    iterations = PERF_ITERATIONS;
+    #endif
+
+    char *iterVar = getenv("PERF_ITERATIONS");
+    if (iterVar) {
+        int iters = QString::fromAscii(iterVar).toInt();
+        if (iters > 0) {
+            iterations = iters;
+        }
+    }
+
+    return iterations;
+}
+
+/*
+ * Before templates every load formatted the whole query text, after
+ * them only the first load of each shape does and the others bind
+ * their values.
+ */
+void QueryTemplatesPerfTest::logBytes(qint64 formattedBytes, int loads)
+{
+    QueryTemplates::Stats stats = QueryTemplates::stats();
+    qint64 templatedBytes = stats.templateBytes + stats.boundBytes;
+
+    qint64 before = loads ? formattedBytes / loads : 0;
+    qint64 after = loads ? templatedBytes / loads : 0;
+
+    qDebug("##### Query text per load: %lld bytes before, %lld bytes after "
+           "(%d template hits, %d misses)",
+           before, after, stats.hits, stats.misses);
+
+    if(logFile) {
+        QTextStream out(logFile);
+
+        out << QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss") << ": "
+            << metaObject()->className() << "::" << QTest::currentTestFunction() << "("
+            << QTest::currentDataTag() << ", " << loads << " loads)"
+            << "\n";
+        out << "Query text per load: " << before << " bytes before, "
+            << after << " bytes after\n";
+    }
+}
+
+QTEST_MAIN(QueryTemplatesPerfTest)
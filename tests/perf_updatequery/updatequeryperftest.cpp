@@ -0,0 +1,189 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** Contact: Reto Zingg <reto.zingg@nokia.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include <QtTest/QtTest>
+#include <QDateTime>
+#include <cstdlib>
+#include "updatequeryperftest.h"
+#include "updatequery.h"
+#include "common.h"
+
+using namespace CommHistory;
+
+namespace {
+
+/*
+ * Roughly the statements TrackerIO writes when adding an incoming SMS:
+ * message properties, contact and channel updates.
+ */
+void writeEvent(UpdateQuery &query, int id, int channel, const QDateTime &when)
+{
+    QUrl subject(QString("message:%1").arg(id));
+    QUrl channelUrl(QString("conversation:%1").arg(channel));
+    QString remoteUid = QString("+35850%1").arg(channel, 7, 10, QLatin1Char('0'));
+
+    query.insertionRaw(subject, "rdf:type", "nmo:SMSMessage");
+    query.insertion(subject, "nmo:isSent", false);
+    query.insertion(subject, "nmo:isDraft", false);
+    query.insertion(subject, "nmo:isDeleted", false);
+    query.insertion(subject, "nmo:isRead", id % 2 == 0);
+    query.insertion(subject, "nmo:sentDate", when);
+    query.insertion(subject, "nmo:receivedDate", when);
+    query.insertion(subject, "nie:plainTextContent",
+                    QString("Message %1 with \"some\" text to escape").arg(id));
+    query.insertionRaw(subject, "nmo:deliveryStatus", "nmo:delivery-status-delivered");
+    query.insertion(subject, "nmo:phoneMessageId", id);
+    query.insertionRaw(subject, "nmo:to", "[rdf:type nco:Contact; nco:hasIMAddress <telepathy:ring/tel/ring>]");
+    query.insertionRaw(subject, "nmo:from",
+                       QString("[rdf:type nco:Contact; nco:hasPhoneNumber <tel:%1>]").arg(remoteUid));
+    query.appendInsertion(QString("INSERT SILENT { <tel:%1> a nco:PhoneNumber ; "
+                                  "nco:phoneNumber \"%1\" }").arg(remoteUid));
+    query.insertionRaw(subject, "rdf:type", "nie:DataObject");
+
+    query.deletion(QString("DELETE {<%1> nmo:lastMessageDate ?d} WHERE {<%1> nmo:lastMessageDate ?d}")
+                   .arg(channelUrl.toString()));
+    query.insertionSilent(QString("<%1> nmo:lastMessageDate \"%2\"^^xsd:dateTime . ")
+                          .arg(channelUrl.toString())
+                          .arg(when.toUTC().toString(Qt::ISODate)));
+    query.insertion(channelUrl, "nie:contentLastModified", when, true);
+    query.insertion(subject, "nmo:communicationChannel", channelUrl);
+    query.insertion(channelUrl, "nie:generator", remoteUid, true);
+    query.insertion(subject, "nie:contentLastModified", when);
+}
+
+}
+
+void UpdateQueryPerfTest::initTestCase()
+{
+    logFile = new QFile("libcommhistory-performance-test.log");
+    if(!logFile->open(QIODevice::Append)) {
+        qDebug() << "!!!! Failed to open log file !!!!";
+        logFile = 0;
+    }
+}
+
+void UpdateQueryPerfTest::buildUpdate_data()
+{
+    QTest::addColumn<int>("events");
+    QTest::addColumn<int>("channels");
+
+    QTest::newRow("1000 events, 1 conversation") << 1000 << 1;
+    QTest::newRow("1000 events, 100 conversations") << 1000 << 100;
+    QTest::newRow("1000 events, 1000 conversations") << 1000 << 1000;
+}
+
+void UpdateQueryPerfTest::buildUpdate()
+{
+    QFETCH(int, events);
+    QFETCH(int, channels);
+
+    QDateTime when = QDateTime::fromTime_t(1290000000);
+    int count = iterations();
+    QList<int> times;
+    int bytes = 0;
+
+    qDebug() << __FUNCTION__ << "- Building update for" << events << "events."
+             << count << "iterations";
+    for (int i = 0; i < count; i++) {
+        QTime time;
+        time.start();
+
+        UpdateQuery query;
+        for (int id = 0; id < events; id++)
+            writeEvent(query, id + 1, id % channels, when.addSecs(id));
+        QString text = query.query();
+
+        times << time.elapsed();
+        bytes = text.size() * sizeof(QChar);
+
+        QVERIFY(text.startsWith(QLatin1String("DELETE")));
+        QVERIFY(text.contains(QString("<message:%1>").arg(events)));
+    }
+
+    qDebug("##### Update text: %d bytes", bytes);
+    logTimes(times, events);
+}
+
+void UpdateQueryPerfTest::cleanupTestCase()
+{
+    if(logFile) {
+        logFile->close();
+        delete logFile;
+        logFile = 0;
+    }
+}
+
+int UpdateQueryPerfTest::iterations() const
+{
+    int iterations = 10;
+
+    #ifdef PERF_ITERATIONS
+    iterations = PERF_ITERATIONS;
+    #endif
+
+    char *iterVar = getenv("PERF_ITERATIONS");
+    if (iterVar) {
+        int iters = QString::fromAscii(iterVar).toInt();
+        if (iters > 0) {
+            iterations = iters;
+        }
+    }
+
+    return iterations;
+}
+
+void UpdateQueryPerfTest::logTimes(QList<int> times, int events)
+{
+    if(logFile) {
+        QTextStream out(logFile);
+
+        out << QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss") << ": "
+            << metaObject()->className() << "::" << QTest::currentTestFunction() << "("
+            << QTest::currentDataTag() << ", " << times.size() << " iterations)"
+            << "\n";
+
+        for (int i = 0; i < times.size(); i++) {
+            out << times.at(i) << " ";
+        }
+        out << "\n";
+    }
+
+    qSort(times);
+    float median = 0.0;
+    if(times.size() % 2 > 0) {
+        median = times[times.size() / 2];
+    } else {
+        median = (times[times.size() / 2] + times[times.size() / 2 - 1]) / 2.0f;
+    }
+
+    int eventsPerSec = median > 0 ? (int)(events * 1000 / median) : 0;
+
+    qDebug("##### Median: %.1f ms; %d events/s", median, eventsPerSec);
+
+    if(logFile) {
+        QTextStream out(logFile);
+        out << "Median average: " << (int)median << " ms. "
+            << eventsPerSec << " events/s\n";
+    }
+}
+
+QTEST_MAIN(UpdateQueryPerfTest)
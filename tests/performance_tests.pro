@@ -24,8 +24,15 @@
 
 TEMPLATE = subdirs
 SUBDIRS = perf_callmodel \
+		  perf_committingtransaction \
 		  perf_conversationmodel \
-		  perf_groupmodel
+		  perf_eventmodel \
+		  perf_groupmodel \
+		  perf_idsource \
+		  perf_paging \
+		  perf_queryresult \
+		  perf_querytemplates \
+		  perf_updatequery
 CONFIG += ordered
 
 # make sure the destination path exists
@@ -37,7 +37,11 @@ SUBDIRS = model_example \
           ut_unreadeventsmodel \
           ut_classzerosmsmodel \
           ut_singleeventmodel \
-          ut_eventsquery
+          ut_eventsquery \
+          ut_queryresult \
+          ut_querycache \
+          ut_writejournal \
+          ut_idsource
 CONFIG += ordered
 
 # make sure the destination path exists
@@ -733,6 +733,50 @@ void CallModelTest::testSortByContactUpdate()
     QCOMPARE(e1.eventCount(), 3);
 }
 
+void CallModelTest::testStoredMissedCount()
+{
+    deleteAll();
+
+    CallModel model;
+    model.enableContactChanges(false);
+    watcher.setModel(&model);
+
+    /*
+     * user1, missed   (3)
+     * user1, missed
+     * user1, missed
+     * user1, received
+     * user1, missed, older than the received call -> not counted
+     */
+    QDateTime when = QDateTime::currentDateTime();
+    addTestEvent(model, Event::CallEvent, Event::Inbound, ACCOUNT1, -1, "", false, false, when.addSecs(1), REMOTEUID1);
+    addTestEvent(model, Event::CallEvent, Event::Inbound, ACCOUNT1, -1, "", false, true, when.addSecs(2), REMOTEUID1);
+    addTestEvent(model, Event::CallEvent, Event::Inbound, ACCOUNT1, -1, "", false, true, when.addSecs(3), REMOTEUID1);
+    int lastMissedId = addTestEvent(model, Event::CallEvent, Event::Inbound, ACCOUNT1, -1, "", false, true,
+                                    when.addSecs(4), REMOTEUID1);
+    addTestEvent(model, Event::CallEvent, Event::Inbound, ACCOUNT1, -1, "", false, true, when, REMOTEUID1);
+    watcher.waitForSignals(5, 5);
+
+    QVERIFY(model.setFilter(CallModel::SortByContact));
+    QVERIFY(model.getEvents());
+    QVERIFY(watcher.waitForModelReady());
+    QCOMPARE(model.rowCount(), 1);
+    QCOMPARE(model.event(model.index(0, 0)).eventCount(), 3);
+
+    // deleting a missed call recounts
+    QVERIFY(model.deleteEvent(lastMissedId));
+    watcher.waitForSignals(-1, -1, 1);
+    QVERIFY(model.getEvents());
+    QVERIFY(watcher.waitForModelReady());
+    QCOMPARE(model.event(model.index(0, 0)).eventCount(), 2);
+
+    // recounting all call groups gives the same result
+    QVERIFY(model.trackerIO().recountGroups());
+    QVERIFY(model.getEvents());
+    QVERIFY(watcher.waitForModelReady());
+    QCOMPARE(model.event(model.index(0, 0)).eventCount(), 2);
+}
+
 void CallModelTest::testSortByTimeUpdate()
 {
     deleteAll();
@@ -970,6 +1014,46 @@ void CallModelTest::testLimit()
     QVERIFY(e1.id() != e2.id());
 }
 
+void CallModelTest::testNextPage()
+{
+    CallModel model;
+    model.enableContactChanges(false);
+    model.setQueryMode(EventModel::SyncQuery);
+    model.setTreeMode(false);
+    model.setFilter(CallModel::SortByTime);
+
+    QVERIFY(model.getEvents());
+    int total = model.rowCount();
+    QVERIFY(total > 2);
+    QVERIFY(!model.hasNextPage());
+
+    QList<int> ids;
+    for (int i = 0; i < total; i++)
+        ids << model.event(model.index(i, 0)).id();
+
+    // every page continues where the previous one ended
+    model.setLimit(2);
+    QVERIFY(model.getEvents());
+    QCOMPARE(model.rowCount(), 2);
+
+    while (model.hasNextPage())
+        QVERIFY(model.fetchNextPage());
+
+    QCOMPARE(model.rowCount(), total);
+    for (int i = 0; i < total; i++)
+        QCOMPARE(model.event(model.index(i, 0)).id(), ids.at(i));
+    QVERIFY(!model.fetchNextPage());
+
+    // the offset only moves the first page
+    model.setOffset(1);
+    QVERIFY(model.getEvents());
+    QCOMPARE(model.event(model.index(0, 0)).id(), ids.at(1));
+    QVERIFY(model.fetchNextPage());
+    QCOMPARE(model.rowCount(), qMin(total - 1, 4));
+    for (int i = 0; i < model.rowCount(); i++)
+        QCOMPARE(model.event(model.index(i, 0)).id(), ids.at(i + 1));
+}
+
 void CallModelTest::testModifyEvent()
 {
     Event e1, e2, e3;
@@ -44,8 +44,10 @@ private slots:
     void testGetEventsTimeTypeFilter();
     void testSortByContactUpdate();
     void testSortByTimeUpdate();
+    void testStoredMissedCount();
     void testSIPAddress();
     void testLimit();
+    void testNextPage();
     void deleteAllCalls();
     void testMarkAllRead();
     void testModifyEvent();
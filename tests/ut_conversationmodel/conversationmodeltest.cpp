@@ -431,6 +431,98 @@ void ConversationModelTest::contacts()
     deleteTestContact(contactId);
 }
 
+void ConversationModelTest::supersededQueries_data()
+{
+    QTest::addColumn<bool>("useThread");
+    QTest::addColumn<int>("queryMode");
+
+    QTest::newRow("Async") << false << (int)EventModel::AsyncQuery;
+    QTest::newRow("Async, use thread") << true << (int)EventModel::AsyncQuery;
+    QTest::newRow("Streamed") << false << (int)EventModel::StreamedAsyncQuery;
+    QTest::newRow("Streamed, use thread") << true << (int)EventModel::StreamedAsyncQuery;
+}
+
+void ConversationModelTest::supersededQueries()
+{
+    QFETCH(bool, useThread);
+    QFETCH(int, queryMode);
+
+    QThread modelThread;
+
+    ConversationModel model;
+    model.setQueryMode((EventModel::QueryMode)queryMode);
+    model.setFirstChunkSize(100);
+    model.setChunkSize(100);
+    model.enableContactChanges(false);
+    watcher.setModel(&model);
+
+    if (useThread) {
+        modelThread.start();
+        model.setBackgroundThread(&modelThread);
+    }
+
+    QVERIFY(model.getEvents(group1.id()));
+    QVERIFY(watcher.waitForModelReady());
+
+    // reference counts from settled queries
+    QHash<int, int> expected;
+    QList<Event::EventType> types;
+    types << Event::IMEvent << Event::SMSEvent;
+    foreach (Event::EventType type, types) {
+        QVERIFY(model.setFilter(type));
+        QVERIFY(watcher.waitForModelReady());
+        expected.insert(type, model.rowCount());
+        QVERIFY(model.rowCount() > 0);
+    }
+
+    QSignalSpy modelReady(&model, SIGNAL(modelReady(bool)));
+    QSignalSpy rowsInserted(&model, SIGNAL(rowsInserted(const QModelIndex &, int, int)));
+
+    for (int i = 0; i < 50; i++) {
+        Event::EventType type = types.at(i % types.size());
+
+        QVERIFY(model.setFilter(type));
+
+        // let some of the superseded queries deliver partial results
+        if (i % 3) {
+            QTime timer;
+            timer.start();
+            int wait = qrand() % 20;
+            while (timer.elapsed() < wait)
+                QCoreApplication::processEvents();
+        }
+    }
+
+    Event::EventType finalType = types.at(49 % types.size());
+    QVERIFY(model.setFilter(finalType));
+    modelReady.clear();
+    rowsInserted.clear();
+
+    QVERIFY(watcher.waitForModelReady());
+
+    // wait for anything still in flight
+    QTime timer;
+    timer.start();
+    while (timer.elapsed() < 1000)
+        QCoreApplication::processEvents();
+
+    QCOMPARE(modelReady.count(), 1);
+    QCOMPARE(model.rowCount(), expected.value(finalType));
+
+    int inserted = 0;
+    while (!rowsInserted.isEmpty()) {
+        QList<QVariant> args = rowsInserted.takeFirst();
+        inserted += args.at(2).toInt() - args.at(1).toInt() + 1;
+    }
+    QCOMPARE(inserted, model.rowCount());
+
+    for (int i = 0; i < model.rowCount(); i++)
+        QCOMPARE(model.event(model.index(i, 0)).type(), finalType);
+
+    modelThread.quit();
+    modelThread.wait(3000);
+}
+
 void ConversationModelTest::reset() {
     ConversationModel conv;
     conv.enableContactChanges(false);
@@ -45,6 +45,8 @@ private slots:
     void sorting();
     void contacts_data();
     void contacts();
+    void supersededQueries_data();
+    void supersededQueries();
     void reset();
     void cleanupTestCase();
 };
@@ -36,6 +36,9 @@
 #include "event.h"
 #include "common.h"
 #include "trackerio.h"
+#include "knownresources.h"
+#include "pendinglookup.h"
+#include "trackerio_p.h"
 
 #include "modelwatcher.h"
 
@@ -818,6 +821,41 @@ void EventModelTest::testDeleteEventGroupUpdated()
     QVERIFY(!groupModel.trackerIO().getGroup(group.id(), group));
 }
 
+void EventModelTest::testDeleteMissingEvent()
+{
+    EventModel model;
+    watcher.setModel(&model);
+
+    Group group;
+    addTestGroup(group, RING_ACCOUNT, "555123456");
+
+    Event event;
+    event.setType(Event::SMSEvent);
+    event.setDirection(Event::Inbound);
+    event.setGroupId(group.id());
+    event.setStartTime(QDateTime::currentDateTime());
+    event.setEndTime(QDateTime::currentDateTime());
+    event.setLocalUid(RING_ACCOUNT);
+    event.setRemoteUid("555123456");
+    event.setFreeText("deletetest missing");
+    QVERIFY(model.addEvent(event));
+    watcher.waitForSignals();
+    QVERIFY(event.id() != -1);
+
+    int id = event.id();
+    QVERIFY(model.deleteEvent(event));
+    watcher.waitForSignals();
+    QCOMPARE(watcher.lastDeletedId(), id);
+
+    // neither in the model nor in tracker: the lookup is started, the
+    // failure is reported when it finishes
+    QVERIFY(model.deleteEvent(id));
+    watcher.waitForSignals();
+    QVERIFY(!watcher.lastSuccess());
+    QCOMPARE(watcher.committedCount(), 0);
+    QCOMPARE(watcher.deletedCount(), 0);
+}
+
 void EventModelTest::testVCard()
 {
     QString vcardFilename1( "filename.vcd" );
@@ -1341,6 +1379,129 @@ void EventModelTest::testMessagePartsQuery()
     QVERIFY(!QDir(mmsPath + "MSGTOKEN3").exists());
 }
 
+// Adds count MMS messages with partsPerEvent text parts each to group.
+bool addMmsEvents(EventModel &model, const Group &group, int count, int partsPerEvent)
+{
+    QList<Event> events;
+    QDateTime startTime = QDateTime::currentDateTime();
+    for (int i = 0; i < count; i++) {
+        Event event;
+        event.setLocalUid(RING_ACCOUNT);
+        event.setRemoteUid(group.remoteUids().first());
+        event.setType(Event::MMSEvent);
+        event.setDirection(Event::Inbound);
+        event.setStartTime(startTime.addSecs(-i));
+        event.setEndTime(startTime.addSecs(-i));
+        event.setFreeText(QString("mms %1").arg(i));
+        event.setGroupId(group.id());
+
+        QList<MessagePart> parts;
+        for (int j = 0; j < partsPerEvent; j++) {
+            MessagePart part;
+            part.setContentId(QString("text_slide%1").arg(j));
+            part.setContentType("text/plain");
+            part.setPlainTextContent(QString("mms %1 part %2").arg(i).arg(j));
+            parts << part;
+        }
+        event.setMessageParts(parts);
+        events << event;
+    }
+
+    if (!model.addEvents(events))
+        return false;
+    watcher.waitForSignals(count, count);
+    return watcher.committedCount() == count;
+}
+
+void EventModelTest::testMessagePartsOrder()
+{
+    EventModel model;
+    watcher.setModel(&model);
+
+    Group group;
+    addTestGroup(group, RING_ACCOUNT, "555987654");
+
+    // enough messages for several part queries, which are run by
+    // tracker at the same time
+    const int count = 2 * MAX_VARIABLES_IN_QUERY + 10;
+    QVERIFY(addMmsEvents(model, group, count, 2));
+
+    qRegisterMetaType<QModelIndex>("QModelIndex");
+    ConversationModel convModel;
+    convModel.enableContactChanges(false);
+    QSignalSpy rowsInserted(&convModel, SIGNAL(rowsInserted(const QModelIndex &, int, int)));
+    QSignalSpy dataChanged(&convModel, SIGNAL(dataChanged(const QModelIndex &, const QModelIndex &)));
+    QSignalSpy modelReady(&convModel, SIGNAL(modelReady(bool)));
+    QVERIFY(convModel.getEvents(group.id()));
+    QVERIFY(waitSignal(modelReady));
+    QCOMPARE(convModel.rowCount(), count);
+
+    // each received chunk of rows is split into part queries of
+    // MAX_VARIABLES_IN_QUERY messages, queued in row order
+    QVector<int> queryOfRow(count);
+    int queries = 0;
+    foreach (const QList<QVariant> &args, rowsInserted) {
+        int first = args.at(1).toInt();
+        int last = args.at(2).toInt();
+        for (int row = first; row <= last; row++)
+            queryOfRow[row] = queries + (row - first) / MAX_VARIABLES_IN_QUERY;
+        queries += (last - first) / MAX_VARIABLES_IN_QUERY + 1;
+    }
+    QVERIFY(queries > 1);
+
+    // parts are delivered query by query in the same order, whichever
+    // query tracker finished first
+    int previous = 0;
+    QSet<int> updatedRows;
+    foreach (const QList<QVariant> &args, dataChanged) {
+        int row = args.at(0).value<QModelIndex>().row();
+        QVERIFY(queryOfRow[row] >= previous);
+        previous = queryOfRow[row];
+        updatedRows.insert(row);
+    }
+    QCOMPARE(updatedRows.size(), count);
+
+    for (int i = 0; i < count; i++)
+        QCOMPARE(convModel.event(convModel.index(i, 0)).messageParts().size(), 2);
+}
+
+void EventModelTest::testMessagePartsBatches()
+{
+    EventModel model;
+    watcher.setModel(&model);
+
+    Group group;
+    addTestGroup(group, RING_ACCOUNT, "555987655");
+
+    // rows of one part query belong to many messages, the last batch
+    // is a partial one
+    const int count = MAX_VARIABLES_IN_QUERY + MAX_VARIABLES_IN_QUERY / 2;
+    const int partsPerEvent = 3;
+    QVERIFY(addMmsEvents(model, group, count, partsPerEvent));
+
+    ConversationModel convModel;
+    convModel.enableContactChanges(false);
+    QSignalSpy modelReady(&convModel, SIGNAL(modelReady(bool)));
+    QVERIFY(convModel.getEvents(group.id()));
+    QVERIFY(waitSignal(modelReady));
+    QCOMPARE(convModel.rowCount(), count);
+
+    QSet<QString> seen;
+    for (int row = 0; row < convModel.rowCount(); row++) {
+        Event e = convModel.event(convModel.index(row, 0));
+        QVERIFY(!seen.contains(e.freeText()));
+        seen.insert(e.freeText());
+
+        QList<MessagePart> parts = e.messageParts();
+        QCOMPARE(parts.size(), partsPerEvent);
+        for (int j = 0; j < partsPerEvent; j++) {
+            QCOMPARE(parts.at(j).contentId(), QString("text_slide%1").arg(j));
+            QCOMPARE(parts.at(j).plainTextContent(),
+                     QString("%1 part %2").arg(e.freeText()).arg(j));
+        }
+    }
+}
+
 void EventModelTest::testCcBcc()
 {
     EventModel model;
@@ -1687,6 +1848,45 @@ void EventModelTest::testStreaming()
     modelThread.wait(3000);
 }
 
+void EventModelTest::testAdaptiveStreaming()
+{
+    GroupModel groupModel;
+    groupModel.enableContactChanges(false);
+    Group group;
+
+    QVERIFY(groupModel.trackerIO().getGroup(group1.id(), group));
+    int total = group.totalMessages();
+    QVERIFY(total > 2);
+
+    ConversationModel streamModel;
+    streamModel.enableContactChanges(false);
+    streamModel.setQueryMode(EventModel::StreamedAdaptiveQuery);
+    streamModel.setFirstChunkSize(2);
+    // generous target, chunks should grow past the first one
+    streamModel.setChunkLatencyTarget(1000);
+
+    QSignalSpy chunkSizes(&streamModel, SIGNAL(chunkSizeAdapted(int)));
+    QSignalSpy modelReady(&streamModel, SIGNAL(modelReady(bool)));
+    QVERIFY(streamModel.getEvents(group1.id()));
+
+    QTime timer;
+    timer.start();
+    while (modelReady.isEmpty() && timer.elapsed() < WAIT_SIGNAL_TIMEOUT) {
+        QTest::qWait(100);
+        if (streamModel.canFetchMore(QModelIndex()))
+            streamModel.fetchMore(QModelIndex());
+    }
+
+    QCOMPARE(modelReady.count(), 1);
+    QVERIFY(modelReady.first().at(0).toBool());
+    QCOMPARE(streamModel.rowCount(), total);
+
+    QVERIFY(!chunkSizes.isEmpty());
+    int size = chunkSizes.first().at(0).toInt();
+    QVERIFY(size >= 2);
+    QVERIFY(size <= 1000);
+}
+
 void EventModelTest::testModifyInGroup()
 {
     EventModel model;
@@ -1909,6 +2109,186 @@ void EventModelTest::testAddNonDigitRemoteId()
     QVERIFY(compareEvents(event, tevent));
 }
 
+void EventModelTest::testGroupCommit()
+{
+    EventModel model;
+    watcher.setModel(&model);
+    model.trackerIO().setGroupCommit(true);
+
+    // one transaction per event, all but the first one are queued
+    // while the first commits and get merged
+    const int count = 5;
+    QList<Event> events;
+    for (int i = 0; i < count; i++) {
+        Event event;
+        event.setGroupId(group1.id());
+        event.setType(Event::IMEvent);
+        event.setDirection(Event::Inbound);
+        event.setStartTime(QDateTime::fromString("2010-01-08T13:40:00Z", Qt::ISODate).addSecs(i));
+        event.setEndTime(QDateTime::fromString("2010-01-08T13:40:00Z", Qt::ISODate).addSecs(i));
+        event.setLocalUid("/org/freedesktop/Telepathy/Account/gabble/jabber/dut_40localhost0");
+        event.setRemoteUid("td@localhost");
+        event.setFreeText(QString("group commit %1").arg(i));
+        QVERIFY(model.addEvent(event));
+        events << event;
+    }
+
+    watcher.waitForSignals(count, count);
+    model.trackerIO().setGroupCommit(false);
+
+    QVERIFY(watcher.lastSuccess());
+    QCOMPARE(watcher.committedCount(), count);
+    QCOMPARE(watcher.addedCount(), count);
+
+    foreach (Event event, events) {
+        Event tevent;
+        QVERIFY(model.trackerIO().getEvent(event.id(), tevent));
+        QVERIFY(compareEvents(event, tevent));
+    }
+}
+
+void EventModelTest::testMarkAsRead()
+{
+    EventModel model;
+    watcher.setModel(&model);
+
+    const int count = 3;
+    QList<int> ids;
+    for (int i = 0; i < count; i++) {
+        Event event;
+        event.setGroupId(group1.id());
+        event.setType(Event::SMSEvent);
+        event.setDirection(Event::Inbound);
+        event.setIsRead(false);
+        event.setStartTime(QDateTime::fromString("2010-02-08T13:40:00Z", Qt::ISODate).addSecs(i));
+        event.setEndTime(QDateTime::fromString("2010-02-08T13:40:00Z", Qt::ISODate).addSecs(i));
+        event.setLocalUid("/org/freedesktop/Telepathy/Account/ring/tel/ring");
+        event.setRemoteUid("555123456");
+        event.setFreeText(QString("mark as read %1").arg(i));
+        QVERIFY(model.addEvent(event));
+        watcher.waitForSignals();
+        ids << event.id();
+    }
+
+    QSignalSpy markedAsRead(&model, SIGNAL(markedAsRead(bool)));
+
+    // by id, all but the last one
+    QVERIFY(model.markAsRead(ids.mid(0, count - 1)));
+    QVERIFY(waitSignal(markedAsRead));
+    QVERIFY(markedAsRead.takeFirst().at(0).toBool());
+
+    Event event;
+    for (int i = 0; i < count; i++) {
+        QVERIFY(model.trackerIO().getEvent(ids.at(i), event));
+        QCOMPARE(event.isRead(), i < count - 1);
+    }
+
+    // by type and date
+    QVERIFY(model.markAsReadBefore(Event::SMSEvent,
+                                   QDateTime::fromString("2010-02-08T13:41:00Z", Qt::ISODate)));
+    QVERIFY(waitSignal(markedAsRead));
+    QVERIFY(markedAsRead.takeFirst().at(0).toBool());
+
+    QVERIFY(model.trackerIO().getEvent(ids.last(), event));
+    QVERIFY(event.isRead());
+
+    QVERIFY(!model.markAsReadBefore(Event::SMSEvent, QDateTime()));
+}
+
+void EventModelTest::testKnownResources()
+{
+    EventModel model;
+    watcher.setModel(&model);
+    KnownResources::clear();
+
+    const QString localUid("/org/freedesktop/Telepathy/Account/gabble/jabber/dut_40localhost0");
+    const QString remoteUid("known@localhost");
+    const QString imAddress = QUrl(QString("telepathy:") + localUid + "!" + remoteUid).toString();
+
+    Event event;
+    event.setGroupId(group1.id());
+    event.setType(Event::IMEvent);
+    event.setDirection(Event::Inbound);
+    event.setStartTime(QDateTime::fromString("2010-03-08T13:40:00Z", Qt::ISODate));
+    event.setEndTime(QDateTime::fromString("2010-03-08T13:40:00Z", Qt::ISODate));
+    event.setLocalUid(localUid);
+    event.setRemoteUid(remoteUid);
+    event.setFreeText("known resources");
+    QVERIFY(model.addEvent(event));
+    watcher.waitForSignals();
+    QVERIFY(KnownResources::contains(imAddress));
+
+    // the second event reuses the address without inserting it
+    Event second = event;
+    second.setId(-1);
+    second.setFreeText("known resources again");
+    QVERIFY(model.addEvent(second));
+    watcher.waitForSignals();
+
+    Event tevent;
+    QVERIFY(model.trackerIO().getEvent(second.id(), tevent));
+    QVERIFY(compareEvents(second, tevent));
+
+    // additions from before a clear are dropped
+    int generation = KnownResources::generation();
+    KnownResources::clear();
+    KnownResources::insert(QStringList() << imAddress, generation);
+    QVERIFY(!KnownResources::contains(imAddress));
+}
+
+void EventModelTest::testAsyncLookup()
+{
+    EventModel model;
+    watcher.setModel(&model);
+
+    Event event;
+    event.setGroupId(group1.id());
+    event.setType(Event::IMEvent);
+    event.setDirection(Event::Inbound);
+    event.setStartTime(QDateTime::fromString("2010-04-08T13:40:00Z", Qt::ISODate));
+    event.setEndTime(QDateTime::fromString("2010-04-08T13:40:00Z", Qt::ISODate));
+    event.setLocalUid("/org/freedesktop/Telepathy/Account/gabble/jabber/dut_40localhost0");
+    event.setRemoteUid("td@localhost");
+    event.setFreeText("async lookup");
+    event.setMessageToken("asyncLookupToken");
+    QVERIFY(model.addEvent(event));
+    watcher.waitForSignals();
+
+    // lookups delete themselves from the event loop after finished(),
+    // waitSignal() returns before that
+    PendingLookup *lookup = model.trackerIO().getEventAsync(event.id());
+    QSignalSpy eventFound(lookup, SIGNAL(finished(CommHistory::PendingLookup*)));
+    QVERIFY(waitSignal(eventFound));
+    QVERIFY(lookup->isValid());
+    QVERIFY(compareEvents(event, lookup->event()));
+
+    lookup = model.trackerIO().getEventByMessageTokenAsync("asyncLookupToken", group1.id());
+    QSignalSpy tokenFound(lookup, SIGNAL(finished(CommHistory::PendingLookup*)));
+    QVERIFY(waitSignal(tokenFound));
+    QVERIFY(lookup->isValid());
+    QCOMPARE(lookup->event().id(), event.id());
+
+    lookup = model.trackerIO().getGroupAsync(group1.id());
+    QSignalSpy groupFound(lookup, SIGNAL(finished(CommHistory::PendingLookup*)));
+    QVERIFY(waitSignal(groupFound));
+    QVERIFY(lookup->isValid());
+    QCOMPARE(lookup->group().id(), group1.id());
+
+    int total = -1;
+    QVERIFY(model.trackerIO().totalEventsInGroup(group1.id(), total));
+    lookup = model.trackerIO().totalEventsInGroupAsync(group1.id());
+    QSignalSpy counted(lookup, SIGNAL(finished(CommHistory::PendingLookup*)));
+    QVERIFY(waitSignal(counted));
+    QVERIFY(lookup->isValid());
+    QCOMPARE(lookup->count(), total);
+
+    lookup = model.trackerIO().getEventAsync(-2);
+    QSignalSpy notFound(lookup, SIGNAL(finished(CommHistory::PendingLookup*)));
+    QVERIFY(waitSignal(notFound));
+    QVERIFY(lookup->isFinished());
+    QVERIFY(!lookup->isValid());
+}
+
 void EventModelTest::cleanupTestCase()
 {
     deleteAll();
@@ -41,6 +41,7 @@ private slots:
     void testDeleteEventMmsParts_data();
     void testDeleteEventMmsParts();
     void testDeleteEventGroupUpdated();
+    void testDeleteMissingEvent();
     void testMessageToken();
     void testVCard();
     void testDeliveryStatus();
@@ -52,13 +53,20 @@ private slots:
     void testCcBcc();
     void testStreaming_data();
     void testStreaming();
+    void testAdaptiveStreaming();
     void testModifyInGroup();
     void testMessagePartsQuery_data();
     void testMessagePartsQuery();
+    void testMessagePartsOrder();
+    void testMessagePartsBatches();
     void testContactMatching_data();
     void testContactMatching();
     void testAddNonDigitRemoteId_data();
     void testAddNonDigitRemoteId();
+    void testGroupCommit();
+    void testMarkAsRead();
+    void testKnownResources();
+    void testAsyncLookup();
     void cleanupTestCase();
 
     void groupsUpdatedSlot(const QList<int> &groupIds);
@@ -802,6 +802,40 @@ void GroupModelTest::limitOffset()
     QVERIFY(!headGroups.contains(model.group(model.index(1, 0)).id()));
 }
 
+void GroupModelTest::nextPage()
+{
+    GroupModel model;
+    model.enableContactChanges(false);
+    QSignalSpy modelReady(&model, SIGNAL(modelReady(bool)));
+
+    QVERIFY(model.getGroups());
+    QVERIFY(waitSignal(modelReady));
+    QCOMPARE(model.rowCount(), 4);
+    QVERIFY(!model.hasNextPage());
+
+    QList<int> ids;
+    for (int i = 0; i < model.rowCount(); i++)
+        ids << model.group(model.index(i, 0)).id();
+
+    // pages continue after the last group of the previous page
+    model.setLimit(3);
+    modelReady.clear();
+    QVERIFY(model.getGroups());
+    QVERIFY(waitSignal(modelReady));
+    QCOMPARE(model.rowCount(), 3);
+    QVERIFY(model.hasNextPage());
+
+    modelReady.clear();
+    QVERIFY(model.fetchNextPage());
+    QVERIFY(waitSignal(modelReady));
+    QCOMPARE(model.rowCount(), 4);
+    QVERIFY(!model.hasNextPage());
+    QVERIFY(!model.fetchNextPage());
+
+    for (int i = 0; i < ids.size(); i++)
+        QCOMPARE(model.group(model.index(i, 0)).id(), ids.at(i));
+}
+
 void GroupModelTest::cleanupTestCase()
 {
     deleteAll();
@@ -1422,4 +1456,112 @@ void GroupModelTest::endTimeUpdate()
     QVERIFY(model.group(model.index(0, 0)).endTime().toTime_t() != olEvent.endTime().toTime_t());
 }
 
+void GroupModelTest::storedSummary()
+{
+    EventModel eventModel;
+    Group group;
+    addTestGroup(group, "storedSummary", QString("td@localhost"));
+
+    QSignalSpy eventsCommitted(&eventModel, SIGNAL(eventsCommitted(const QList<CommHistory::Event>&, bool)));
+    int inboundId = addTestEvent(eventModel, Event::IMEvent, Event::Inbound, "storedSummary",
+                                 group.id(), "stored counters 1");
+    QVERIFY(waitSignal(eventsCommitted));
+    eventsCommitted.clear();
+    int lastInboundId = addTestEvent(eventModel, Event::IMEvent, Event::Inbound, "storedSummary",
+                                     group.id(), "stored counters 2");
+    QVERIFY(waitSignal(eventsCommitted));
+    eventsCommitted.clear();
+    int outboundId = addTestEvent(eventModel, Event::IMEvent, Event::Outbound, "storedSummary",
+                                  group.id(), "stored counters 3");
+    QVERIFY(waitSignal(eventsCommitted));
+
+    TrackerIO *tracker = TrackerIO::instance();
+    Group testGroup;
+    QVERIFY(tracker->getGroup(group.id(), testGroup));
+    QCOMPARE(testGroup.totalMessages(), 3);
+    QCOMPARE(testGroup.unreadMessages(), 2);
+    QCOMPARE(testGroup.sentMessages(), 1);
+    QCOMPARE(testGroup.lastEventId(), outboundId);
+
+    // read flag change
+    Event event;
+    QVERIFY(tracker->getEvent(inboundId, event));
+    event.resetModifiedProperties();
+    event.setIsRead(true);
+    eventsCommitted.clear();
+    QVERIFY(eventModel.modifyEvent(event));
+    QVERIFY(waitSignal(eventsCommitted));
+
+    QVERIFY(tracker->getGroup(group.id(), testGroup));
+    QCOMPARE(testGroup.totalMessages(), 3);
+    QCOMPARE(testGroup.unreadMessages(), 1);
+
+    // deletion
+    QVERIFY(tracker->getEvent(outboundId, event));
+    eventsCommitted.clear();
+    QVERIFY(eventModel.deleteEvent(event));
+    QVERIFY(waitSignal(eventsCommitted));
+
+    QVERIFY(tracker->getGroup(group.id(), testGroup));
+    QCOMPARE(testGroup.totalMessages(), 2);
+    QCOMPARE(testGroup.unreadMessages(), 1);
+    QCOMPARE(testGroup.sentMessages(), 0);
+    QCOMPARE(testGroup.lastEventId(), lastInboundId);
+
+    // recount gives the same result
+    QVERIFY(tracker->recountGroups());
+    QVERIFY(tracker->getGroup(group.id(), testGroup));
+    QCOMPARE(testGroup.totalMessages(), 2);
+    QCOMPARE(testGroup.unreadMessages(), 1);
+    QCOMPARE(testGroup.sentMessages(), 0);
+    QCOMPARE(testGroup.lastEventId(), lastInboundId);
+}
+
+void GroupModelTest::batchedContacts()
+{
+    int contactId = addTestContact("Batched", "td@localhost", ACCOUNT1);
+
+    GroupModel model;
+    model.enableContactChanges(false);
+    model.setQueryContacts(false);
+    QVERIFY(!model.queryContacts());
+    QSignalSpy modelReady(&model, SIGNAL(modelReady(bool)));
+    QSignalSpy dataChanged(&model, SIGNAL(dataChanged(const QModelIndex &, const QModelIndex &)));
+
+    QVERIFY(model.getGroups());
+    QVERIFY(waitSignal(modelReady));
+    QCOMPARE(model.rowCount(), 4);
+
+    // contacts arrive after the groups
+    QVERIFY(waitSignal(dataChanged, 5000));
+
+    for (int i = 0; i < model.rowCount(); i++) {
+        Group g = model.group(model.index(i, 0));
+        if (g.remoteUids().contains("td@localhost")
+            && g.localUid() == ACCOUNT1) {
+            QCOMPARE(g.contactId(), contactId);
+            QCOMPARE(g.contactName(), QString("Batched"));
+        } else {
+            QCOMPARE(g.contactId(), 0);
+        }
+    }
+
+    // a second model is served from the shared cache
+    GroupModel cachedModel;
+    cachedModel.enableContactChanges(false);
+    cachedModel.setQueryContacts(false);
+    QSignalSpy cachedReady(&cachedModel, SIGNAL(modelReady(bool)));
+    QVERIFY(cachedModel.getGroups());
+    QVERIFY(waitSignal(cachedReady));
+
+    for (int i = 0; i < cachedModel.rowCount(); i++) {
+        Group g = cachedModel.group(cachedModel.index(i, 0));
+        if (g.remoteUids().contains("td@localhost")
+            && g.localUid() == ACCOUNT1)
+            QCOMPARE(g.contactId(), contactId);
+    }
+
+    deleteTestContact(contactId);
+}
+
 QTEST_MAIN(GroupModelTest)
@@ -61,8 +61,11 @@ private slots:
     void changeRemoteUid();
     void addMultipleGroups();
     void limitOffset();
+    void nextPage();
     void noRemoteId();
     void endTimeUpdate();
+    void storedSummary();
+    void batchedContacts();
     void cleanupTestCase();
     void init();
     void cleanup();
@@ -0,0 +1,163 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** Contact: Reto Zingg <reto.zingg@nokia.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include <QtTest/QtTest>
+#include <QSharedMemory>
+#include <cstddef>
+#include "idsourcetest.h"
+#include "idsource.h"
+
+using namespace CommHistory;
+
+namespace {
+
+// layout of ~/.commhistoryd/ids.dat
+struct IdsFile {
+    int lastEventId;
+    int lastGroupId;
+    int users;
+    int valid;
+    int checksum;
+};
+
+QString idsDir()
+{
+    return QDir::tempPath() + QLatin1String("/ut_idsource");
+}
+
+QString idsFile()
+{
+    return idsDir() + QLatin1String("/.commhistoryd/ids.dat");
+}
+
+void writeIds(const char *data, int size)
+{
+    QFile file(idsFile());
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    QCOMPARE((int)file.write(data, size), size);
+}
+
+void writeIds(int lastEventId, int lastGroupId, bool validChecksum = true)
+{
+    IdsFile ids;
+    ids.lastEventId = lastEventId;
+    ids.lastGroupId = lastGroupId;
+    ids.users = 0;
+    ids.valid = 1;
+    ids.checksum = qChecksum(reinterpret_cast<const char*>(&ids),
+                             offsetof(IdsFile, checksum));
+    if (!validChecksum)
+        ids.checksum++;
+    writeIds(reinterpret_cast<const char*>(&ids), sizeof(ids));
+}
+
+}
+
+void IdSourceTest::initTestCase()
+{
+    // keep the ids of the user out of the way
+    m_home = qgetenv("HOME");
+    QVERIFY(QDir().mkpath(idsDir() + QLatin1String("/.commhistoryd")));
+    qputenv("HOME", QFile::encodeName(idsDir()));
+}
+
+void IdSourceTest::init()
+{
+    // the shared memory is only loaded from the file when created
+    QSharedMemory shm(QLatin1String("CommHistoryIdSource"));
+    if (shm.attach())
+        QSKIP("ids in use by another process", SkipAll);
+
+    QFile::remove(idsFile());
+}
+
+void IdSourceTest::validFile()
+{
+    writeIds(100, 200);
+
+    IdSource source;
+    int lastEventId = -1, lastGroupId = -1;
+    QVERIFY(source.lastIds(lastEventId, lastGroupId));
+    QCOMPARE(lastEventId, 100);
+    QCOMPARE(lastGroupId, 200);
+    QVERIFY(source.nextEventId() > 100);
+    QVERIFY(source.nextGroupId() > 200);
+}
+
+void IdSourceTest::invalidChecksum()
+{
+    writeIds(100, 200, false);
+
+    IdSource source;
+    int lastEventId, lastGroupId;
+    QVERIFY(!source.lastIds(lastEventId, lastGroupId));
+}
+
+void IdSourceTest::oldFormat()
+{
+    // older versions saved only the two ids
+    int ids[2] = { 100, 200 };
+    writeIds(reinterpret_cast<const char*>(ids), sizeof(ids));
+
+    IdSource source;
+    int lastEventId, lastGroupId;
+    QVERIFY(!source.lastIds(lastEventId, lastGroupId));
+}
+
+void IdSourceTest::missingFile()
+{
+    IdSource source;
+    int lastEventId, lastGroupId;
+    QVERIFY(!source.lastIds(lastEventId, lastGroupId));
+}
+
+void IdSourceTest::setIdsMakesValid()
+{
+    writeIds(100, 200, false);
+
+    {
+        IdSource source;
+        int lastEventId, lastGroupId;
+        QVERIFY(!source.lastIds(lastEventId, lastGroupId));
+
+        source.setNextEventId(300);
+        source.setNextGroupId(400);
+        QVERIFY(source.lastIds(lastEventId, lastGroupId));
+        QCOMPARE(lastEventId, 300);
+        QCOMPARE(lastGroupId, 400);
+    }
+
+    // saved with a valid checksum
+    IdSource source;
+    int lastEventId, lastGroupId;
+    QVERIFY(source.lastIds(lastEventId, lastGroupId));
+    QCOMPARE(lastEventId, 300);
+    QCOMPARE(lastGroupId, 400);
+}
+
+void IdSourceTest::cleanupTestCase()
+{
+    QFile::remove(idsFile());
+    qputenv("HOME", m_home);
+}
+
+QTEST_MAIN(IdSourceTest)
@@ -0,0 +1,368 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** Contact: Reto Zingg <reto.zingg@nokia.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include <QtTest/QtTest>
+#include <QDBusConnection>
+#include "querycachetest.h"
+#include "querycache.h"
+#include "updatesemitter.h"
+#include "conversationmodel.h"
+#include "eventmodel.h"
+#include "event.h"
+#include "group.h"
+#include "common.h"
+#include "modelwatcher.h"
+
+using namespace CommHistory;
+
+namespace {
+
+QSharedPointer<QueryCache> cache;
+QSharedPointer<UpdatesEmitter> emitter;
+QEventLoop *loop;
+ModelWatcher watcher;
+
+const QString conversationQuery = QLatin1String("conversation");
+const QString inboxQuery = QLatin1String("inbox");
+const QString groupQuery = QLatin1String("groups");
+const QString callQuery = QLatin1String("calls");
+
+Event testEvent(int id, int groupId, Event::EventType type = Event::SMSEvent)
+{
+    Event event;
+    event.setId(id);
+    event.setType(type);
+    event.setGroupId(groupId);
+    event.setFreeText(QLatin1String("cached event"));
+    return event;
+}
+
+Group testGroup(int id)
+{
+    Group group;
+    group.setId(id);
+    group.setLastMessageText(QLatin1String("cached group"));
+    return group;
+}
+
+bool hasEvents(QueryType type, const QString &query)
+{
+    QList<Event> events;
+    QVariantList extra;
+    return cache->findEvents(type, query, events, extra);
+}
+
+bool hasGroups(const QString &query)
+{
+    QList<Group> groups;
+    return cache->findGroups(query, groups);
+}
+
+// lets echoes of the update signals arrive over D-Bus
+void settle()
+{
+    QTime timer;
+    timer.start();
+    while (timer.elapsed() < 500)
+        QCoreApplication::processEvents();
+}
+
+}
+
+void QueryCacheTest::initTestCase()
+{
+    QVERIFY(QDBusConnection::sessionBus().isConnected());
+
+    deleteAll();
+
+    loop = new QEventLoop(this);
+    watcher.setLoop(loop);
+
+    cache = QueryCache::instance();
+    emitter = UpdatesEmitter::instance();
+    QueryCache::setMemoryBudget(1024 * 1024);
+}
+
+void QueryCacheTest::init()
+{
+    settle();
+    cache->clear();
+}
+
+void QueryCacheTest::hitsAndMisses()
+{
+    int hits = cache->hits();
+    int misses = cache->misses();
+
+    QList<Event> events;
+    QVariantList extra;
+    QVERIFY(!cache->findEvents(EventQuery, conversationQuery, events, extra));
+    QCOMPARE(cache->misses(), misses + 1);
+
+    QList<Event> stored;
+    QVariantList storedExtra;
+    stored << testEvent(1, 10) << testEvent(2, 10);
+    storedExtra << 1 << 2;
+    cache->insertEvents(EventQuery, conversationQuery, 10, stored, storedExtra,
+                        cache->generation());
+    QVERIFY(cache->cost() > 0);
+
+    QVERIFY(cache->findEvents(EventQuery, conversationQuery, events, extra));
+    QCOMPARE(cache->hits(), hits + 1);
+    QCOMPARE(events.size(), 2);
+    QCOMPARE(events.at(1).id(), 2);
+    QCOMPARE(events.at(0).freeText(), QLatin1String("cached event"));
+    QCOMPARE(extra, storedExtra);
+
+    // the same text for another kind of query is a different entry
+    QVERIFY(!hasEvents(GroupedCallQuery, conversationQuery));
+
+    // disabled cache neither finds nor counts
+    QueryCache::setMemoryBudget(0);
+    hits = cache->hits();
+    misses = cache->misses();
+    QVERIFY(!hasEvents(EventQuery, conversationQuery));
+    QCOMPARE(cache->hits(), hits);
+    QCOMPARE(cache->misses(), misses);
+    QCOMPARE(cache->cost(), 0);
+    QueryCache::setMemoryBudget(1024 * 1024);
+}
+
+void QueryCacheTest::memoryBudget()
+{
+    QList<Event> events;
+    for (int i = 0; i < 10; i++)
+        events << testEvent(i + 1, 10);
+
+    cache->insertEvents(EventQuery, QLatin1String("first"), -1, events,
+                        QVariantList(), cache->generation());
+    int entryCost = cache->cost();
+    QVERIFY(entryCost > 0);
+
+    // room for two entries
+    QueryCache::setMemoryBudget(entryCost * 2 + entryCost / 2);
+
+    cache->insertEvents(EventQuery, QLatin1String("second"), -1, events,
+                        QVariantList(), cache->generation());
+    // touch the first one, second is now least recently used
+    QVERIFY(hasEvents(EventQuery, QLatin1String("first")));
+    cache->insertEvents(EventQuery, QLatin1String("third"), -1, events,
+                        QVariantList(), cache->generation());
+
+    QVERIFY(cache->cost() <= QueryCache::memoryBudget());
+    QVERIFY(hasEvents(EventQuery, QLatin1String("first")));
+    QVERIFY(!hasEvents(EventQuery, QLatin1String("second")));
+    QVERIFY(hasEvents(EventQuery, QLatin1String("third")));
+
+    // results larger than the budget are not cached at all
+    QList<Event> many;
+    for (int i = 0; i < 40; i++)
+        many << testEvent(i + 1, 10);
+    cache->insertEvents(EventQuery, QLatin1String("huge"), -1, many,
+                        QVariantList(), cache->generation());
+    QVERIFY(!hasEvents(EventQuery, QLatin1String("huge")));
+    QVERIFY(hasEvents(EventQuery, QLatin1String("first")));
+
+    // shrinking the budget evicts
+    QueryCache::setMemoryBudget(entryCost);
+    QVERIFY(cache->cost() <= entryCost);
+
+    QueryCache::setMemoryBudget(1024 * 1024);
+}
+
+void QueryCacheTest::eventInvalidation()
+{
+    cache->insertEvents(EventQuery, conversationQuery, 10,
+                        QList<Event>() << testEvent(1, 10) << testEvent(2, 10),
+                        QVariantList(), cache->generation());
+    cache->insertEvents(EventQuery, inboxQuery, -1,
+                        QList<Event>() << testEvent(1, 10) << testEvent(3, 11),
+                        QVariantList(), cache->generation());
+    cache->insertEvents(GroupedCallQuery, callQuery, -1,
+                        QList<Event>() << testEvent(4, -1, Event::CallEvent),
+                        QVariantList(), cache->generation());
+    cache->insertGroups(groupQuery, QList<Group>() << testGroup(10) << testGroup(11),
+                        cache->generation());
+
+    // new message in another conversation
+    QMetaObject::invokeMethod(emitter.data(), "eventsAdded",
+                              Q_ARG(QList<CommHistory::Event>,
+                                    QList<Event>() << testEvent(5, 12)));
+    QVERIFY(hasEvents(EventQuery, conversationQuery));
+    QVERIFY(!hasEvents(EventQuery, inboxQuery));
+    QVERIFY(hasEvents(GroupedCallQuery, callQuery));
+    QVERIFY(hasGroups(groupQuery));
+
+    // new message in the cached conversation
+    QMetaObject::invokeMethod(emitter.data(), "eventsAdded",
+                              Q_ARG(QList<CommHistory::Event>,
+                                    QList<Event>() << testEvent(6, 10)));
+    QVERIFY(!hasEvents(EventQuery, conversationQuery));
+    QVERIFY(!hasGroups(groupQuery));
+    QVERIFY(hasEvents(GroupedCallQuery, callQuery));
+
+    // deleting an event only drops lists containing it, call groups
+    // and conversations
+    cache->insertEvents(EventQuery, conversationQuery, 10,
+                        QList<Event>() << testEvent(1, 10) << testEvent(2, 10),
+                        QVariantList(), cache->generation());
+    cache->insertEvents(EventQuery, inboxQuery, -1,
+                        QList<Event>() << testEvent(3, 11),
+                        QVariantList(), cache->generation());
+    cache->insertGroups(groupQuery, QList<Group>() << testGroup(10) << testGroup(11),
+                        cache->generation());
+    QMetaObject::invokeMethod(emitter.data(), "eventDeleted", Q_ARG(int, 2));
+    QVERIFY(!hasEvents(EventQuery, conversationQuery));
+    QVERIFY(hasEvents(EventQuery, inboxQuery));
+    QVERIFY(!hasEvents(GroupedCallQuery, callQuery));
+    QVERIFY(!hasGroups(groupQuery));
+
+    // updated call
+    cache->insertEvents(GroupedCallQuery, callQuery, -1,
+                        QList<Event>() << testEvent(4, -1, Event::CallEvent),
+                        QVariantList(), cache->generation());
+    QMetaObject::invokeMethod(emitter.data(), "eventsUpdated",
+                              Q_ARG(QList<CommHistory::Event>,
+                                    QList<Event>() << testEvent(7, -1, Event::CallEvent)));
+    QVERIFY(!hasEvents(GroupedCallQuery, callQuery));
+}
+
+void QueryCacheTest::groupInvalidation()
+{
+    cache->insertEvents(EventQuery, conversationQuery, 10,
+                        QList<Event>() << testEvent(1, 10),
+                        QVariantList(), cache->generation());
+    cache->insertGroups(groupQuery, QList<Group>() << testGroup(10),
+                        cache->generation());
+
+    // unrelated group
+    QMetaObject::invokeMethod(emitter.data(), "groupsUpdated",
+                              Q_ARG(QList<int>, QList<int>() << 11));
+    QVERIFY(hasGroups(groupQuery));
+
+    // group metadata does not affect its messages
+    QMetaObject::invokeMethod(emitter.data(), "groupsUpdated",
+                              Q_ARG(QList<int>, QList<int>() << 10));
+    QVERIFY(!hasGroups(groupQuery));
+    QVERIFY(hasEvents(EventQuery, conversationQuery));
+
+    cache->insertGroups(groupQuery, QList<Group>() << testGroup(10),
+                        cache->generation());
+    QMetaObject::invokeMethod(emitter.data(), "groupsAdded",
+                              Q_ARG(QList<CommHistory::Group>,
+                                    QList<Group>() << testGroup(12)));
+    QVERIFY(!hasGroups(groupQuery));
+    QVERIFY(hasEvents(EventQuery, conversationQuery));
+
+    QMetaObject::invokeMethod(emitter.data(), "groupsDeleted",
+                              Q_ARG(QList<int>, QList<int>() << 10));
+    QVERIFY(!hasEvents(EventQuery, conversationQuery));
+}
+
+void QueryCacheTest::racingInvalidation()
+{
+    // query started, then something changed before its results were stored
+    int generation = cache->generation();
+    QMetaObject::invokeMethod(emitter.data(), "eventsAdded",
+                              Q_ARG(QList<CommHistory::Event>,
+                                    QList<Event>() << testEvent(5, 12)));
+    cache->insertEvents(EventQuery, conversationQuery, 10,
+                        QList<Event>() << testEvent(1, 10),
+                        QVariantList(), generation);
+    QVERIFY(!hasEvents(EventQuery, conversationQuery));
+}
+
+void QueryCacheTest::conversationModel()
+{
+    Group group1, group2;
+    addTestGroups(group1, group2);
+
+    EventModel model;
+    watcher.setModel(&model);
+    addTestEvent(model, Event::SMSEvent, Event::Inbound, ACCOUNT1, group1.id());
+    addTestEvent(model, Event::SMSEvent, Event::Outbound, ACCOUNT1, group1.id());
+    addTestEvent(model, Event::SMSEvent, Event::Inbound, ACCOUNT1, group2.id());
+    watcher.waitForSignals(3, 3);
+
+    settle();
+    int hits = cache->hits();
+    int misses = cache->misses();
+
+    ConversationModel first;
+    first.enableContactChanges(false);
+    watcher.setModel(&first);
+    QVERIFY(first.getEvents(group1.id()));
+    QVERIFY(watcher.waitForModelReady());
+    QCOMPARE(first.rowCount(), 2);
+    QCOMPARE(cache->misses(), misses + 1);
+
+    // opening the same conversation again does not query tracker
+    ConversationModel second;
+    second.enableContactChanges(false);
+    watcher.setModel(&second);
+    QVERIFY(second.getEvents(group1.id()));
+    QVERIFY(watcher.waitForModelReady());
+    QCOMPARE(cache->hits(), hits + 1);
+    QCOMPARE(second.rowCount(), first.rowCount());
+    for (int i = 0; i < first.rowCount(); i++) {
+        Event e1 = first.event(first.index(i, 0));
+        Event e2 = second.event(second.index(i, 0));
+        QVERIFY(compareEvents(e1, e2));
+    }
+
+    // a message to the other conversation keeps the entry
+    watcher.setModel(&model);
+    addTestEvent(model, Event::SMSEvent, Event::Inbound, ACCOUNT1, group2.id());
+    watcher.waitForSignals(1, 1);
+    settle();
+
+    ConversationModel third;
+    third.enableContactChanges(false);
+    watcher.setModel(&third);
+    QVERIFY(third.getEvents(group1.id()));
+    QVERIFY(watcher.waitForModelReady());
+    QCOMPARE(cache->hits(), hits + 2);
+
+    // a message to this one drops it
+    watcher.setModel(&model);
+    addTestEvent(model, Event::SMSEvent, Event::Inbound, ACCOUNT1, group1.id());
+    watcher.waitForSignals(1, 1);
+    settle();
+
+    ConversationModel fourth;
+    fourth.enableContactChanges(false);
+    watcher.setModel(&fourth);
+    QVERIFY(fourth.getEvents(group1.id()));
+    QVERIFY(watcher.waitForModelReady());
+    QCOMPARE(cache->misses(), misses + 2);
+    QCOMPARE(fourth.rowCount(), 3);
+}
+
+void QueryCacheTest::cleanupTestCase()
+{
+    QueryCache::setMemoryBudget(0);
+    cache.clear();
+    emitter.clear();
+    deleteAll();
+}
+
+QTEST_MAIN(QueryCacheTest)
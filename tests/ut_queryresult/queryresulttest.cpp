@@ -0,0 +1,235 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** Contact: Reto Zingg <reto.zingg@nokia.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include <QtTest/QtTest>
+
+#include <QSparqlBinding>
+#include <QSparqlResultRow>
+
+#include "event.h"
+#include "queryresult.h"
+
+#include "queryresulttest.h"
+
+using namespace CommHistory;
+
+namespace {
+
+const char separators[] = { '\x1c', '\x1d', '\x1e', '\x1f', '!', ',', 'a', '1' };
+
+QString randomPacked(int maxLength)
+{
+    QString packed;
+    int length = qrand() % (maxLength + 1);
+    for (int i = 0; i < length; i++)
+        packed.append(QLatin1Char(separators[qrand() % sizeof(separators)]));
+    return packed;
+}
+
+QStringList headerList(const QHash<QString, QString> &headers)
+{
+    QStringList list;
+    QHashIterator<QString, QString> i(headers);
+    while (i.hasNext()) {
+        i.next();
+        list << i.key() + QLatin1Char('=') + i.value();
+    }
+    list.sort();
+    return list;
+}
+
+QStringList contactList(const QList<Event::Contact> &contacts)
+{
+    QStringList list;
+    foreach (const Event::Contact &contact, contacts)
+        list << QString::number(contact.first) + QLatin1Char(':') + contact.second;
+    return list;
+}
+
+}
+
+void QueryResultTest::parseHeaders_data()
+{
+    QTest::addColumn<QString>("column");
+    QTest::addColumn<QStringList>("headers");
+
+    QTest::newRow("empty") << QString() << QStringList();
+    QTest::newRow("single")
+        << QString("x-mms-to\x1d" "+35801")
+        << (QStringList() << "x-mms-to=+35801");
+    QTest::newRow("multiple")
+        << QString("b\x1d" "2\x1f" "a\x1d" "1")
+        << (QStringList() << "a=1" << "b=2");
+    QTest::newRow("trailing separators")
+        << QString("a\x1d" "1\x1f\x1f\x1f")
+        << (QStringList() << "a=1");
+    QTest::newRow("empty key")
+        << QString("\x1d" "1\x1f" "a\x1d" "1")
+        << (QStringList() << "a=1");
+    QTest::newRow("missing value separator")
+        << QString("a\x1f" "b\x1d" "2")
+        << (QStringList() << "a=" << "b=2");
+    QTest::newRow("extra value separator")
+        << QString("a\x1d" "1\x1d" "2")
+        << (QStringList() << "a=1");
+}
+
+void QueryResultTest::parseHeaders()
+{
+    QFETCH(QString, column);
+    QFETCH(QStringList, headers);
+
+    QHash<QString, QString> result;
+    QueryResult::parseHeaders(column, result);
+
+    QCOMPARE(headerList(result), headers);
+}
+
+void QueryResultTest::parseContacts_data()
+{
+    QTest::addColumn<QString>("column");
+    QTest::addColumn<QString>("localUid");
+    QTest::addColumn<QStringList>("contacts");
+
+    QTest::newRow("empty") << QString() << QString() << QStringList();
+    QTest::newRow("first name")
+        << QString("5\x1e" "John")
+        << QString()
+        << (QStringList() << "5:John");
+    QTest::newRow("contact nickname")
+        << QString("7\x1e\x1e\x1d" "Nick")
+        << QString()
+        << (QStringList() << "7:Nick");
+    QTest::newRow("im nickname")
+        << QString("7\x1d\x1d\x1e" "telepathy:acc!user\x1f" "Im")
+        << QString("acc")
+        << (QStringList() << "7:Im");
+    QTest::newRow("im nickname for local uid")
+        << QString("7\x1d\x1d\x1e" "telepathy:other!user\x1f" "Other"
+                   "\x1e" "telepathy:acc!user\x1f" "Mine")
+        << QString("acc")
+        << (QStringList() << "7:Mine");
+    QTest::newRow("im address without nickname")
+        << QString("7\x1d\x1d\x1e" "telepathy:acc!user\x1f\x1e\x1f\x1f")
+        << QString("acc")
+        << (QStringList() << "7:");
+    QTest::newRow("two contacts")
+        << QString("5\x1e" "John\x1c" "6\x1e" "Jane")
+        << QString()
+        << (QStringList() << "5:John" << "6:Jane");
+    QTest::newRow("duplicates")
+        << QString("5\x1e" "John\x1c\x1c" "5\x1e" "John")
+        << QString()
+        << (QStringList() << "5:John");
+    QTest::newRow("bad contact id")
+        << QString("x5\x1e" "John")
+        << QString()
+        << (QStringList() << "0:John");
+}
+
+void QueryResultTest::parseContacts()
+{
+    QFETCH(QString, column);
+    QFETCH(QString, localUid);
+    QFETCH(QStringList, contacts);
+
+    QList<Event::Contact> result;
+    QueryResult::parseContacts(column, localUid, result);
+
+    QCOMPARE(contactList(result), contacts);
+}
+
+void QueryResultTest::remoteUid_data()
+{
+    QTest::addColumn<QString>("column");
+    QTest::addColumn<QString>("remoteUid");
+
+    QTest::newRow("empty") << QString() << QString();
+    QTest::newRow("separators only") << QString("\x1e\x1e") << QString();
+    QTest::newRow("phone number")
+        << QString("+35801\x1e" "telepathy:acc!+35801")
+        << QString("+35801");
+    QTest::newRow("im address")
+        << QString("\x1e" "telepathy:acc!user@example.com")
+        << QString("user@example.com");
+    QTest::newRow("sip preferred")
+        << QString("+35801\x1e" "sip:user@example.com")
+        << QString("sip:user@example.com");
+    QTest::newRow("trailing im separator")
+        << QString("telepathy:acc!")
+        << QString();
+}
+
+void QueryResultTest::remoteUid()
+{
+    QFETCH(QString, column);
+    QFETCH(QString, remoteUid);
+
+    QueryResult result;
+    result.properties << Event::Id << Event::Direction
+                      << Event::LocalUid << Event::RemoteUid;
+
+    // inbound: remote uid comes from the local uid (from) column
+    QSparqlResultRow row;
+    row.append(QSparqlBinding(QString(), QString("message:1")));
+    row.append(QSparqlBinding(QString(), false));
+    row.append(QSparqlBinding(QString(), column));
+    row.append(QSparqlBinding(QString(), QString("telepathy:acc")));
+
+    Event event;
+    result.fillEventFromRow(row, event);
+
+    QCOMPARE(event.remoteUid(), remoteUid);
+    QCOMPARE(event.localUid(), QString("acc"));
+}
+
+void QueryResultTest::malformedSeparators()
+{
+    qsrand(QDateTime::currentDateTime().toTime_t());
+
+    QueryResult result;
+    result.properties << Event::Id << Event::Type << Event::Direction
+                      << Event::LocalUid << Event::RemoteUid
+                      << Event::Cc << Event::Bcc << Event::Headers
+                      << Event::ContactId;
+
+    for (int i = 0; i < 10000; i++) {
+        QHash<QString, QString> headers;
+        QueryResult::parseHeaders(randomPacked(32), headers);
+        QVERIFY(!headers.contains(QString()));
+
+        QList<Event::Contact> contacts;
+        QueryResult::parseContacts(randomPacked(32), QLatin1String("a"), contacts);
+        QCOMPARE(contacts.toSet().size(), contacts.size());
+
+        QSparqlResultRow row;
+        for (int column = 0; column < result.properties.size(); column++)
+            row.append(QSparqlBinding(QString(), randomPacked(32)));
+
+        Event event;
+        result.fillEventFromRow(row, event);
+        QVERIFY(!event.ccList().contains(QString()));
+        QVERIFY(!event.bccList().contains(QString()));
+    }
+}
+
+QTEST_MAIN(QueryResultTest)
@@ -0,0 +1,150 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+** Contact: Reto Zingg <reto.zingg@nokia.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include <QtTest/QtTest>
+#include "writejournaltest.h"
+#include "writejournal.h"
+
+using namespace CommHistory;
+
+namespace {
+
+QString journalFile()
+{
+    return QDir::tempPath() + QLatin1String("/ut_writejournal.journal");
+}
+
+}
+
+void WriteJournalTest::init()
+{
+    QFile::remove(journalFile());
+}
+
+void WriteJournalTest::appendAndReplay()
+{
+    quint32 first, second;
+    {
+        WriteJournal journal;
+        QVERIFY(journal.open(journalFile()));
+        QVERIFY(journal.isEmpty());
+        QVERIFY(journal.append(QLatin1String("INSERT { <a> a nmo:Message }"), 1, first));
+        QVERIFY(journal.append(QString::fromUtf8("INSERT { <b> nie:plainTextContent \"\xc3\xa4\" }"),
+                               -1, second));
+        QVERIFY(first < second);
+        QVERIFY(!journal.isEmpty());
+    }
+
+    // closed without marking done, like a crash
+    WriteJournal journal;
+    QVERIFY(journal.open(journalFile()));
+    QList<WriteJournal::Record> records = journal.pendingRecords();
+    QCOMPARE(records.size(), 2);
+    QCOMPARE(records[0].eventId, 1);
+    QCOMPARE(records[0].end, first);
+    QCOMPARE(records[0].query, QLatin1String("INSERT { <a> a nmo:Message }"));
+    QCOMPARE(records[1].eventId, -1);
+    QCOMPARE(records[1].end, second);
+    QCOMPARE(records[1].query,
+             QString::fromUtf8("INSERT { <b> nie:plainTextContent \"\xc3\xa4\" }"));
+}
+
+void WriteJournalTest::markDone()
+{
+    quint32 first, second;
+    {
+        WriteJournal journal;
+        QVERIFY(journal.open(journalFile()));
+        QVERIFY(journal.append(QLatin1String("first"), 1, first));
+        QVERIFY(journal.append(QLatin1String("second"), 2, second));
+        journal.markDone(first);
+        // already done
+        journal.markDone(first);
+        QCOMPARE(journal.pendingRecords().size(), 1);
+    }
+
+    WriteJournal journal;
+    QVERIFY(journal.open(journalFile()));
+    QList<WriteJournal::Record> records = journal.pendingRecords();
+    QCOMPARE(records.size(), 1);
+    QCOMPARE(records.first().query, QLatin1String("second"));
+    journal.markDone(records.first().end);
+    QVERIFY(journal.isEmpty());
+    QVERIFY(journal.pendingRecords().isEmpty());
+}
+
+void WriteJournalTest::rewind()
+{
+    WriteJournal journal;
+    QVERIFY(journal.open(journalFile()));
+
+    quint32 first, end;
+    QVERIFY(journal.append(QLatin1String("query"), 1, first));
+    journal.markDone(first);
+    QVERIFY(journal.isEmpty());
+
+    // written again from the start
+    QVERIFY(journal.append(QLatin1String("query"), 2, end));
+    QCOMPARE(end, first);
+    QCOMPARE(journal.pendingRecords().size(), 1);
+    QCOMPARE(journal.pendingRecords().first().eventId, 2);
+}
+
+void WriteJournalTest::full()
+{
+    WriteJournal journal;
+    QVERIFY(journal.open(journalFile()));
+
+    QString query(64 * 1024, QLatin1Char('x'));
+    quint32 end;
+    int appended = 0;
+    while (journal.append(query, appended, end))
+        appended++;
+
+    QVERIFY(appended > 0);
+    QVERIFY(appended * (quint32)query.size() <= WriteJournal::MaxSize);
+    QCOMPARE(journal.pendingRecords().size(), appended);
+
+    // space is available again once done
+    journal.markDone(end);
+    QVERIFY(journal.append(query, 0, end));
+}
+
+void WriteJournalTest::locked()
+{
+    WriteJournal journal;
+    QVERIFY(journal.open(journalFile()));
+
+    WriteJournal other;
+    QVERIFY(!other.open(journalFile()));
+    QVERIFY(!other.isOpen());
+
+    journal.close();
+    QVERIFY(other.open(journalFile()));
+}
+
+void WriteJournalTest::cleanup()
+{
+    QFile::remove(journalFile());
+}
+
+QTEST_MAIN(WriteJournalTest)
@@ -826,6 +826,13 @@ int doDelete(const QStringList &arguments, const QVariantMap &options)
     }
     c.waitCommit();
 
+    // an event not in the model is looked up first, a missing one
+    // fails only when committed
+    if (!c.ok) {
+        qCritical() << "Error deleting event" << id;
+        return -1;
+    }
+
     return 0;
 }
 